@@ -1,22 +1,220 @@
+#include <cmath>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "utils/scene_parser.h"
 #include "renderer/renderer.h"
+#include "renderer/accelerator.h"
+#include "renderer/batch_render.h"
 #include "renderer/camera.h"
+#include "renderer/checkpoint.h"
+#include "renderer/embedded_scenes.h"
+#include "renderer/preview.h"
+#include "renderer/relight.h"
+#include "renderer/static_scene.h"
+#include "renderer/streaming_render.h"
 #include "utils/image.h"
+#include "utils/memory_report.h"
+#include "utils/options.h"
+#include "utils/perf_counters.h"
+#include "utils/resource_usage.h"
+#include "utils/stopwatch.h"
+#include "postprocess/denoiser.h"
 
-graphics::raytracer::Scene ConstructScene(std::string_view path) {
-  graphics::raytracer::SceneParser scene_parser;
+namespace {
+
+// Primitives listed in the render cost report.
+constexpr size_t kHeatmapTopPrimitives = 10;
+
+} // namespace
+
+// Wall time of each phase of a run, printed with --timings.
+struct PhaseTimings {
+  // Reading the scene file.
+  double parse_ms = 0.0;
+  // Turning the parsed scene into what is rendered (acceleration structure, static dispatch lists).
+  double build_ms = 0.0;
+  // Rendering, including any post processing of the image.
+  double render_ms = 0.0;
+};
+
+// Returns false (after printing where the memory goes) if |memory| is over the budget set in
+// |options|.
+bool WithinMemoryBudget(const graphics::MemoryReport& memory, const graphics::Options& options) {
+  if (options.memory_budget_mb == 0 || memory.total_bytes() <= (options.memory_budget_mb << 20)) {
+    return true;
+  }
+  memory.Print(std::cout);
+  std::cout << "The scene needs " << memory.total_bytes() / double(1 << 20) << " MB, over the memory budget of "
+            << options.memory_budget_mb << " MB.\n";
+  return false;
+}
+
+// Render settings from the sampling flags.
+graphics::raytracer::RenderSettings MakeRenderSettings(const graphics::Options& options) {
+  graphics::raytracer::RenderSettings settings;
+  settings.samples_per_pixel = options.samples_per_pixel;
+  settings.sampler = graphics::sampling::SamplerSettings{
+    .type = options.sampler.value_or(options.samples_per_pixel > 1 ? graphics::sampling::SamplerType::kSobol
+                                                                     : graphics::sampling::SamplerType::kPixelCorner),
+    .samples_per_pixel = static_cast<uint32_t>(options.samples_per_pixel),
+    .seed = options.seed,
+  };
+  settings.raster_primary = options.raster_primary;
+  return settings;
+}
+
+// Renders every job of the --batch manifest, jobs without a size or camera of their own getting
+// the --size and |camera|, and reports the throughput. Returns the exit code.
+int RunBatch(graphics::raytracer::Renderer& renderer, const graphics::raytracer::Camera& camera,
+             const graphics::Options& options) {
+  const auto jobs = graphics::raytracer::ParseBatchManifest(options.batch_path, options.width, options.height, camera);
+  if (!jobs) {
+    return 1;
+  }
+  const graphics::raytracer::BatchStats stats = graphics::raytracer::RenderBatch(renderer, *jobs, {
+    .render = MakeRenderSettings(options),
+    .output = options.output,
+    .accelerator = options.accelerator,
+    .static_dispatch = options.static_dispatch,
+    .texture_cache = std::make_shared<graphics::raytracer::TextureCache>(options.texture_budget_mb << 20),
+  });
+  std::cout << "Batch: " << stats.jobs << " jobs (" << stats.unsplit << " on one thread each, " << stats.split
+            << " split across threads) in " << stats.seconds << " s, " << stats.jobs_per_second() << " jobs/s";
+  if (stats.failed > 0) {
+    std::cout << ", " << stats.failed << " failed";
+  }
+  std::cout << ".\n";
+  return stats.failed == 0 ? 0 : 1;
+}
+
+// Linux thread ids of the render workers.
+std::vector<pid_t> RenderThreadIds(graphics::raytracer::Renderer& renderer) {
+  std::vector<pid_t> thread_ids(renderer.num_threads());
+  renderer.pool().RunOnAll([&](size_t worker) { thread_ids[worker] = graphics::CurrentThreadId(); });
+  return thread_ids;
+}
+
+// Parses and builds the scene (or instantiates the embedded one) on |pool|, leaving the memory it
+// uses in |memory| and the files it references besides the scene file in |asset_paths|. Returns nullopt if the parsed scene is already over the memory budget. If |perf| is
+// set, the parse and build phases are counted in it.
+std::optional<graphics::raytracer::Scene> ConstructScene(std::string_view path, const graphics::Options& options,
+                                                         std::shared_ptr<graphics::raytracer::TextureCache> texture_cache,
+                                                         graphics::ThreadPool& pool, PhaseTimings& timings,
+                                                         graphics::MemoryReport& memory,
+                                                         std::vector<std::string>& asset_paths,
+                                                         graphics::PerfProfiler* perf) {
+  if (perf) {
+    perf->BeginPhase("parse");
+  }
+  graphics::Stopwatch stopwatch;
+  if (!options.embedded_scene.empty()) {
+    // Nothing to parse or build, the scene is already in the binary in its final form.
+    auto scene = graphics::raytracer::embedded::Instantiate(
+        *graphics::raytracer::embedded::FindEmbeddedScene(options.embedded_scene));
+    timings.parse_ms = stopwatch.ElapsedMilliseconds();
+    if (perf) {
+      perf->End();
+    }
+    graphics::raytracer::AccountSceneMemory(scene, memory);
+    return scene;
+  }
+  graphics::raytracer::SceneParser scene_parser({.compress_geometry = options.compress_geometry,
+                                                  .geometry_store_path = options.geometry_store_path,
+                                                  .texture_cache = std::move(texture_cache),
+                                                  .pool = &pool});
   auto scene = scene_parser.ReadScene(path);
+  asset_paths = scene_parser.asset_paths();
+  timings.parse_ms = stopwatch.ElapsedMilliseconds();
+
+  // Don't build an acceleration structure for a scene that already doesn't fit.
+  scene_parser.AccountMemory(memory);
+  graphics::raytracer::AccountSceneMemory(scene, memory);
+  if (!WithinMemoryBudget(memory, options)) {
+    return std::nullopt;
+  }
+
+  if (perf) {
+    perf->BeginPhase("build");
+  }
+  stopwatch.Reset();
+  const auto accelerator = options.accelerator.value_or(
+      scene_parser.accelerator().value_or(graphics::raytracer::AcceleratorType::kList));
+  scene = graphics::raytracer::BuildAccelerator(scene, accelerator, &pool, /*verbose=*/true);
+  if (options.static_dispatch) {
+    scene = graphics::raytracer::MakeStaticDispatchScene(scene);
+  }
+  timings.build_ms = stopwatch.ElapsedMilliseconds();
+  if (perf) {
+    perf->End();
+  }
+
+  // Account for the scene as it is rendered.
+  memory = graphics::MemoryReport{};
+  scene_parser.AccountMemory(memory);
+  graphics::raytracer::AccountSceneMemory(scene, memory);
   return scene;
 }
 
-int main(int argc, char** argv) {
-  constexpr size_t height = 400;
-  constexpr size_t width = 400;
-  graphics::Image image(height, width);
+// Preview demo: pans |camera| sideways for |moving_frames| frames, then holds it still until the
+// preview converges, printing the stats of every frame. Leaves the final frame in |image|.
+void RunPreview(graphics::raytracer::Renderer& renderer, graphics::Image& image,
+                const graphics::raytracer::Camera& camera, const graphics::raytracer::Scene& scene,
+                const graphics::raytracer::RenderSettings& settings, int moving_frames, double target_ms) {
+  graphics::raytracer::PreviewRenderer preview(renderer, image.height(), image.width(), {.target_frame_ms = target_ms});
+  graphics::raytracer::Camera frame_camera = camera;
+  for (int frame = 0; ; frame++) {
+    if (frame < moving_frames) {
+      frame_camera.eye = camera.eye + graphics::math::UnitX * (0.5f * std::sin(frame * 0.1f));
+    }
+    const auto stats = preview.RenderFrame(frame_camera, scene, settings);
+    std::cout << "Frame " << frame << ": block " << stats.block_size << ", " << stats.rays << " rays, "
+              << stats.milliseconds << " ms" << (stats.converged ? " (converged)" : "") << '\n';
+    if (stats.converged && frame >= moving_frames) {
+      break;
+    }
+  }
+  image = preview.image();
+}
+
+// Relight demo: caches the camera hits of |scene| and what every light contributes to them, then
+// applies |edits| light edits, alternating between recoloring every light (only recombines the
+// cache) and moving one light sideways (re-traces the shadow rays towards it). Prints the time of
+// every edit and leaves the last result in |image|.
+void RunRelight(graphics::raytracer::Renderer& renderer, graphics::Image& image,
+                const graphics::raytracer::Camera& camera, const graphics::raytracer::Scene& scene, int edits) {
+  graphics::Stopwatch stopwatch;
+  graphics::raytracer::RelightCache cache(camera, scene, image.height(), image.width(), renderer.pool());
+  cache.Compose(image);
+  std::cout << "Cached " << scene.lights.size() << " lights in " << stopwatch.ElapsedMilliseconds() << " ms\n";
+  if (scene.lights.empty()) {
+    return;
+  }
+  for (int edit = 0; edit < edits; edit++) {
+    stopwatch.Reset();
+    std::string description;
+    if (edit % 2 == 0) {
+      const float scale = 1.f + 0.5f * std::sin(edit * 0.5f);
+      for (size_t i = 0; i < scene.lights.size(); i++) {
+        cache.SetLightColor(i, scene.lights[i]->Color() * scale);
+      }
+      description = "recolor lights";
+    } else {
+      const size_t light_index = (edit / 2) % scene.lights.size();
+      const graphics::math::Vector3f offset = graphics::math::UnitX * (0.5f * std::sin(edit * 0.1f));
+      cache.UpdateLight(light_index, scene.lights[light_index]->Moved(offset));
+      description = "move light " + std::to_string(light_index);
+    }
+    cache.Compose(image);
+    std::cout << "Edit " << edit << ": " << description << ", " << stopwatch.ElapsedMilliseconds() << " ms\n";
+  }
+}
 
+int main(int argc, char** argv) {
   constexpr graphics::raytracer::Camera camera { // Not actually a compile error
     .eye      = graphics::math::Vector3f{0, 0, 1}, //graphics::math::ZeroVector,
     .forward  = -graphics::math::UnitZ,
@@ -24,16 +222,154 @@ int main(int argc, char** argv) {
     .up       = graphics::math::UnitY,
   };
 
-  if (argc != 2) {
-    std::cout << "Missing input scene argument.\n";
+  const auto options = graphics::ParseOptions(argc, argv);
+  if (!options) {
+    graphics::PrintUsage();
     return 0;
   }
 
-  auto scene = ConstructScene(argv[1]);
+  const size_t height = options->height;
+  const size_t width = options->width;
+  const bool streaming = !options->stream_path.empty();
 
-  // If this becomes > 1, then we have execessive shadow because of our diffuse model.
-  graphics::raytracer::RenderSceneMultithreaded(image, camera, scene, 1);
+  graphics::raytracer::Renderer renderer(options->num_threads, options->pin_threads);
+  if (options->pin_threads && !renderer.pool().pinned()) {
+    std::cout << "Could not pin every render thread to a CPU.\n";
+  }
+  if (!options->batch_path.empty()) {
+    return RunBatch(renderer, camera, *options);
+  }
+  // Created after the render threads, so they are counted one by one.
+  std::optional<graphics::PerfProfiler> perf;
+  if (options->perf) {
+    perf.emplace(RenderThreadIds(renderer));
+  }
+  graphics::PerfProfiler* perf_ptr = perf ? &*perf : nullptr;
+
+  PhaseTimings timings;
+  auto texture_cache = std::make_shared<graphics::raytracer::TextureCache>(options->texture_budget_mb << 20);
+  graphics::MemoryReport memory;
+  std::vector<std::string> asset_paths;
+  const auto constructed_scene = ConstructScene(options->scene_path, *options, texture_cache, renderer.pool(), timings,
+                                                memory, asset_paths, perf_ptr);
+  if (!constructed_scene) {
+    return 1;
+  }
+  const auto& scene = *constructed_scene;
+
+  // Everything else the render allocates up front.
+  memory.Add("framebuffer", streaming ? graphics::raytracer::StreamingMemoryUsage(height, width)
+                                      : graphics::Image::bytes_for(height, width));
+  if (options->denoise) {
+    memory.Add("feature buffers", 3 * height * width * sizeof(graphics::Color3f), 3);
+  }
+  if (!options->heatmap_path.empty()) {
+    memory.Add("heatmap", height * width * sizeof(float));
+  }
+  if (options->relight_edits > 0) {
+    memory.Add("relight cache", graphics::raytracer::RelightCache::MemoryUsage(height, width, scene.lights.size()));
+  }
+  if (!options->checkpoint_path.empty()) {
+    // The buffer being rendered and the snapshot being written.
+    memory.Add("accumulation buffers", 2 * height * width * (sizeof(graphics::Color3f) + sizeof(uint32_t)), 2);
+  }
+  if (texture_cache->texture_count() > 0) {
+    memory.Add("texture cache", texture_cache->Stats().budget_bytes, texture_cache->texture_count());
+  }
+  if (!options->memory_report_path.empty()) {
+    if (options->memory_report_path == "-") {
+      memory.WriteJson(std::cout);
+    } else {
+      std::ofstream report_file(options->memory_report_path);
+      memory.WriteJson(report_file);
+    }
+  }
+  if (!WithinMemoryBudget(memory, *options)) {
+    return 1;
+  }
+
+  // A streamed render only keeps a few bands of the image in memory at a time.
+  graphics::Image image = streaming ? graphics::Image(0, 0) : renderer.AllocateImage(height, width);
+
+  const graphics::raytracer::RenderSettings settings = MakeRenderSettings(*options);
+
+  const graphics::PageFaults faults_before_render = graphics::CurrentPageFaults();
 
-  image.write("./test.ppm");
+  std::optional<graphics::raytracer::CostHeatmap> heatmap;
+  if (!options->heatmap_path.empty()) {
+    heatmap.emplace(height, width, options->heatmap_metric);
+  }
+  graphics::raytracer::CostHeatmap* heatmap_ptr = heatmap ? &*heatmap : nullptr;
+
+  if (perf) {
+    perf->BeginPhase("render");
+  }
+  graphics::Stopwatch render_stopwatch;
+  if (streaming) {
+    if (!graphics::raytracer::RenderStreaming(renderer, camera, scene, settings, height, width, options->stream_path,
+                                              options->resume, options->output)) {
+      return 1;
+    }
+  } else if (options->preview_frames > 0) {
+    RunPreview(renderer, image, camera, scene, settings, options->preview_frames, options->preview_target_ms);
+  } else if (options->relight_edits > 0) {
+    RunRelight(renderer, image, camera, scene, options->relight_edits);
+  } else if (!options->checkpoint_path.empty()) {
+    graphics::raytracer::RenderCheckpointed(renderer, image, camera, scene, settings, {
+      .path = options->checkpoint_path,
+      .interval_seconds = options->checkpoint_interval_s,
+      .resume = options->resume,
+      .scene_name = options->embedded_scene.empty() ? options->scene_path : "embedded:" + options->embedded_scene,
+      .asset_paths = asset_paths,
+    });
+  } else if (options->denoise) {
+    graphics::raytracer::FeatureBuffers features(height, width);
+    renderer.Render(image, camera, scene, settings, &features, heatmap_ptr);
+    graphics::raytracer::DenoiseImage(image, features, renderer.pool());
+  } else {
+    renderer.Render(image, camera, scene, settings, nullptr, heatmap_ptr);
+  }
+  timings.render_ms = render_stopwatch.ElapsedMilliseconds();
+  if (perf) {
+    perf->End();
+  }
+
+  if (heatmap) {
+    heatmap->PrintReport(std::cout, kHeatmapTopPrimitives);
+    heatmap->Write(options->heatmap_path);
+  }
+
+  if (texture_cache->texture_count() > 0) {
+    texture_cache->PrintReport(std::cout);
+  }
+
+  if (!options->geometry_store_path.empty()) {
+    const graphics::PageFaults render_faults = graphics::CurrentPageFaults() - faults_before_render;
+    std::cout << "Page faults during render: " << render_faults.major << " major, "
+              << render_faults.minor << " minor.\n";
+  }
+
+  if (options->timings) {
+    std::cout << "Timings: threads=" << renderer.num_threads() << " parse_ms=" << timings.parse_ms
+              << " build_ms=" << timings.build_ms << " render_ms=" << timings.render_ms
+              << " peak_rss_kb=" << graphics::PeakResidentKilobytes() << '\n';
+    const graphics::raytracer::ShadowCacheStats shadow_cache = graphics::raytracer::ShadowOccluderCache::Stats();
+    std::cout << "Shadow occluder cache: " << shadow_cache.hits << " hits in " << shadow_cache.lookups
+              << " lookups (" << 100.0 * shadow_cache.hit_rate() << "%).\n";
+  }
+
+  if (!streaming) {
+    if (perf) {
+      perf->BeginPhase("write");
+    }
+    image.write("./test.ppm", options->output);
+    if (!options->checkpoint_path.empty()) {
+      graphics::raytracer::RemoveCheckpoint(options->checkpoint_path);
+    }
+  }
+  if (perf) {
+    perf->End();
+    perf->Print(std::cout);
+  }
   return 0;
 }
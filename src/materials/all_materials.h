@@ -2,3 +2,4 @@
 
 #include "../materials/material.h"
 #include "../materials/diffuse.h"
+#include "../materials/textured_diffuse.h"
@@ -26,6 +26,8 @@ public:
     return ScatterInfo{.ray_out = scatter_ray, .attenuation = color_};
   }
 
+  size_t MemoryUsage() const override { return sizeof(*this); }
+
 private:
   Color3f color_{};
 };
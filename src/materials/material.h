@@ -4,8 +4,10 @@
 // hitting the surface of the material.
 #pragma once
 
+#include <memory>
 #include <optional>
 
+#include "../utils/memory_report.h"
 #include "../utils/ray.h"
 #include "../utils/color.h"
 
@@ -29,6 +31,17 @@ public:
   virtual ~Material() = default;
 
   virtual std::optional<ScatterInfo> Scatter(const Ray& ray_in, const ObjectIntersectionInfo& intersection_info) const = 0;
+
+  // Bytes used by the material object.
+  virtual size_t MemoryUsage() const { return sizeof(Material); }
 };
 
+// Adds |material| to |report|, unless another object sharing it already did.
+inline void AccountMaterial(MemoryReport& report, const std::shared_ptr<Material>& material) {
+  if (material && report.FirstVisit(material.get())) {
+    report.Add("materials", material->MemoryUsage());
+    report.Add("control blocks", MemoryReport::kControlBlockBytes);
+  }
+}
+
 } // namespace graphics::raytracer
@@ -0,0 +1,491 @@
+// Cache of image textures that are decoded on demand, a tile at a time. Textures are only opened
+// when registered (the file is memory mapped, and only its header is read, plus where each row
+// starts for text PPMs), and a tile of texels is decoded the first time a lookup touches it. Mip levels are built lazily too: a tile of level
+// L is box filtered from the (cached) tiles of level L - 1 that it covers. The decoded tiles of
+// all textures share one memory budget, and the least recently used ones are evicted beyond it.
+//
+// Lookups are thread-safe. Every thread keeps a small direct mapped cache of the tiles it used
+// last, which answers most lookups without touching shared state. Misses go to one of kShards
+// independently locked LRU maps, and tiles are decoded outside of any lock.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../math/vec.h"
+#include "../utils/color.h"
+#include "../utils/mapped_file.h"
+
+namespace graphics::raytracer {
+
+using TextureId = uint32_t;
+
+// An image in a PPM file (P3 or P6), read directly from the mapping of the file.
+class TextureSource {
+
+public:
+  // Returns nullptr (after printing why) if |path| isn't a readable PPM file.
+  static std::unique_ptr<TextureSource> Open(std::string_view path) {
+    auto source = std::unique_ptr<TextureSource>(new TextureSource());
+    if (!source->file_.open(path, MADV_RANDOM)) {
+      std::cerr << "Unable to open texture '" << path << "'.\n";
+      return nullptr;
+    }
+    if (!source->readHeader()) {
+      std::cerr << "Texture '" << path << "' is not a valid PPM file.\n";
+      return nullptr;
+    }
+    return source;
+  }
+
+  uint32_t width() const { return width_; }
+
+  uint32_t height() const { return height_; }
+
+  // Decodes |count| texels of row |y| starting at column |x| into |out| as 8-bit RGB.
+  void ReadTexels(uint32_t y, uint32_t x, uint32_t count, uint8_t* out) const {
+    const std::string_view data = file_.view();
+    if (binary_) {
+      const size_t bytes_per_sample = max_value_ > 255 ? 2 : 1;
+      size_t pos = data_offset_ + (static_cast<size_t>(y) * width_ + x) * 3 * bytes_per_sample;
+      for (uint32_t i = 0; i < 3 * count; i++) {
+        uint32_t value = static_cast<uint8_t>(data[pos++]);
+        if (bytes_per_sample == 2) {
+          value = (value << 8) | static_cast<uint8_t>(data[pos++]);
+        }
+        out[i] = scale(value);
+      }
+      return;
+    }
+    size_t pos = row_offsets_[y];
+    for (uint32_t i = 0; i < 3 * x; i++) {
+      skipNumber(data, pos);
+    }
+    for (uint32_t i = 0; i < 3 * count; i++) {
+      out[i] = scale(readNumber(data, pos).value_or(0));
+    }
+  }
+
+private:
+  TextureSource() = default;
+
+  bool readHeader() {
+    const std::string_view data = file_.view();
+    if (data.size() < 2 || data[0] != 'P' || (data[1] != '3' && data[1] != '6')) {
+      return false;
+    }
+    binary_ = data[1] == '6';
+    size_t pos = 2;
+    const auto width = readNumber(data, pos);
+    const auto height = readNumber(data, pos);
+    const auto max_value = readNumber(data, pos);
+    if (!width || !height || !max_value || *width == 0 || *height == 0 || *max_value == 0 || *max_value > 65535) {
+      return false;
+    }
+    width_ = *width;
+    height_ = *height;
+    max_value_ = *max_value;
+
+    if (binary_) {
+      // Exactly one whitespace character separates the header from the samples.
+      data_offset_ = pos + 1;
+      const size_t bytes_per_sample = max_value_ > 255 ? 2 : 1;
+      return data_offset_ + static_cast<size_t>(width_) * height_ * 3 * bytes_per_sample <= data.size();
+    }
+    // Text samples have no fixed size, so index where every row starts. This is the only pass
+    // over the whole file, texels are still only decoded when their tile is needed.
+    row_offsets_.resize(height_);
+    for (uint32_t y = 0; y < height_; y++) {
+      skipWhitespace(data, pos);
+      row_offsets_[y] = pos;
+      for (uint32_t i = 0; i < 3 * width_; i++) {
+        if (!skipNumber(data, pos)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  uint8_t scale(uint32_t value) const {
+    return static_cast<uint8_t>((std::min(value, max_value_) * 255 + max_value_ / 2) / max_value_);
+  }
+
+  // Skips whitespace and '#' comments.
+  static void skipWhitespace(std::string_view data, size_t& pos) {
+    while (pos < data.size()) {
+      if (data[pos] == '#') {
+        while (pos < data.size() && data[pos] != '\n') {
+          pos++;
+        }
+      } else if (std::isspace(static_cast<unsigned char>(data[pos]))) {
+        pos++;
+      } else {
+        return;
+      }
+    }
+  }
+
+  static std::optional<uint32_t> readNumber(std::string_view data, size_t& pos) {
+    skipWhitespace(data, pos);
+    if (pos >= data.size() || !std::isdigit(static_cast<unsigned char>(data[pos]))) {
+      return std::nullopt;
+    }
+    uint32_t value = 0;
+    while (pos < data.size() && std::isdigit(static_cast<unsigned char>(data[pos]))) {
+      value = value * 10 + (data[pos++] - '0');
+    }
+    return value;
+  }
+
+  static bool skipNumber(std::string_view data, size_t& pos) {
+    skipWhitespace(data, pos);
+    const size_t start = pos;
+    while (pos < data.size() && std::isdigit(static_cast<unsigned char>(data[pos]))) {
+      pos++;
+    }
+    return pos > start;
+  }
+
+  MappedFile file_{};
+  bool binary_ = false;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  uint32_t max_value_ = 255;
+  // P6: where the samples start. P3: where each row starts.
+  size_t data_offset_ = 0;
+  std::vector<size_t> row_offsets_{};
+};
+
+struct TextureCacheStats {
+  // Tile lookups, and how many were answered by an already decoded tile.
+  uint64_t lookups = 0;
+  uint64_t hits = 0;
+  // Tiles decoded (from the file for level 0, from level L - 1 for mip levels), and evicted.
+  uint64_t loads = 0;
+  uint64_t evictions = 0;
+  // Bytes of decoded tiles held by the cache, and the budget for them.
+  size_t resident_bytes = 0;
+  size_t peak_resident_bytes = 0;
+  size_t budget_bytes = 0;
+
+  double HitRate() const { return lookups > 0 ? static_cast<double>(hits) / lookups : 0.0; }
+};
+
+class TextureCache {
+
+public:
+  // Texels per side of a tile.
+  static constexpr uint32_t kTileSize = 64;
+  static constexpr size_t kDefaultBudgetBytes = size_t{256} << 20;
+  // Independently locked parts of the cache. Each gets an equal share of the budget.
+  static constexpr size_t kShards = 64;
+  // Tiles remembered by each thread.
+  static constexpr size_t kThreadCacheSize = 16;
+
+  struct Tile {
+    // 8-bit RGB texels, row by row.
+    std::array<uint8_t, kTileSize * kTileSize * 3> texels;
+  };
+  static constexpr size_t kTileBytes = sizeof(Tile);
+
+  explicit TextureCache(size_t budget_bytes = kDefaultBudgetBytes) :
+    budget_bytes_{budget_bytes},
+    shard_budget_bytes_{std::max(kTileBytes, budget_bytes / kShards)},
+    shards_{std::make_unique<Shard[]>(kShards)} {}
+
+  TextureCache(const TextureCache&) = delete;
+  TextureCache& operator=(const TextureCache&) = delete;
+
+  // Registers the texture at |path|, or returns the id it already has. No texels are decoded.
+  // Must not be called while other threads are sampling.
+  std::optional<TextureId> Load(std::string_view path) {
+    if (auto it = ids_by_path_.find(std::string(path)); it != ids_by_path_.end()) {
+      return it->second;
+    }
+    auto source = TextureSource::Open(path);
+    if (!source) {
+      return std::nullopt;
+    }
+    Texture texture;
+    texture.levels = 1 + static_cast<uint32_t>(std::log2(std::max(source->width(), source->height())));
+    for (uint32_t level = 0; level < texture.levels; level++) {
+      texture.widths.push_back(std::max(1u, source->width() >> level));
+      texture.heights.push_back(std::max(1u, source->height() >> level));
+    }
+    texture.source = std::move(source);
+    const TextureId id = static_cast<TextureId>(textures_.size());
+    textures_.push_back(std::move(texture));
+    ids_by_path_.emplace(std::string(path), id);
+    return id;
+  }
+
+  size_t texture_count() const { return textures_.size(); }
+
+  uint32_t width(TextureId id) const { return textures_[id].widths[0]; }
+
+  uint32_t height(TextureId id) const { return textures_[id].heights[0]; }
+
+  uint32_t levels(TextureId id) const { return textures_[id].levels; }
+
+  // Trilinear lookup: bilinear in the two mip levels around |lod| (0 is full resolution). The
+  // texture repeats outside of [0, 1], and v = 0 is the bottom row of the image.
+  Color3f Sample(TextureId id, math::Vector2f uv, float lod) const {
+    const Texture& texture = textures_[id];
+    if (!std::isfinite(uv.x) || !std::isfinite(uv.y)) {
+      uv = {0.f, 0.f};
+    }
+    lod = std::clamp(std::isfinite(lod) ? lod : 0.f, 0.f, static_cast<float>(texture.levels - 1));
+    const uint32_t level = static_cast<uint32_t>(lod);
+    const float blend = lod - level;
+    const Color3f color = bilinear(id, texture, level, uv);
+    if (blend <= 0.f || level + 1 >= texture.levels) {
+      return color;
+    }
+    return (1.f - blend) * color + blend * bilinear(id, texture, level + 1, uv);
+  }
+
+  // Counters are summed over every thread. Hits answered by a thread's own cache are published
+  // in batches, so the counts can lag by up to kStatsBatch lookups per thread.
+  TextureCacheStats Stats() const {
+    return TextureCacheStats{.lookups = lookups_.load(std::memory_order_relaxed),
+                             .hits = hits_.load(std::memory_order_relaxed),
+                             .loads = loads_.load(std::memory_order_relaxed),
+                             .evictions = evictions_.load(std::memory_order_relaxed),
+                             .resident_bytes = resident_bytes_.load(std::memory_order_relaxed),
+                             .peak_resident_bytes = peak_resident_bytes_.load(std::memory_order_relaxed),
+                             .budget_bytes = budget_bytes_};
+  }
+
+  void PrintReport(std::ostream& out) const {
+    const TextureCacheStats stats = Stats();
+    out << "Texture cache: " << textures_.size() << " textures, " << stats.lookups << " tile lookups, "
+        << 100.0 * stats.HitRate() << "% hit rate, " << stats.loads << " tiles decoded, " << stats.evictions
+        << " evicted, " << stats.resident_bytes / 1024 << " KB resident (peak " << stats.peak_resident_bytes / 1024
+        << " KB) of a " << stats.budget_bytes / 1024 << " KB budget.\n";
+  }
+
+private:
+  // Hits answered by a thread's own cache are added to the shared counters this many at a time.
+  static constexpr uint64_t kStatsBatch = 1024;
+
+  struct Texture {
+    std::unique_ptr<TextureSource> source{};
+    uint32_t levels = 0;
+    std::vector<uint32_t> widths{};
+    std::vector<uint32_t> heights{};
+  };
+
+  struct Shard {
+    struct Entry {
+      std::shared_ptr<const Tile> tile;
+      std::list<uint64_t>::iterator lru_position;
+    };
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> tiles;
+    // Keys of the tiles, most recently used first.
+    std::list<uint64_t> lru;
+    size_t bytes = 0;
+  };
+
+  // The tiles a thread looked up last, indexed by a hash of their key. Holding the tile keeps it
+  // alive after the shard evicts it, so pointers into it stay valid until the slot is reused.
+  struct ThreadCache {
+    struct Slot {
+      uint64_t key = 0;
+      std::shared_ptr<const Tile> tile{};
+    };
+    // Which TextureCache the slots belong to.
+    uint64_t owner = 0;
+    uint64_t pending_hits = 0;
+    std::array<Slot, kThreadCacheSize> slots{};
+  };
+
+  static inline std::atomic<uint64_t> next_instance_id_{1};
+
+  static uint64_t tileKey(TextureId id, uint32_t level, uint32_t tile_x, uint32_t tile_y) {
+    return (static_cast<uint64_t>(id) << 40) | (static_cast<uint64_t>(level) << 32) |
+           (static_cast<uint64_t>(tile_y) << 16) | tile_x;
+  }
+
+  static size_t hashKey(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return static_cast<size_t>(key);
+  }
+
+  static int wrap(int i, int n) {
+    i %= n;
+    return i < 0 ? i + n : i;
+  }
+
+  Color3f bilinear(TextureId id, const Texture& texture, uint32_t level, math::Vector2f uv) const {
+    const int width = static_cast<int>(texture.widths[level]);
+    const int height = static_cast<int>(texture.heights[level]);
+    // Wrap the coordinates first so they stay small enough to be exact in a float.
+    const float x = (uv.x - std::floor(uv.x)) * width - 0.5f;
+    const float y = (1.f - (uv.y - std::floor(uv.y))) * height - 0.5f;
+    const float x0 = std::floor(x);
+    const float y0 = std::floor(y);
+    const float fx = x - x0;
+    const float fy = y - y0;
+    const int x_lo = wrap(static_cast<int>(x0), width);
+    const int x_hi = wrap(static_cast<int>(x0) + 1, width);
+    const int y_lo = wrap(static_cast<int>(y0), height);
+    const int y_hi = wrap(static_cast<int>(y0) + 1, height);
+    return (1.f - fy) * ((1.f - fx) * texel(id, level, x_lo, y_lo) + fx * texel(id, level, x_hi, y_lo)) +
+           fy * ((1.f - fx) * texel(id, level, x_lo, y_hi) + fx * texel(id, level, x_hi, y_hi));
+  }
+
+  Color3f texel(TextureId id, uint32_t level, uint32_t x, uint32_t y) const {
+    const Tile* tile = threadTile(tileKey(id, level, x / kTileSize, y / kTileSize)).get();
+    const uint8_t* rgb = &tile->texels[((y % kTileSize) * kTileSize + x % kTileSize) * 3];
+    return to_color3f(Color3{rgb[0], rgb[1], rgb[2]});
+  }
+
+  // Looks |key| up in this thread's cache first, then in the shared cache.
+  const std::shared_ptr<const Tile>& threadTile(uint64_t key) const {
+    thread_local ThreadCache cache;
+    if (cache.owner != instance_id_) {
+      cache = ThreadCache{.owner = instance_id_};
+    }
+    auto& slot = cache.slots[hashKey(key) % kThreadCacheSize];
+    if (slot.tile && slot.key == key) [[likely]] {
+      if (++cache.pending_hits == kStatsBatch) {
+        lookups_.fetch_add(kStatsBatch, std::memory_order_relaxed);
+        hits_.fetch_add(kStatsBatch, std::memory_order_relaxed);
+        cache.pending_hits = 0;
+      }
+      return slot.tile;
+    }
+    auto tile = sharedTile(key);
+    // Decoding a mip tile looks up other tiles, which may have reused the slot in the meantime.
+    slot = ThreadCache::Slot{.key = key, .tile = std::move(tile)};
+    return slot.tile;
+  }
+
+  std::shared_ptr<const Tile> sharedTile(uint64_t key) const {
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    Shard& shard = shards_[hashKey(key) % kShards];
+    {
+      std::lock_guard lock(shard.mutex);
+      if (auto it = shard.tiles.find(key); it != shard.tiles.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_position);
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return it->second.tile;
+      }
+    }
+
+    // Decode without holding the lock. Two threads missing the same tile both decode it, and the
+    // second one uses the copy inserted by the first.
+    std::shared_ptr<const Tile> tile = decodeTile(key);
+    loads_.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard lock(shard.mutex);
+    if (auto it = shard.tiles.find(key); it != shard.tiles.end()) {
+      return it->second.tile;
+    }
+    while (!shard.lru.empty() && shard.bytes + kTileBytes > shard_budget_bytes_) {
+      shard.tiles.erase(shard.lru.back());
+      shard.lru.pop_back();
+      shard.bytes -= kTileBytes;
+      resident_bytes_.fetch_sub(kTileBytes, std::memory_order_relaxed);
+      evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.lru.push_front(key);
+    shard.tiles.emplace(key, Shard::Entry{.tile = tile, .lru_position = shard.lru.begin()});
+    shard.bytes += kTileBytes;
+    const size_t resident = resident_bytes_.fetch_add(kTileBytes, std::memory_order_relaxed) + kTileBytes;
+    size_t peak = peak_resident_bytes_.load(std::memory_order_relaxed);
+    while (resident > peak && !peak_resident_bytes_.compare_exchange_weak(peak, resident, std::memory_order_relaxed)) {
+    }
+    return tile;
+  }
+
+  std::shared_ptr<const Tile> decodeTile(uint64_t key) const {
+    const TextureId id = static_cast<TextureId>(key >> 40);
+    const uint32_t level = static_cast<uint32_t>(key >> 32) & 0xff;
+    const uint32_t tile_y = static_cast<uint32_t>(key >> 16) & 0xffff;
+    const uint32_t tile_x = static_cast<uint32_t>(key) & 0xffff;
+    const Texture& texture = textures_[id];
+    const uint32_t x0 = tile_x * kTileSize;
+    const uint32_t y0 = tile_y * kTileSize;
+    const uint32_t columns = std::min(kTileSize, texture.widths[level] - x0);
+    const uint32_t rows = std::min(kTileSize, texture.heights[level] - y0);
+
+    // Texels past the edge of the image are never sampled, and are left black.
+    auto tile = std::make_shared<Tile>();
+    if (level == 0) {
+      for (uint32_t row = 0; row < rows; row++) {
+        texture.source->ReadTexels(y0 + row, x0, columns, &tile->texels[row * kTileSize * 3]);
+      }
+      return tile;
+    }
+
+    // Box filter the 2x2 texel footprints in the (up to) 2x2 tiles of the level below. Odd sized
+    // levels repeat their last row or column.
+    const uint32_t child_width = texture.widths[level - 1];
+    const uint32_t child_height = texture.heights[level - 1];
+    const uint32_t child_tiles_x = (child_width + kTileSize - 1) / kTileSize;
+    const uint32_t child_tiles_y = (child_height + kTileSize - 1) / kTileSize;
+    std::shared_ptr<const Tile> children[2][2];
+    for (uint32_t dy = 0; dy < 2; dy++) {
+      for (uint32_t dx = 0; dx < 2; dx++) {
+        if (2 * tile_x + dx < child_tiles_x && 2 * tile_y + dy < child_tiles_y) {
+          children[dy][dx] = threadTile(tileKey(id, level - 1, 2 * tile_x + dx, 2 * tile_y + dy));
+        }
+      }
+    }
+    for (uint32_t row = 0; row < rows; row++) {
+      for (uint32_t column = 0; column < columns; column++) {
+        uint32_t sum[3] = {0, 0, 0};
+        for (uint32_t sy = 0; sy < 2; sy++) {
+          for (uint32_t sx = 0; sx < 2; sx++) {
+            const uint32_t cx = std::min(2 * (x0 + column) + sx, child_width - 1) - 2 * x0;
+            const uint32_t cy = std::min(2 * (y0 + row) + sy, child_height - 1) - 2 * y0;
+            const Tile& child = *children[cy / kTileSize][cx / kTileSize];
+            const uint8_t* rgb = &child.texels[((cy % kTileSize) * kTileSize + cx % kTileSize) * 3];
+            for (int c = 0; c < 3; c++) {
+              sum[c] += rgb[c];
+            }
+          }
+        }
+        for (int c = 0; c < 3; c++) {
+          tile->texels[(row * kTileSize + column) * 3 + c] = static_cast<uint8_t>((sum[c] + 2) / 4);
+        }
+      }
+    }
+    return tile;
+  }
+
+  std::vector<Texture> textures_{};
+  std::unordered_map<std::string, TextureId> ids_by_path_{};
+
+  const uint64_t instance_id_ = next_instance_id_.fetch_add(1, std::memory_order_relaxed);
+  const size_t budget_bytes_;
+  const size_t shard_budget_bytes_;
+  std::unique_ptr<Shard[]> shards_;
+
+  mutable std::atomic<uint64_t> lookups_{0};
+  mutable std::atomic<uint64_t> hits_{0};
+  mutable std::atomic<uint64_t> loads_{0};
+  mutable std::atomic<uint64_t> evictions_{0};
+  mutable std::atomic<size_t> resident_bytes_{0};
+  mutable std::atomic<size_t> peak_resident_bytes_{0};
+};
+
+} // namespace graphics::raytracer
@@ -0,0 +1,56 @@
+// Diffuse object whose color comes from an image texture, looked up through a TextureCache at the
+// texture coordinates of the hit.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <optional>
+
+#include "../materials/material.h"
+#include "../materials/texture_cache.h"
+#include "../math/vec_utils.h"
+#include "../math/vec.h"
+#include "../utils/ray.h"
+#include "../utils/color.h"
+#include "../objects/intersectables/intersectable.h"
+
+namespace graphics::raytracer {
+
+class TexturedDiffuse : public Material {
+
+public:
+  // The texture is tinted by |color|, and repeats |scale| times per unit of texture coordinates.
+  // Mip levels are picked from the footprint of the incoming ray (its spread angle times the hit
+  // distance) against the world space size of the texels at the hit.
+  TexturedDiffuse(std::shared_ptr<const TextureCache> cache, TextureId texture, const Color3f& color, float scale = 1.f) :
+    cache_{std::move(cache)}, texture_{texture}, color_{color}, scale_{scale} {
+    texels_per_uv_ = std::max(cache_->width(texture_), cache_->height(texture_)) * scale_;
+  }
+
+  std::optional<ScatterInfo> Scatter(const Ray& ray_in, const ObjectIntersectionInfo& intersection_info) const override {
+    math::Vector3f scatter_direction = intersection_info.normal;
+    auto scatter_ray = Ray(intersection_info.point + (0.0001f * scatter_direction), scatter_direction);
+
+    const float footprint = intersection_info.t * magnitude(ray_in.direction()) * ray_in.spread_angle();
+    // Degenerate texture mappings (eg. at a sphere's poles) get the coarsest level.
+    const float texels_per_unit = texels_per_uv_ / std::max(intersection_info.uv_length, kMinUvLength);
+    const float lod = std::log2(std::max(1.f, footprint * texels_per_unit));
+    const Color3f texture_color = cache_->Sample(texture_, intersection_info.uv * scale_, lod);
+    return ScatterInfo{.ray_out = scatter_ray, .attenuation = math::elem_prod(color_, texture_color)};
+  }
+
+  // The texels live in the cache, which is accounted for separately.
+  size_t MemoryUsage() const override { return sizeof(*this); }
+
+private:
+  static constexpr float kMinUvLength = 1e-6f;
+
+  std::shared_ptr<const TextureCache> cache_{};
+  TextureId texture_{};
+  Color3f color_{};
+  float scale_ = 1.f;
+  float texels_per_uv_ = 1.f;
+};
+
+} // namespace graphics::raytracer
@@ -0,0 +1,76 @@
+// Morton (Z-order) encoding helpers. Interleaving the bits of integer coordinates gives a
+// 1-d index where points that are close in 2-d/3-d space tend to be close in memory.
+#pragma once
+
+#include <cstdint>
+
+namespace graphics::math {
+
+// Spreads the lower 16 bits of |x| so that there is a 0 bit between each of them.
+constexpr uint32_t part1by1(uint32_t x) {
+  x &= 0x0000ffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+// Inverse of part1by1, gathers every other bit into the lower 16 bits.
+constexpr uint32_t compact1by1(uint32_t x) {
+  x &= 0x55555555;
+  x = (x | (x >> 1)) & 0x33333333;
+  x = (x | (x >> 2)) & 0x0f0f0f0f;
+  x = (x | (x >> 4)) & 0x00ff00ff;
+  x = (x | (x >> 8)) & 0x0000ffff;
+  return x;
+}
+
+// Morton code of a 2-d coordinate, x occupies the even bits and y the odd bits.
+constexpr uint32_t morton_encode_2d(uint32_t x, uint32_t y) {
+  return part1by1(x) | (part1by1(y) << 1);
+}
+
+constexpr uint32_t morton_decode_2d_x(uint32_t code) {
+  return compact1by1(code);
+}
+
+constexpr uint32_t morton_decode_2d_y(uint32_t code) {
+  return compact1by1(code >> 1);
+}
+
+// Spreads the lower 10 bits of |x| so that there are two 0 bits between each of them.
+constexpr uint32_t part1by2(uint32_t x) {
+  x &= 0x000003ff;
+  x = (x | (x << 16)) & 0xff0000ff;
+  x = (x | (x << 8))  & 0x0300f00f;
+  x = (x | (x << 4))  & 0x030c30c3;
+  x = (x | (x << 2))  & 0x09249249;
+  return x;
+}
+
+// Same as part1by2, but for the lower 21 bits of a 64 bit value.
+constexpr uint64_t part1by2_64(uint64_t x) {
+  x &= 0x1fffff;
+  x = (x | (x << 32)) & 0x001f00000000ffffull;
+  x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+  x = (x | (x << 8))  & 0x100f00f00f00f00full;
+  x = (x | (x << 4))  & 0x10c30c30c30c30c3ull;
+  x = (x | (x << 2))  & 0x1249249249249249ull;
+  return x;
+}
+
+// 30 bit Morton code of a 3-d coordinate with 10 bits per axis.
+constexpr uint32_t morton_encode_3d(uint32_t x, uint32_t y, uint32_t z) {
+  return part1by2(x) | (part1by2(y) << 1) | (part1by2(z) << 2);
+}
+
+// 63 bit Morton code of a 3-d coordinate with 21 bits per axis.
+constexpr uint64_t morton_encode_3d_64(uint64_t x, uint64_t y, uint64_t z) {
+  return part1by2_64(x) | (part1by2_64(y) << 1) | (part1by2_64(z) << 2);
+}
+
+static_assert(morton_encode_3d(1023, 1023, 1023) == 0x3fffffff);
+static_assert(morton_encode_3d_64(0x1fffff, 0x1fffff, 0x1fffff) == 0x7fffffffffffffffull);
+
+} // namespace graphics::math
@@ -0,0 +1,66 @@
+// Octahedral encoding of unit vectors. The unit sphere is projected onto an octahedron which is
+// then unfolded into the [-1, 1]^2 square, so a direction fits into two 16 bit snorm values.
+// See "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al. 2014).
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "../math/vec.h"
+#include "../math/math_utils.h"
+
+namespace graphics::math {
+
+namespace detail {
+
+inline float signNotZero(float value) {
+  return value >= 0.f ? 1.f : -1.f;
+}
+
+inline uint32_t toSnorm16(float value) {
+  return static_cast<uint16_t>(static_cast<int16_t>(std::round(clamp(value, -1.f, 1.f) * 32767.f)));
+}
+
+inline float fromSnorm16(uint32_t value) {
+  return clamp(static_cast<int16_t>(value & 0xffff) / 32767.f, -1.f, 1.f);
+}
+
+} // namespace detail
+
+// Largest angle in radians between a unit vector and its decoded encoding. Rounding to 16 bits
+// moves each coordinate by at most half a step (0.5 / 32767), which moves the point on the
+// octahedron by at most sqrt(6) times that, and the octahedron is at least 1 / sqrt(3) from the
+// origin. sqrt(18) is rounded up to leave room for float rounding.
+constexpr float kOctahedralMaxAngleError = 4.3f * 0.5f / 32767.f;
+
+// Packs a (not necessarily normalized) direction into 32 bits.
+inline uint32_t octahedral_encode(const Vector3f& vec) {
+  const float l1_norm = std::abs(vec.x) + std::abs(vec.y) + std::abs(vec.z);
+  if (l1_norm == 0.f) {
+    return 0;
+  }
+  float u = vec.x / l1_norm;
+  float v = vec.y / l1_norm;
+  // Fold the lower hemisphere over the diagonals.
+  if (vec.z < 0.f) {
+    const float folded_u = (1.f - std::abs(v)) * detail::signNotZero(u);
+    const float folded_v = (1.f - std::abs(u)) * detail::signNotZero(v);
+    u = folded_u;
+    v = folded_v;
+  }
+  return detail::toSnorm16(u) | (detail::toSnorm16(v) << 16);
+}
+
+// Unpacks a direction encoded with octahedral_encode. The result is normalized.
+inline Vector3f octahedral_decode(uint32_t encoded) {
+  const float u = detail::fromSnorm16(encoded);
+  const float v = detail::fromSnorm16(encoded >> 16);
+  Vector3f vec{u, v, 1.f - std::abs(u) - std::abs(v)};
+  if (vec.z < 0.f) {
+    vec.x = (1.f - std::abs(v)) * detail::signNotZero(u);
+    vec.y = (1.f - std::abs(u)) * detail::signNotZero(v);
+  }
+  return normalize(vec);
+}
+
+} // namespace graphics::math
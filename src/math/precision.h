@@ -0,0 +1,74 @@
+// Precision policy of the hot math kernels: normalizing camera rays, shadow rays and hit normals,
+// and the dot products of the ray/primitive intersection tests. The renderer is exact by default.
+// Configuring with -DFAST_MATH=ON defines GRAPHICS_FAST_MATH, which switches the kernels to an
+// approximate reciprocal square root refined with one Newton step, and to fused multiply-add dot
+// products when the target has FMA.
+//
+// Both versions are always compiled, so they can be compared in one binary (see
+// tools/precision_benchmark.cpp); kPrecision is the one the renderer uses. The exact versions
+// give bit for bit the same results as math::normalize and the vector dot product, and constant
+// evaluation always takes the exact path.
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "../math/fast_math.h"
+#include "../math/vec.h"
+
+namespace graphics::math {
+
+enum class Precision {
+  kExact,
+  kFast,
+};
+
+#ifdef GRAPHICS_FAST_MATH
+inline constexpr Precision kPrecision = Precision::kFast;
+#else
+inline constexpr Precision kPrecision = Precision::kExact;
+#endif
+
+// 1 / sqrt(x). The fast version is the hardware estimate (12 bits) plus one Newton-Raphson step,
+// which is accurate to about 2^-22 relative error.
+template <Precision P = kPrecision>
+constexpr float rsqrt(float x) {
+#ifdef __SSE__
+  if constexpr (P == Precision::kFast) {
+    if (!std::is_constant_evaluated()) {
+      const float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+      return y * (1.5f - 0.5f * x * y * y);
+    }
+  }
+#endif
+  return 1.f / math::sqrt(x);
+}
+
+// Dot product. The fast version fuses the multiplies and adds when the target has FMA
+// instructions (without them std::fma is a slow library call, so it isn't used).
+template <Precision P = kPrecision>
+constexpr float dot(const Vector3f& a, const Vector3f& b) {
+#ifdef FP_FAST_FMAF
+  if constexpr (P == Precision::kFast) {
+    if (!std::is_constant_evaluated()) {
+      return std::fma(a.data[0], b.data[0], std::fma(a.data[1], b.data[1], a.data[2] * b.data[2]));
+    }
+  }
+#endif
+  return a * b;
+}
+
+// |v| scaled to unit length.
+template <Precision P = kPrecision>
+constexpr Vector3f unit_vector(const Vector3f& v) {
+  if constexpr (P == Precision::kFast) {
+    return v * rsqrt<P>(dot<P>(v, v));
+  }
+  return normalize(v);
+}
+
+} // namespace graphics::math
@@ -58,7 +58,7 @@ struct Vector {
   }
 
   // Access element transparently, const
-  constexpr T& operator[](const int i) const {
+  constexpr const T& operator[](const int i) const {
     return data[i];
   }
 };
@@ -109,7 +109,7 @@ struct Vector<T, 2> {
   }
 
   // Access element transparently, const
-  constexpr T& operator[](const int i) const {
+  constexpr const T& operator[](const int i) const {
     return data[i];
   }
 };
@@ -158,7 +158,7 @@ struct Vector<T, 3> {
   }
 
   // Access element transparently, const
-  constexpr T& operator[](const int i) const {
+  constexpr const T& operator[](const int i) const {
     return data[i];
   }
 };
@@ -207,7 +207,7 @@ struct Vector<T, 4> {
   }
 
   // Access element transparently, const
-  constexpr T& operator[](const int i) const {
+  constexpr const T& operator[](const int i) const {
     return data[i];
   }
 };
@@ -328,13 +328,16 @@ constexpr bool operator!=(const Vector<T, Dims>& v1, const Vector<T, Dims>& v2)
 // Cross product between two generic vectors, but it takes the type of the type of the first
 // vector. This is only defined for vectors of dimension 3.
 template <typename T>
-Vector<T, 3> cross(const Vector<T, 3>& v1, const Vector<T, 3>& v2) noexcept {
-  return Vector<T, 3>{v1.y * v2.z - v1.z * v2.y,
-                      v1.z * v2.x - v1.x * v2.z,
-                      v1.x * v2.y - v1.y * v2.x};
+constexpr Vector<T, 3> cross(const Vector<T, 3>& v1, const Vector<T, 3>& v2) noexcept {
+  // Goes through |data| rather than x, y, z so it can be constant evaluated (only the union member
+  // that was initialized may be read there).
+  return Vector<T, 3>{v1.data[1] * v2.data[2] - v1.data[2] * v2.data[1],
+                      v1.data[2] * v2.data[0] - v1.data[0] * v2.data[2],
+                      v1.data[0] * v2.data[1] - v1.data[1] * v2.data[0]};
 }
 
 // Type aliases for commonly used vector types.
+using Vector2f = Vector<float, 2>;
 using Vector3f = Vector<float, 3>;
 
 // Alias for point, its just a vector but looks nicer.
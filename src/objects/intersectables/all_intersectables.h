@@ -1,7 +1,11 @@
 #pragma once
 
+#include "../../objects/intersectables/bvh.h"
 #include "../../objects/intersectables/intersectable.h"
 #include "../../objects/intersectables/intersectable_list.h"
+#include "../../objects/intersectables/mapped_mesh.h"
 #include "../../objects/intersectables/plane.h"
+#include "../../objects/intersectables/quantized_mesh.h"
 #include "../../objects/intersectables/sphere.h"
 #include "../../objects/intersectables/triangle.h"
+#include "../../objects/intersectables/uniform_grid.h"
@@ -0,0 +1,526 @@
+// Bounding volume hierarchy over arbitrary Intersectables, with two builders:
+// - Fast: a linear BVH (LBVH). Objects are sorted along a Morton curve by their centroids with a
+//   parallel radix sort, and the hierarchy is emitted from the sorted codes with every internal
+//   node built independently (Karras 2012, "Maximizing parallelism in the construction of BVHs,
+//   octrees, and k-d trees"). Every step is parallel, so it builds quickly, at the cost of a
+//   somewhat worse tree. Meant for interactive jobs where time to first pixel matters.
+// - High: a top-down binned surface area heuristic (SAH) build. The top of the tree is split on
+//   one thread, and the subtrees below it are built in parallel. Slower to build, faster to trace.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../objects/intersectables/intersectable.h"
+#include "../../math/morton.h"
+#include "../../utils/bounding_box.h"
+#include "../../utils/ray.h"
+#include "../../utils/thread_pool.h"
+
+namespace graphics::raytracer {
+
+enum class BvhQuality {
+  // LBVH, parallel Morton code build.
+  kFast,
+  // Binned SAH build.
+  kHigh,
+};
+
+class Bvh final : public Intersectable {
+
+public:
+  // Above this many objects the LBVH uses 63-bit Morton codes (21 bits per axis) instead of
+  // 30-bit ones, so that large scenes don't end up with many objects sharing a code.
+  static constexpr size_t kWideMortonThreshold = size_t{1} << 20;
+  static constexpr int kSahBins = 12;
+  // SAH leaves hold at most this many objects...
+  static constexpr uint32_t kMaxLeafSize = 8;
+  // ... and ranges this small are always turned into a leaf.
+  static constexpr uint32_t kMinSplitSize = 2;
+  // Relative cost of visiting a node, compared to testing one object.
+  static constexpr float kTraversalCost = 1.f;
+  // SAH subtrees with more objects than this are built as tasks of their own.
+  static constexpr uint32_t kParallelSahThreshold = 1u << 14;
+
+  // Builds the hierarchy over |objects| on |pool|, or on the calling thread if |pool| is null.
+  // Unbounded objects (planes) can't be placed in the hierarchy, and are tested against every ray
+  // instead.
+  Bvh(std::vector<std::shared_ptr<Intersectable>> objects, BvhQuality quality, ThreadPool* pool = nullptr) {
+    for (auto& object : objects) {
+      if (object->Bounds()) {
+        objects_.push_back(std::move(object));
+      } else {
+        unbounded_.push_back(std::move(object));
+      }
+    }
+    if (objects_.empty()) {
+      return;
+    }
+
+    std::vector<BoundingBox> boxes(objects_.size());
+    ParallelFor(pool, 0, objects_.size(), kBuildGrain, [&](size_t i, size_t) { boxes[i] = *objects_[i]->Bounds(); });
+
+    std::vector<uint32_t> order;
+    if (quality == BvhQuality::kFast) {
+      order = buildLinear(boxes, pool);
+    } else {
+      order = buildSah(boxes, pool);
+    }
+
+    // Store the objects in leaf order, so the objects of a leaf are next to each other.
+    std::vector<std::shared_ptr<Intersectable>> sorted(objects_.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      sorted[i] = std::move(objects_[order[i]]);
+    }
+    objects_ = std::move(sorted);
+  }
+
+  std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
+    std::optional<ObjectIntersectionInfo> closest;
+    float max_distance = std::numeric_limits<float>::max();
+    auto test = [&](const Intersectable* object) {
+      if (auto intersection_record = object->Intersect(ray); intersection_record && intersection_record->t <= max_distance) {
+        max_distance = intersection_record->t;
+        closest = std::move(intersection_record);
+      }
+    };
+    for (const auto& object : unbounded_) {
+      test(object.get());
+    }
+    if (nodes_.empty()) {
+      return closest;
+    }
+
+    const math::Vector3f inv_direction = inverse_direction(ray);
+    struct StackEntry {
+      uint32_t node;
+      float t_enter;
+    };
+    StackEntry stack[kMaxDepth];
+    int stack_size = 0;
+    if (const auto t = nodes_[0].box.Intersect(ray, inv_direction, max_distance)) {
+      stack[stack_size++] = StackEntry{0, *t};
+    }
+
+    while (stack_size > 0) {
+      const StackEntry entry = stack[--stack_size];
+      // A closer hit may have been found since the node was pushed.
+      if (entry.t_enter > max_distance) {
+        continue;
+      }
+      const Node& node = nodes_[entry.node];
+      if (node.count > 0) {
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+          test(objects_[i].get());
+        }
+        continue;
+      }
+      // Visit the nearer child first, so its hits cull the farther one.
+      const uint32_t children[2] = {node.offset, node.right};
+      std::optional<float> t[2];
+      for (int c = 0; c < 2; c++) {
+        t[c] = nodes_[children[c]].box.Intersect(ray, inv_direction, max_distance);
+      }
+      const int near = t[0] && (!t[1] || *t[0] <= *t[1]) ? 0 : 1;
+      const int far = 1 - near;
+      if (t[far]) {
+        stack[stack_size++] = StackEntry{children[far], *t[far]};
+      }
+      if (t[near]) {
+        stack[stack_size++] = StackEntry{children[near], *t[near]};
+      }
+    }
+    return closest;
+  }
+
+  std::optional<BoundingBox> Bounds() const override {
+    if (!unbounded_.empty()) {
+      return std::nullopt;
+    }
+    return nodes_.empty() ? BoundingBox{} : nodes_[0].box;
+  }
+
+  std::string Describe() const override {
+    return "BVH of " + std::to_string(nodes_.size()) + " nodes over " + std::to_string(objects_.size()) + " objects";
+  }
+
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("BVH", sizeof(*this) + MemoryReport::VectorBytes(nodes_) + MemoryReport::VectorBytes(objects_) +
+                      MemoryReport::VectorBytes(unbounded_));
+    for (const auto& object : unbounded_) {
+      AccountSharedObject(report, object);
+    }
+    for (const auto& object : objects_) {
+      AccountSharedObject(report, object);
+    }
+  }
+
+  // Unbounded objects are tested first. The others are tested in an order that depends on the ray,
+  // so ties between them may be decided differently than in this order.
+  void CollectPrimitives(std::vector<const Intersectable*>& primitives) const override {
+    for (const auto& object : unbounded_) {
+      object->CollectPrimitives(primitives);
+    }
+    for (const auto& object : objects_) {
+      object->CollectPrimitives(primitives);
+    }
+  }
+
+  size_t node_count() const { return nodes_.size(); }
+
+  // Sum of the surface areas of the internal nodes relative to the root, weighted by the SAH
+  // traversal cost, plus the expected number of object tests. Lower is a better tree.
+  float SahCost() const {
+    if (nodes_.empty()) {
+      return 0.f;
+    }
+    const float root_area = std::max(nodes_[0].box.SurfaceArea(), std::numeric_limits<float>::min());
+    float cost = 0.f;
+    for (const Node& node : nodes_) {
+      cost += node.box.SurfaceArea() / root_area * (node.count > 0 ? node.count : kTraversalCost);
+    }
+    return cost;
+  }
+
+private:
+  // Neither builder makes trees deeper than this: LBVH depth is bounded by the bits of the
+  // Morton code plus the bits of the object index, and below kMaxSahDepth the SAH builder only
+  // makes median splits.
+  static constexpr int kMaxDepth = 128;
+  static constexpr int kMaxSahDepth = 64;
+  // Objects (or nodes) a build worker takes at a time.
+  static constexpr size_t kBuildGrain = 4096;
+
+  struct Node {
+    BoundingBox box;
+    // For leaves (count > 0), the node holds objects [offset, offset + count). For internal
+    // nodes, the children are nodes |offset| and |right|.
+    uint32_t offset;
+    uint32_t right;
+    uint32_t count;
+  };
+
+  // Splits [0, size) into |num_chunks| contiguous chunks and calls func(chunk, first, last) for
+  // each on |pool|.
+  template <typename F>
+  static void parallelChunks(ThreadPool* pool, size_t size, size_t num_chunks, F&& func) {
+    ParallelFor(pool, 0, num_chunks, 1, [&](size_t c, size_t) {
+      func(c, size * c / num_chunks, size * (c + 1) / num_chunks);
+    });
+  }
+
+  // Stable LSD radix sort of |keys| (and |values| along with them) on their low |bits| bits,
+  // 8 bits per pass. Each pass histograms the digits per chunk in parallel, turns the histograms
+  // into per chunk output offsets, and scatters in parallel.
+  static void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int bits, ThreadPool* pool) {
+    constexpr int kDigitBits = 8;
+    constexpr size_t kBuckets = size_t{1} << kDigitBits;
+    const size_t size = keys.size();
+    const size_t num_chunks = std::max<size_t>(1, std::min(WorkerCount(pool), size / kBuildGrain));
+
+    std::vector<uint64_t> keys_out(size);
+    std::vector<uint32_t> values_out(size);
+    std::vector<std::array<size_t, kBuckets>> offsets(num_chunks);
+    for (int shift = 0; shift < bits; shift += kDigitBits) {
+      parallelChunks(pool, size, num_chunks, [&](size_t chunk, size_t first, size_t last) {
+        offsets[chunk].fill(0);
+        for (size_t i = first; i < last; i++) {
+          offsets[chunk][(keys[i] >> shift) & (kBuckets - 1)]++;
+        }
+      });
+      size_t total = 0;
+      for (size_t digit = 0; digit < kBuckets; digit++) {
+        for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+          const size_t count = offsets[chunk][digit];
+          offsets[chunk][digit] = total;
+          total += count;
+        }
+      }
+      parallelChunks(pool, size, num_chunks, [&](size_t chunk, size_t first, size_t last) {
+        auto& chunk_offsets = offsets[chunk];
+        for (size_t i = first; i < last; i++) {
+          const size_t destination = chunk_offsets[(keys[i] >> shift) & (kBuckets - 1)]++;
+          keys_out[destination] = keys[i];
+          values_out[destination] = values[i];
+        }
+      });
+      keys.swap(keys_out);
+      values.swap(values_out);
+    }
+  }
+
+  // Karras' tree construction. Internal node i covers a range of sorted codes starting or
+  // ending at i, and is split where the highest differing bit of the range changes. Internal
+  // nodes are nodes_[0, n - 1), leaf k (the k-th sorted object) is nodes_[n - 1 + k].
+  // Returns the order of the objects.
+  std::vector<uint32_t> buildLinear(const std::vector<BoundingBox>& boxes, ThreadPool* pool) {
+    const int n = static_cast<int>(boxes.size());
+
+    // Bounds of the centroids, reduced over chunks.
+    std::vector<BoundingBox> chunk_bounds(WorkerCount(pool));
+    parallelChunks(pool, boxes.size(), chunk_bounds.size(), [&](size_t chunk, size_t first, size_t last) {
+      BoundingBox local;
+      for (size_t i = first; i < last; i++) {
+        local.Expand(boxes[i].Centroid());
+      }
+      chunk_bounds[chunk] = local;
+    });
+    BoundingBox centroid_bounds;
+    for (const BoundingBox& bounds : chunk_bounds) {
+      centroid_bounds.Expand(bounds);
+    }
+
+    const bool wide_codes = boxes.size() > kWideMortonThreshold;
+    const int bits_per_axis = wide_codes ? 21 : 10;
+    const float grid_max = static_cast<float>((1u << bits_per_axis) - 1);
+    const math::Vector3f extent = centroid_bounds.Extent();
+    std::vector<uint64_t> codes(n);
+    std::vector<uint32_t> order(n);
+    ParallelFor(pool, 0, boxes.size(), kBuildGrain, [&](size_t i, size_t) {
+      const math::Point3f centroid = boxes[i].Centroid();
+      uint32_t grid[3];
+      for (int a = 0; a < 3; a++) {
+        const float normalized = extent.data[a] > 0.f ? (centroid.data[a] - centroid_bounds.min.data[a]) / extent.data[a] : 0.f;
+        grid[a] = static_cast<uint32_t>(std::clamp(normalized * grid_max, 0.f, grid_max));
+      }
+      codes[i] = wide_codes ? math::morton_encode_3d_64(grid[0], grid[1], grid[2])
+                            : math::morton_encode_3d(grid[0], grid[1], grid[2]);
+      order[i] = static_cast<uint32_t>(i);
+    });
+    radixSort(codes, order, 3 * bits_per_axis, pool);
+
+    nodes_.resize(2 * static_cast<size_t>(n) - 1);
+    std::vector<uint32_t> parents(nodes_.size(), 0);
+    for (int k = 0; k < n; k++) {
+      nodes_[n - 1 + k] = Node{.box = boxes[order[k]], .offset = static_cast<uint32_t>(k), .right = 0, .count = 1};
+    }
+    if (n == 1) {
+      return order;
+    }
+
+    // Length of the common prefix of codes i and j, with equal codes told apart by index.
+    auto delta = [&](int i, int j) -> int {
+      if (j < 0 || j >= n) {
+        return -1;
+      }
+      if (codes[i] == codes[j]) {
+        return 64 + std::countl_zero(static_cast<uint32_t>(i ^ j));
+      }
+      return std::countl_zero(codes[i] ^ codes[j]);
+    };
+
+    ParallelFor(pool, 0, static_cast<size_t>(n - 1), kBuildGrain, [&](size_t index, size_t) {
+      const int i = static_cast<int>(index);
+      // Direction of the range, and its other end j.
+      const int d = delta(i, i + 1) - delta(i, i - 1) > 0 ? 1 : -1;
+      const int delta_min = delta(i, i - d);
+      int length_max = 2;
+      while (delta(i, i + length_max * d) > delta_min) {
+        length_max *= 2;
+      }
+      int length = 0;
+      for (int step = length_max / 2; step >= 1; step /= 2) {
+        if (delta(i, i + (length + step) * d) > delta_min) {
+          length += step;
+        }
+      }
+      const int j = i + length * d;
+
+      // Split position: the last index that shares more than delta(i, j) bits with i.
+      const int delta_node = delta(i, j);
+      int split = 0;
+      int step = length;
+      do {
+        step = (step + 1) / 2;
+        if (delta(i, i + (split + step) * d) > delta_node) {
+          split += step;
+        }
+      } while (step > 1);
+      const int gamma = i + split * d + std::min(d, 0);
+
+      const uint32_t left = std::min(i, j) == gamma ? n - 1 + gamma : gamma;
+      const uint32_t right = std::max(i, j) == gamma + 1 ? n + gamma : gamma + 1;
+      nodes_[i] = Node{.box = {}, .offset = left, .right = right, .count = 0};
+      parents[left] = static_cast<uint32_t>(i);
+      parents[right] = static_cast<uint32_t>(i);
+    });
+
+    // Bounds, bottom up. Every leaf walks towards the root, and the second child to arrive at
+    // a node (when both children's boxes are known) computes its box and continues upwards.
+    std::vector<std::atomic<uint32_t>> arrivals(n - 1);
+    ParallelFor(pool, 0, boxes.size(), kBuildGrain, [&](size_t k, size_t) {
+      uint32_t node = parents[n - 1 + k];
+      while (arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 1) {
+        BoundingBox box = nodes_[nodes_[node].offset].box;
+        box.Expand(nodes_[nodes_[node].right].box);
+        nodes_[node].box = box;
+        if (node == 0) {
+          break;
+        }
+        node = parents[node];
+      }
+    });
+    return order;
+  }
+
+  // A SAH subtree that is left to be built: node |node_index| over objects [first, last) of the order.
+  struct SahTask {
+    uint32_t node_index;
+    uint32_t first;
+    uint32_t last;
+    int depth;
+  };
+
+  // Top down binned SAH build. Returns the order of the objects.
+  std::vector<uint32_t> buildSah(const std::vector<BoundingBox>& boxes, ThreadPool* pool) {
+    const uint32_t n = static_cast<uint32_t>(boxes.size());
+    std::vector<uint32_t> order(n);
+    std::vector<math::Point3f> centroids(n);
+    for (uint32_t i = 0; i < n; i++) {
+      order[i] = i;
+      centroids[i] = boxes[i].Centroid();
+    }
+    nodes_.resize(2 * static_cast<size_t>(n) - 1);
+    std::atomic<uint32_t> node_count{1};
+    // The top |parallel_depth| levels are split on this thread, which leaves up to 4 subtrees per
+    // worker (large ones first) for the pool to balance. Subtrees are independent, each has its
+    // own range of |order| and allocates its own nodes.
+    const size_t workers = WorkerCount(pool);
+    const int parallel_depth = workers > 1 ? std::bit_width(workers) + 1 : 0;
+    std::vector<SahTask> subtrees;
+    buildSahNode(SahTask{.node_index = 0, .first = 0, .last = n, .depth = 0}, parallel_depth, &subtrees, boxes,
+                 centroids, order, node_count);
+    std::sort(subtrees.begin(), subtrees.end(),
+              [](const SahTask& a, const SahTask& b) { return a.last - a.first > b.last - b.first; });
+    ParallelFor(pool, 0, subtrees.size(), 1, [&](size_t i, size_t) {
+      buildSahNode(subtrees[i], parallel_depth, nullptr, boxes, centroids, order, node_count);
+    });
+    nodes_.resize(node_count.load());
+    return order;
+  }
+
+  // Builds the subtree of |task|. With |subtrees|, subtrees of more than kParallelSahThreshold
+  // objects at |parallel_depth| are added to it instead of being built.
+  void buildSahNode(const SahTask& task, int parallel_depth, std::vector<SahTask>* subtrees,
+                    const std::vector<BoundingBox>& boxes, const std::vector<math::Point3f>& centroids,
+                    std::vector<uint32_t>& order, std::atomic<uint32_t>& node_count) {
+    const uint32_t node_index = task.node_index;
+    const uint32_t first = task.first;
+    const uint32_t last = task.last;
+    const int depth = task.depth;
+    if (subtrees != nullptr && depth >= parallel_depth && last - first > kParallelSahThreshold) {
+      subtrees->push_back(task);
+      return;
+    }
+    BoundingBox box;
+    BoundingBox centroid_bounds;
+    for (uint32_t i = first; i < last; i++) {
+      box.Expand(boxes[order[i]]);
+      centroid_bounds.Expand(centroids[order[i]]);
+    }
+    const uint32_t count = last - first;
+    auto make_leaf = [&]() {
+      nodes_[node_index] = Node{.box = box, .offset = first, .right = 0, .count = count};
+    };
+    if (count <= kMinSplitSize) {
+      make_leaf();
+      return;
+    }
+
+    // Find the cheapest bin boundary over all axes.
+    const math::Vector3f extent = centroid_bounds.Extent();
+    float best_cost = std::numeric_limits<float>::max();
+    int best_axis = -1;
+    int best_boundary = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      if (extent.data[axis] <= 0.f) {
+        continue;
+      }
+      const float scale = kSahBins / extent.data[axis];
+      BoundingBox bin_boxes[kSahBins];
+      uint32_t bin_counts[kSahBins] = {};
+      for (uint32_t i = first; i < last; i++) {
+        const int bin = std::min(kSahBins - 1, static_cast<int>((centroids[order[i]].data[axis] - centroid_bounds.min.data[axis]) * scale));
+        bin_boxes[bin].Expand(boxes[order[i]]);
+        bin_counts[bin]++;
+      }
+      // Sweep from the right to get the area and count of everything right of each boundary.
+      float right_area[kSahBins];
+      uint32_t right_count[kSahBins];
+      BoundingBox right_box;
+      uint32_t right_total = 0;
+      for (int b = kSahBins - 1; b > 0; b--) {
+        right_box.Expand(bin_boxes[b]);
+        right_total += bin_counts[b];
+        right_area[b] = right_box.Empty() ? 0.f : right_box.SurfaceArea();
+        right_count[b] = right_total;
+      }
+      BoundingBox left_box;
+      uint32_t left_total = 0;
+      for (int b = 1; b < kSahBins; b++) {
+        left_box.Expand(bin_boxes[b - 1]);
+        left_total += bin_counts[b - 1];
+        if (left_total == 0 || right_count[b] == 0) {
+          continue;
+        }
+        const float cost = left_box.SurfaceArea() * left_total + right_area[b] * right_count[b];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_boundary = b;
+        }
+      }
+    }
+
+    uint32_t middle = 0;
+    if (depth >= kMaxSahDepth) {
+      // Very unbalanced SAH splits, split at the median of the widest axis to bound the depth.
+      const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+      middle = first + count / 2;
+      std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + last,
+                       [&](uint32_t a, uint32_t b) { return centroids[a].data[axis] < centroids[b].data[axis]; });
+    } else if (best_axis >= 0) {
+      const float split_cost = kTraversalCost + best_cost / std::max(box.SurfaceArea(), std::numeric_limits<float>::min());
+      if (split_cost >= count && count <= kMaxLeafSize) {
+        make_leaf();
+        return;
+      }
+      const float scale = kSahBins / extent.data[best_axis];
+      const auto middle_it = std::partition(order.begin() + first, order.begin() + last, [&](uint32_t object) {
+        const int bin = std::min(kSahBins - 1, static_cast<int>((centroids[object].data[best_axis] - centroid_bounds.min.data[best_axis]) * scale));
+        return bin < best_boundary;
+      });
+      middle = static_cast<uint32_t>(middle_it - order.begin());
+    } else if (count <= kMaxLeafSize) {
+      // All centroids coincide, binning can't separate them.
+      make_leaf();
+      return;
+    } else {
+      middle = first + count / 2;
+    }
+
+    const uint32_t left = node_count.fetch_add(2);
+    const uint32_t right = left + 1;
+    nodes_[node_index] = Node{.box = box, .offset = left, .right = right, .count = 0};
+    buildSahNode(SahTask{.node_index = left, .first = first, .last = middle, .depth = depth + 1}, parallel_depth,
+                 subtrees, boxes, centroids, order, node_count);
+    buildSahNode(SahTask{.node_index = right, .first = middle, .last = last, .depth = depth + 1}, parallel_depth,
+                 subtrees, boxes, centroids, order, node_count);
+  }
+
+  // Bounded objects, in leaf order once built.
+  std::vector<std::shared_ptr<Intersectable>> objects_{};
+  std::vector<std::shared_ptr<Intersectable>> unbounded_{};
+  // nodes_[0] is the root.
+  std::vector<Node> nodes_{};
+};
+
+} // graphics::raytracer
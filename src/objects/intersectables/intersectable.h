@@ -4,13 +4,19 @@
 
 #include <optional>
 #include <memory>
+#include <string>
+#include <vector>
 
+#include "../../utils/bounding_box.h"
+#include "../../utils/memory_report.h"
 #include "../../utils/ray.h"
 #include "../../math/vec.h"
 #include "../../materials/material.h"
 
 namespace graphics::raytracer {
 
+class Intersectable;
+
 struct ObjectIntersectionInfo {
   // Value for how far along the distance vector the intersection took place,
   // if any. This is commonly referred to as 't'.
@@ -21,6 +27,15 @@ struct ObjectIntersectionInfo {
   math::Vector3f normal;
   // The material of the object hit.
   std::shared_ptr<Material> material;
+  // Texture coordinates of the intersection point, used by textured materials.
+  math::Vector2f uv;
+  // World space length one unit of texture coordinates spans around the intersection point, which
+  // textured materials turn the footprint of the ray into texels with.
+  float uv_length;
+  // The primitive that was hit, which the shadow occluder cache tests again on its own. Null for
+  // meshes that hold their triangles themselves (QuantizedMesh, MappedMesh): testing the whole
+  // mesh again would cost a full traversal of it, and for a mapped mesh can fault pages in.
+  const Intersectable* object;
 };
 
 
@@ -30,6 +45,30 @@ public:
   virtual ~Intersectable() = default;
 
   virtual std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const = 0;
+
+  // Box that contains the whole object, or nullopt if the object is unbounded (eg. a plane).
+  // Acceleration structures only cull bounded objects, unbounded ones are tested by every ray.
+  virtual std::optional<BoundingBox> Bounds() const { return std::nullopt; }
+
+  // Short human readable description, used in diagnostics like the render cost report.
+  virtual std::string Describe() const { return "object"; }
+
+  // Adds the memory used by this object, and everything it owns, to |report|.
+  virtual void AccountMemory(MemoryReport& report) const {}
+
+  // Adds the primitives the object is made of to |primitives|, in the order Intersect tests them
+  // (which decides ties). Containers (lists, acceleration structures) add the primitives of their
+  // objects, everything else adds itself.
+  virtual void CollectPrimitives(std::vector<const Intersectable*>& primitives) const { primitives.push_back(this); }
 };
 
+// Adds |object|, owned through a shared_ptr from std::make_shared, to |report| unless another
+// owner already did.
+inline void AccountSharedObject(MemoryReport& report, const std::shared_ptr<Intersectable>& object) {
+  if (object && report.FirstVisit(object.get())) {
+    report.Add("control blocks", MemoryReport::kControlBlockBytes);
+    object->AccountMemory(report);
+  }
+}
+
 } // namespace graphics::raytracer
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <optional>
+#include <string>
 #include <vector>
 
 #include "../../objects/intersectables/intersectable.h"
@@ -30,6 +31,16 @@ public:
     intersectable_list_.push_back(intersectable);
   }
 
+  void AddObjects(std::vector<std::shared_ptr<Intersectable>>&& intersectables) {
+    if (intersectable_list_.empty()) {
+      intersectable_list_ = std::move(intersectables);
+      return;
+    }
+    intersectable_list_.insert(intersectable_list_.end(),
+                               std::make_move_iterator(intersectables.begin()),
+                               std::make_move_iterator(intersectables.end()));
+  }
+
   std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
     bool hit = false;
     float max_distance = std::numeric_limits<float>::max();
@@ -50,6 +61,36 @@ public:
     return hit ? std::make_optional(intersection_info) : std::nullopt;
   }
 
+  // Union of the bounds of the objects, unbounded if any of them is.
+  std::optional<BoundingBox> Bounds() const override {
+    BoundingBox box;
+    for (const auto& intersectable : intersectable_list_) {
+      const auto object_box = intersectable->Bounds();
+      if (!object_box) {
+        return std::nullopt;
+      }
+      box.Expand(*object_box);
+    }
+    return box;
+  }
+
+  std::string Describe() const override {
+    return "list of " + std::to_string(intersectable_list_.size()) + " objects";
+  }
+
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("object lists", sizeof(*this) + MemoryReport::VectorBytes(intersectable_list_));
+    for (const auto& object : intersectable_list_) {
+      AccountSharedObject(report, object);
+    }
+  }
+
+  void CollectPrimitives(std::vector<const Intersectable*>& primitives) const override {
+    for (const auto& object : intersectable_list_) {
+      object->CollectPrimitives(primitives);
+    }
+  }
+
 public:
   std::vector<std::shared_ptr<Intersectable>> intersectable_list_{};
 };
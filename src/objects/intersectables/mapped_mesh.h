@@ -0,0 +1,548 @@
+// Out-of-core triangle mesh backed by a memory mapped geometry store file, so a mesh can be
+// rendered on a machine that can't hold it in memory. The OS pages in only the parts of the
+// file that rays actually touch.
+//
+// Store layout, every section starts on a kStorePageSize boundary:
+//   [header] [hierarchy nodes] [triangle page 0] [triangle page 1] ...
+// Triangles are sorted along a Morton curve and packed kTrianglesPerPage to a page, so every page
+// holds spatially close triangles and a ray only touches a few of them. The hierarchy over the
+// pages is small and is read on every ray, so it is hinted to stay resident. Its nodes keep the
+// bounds of both children, pages included, so a page is only read by rays that hit its bounds.
+// The header records the size and modification time of the OBJ the store was built from, so a
+// store is rebuilt when its source changes.
+// Only positions are stored, so the mesh is flat shaded even if the OBJ has vertex normals.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "../../objects/intersectables/intersectable.h"
+#include "../../objects/intersectables/triangle.h"
+#include "../../materials/material.h"
+#include "../../math/vec.h"
+#include "../../math/morton.h"
+#include "../../math/precision.h"
+#include "../../utils/bounding_box.h"
+#include "../../utils/intersection_counters.h"
+#include "../../utils/mapped_file.h"
+#include "../../utils/obj_loader.h"
+#include "../../utils/ray.h"
+#include "../../utils/thread_pool.h"
+
+namespace graphics::raytracer {
+
+namespace geometry_store {
+
+constexpr uint64_t kMagic = 0x32454f4547525447ull; // "GTRGEOE2"
+constexpr size_t kStorePageSize = 4096;
+constexpr uint32_t kLeafFlag = 0x80000000u;
+constexpr uint32_t kNoChild = 0xffffffffu;
+
+// Identifies the version of the source OBJ a store was built from.
+struct SourceStamp {
+  uint64_t size;
+  int64_t mtime_ns;
+
+  bool operator==(const SourceStamp&) const = default;
+};
+
+// Stamp of the file at |path|, or nullopt if it doesn't exist.
+inline std::optional<SourceStamp> ReadSourceStamp(std::string_view path) {
+  struct stat info;
+  if (::stat(std::string(path).c_str(), &info) != 0) {
+    return std::nullopt;
+  }
+  return SourceStamp{.size = static_cast<uint64_t>(info.st_size),
+                     .mtime_ns = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec};
+}
+
+struct Header {
+  uint64_t magic;
+  SourceStamp source;
+  uint64_t triangle_count;
+  uint64_t page_count;
+  uint64_t node_count;
+  uint64_t nodes_offset;
+  uint64_t pages_offset;
+  BoundingBox bounds;
+};
+
+struct Node {
+  // Bounds of each child, empty for kNoChild.
+  BoundingBox child_box[2];
+  // Node index of each child, or a page index with kLeafFlag set, or kNoChild.
+  uint32_t child[2];
+};
+
+struct StoredTriangle {
+  math::Point3f v0;
+  math::Point3f v1;
+  math::Point3f v2;
+};
+
+struct PageHeader {
+  uint32_t triangle_count;
+  uint32_t padding[3];
+};
+
+constexpr size_t kTrianglesPerPage = (kStorePageSize - sizeof(PageHeader)) / sizeof(StoredTriangle);
+
+// Aligned (and therefore padded) to a whole page, so the pages of a mapped store index as an array.
+struct alignas(kStorePageSize) Page {
+  PageHeader header;
+  StoredTriangle triangles[kTrianglesPerPage];
+};
+
+static_assert(sizeof(Page) == kStorePageSize);
+
+inline uint64_t alignToPage(uint64_t offset) {
+  return (offset + kStorePageSize - 1) / kStorePageSize * kStorePageSize;
+}
+
+// Builds the hierarchy over pages [lo, hi) (which are in Morton order, so halving the range
+// halves them spatially) and returns the index of its root.
+inline uint32_t buildNode(std::vector<Node>& nodes, const std::vector<BoundingBox>& page_bounds,
+                          uint32_t lo, uint32_t hi) {
+  const uint32_t node_index = static_cast<uint32_t>(nodes.size());
+  nodes.push_back(Node{});
+  const uint32_t mid = hi - lo == 1 ? hi : lo + (hi - lo) / 2;
+  const uint32_t ranges[2][2] = {{lo, mid}, {mid, hi}};
+  for (int c = 0; c < 2; c++) {
+    const auto [child_lo, child_hi] = ranges[c];
+    uint32_t child = kNoChild;
+    if (child_hi - child_lo == 1) {
+      child = child_lo | kLeafFlag;
+    } else if (child_hi > child_lo) {
+      child = buildNode(nodes, page_bounds, child_lo, child_hi);
+    }
+    nodes[node_index].child[c] = child;
+    for (uint32_t i = child_lo; i < child_hi; i++) {
+      nodes[node_index].child_box[c].Expand(page_bounds[i]);
+    }
+  }
+  return node_index;
+}
+
+// Writes the triangles of sorted buckets into the store as pages, and keeps every page's bounds.
+class PageWriter {
+
+public:
+  explicit PageWriter(std::ofstream& file) : file_{file}, page_{std::make_unique<Page>()} {
+    std::memset(page_.get(), 0, sizeof(Page));
+  }
+
+  void Add(const StoredTriangle& triangle) {
+    page_->triangles[page_->header.triangle_count++] = triangle;
+    for (const math::Point3f& vertex : {triangle.v0, triangle.v1, triangle.v2}) {
+      box_.Expand(vertex);
+    }
+    if (page_->header.triangle_count == kTrianglesPerPage) {
+      flush();
+    }
+  }
+
+  // Writes the last, partially filled page.
+  void Finish() {
+    if (page_->header.triangle_count > 0) {
+      flush();
+    }
+  }
+
+  const std::vector<BoundingBox>& page_bounds() const { return page_bounds_; }
+
+private:
+  void flush() {
+    file_.write(reinterpret_cast<const char*>(page_.get()), sizeof(Page));
+    page_bounds_.push_back(box_);
+    std::memset(page_.get(), 0, sizeof(Page));
+    box_ = BoundingBox{};
+  }
+
+  std::ofstream& file_;
+  std::unique_ptr<Page> page_;
+  BoundingBox box_{};
+  std::vector<BoundingBox> page_bounds_{};
+};
+
+// A triangle and the Morton code of its centroid, as the builder sorts them.
+struct SortRecord {
+  uint64_t key;
+  StoredTriangle triangle;
+};
+
+// Buckets with at most this many records (192 MiB) are sorted in memory, larger ones are split
+// by the next kBucketBits bits of their keys first.
+constexpr uint64_t kMaxSortRecords = uint64_t{1} << 22;
+constexpr int kBucketBits = 8;
+// Morton codes have 21 bits per axis.
+constexpr int kKeyBits = 63;
+
+// Splits records into the 2^kBucketBits bucket files |path|.0, |path|.1, ... by the kBucketBits
+// key bits above bit |shift|, keeping their order.
+class BucketSplitter {
+
+public:
+  BucketSplitter(const std::string& path, int shift) : path_{path}, shift_{shift}, counts_(size_t{1} << kBucketBits, 0) {
+    for (size_t b = 0; b < counts_.size(); b++) {
+      files_.emplace_back(BucketPath(b), std::ios::binary | std::ios::trunc);
+    }
+  }
+
+  std::string BucketPath(size_t bucket) const { return path_ + "." + std::to_string(bucket); }
+
+  void Add(const SortRecord& record) {
+    const size_t bucket = (record.key >> shift_) & (counts_.size() - 1);
+    files_[bucket].write(reinterpret_cast<const char*>(&record), sizeof(SortRecord));
+    counts_[bucket]++;
+  }
+
+  // Closes the bucket files and returns the record count of each, or nullopt on I/O errors.
+  std::optional<std::vector<uint64_t>> Close() {
+    bool ok = true;
+    for (auto& file : files_) {
+      file.close();
+      ok &= !file.fail();
+    }
+    return ok ? std::optional{counts_} : std::nullopt;
+  }
+
+private:
+  std::string path_;
+  int shift_;
+  std::vector<uint64_t> counts_;
+  std::vector<std::ofstream> files_;
+};
+
+// Adds the |count| records of the bucket file at |path| to |pages| in key order (and file order
+// for equal keys), then removes the file. The keys in the bucket only differ below bit |shift|.
+inline bool emitBucket(const std::string& path, uint64_t count, int shift, PageWriter& pages) {
+  bool ok = true;
+  if (count <= kMaxSortRecords || shift == 0) {
+    std::ifstream file{path, std::ios::binary};
+    SortRecord record;
+    if (count <= kMaxSortRecords) {
+      std::vector<SortRecord> records(count);
+      file.read(reinterpret_cast<char*>(records.data()), count * sizeof(SortRecord));
+      std::stable_sort(records.begin(), records.end(), [](const SortRecord& a, const SortRecord& b) {
+        return a.key < b.key;
+      });
+      for (const SortRecord& sorted : records) {
+        pages.Add(sorted.triangle);
+      }
+    } else {
+      // Every key is the same, so file order is key order.
+      for (uint64_t i = 0; i < count && file.read(reinterpret_cast<char*>(&record), sizeof(SortRecord)); i++) {
+        pages.Add(record.triangle);
+      }
+    }
+    ok = static_cast<bool>(file);
+  } else {
+    const int child_shift = std::max(0, shift - kBucketBits);
+    BucketSplitter splitter(path, child_shift);
+    {
+      std::ifstream file{path, std::ios::binary};
+      SortRecord record;
+      for (uint64_t i = 0; i < count && file.read(reinterpret_cast<char*>(&record), sizeof(SortRecord)); i++) {
+        splitter.Add(record);
+      }
+      ok = static_cast<bool>(file);
+    }
+    std::remove(path.c_str());
+    const auto counts = splitter.Close();
+    ok &= counts.has_value();
+    for (size_t b = 0; b < (1u << kBucketBits); b++) {
+      if (ok) {
+        ok = emitBucket(splitter.BucketPath(b), (*counts)[b], child_shift, pages);
+      }
+      std::remove(splitter.BucketPath(b).c_str());
+    }
+  }
+  std::remove(path.c_str());
+  return ok;
+}
+
+} // namespace geometry_store
+
+// Builds a geometry store at |path| from the OBJ file at |obj_path|, whose stamp is |source|,
+// without holding the mesh in memory:
+//   1. The OBJ is streamed once to write its vertices to a temporary file.
+//   2. It is streamed again, and every face is resolved against the (memory mapped) vertex file,
+//      keyed by the Morton code of its centroid and appended to one of 2^kBucketBits temporary
+//      bucket files by the top bits of the key.
+//   3. The buckets are sorted one at a time (split further if they don't fit kMaxSortRecords)
+//      and written out as pages, so the pages come out in Morton order.
+// Only the hierarchy and the bounds of the pages stay in memory. Vertices and faces are indexed
+// with 64 bits. Temporary files go next to |path|, and the store is written next to it as well
+// and renamed over it, so mappings of an older store stay valid. Returns false on errors.
+inline bool BuildGeometryStore(std::string_view path, std::string_view obj_path,
+                               const geometry_store::SourceStamp& source, ThreadPool* pool = nullptr) {
+  using namespace geometry_store;
+  const std::string store_path{path};
+  const std::string vertices_path = store_path + ".vertices";
+  const std::string buckets_path = store_path + ".bucket";
+  const std::string temp_path = store_path + ".tmp";
+
+  // Pass 1: vertices.
+  BoundingBox vertex_bounds;
+  uint64_t num_vertices = 0;
+  {
+    std::ofstream vertices{vertices_path, std::ios::binary | std::ios::trunc};
+    const bool streamed = StreamObj(obj_path, pool, [&](const ObjChunk& chunk, uint64_t) {
+      vertices.write(reinterpret_cast<const char*>(chunk.vertices.data()), chunk.vertices.size() * sizeof(math::Point3f));
+      for (const math::Point3f& vertex : chunk.vertices) {
+        vertex_bounds.Expand(vertex);
+      }
+      num_vertices += chunk.vertices.size();
+    });
+    vertices.close();
+    if (!streamed || vertices.fail()) {
+      std::remove(vertices_path.c_str());
+      return false;
+    }
+  }
+
+  // Pass 2: faces into buckets. Keys are relative to the bounds of all vertices, which contain
+  // every centroid.
+  MappedFile vertex_file;
+  if (num_vertices > 0 && !vertex_file.open(vertices_path)) {
+    std::remove(vertices_path.c_str());
+    return false;
+  }
+  const auto* positions = reinterpret_cast<const math::Point3f*>(vertex_file.data());
+  const math::Vector3f extent = vertex_bounds.Extent();
+  uint64_t num_triangles = 0;
+  uint64_t num_invalid = 0;
+  BucketSplitter splitter(buckets_path, kKeyBits - kBucketBits);
+  const bool streamed = StreamObj(obj_path, pool, [&](const ObjChunk& chunk, uint64_t first_vertex) {
+    num_invalid += chunk.invalid_faces;
+    for (size_t f = 0; f < chunk.faces.size(); f++) {
+      math::Point3f corners[3];
+      bool valid = true;
+      for (int v = 0; v < 3; v++) {
+        int64_t index = chunk.faces[f][v];
+        if (chunk.relative_mask[f] & (1 << v)) {
+          index += static_cast<int64_t>(first_vertex);
+        }
+        valid &= index >= 0 && static_cast<uint64_t>(index) < num_vertices;
+        if (valid) {
+          corners[v] = positions[index];
+        }
+      }
+      if (!valid) {
+        num_invalid++;
+        continue;
+      }
+      const math::Point3f centroid = (corners[0] + corners[1] + corners[2]) * (1.f / 3.f);
+      uint64_t grid[3];
+      for (int i = 0; i < 3; i++) {
+        const float normalized = extent.data[i] > 0.f ? (centroid.data[i] - vertex_bounds.min.data[i]) / extent.data[i] : 0.f;
+        grid[i] = std::min<uint64_t>(0x1fffff, static_cast<uint64_t>(math::clamp(normalized, 0.f, 1.f) * 2097152.f));
+      }
+      splitter.Add(SortRecord{.key = math::morton_encode_3d_64(grid[0], grid[1], grid[2]),
+                              .triangle = StoredTriangle{corners[0], corners[1], corners[2]}});
+      num_triangles++;
+    }
+  });
+  vertex_file = MappedFile{};
+  std::remove(vertices_path.c_str());
+  const auto bucket_counts = splitter.Close();
+  auto removeBuckets = [&]() {
+    for (size_t b = 0; b < (1u << kBucketBits); b++) {
+      std::remove(splitter.BucketPath(b).c_str());
+    }
+  };
+  if (!streamed || !bucket_counts) {
+    removeBuckets();
+    return false;
+  }
+  if (num_invalid > 0) {
+    std::cerr << "Skipped " << num_invalid << " malformed or out of range faces.\n";
+  }
+
+  // Nodes and pages are addressed with 32 bits, kLeafFlag included.
+  const uint64_t page_count = (num_triangles + kTrianglesPerPage - 1) / kTrianglesPerPage;
+  if (page_count >= kLeafFlag) {
+    std::cerr << "Too many triangles (" << num_triangles << ") for a geometry store.\n";
+    removeBuckets();
+    return false;
+  }
+  // A binary hierarchy over n > 1 pages has n - 1 nodes, a single page still gets a root.
+  const uint64_t node_count = page_count == 0 ? 0 : std::max<uint64_t>(1, page_count - 1);
+
+  Header header{};
+  header.magic = kMagic;
+  header.source = source;
+  header.triangle_count = num_triangles;
+  header.page_count = page_count;
+  header.node_count = node_count;
+  header.nodes_offset = kStorePageSize;
+  header.pages_offset = alignToPage(header.nodes_offset + node_count * sizeof(Node));
+
+  std::ofstream file{temp_path, std::ios::binary | std::ios::trunc};
+  if (!file.is_open()) {
+    removeBuckets();
+    return false;
+  }
+  // Pass 3: pages, after room for the header and the hierarchy, which need the page bounds.
+  const std::vector<char> zeros(kStorePageSize, 0);
+  for (uint64_t offset = 0; offset < header.pages_offset; offset += kStorePageSize) {
+    file.write(zeros.data(), kStorePageSize);
+  }
+  PageWriter pages(file);
+  bool ok = true;
+  for (size_t b = 0; b < (1u << kBucketBits); b++) {
+    if (ok) {
+      ok = emitBucket(splitter.BucketPath(b), (*bucket_counts)[b], kKeyBits - kBucketBits, pages);
+    }
+    std::remove(splitter.BucketPath(b).c_str());
+  }
+  pages.Finish();
+
+  std::vector<Node> nodes;
+  if (page_count > 0) {
+    buildNode(nodes, pages.page_bounds(), 0, static_cast<uint32_t>(page_count));
+  }
+  for (const auto& box : pages.page_bounds()) {
+    header.bounds.Expand(box);
+  }
+  ok &= pages.page_bounds().size() == page_count && nodes.size() == node_count;
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.seekp(static_cast<std::streamoff>(header.nodes_offset));
+  file.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(Node));
+  file.close();
+  if (!ok || file.fail() || std::rename(temp_path.c_str(), store_path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+class MappedMesh : public Intersectable {
+
+public:
+  // Use Open() to create one, since mapping the store can fail. Also returns nullptr if the store
+  // wasn't built from the OBJ with stamp |source|.
+  static std::shared_ptr<MappedMesh> Open(std::string_view path, const geometry_store::SourceStamp& source,
+                                           std::shared_ptr<Material> material) {
+    using namespace geometry_store;
+    MappedFile file;
+    // Rays touch the file in no particular order, so read ahead would only waste memory.
+    if (!file.open(path, MADV_RANDOM) || file.size() < sizeof(Header)) {
+      return nullptr;
+    }
+    const Header* header = reinterpret_cast<const Header*>(file.data());
+    if (header->magic != kMagic || header->source != source ||
+        header->nodes_offset + header->node_count * sizeof(Node) > file.size() ||
+        header->pages_offset + header->page_count * kStorePageSize > file.size()) {
+      return nullptr;
+    }
+    // The hierarchy is visited by every ray, ask for it up front.
+    const uint64_t nodes_bytes = alignToPage(header->node_count * sizeof(Node));
+    ::madvise(const_cast<char*>(file.data()) + header->nodes_offset, nodes_bytes, MADV_WILLNEED);
+    return std::shared_ptr<MappedMesh>(new MappedMesh(std::move(file), material));
+  }
+
+  std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
+    using namespace geometry_store;
+    const math::Vector3f inv_direction = inverse_direction(ray);
+    if (header_->node_count == 0 || !header_->bounds.Intersect(ray, inv_direction)) {
+      return std::nullopt;
+    }
+    uint32_t stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    float best_t = std::numeric_limits<float>::max();
+    std::optional<Triangle::GeometryHit> best_hit;
+    const StoredTriangle* best_triangle = nullptr;
+
+    while (stack_size > 0) {
+      const Node& node = nodes_[stack[--stack_size]];
+      for (int c = 0; c < 2; c++) {
+        const uint32_t child = node.child[c];
+        // Tested before the child is read, so the pages of leaves the ray misses are never touched.
+        if (child == kNoChild || !node.child_box[c].Intersect(ray, inv_direction, best_t)) {
+          continue;
+        }
+        if (!(child & kLeafFlag)) {
+          stack[stack_size++] = child;
+          continue;
+        }
+        const Page& page = pages_[child & ~kLeafFlag];
+        countIntersectionTests(this, page.header.triangle_count);
+        for (uint32_t i = 0; i < page.header.triangle_count; i++) {
+          const StoredTriangle& tri = page.triangles[i];
+          const math::Vector3f plane_normal = math::cross(tri.v1 - tri.v0, tri.v2 - tri.v0);
+          const auto hit = Triangle::IntersectGeometry(ray, tri.v0, tri.v1, tri.v2, plane_normal);
+          if (hit && hit->t <= best_t) {
+            best_t = hit->t;
+            best_hit = hit;
+            best_triangle = &tri;
+          }
+        }
+      }
+    }
+
+    if (!best_hit) {
+      return std::nullopt;
+    }
+    const math::Vector3f plane_normal = math::cross(best_triangle->v1 - best_triangle->v0,
+                                                    best_triangle->v2 - best_triangle->v0);
+    return ObjectIntersectionInfo{.t = best_hit->t,
+                                  .point = ray.at(best_hit->t),
+                                  .normal = Triangle::NormalSign(plane_normal, best_triangle->v0) * math::unit_vector(plane_normal),
+                                  .material = material_,
+                                  // The store has no texture coordinates, use the barycentrics.
+                                  .uv = {best_hit->u, best_hit->v},
+                                  .uv_length = std::sqrt(magnitude(plane_normal)),
+                                  // Not a primitive to retest, see ObjectIntersectionInfo::object.
+                                  .object = nullptr};
+  }
+
+  std::optional<BoundingBox> Bounds() const override { return header_->bounds; }
+
+  std::string Describe() const override {
+    return "mapped mesh of " + std::to_string(triangle_count()) + " triangles";
+  }
+
+  // The store itself is file backed, its pages can be dropped under memory pressure and aren't
+  // counted.
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("MappedMesh", sizeof(*this));
+    AccountMaterial(report, material_);
+  }
+
+  size_t triangle_count() const { return header_->triangle_count; }
+
+  // Size of the mapping. Only the pages that have been touched are actually resident.
+  size_t mapped_bytes() const { return file_.size(); }
+
+private:
+  MappedMesh(MappedFile file, std::shared_ptr<Material> material) : file_{std::move(file)}, material_{material} {
+    header_ = reinterpret_cast<const geometry_store::Header*>(file_.data());
+    nodes_ = reinterpret_cast<const geometry_store::Node*>(file_.data() + header_->nodes_offset);
+    pages_ = reinterpret_cast<const geometry_store::Page*>(file_.data() + header_->pages_offset);
+  }
+
+  MappedFile file_;
+  const geometry_store::Header* header_ = nullptr;
+  const geometry_store::Node* nodes_ = nullptr;
+  const geometry_store::Page* pages_ = nullptr;
+  std::shared_ptr<Material> material_{};
+};
+
+} // graphics::raytracer
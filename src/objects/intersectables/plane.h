@@ -4,16 +4,20 @@
 
 #include <memory>
 #include <optional>
+#include <sstream>
+#include <string>
 
 #include "../../objects/intersectables/intersectable.h"
 #include "../../math/vec.h"
+#include "../../utils/intersection_counters.h"
 #include "../../utils/ray.h"
 #include "../../materials/material.h"
 #include "../../math/fast_math.h"
+#include "../../math/precision.h"
 
 namespace graphics::raytracer {
 
-class Plane : public Intersectable {
+class Plane final : public Intersectable {
 
 public:
   // Define a plane with a point and a normal
@@ -36,20 +40,49 @@ public:
   }
 
   std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
-    const float denominator = ray.direction() * normal_;
+    countIntersectionTests(this);
+    const float denominator = math::dot(ray.direction(), normal_);
     // Ray parallel to the plane, so no intersection.
     if (denominator > -1e-6 && denominator < 1e-6) {
       return std::nullopt;
     }
-    const float t = ((point_ - ray.origin()) * normal_) / denominator;
+    const float t = math::dot(point_ - ray.origin(), normal_) / denominator;
     // Distance negative, no intersection.
     if (t < 0) {
       return std::nullopt;
     }
+    const math::Point3f point = ray.at(t);
     return ObjectIntersectionInfo{.t = t,
-                                  .point = ray.at(t),
+                                  .point = point,
                                   .normal = normal_, // this is already normalized in the constructor
-                                  .material = material_};
+                                  .material = material_,
+                                  .uv = planarUv(point),
+                                  // planarUv measures world space distances along the plane.
+                                  .uv_length = 1.f,
+                                  .object = this};
+  }
+
+  // Planes are infinite, so they have no bounds (the default).
+
+  std::string Describe() const override {
+    std::ostringstream description;
+    description << "plane through " << point_ << " with normal " << normal_;
+    return description.str();
+  }
+
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("Plane", sizeof(*this));
+    AccountMaterial(report, material_);
+  }
+
+private:
+  // Coordinates of |point| along two axes in the plane, in world units from point_.
+  math::Vector2f planarUv(const math::Point3f& point) const {
+    const math::Vector3f axis = (normal_.y > 0.999f || normal_.y < -0.999f) ? math::UnitX : math::UnitY;
+    const math::Vector3f tangent = normalize(math::cross(axis, normal_));
+    const math::Vector3f bitangent = math::cross(normal_, tangent);
+    const math::Vector3f offset = point - point_;
+    return {offset * tangent, offset * bitangent};
   }
 
 public:
@@ -0,0 +1,437 @@
+// Compressed triangle mesh for scenes that don't fit in memory as individual Triangle objects.
+//
+// Triangles are sorted along a Morton curve and split into clusters of up to kClusterTriangles
+// spatially close triangles. Positions are snapped to a grid over the whole mesh, with a step per
+// axis coarse enough that every cluster spans at most 65535 steps. Each cluster stores the grid
+// cell of its corner, its vertices as 16 bit offsets from that cell, and its triangles as 8 bit
+// indices into the cluster's vertices. Vertex normals, if any, are octahedral encoded into 32
+// bits. The clusters are organized in a binary hierarchy whose nodes store the bounds of their
+// children quantized to 8 bits relative to the node's own bounds, so a node is 20 bytes instead
+// of the 56 needed with float bounds.
+//
+// A dequantized coordinate is within kMaxPositionError grid steps of the original (plus float
+// rounding), and a decoded normal within math::kOctahedralMaxAngleError radians. Since the grid
+// is shared, a vertex used by several clusters dequantizes to the same position in each of them,
+// so there are no cracks along cluster borders. The step is set by the largest cluster, so a few
+// unusually large triangles coarsen it for the whole mesh. tools/compression_benchmark.cpp checks
+// the bounds and the cluster borders.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../objects/intersectables/intersectable.h"
+#include "../../objects/intersectables/triangle.h"
+#include "../../materials/material.h"
+#include "../../math/vec.h"
+#include "../../math/morton.h"
+#include "../../math/precision.h"
+#include "../../math/octahedral.h"
+#include "../../utils/bounding_box.h"
+#include "../../utils/intersection_counters.h"
+#include "../../utils/ray.h"
+
+namespace graphics::raytracer {
+
+class QuantizedMesh : public Intersectable {
+
+public:
+  // At most 64 triangles per cluster keeps the local vertex count (<= 192) addressable with 8 bits.
+  static constexpr size_t kClusterTriangles = 64;
+  static constexpr uint32_t kLeafFlag = 0x80000000u;
+  static constexpr uint32_t kNoChild = 0xffffffffu;
+  // Largest error of a dequantized coordinate, in grid steps along its axis (see step()).
+  static constexpr float kMaxPositionError = 0.5f;
+  // Every cluster spans at most this many grid steps, which leaves room for rounding the cluster's
+  // corner and far side to the grid in different directions.
+  static constexpr float kMaxClusterSteps = 65533.f;
+  // Grid coordinates stay below 2^24, so converting them to float is exact and a grid coordinate
+  // always dequantizes to the same position.
+  static constexpr uint32_t kMaxGridCoordinate = (1u << 24) - 1;
+
+  // |face_normals| is either empty (flat shading) or has, for every face, the index into |normals|
+  // of the normal of each corner.
+  QuantizedMesh(const std::vector<math::Point3f>& positions,
+                const std::vector<std::array<uint32_t, 3>>& faces,
+                const std::vector<math::Vector3f>& normals,
+                const std::vector<std::array<uint32_t, 3>>& face_normals,
+                std::shared_ptr<Material> material) : material_{material} {
+    has_normals_ = !face_normals.empty();
+    std::vector<BoundingBox> cluster_bounds;
+    buildClusters(positions, faces, normals, face_normals, cluster_bounds);
+    if (!clusters_.empty()) {
+      root_ = buildNode(cluster_bounds, 0, static_cast<uint32_t>(clusters_.size()), bounds_);
+    }
+  }
+
+  std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
+    if (clusters_.empty()) {
+      return std::nullopt;
+    }
+    const math::Vector3f inv_direction = inverse_direction(ray);
+    if (!bounds_.Intersect(ray, inv_direction)) {
+      return std::nullopt;
+    }
+
+    struct StackEntry {
+      uint32_t node;
+      BoundingBox box;
+    };
+    StackEntry stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{root_, bounds_};
+
+    float best_t = std::numeric_limits<float>::max();
+    std::optional<Triangle::GeometryHit> best_hit;
+    uint32_t best_cluster = 0;
+    uint32_t best_triangle = 0;
+    math::Point3f best_v0;
+    math::Vector3f best_plane_normal;
+
+    while (stack_size > 0) {
+      const StackEntry entry = stack[--stack_size];
+      const Node& node = nodes_[entry.node];
+      for (int c = 0; c < 2; c++) {
+        if (node.child[c] == kNoChild) {
+          continue;
+        }
+        const BoundingBox child_box = dequantizeChild(node, c, entry.box);
+        if (!child_box.Intersect(ray, inv_direction, best_t)) {
+          continue;
+        }
+        if (node.child[c] & kLeafFlag) {
+          const uint32_t cluster_index = node.child[c] & ~kLeafFlag;
+          const Cluster& cluster = clusters_[cluster_index];
+          countIntersectionTests(this, cluster.triangle_count);
+          for (uint32_t i = 0; i < cluster.triangle_count; i++) {
+            const auto& tri = triangles_[cluster.triangle_offset + i];
+            const math::Point3f v0 = dequantizePosition(cluster, tri[0]);
+            const math::Point3f v1 = dequantizePosition(cluster, tri[1]);
+            const math::Point3f v2 = dequantizePosition(cluster, tri[2]);
+            const math::Vector3f plane_normal = math::cross(v1 - v0, v2 - v0);
+            const auto hit = Triangle::IntersectGeometry(ray, v0, v1, v2, plane_normal);
+            if (hit && hit->t <= best_t) {
+              best_t = hit->t;
+              best_hit = hit;
+              best_cluster = cluster_index;
+              best_triangle = i;
+              best_v0 = v0;
+              best_plane_normal = plane_normal;
+            }
+          }
+        } else {
+          stack[stack_size++] = StackEntry{node.child[c], child_box};
+        }
+      }
+    }
+
+    if (!best_hit) {
+      return std::nullopt;
+    }
+    return ObjectIntersectionInfo{.t = best_hit->t,
+                                  .point = ray.at(best_hit->t),
+                                  .normal = shadingNormal(best_cluster, best_triangle, *best_hit, best_v0, best_plane_normal),
+                                  .material = material_,
+                                  // Meshes don't store texture coordinates, use the barycentrics.
+                                  .uv = {best_hit->u, best_hit->v},
+                                  // Barycentrics span half a unit square over the triangle.
+                                  .uv_length = std::sqrt(magnitude(best_plane_normal)),
+                                  // Not a primitive to retest, see ObjectIntersectionInfo::object.
+                                  .object = nullptr};
+  }
+
+  std::optional<BoundingBox> Bounds() const override { return bounds_; }
+
+  std::string Describe() const override {
+    return "compressed mesh of " + std::to_string(triangle_count()) + " triangles";
+  }
+
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("QuantizedMesh", MemoryUsage());
+    AccountMaterial(report, material_);
+  }
+
+  const BoundingBox& bounds() const { return bounds_; }
+
+  // Calls func(position, normal) for every stored vertex with its dequantized position and its
+  // decoded normal (the zero vector without normals). Vertices shared by several clusters are
+  // visited once per cluster.
+  template <typename F>
+  void ForEachVertex(F&& func) const {
+    for (size_t c = 0; c < clusters_.size(); c++) {
+      const Cluster& cluster = clusters_[c];
+      const size_t end = c + 1 < clusters_.size() ? clusters_[c + 1].vertex_offset : positions_.size();
+      for (size_t v = cluster.vertex_offset; v < end; v++) {
+        const auto local_index = static_cast<uint8_t>(v - cluster.vertex_offset);
+        func(dequantizePosition(cluster, local_index),
+             has_normals_ ? math::octahedral_decode(normals_[v]) : math::ZeroVector);
+      }
+    }
+  }
+
+  size_t triangle_count() const { return triangles_.size(); }
+
+  // Size of one grid step along each axis.
+  const math::Vector3f& step() const { return step_; }
+
+  // Bytes used by this mesh, including the object itself.
+  size_t MemoryUsage() const {
+    return sizeof(*this)
+         + clusters_.capacity() * sizeof(Cluster)
+         + positions_.capacity() * sizeof(QuantizedPosition)
+         + normals_.capacity() * sizeof(uint32_t)
+         + triangles_.capacity() * sizeof(LocalTriangle)
+         + nodes_.capacity() * sizeof(Node);
+  }
+
+private:
+  using QuantizedPosition = std::array<uint16_t, 3>;
+  using LocalTriangle = std::array<uint8_t, 3>;
+
+  struct Cluster {
+    // Grid cell that the cluster's vertex offsets are relative to.
+    std::array<uint32_t, 3> origin;
+    uint32_t vertex_offset;
+    uint32_t triangle_offset;
+    uint32_t triangle_count;
+  };
+
+  struct Node {
+    // Bounds of both children, quantized to 8 bits relative to this node's (dequantized) bounds.
+    uint8_t child_min[2][3];
+    uint8_t child_max[2][3];
+    // Node index of each child, or a cluster index with kLeafFlag set, or kNoChild.
+    uint32_t child[2];
+  };
+
+  void buildClusters(const std::vector<math::Point3f>& positions,
+                     const std::vector<std::array<uint32_t, 3>>& faces,
+                     const std::vector<math::Vector3f>& normals,
+                     const std::vector<std::array<uint32_t, 3>>& face_normals,
+                     std::vector<BoundingBox>& cluster_bounds) {
+    if (faces.empty()) {
+      return;
+    }
+
+    // Sort the triangles along a Morton curve over their centroids so that consecutive triangles
+    // (and therefore clusters) are spatially close.
+    BoundingBox centroid_bounds;
+    std::vector<math::Point3f> centroids(faces.size());
+    for (size_t f = 0; f < faces.size(); f++) {
+      centroids[f] = (positions[faces[f][0]] + positions[faces[f][1]] + positions[faces[f][2]]) * (1.f / 3.f);
+      centroid_bounds.Expand(centroids[f]);
+    }
+    const math::Vector3f centroid_extent = centroid_bounds.Extent();
+    std::vector<std::pair<uint32_t, uint32_t>> order(faces.size());
+    for (size_t f = 0; f < faces.size(); f++) {
+      uint32_t grid[3];
+      for (int i = 0; i < 3; i++) {
+        const float extent = centroid_extent.data[i];
+        const float normalized = extent > 0.f ? (centroids[f].data[i] - centroid_bounds.min.data[i]) / extent : 0.f;
+        grid[i] = std::min(1023u, static_cast<uint32_t>(normalized * 1024.f));
+      }
+      order[f] = {math::morton_encode_3d(grid[0], grid[1], grid[2]), static_cast<uint32_t>(f)};
+    }
+    std::sort(order.begin(), order.end());
+
+    // The grid step is set by the largest cluster along each axis, but kept fine enough for the
+    // grid coordinates of the whole mesh to stay below kMaxGridCoordinate.
+    BoundingBox mesh_bounds;
+    math::Vector3f max_cluster_extent = math::ZeroVector;
+    for (size_t start = 0; start < order.size(); start += kClusterTriangles) {
+      BoundingBox box;
+      for (size_t i = start; i < std::min(order.size(), start + kClusterTriangles); i++) {
+        for (uint32_t v : faces[order[i].second]) {
+          box.Expand(positions[v]);
+        }
+      }
+      mesh_bounds.Expand(box);
+      for (int i = 0; i < 3; i++) {
+        max_cluster_extent.data[i] = std::max(max_cluster_extent.data[i], box.Extent().data[i]);
+      }
+    }
+    origin_ = mesh_bounds.min;
+    for (int i = 0; i < 3; i++) {
+      step_.data[i] = std::max(max_cluster_extent.data[i] / kMaxClusterSteps,
+                               mesh_bounds.Extent().data[i] / static_cast<float>(kMaxGridCoordinate));
+    }
+
+    // Local vertices are unique (position, normal) pairs, so the corners of a position can have
+    // different normals, eg. along hard edges.
+    auto vertexKey = [&](size_t face, int corner) {
+      const uint64_t normal = has_normals_ ? face_normals[face][corner] : 0;
+      return static_cast<uint64_t>(faces[face][corner]) << 32 | normal;
+    };
+    std::vector<uint64_t> cluster_vertices;
+    std::vector<std::array<uint32_t, 3>> grid_positions;
+    for (size_t start = 0; start < order.size(); start += kClusterTriangles) {
+      const size_t end = std::min(order.size(), start + kClusterTriangles);
+
+      // Unique vertices of this cluster, sorted so local indices are a binary search away.
+      cluster_vertices.clear();
+      for (size_t i = start; i < end; i++) {
+        for (int k = 0; k < 3; k++) {
+          cluster_vertices.push_back(vertexKey(order[i].second, k));
+        }
+      }
+      std::sort(cluster_vertices.begin(), cluster_vertices.end());
+      cluster_vertices.erase(std::unique(cluster_vertices.begin(), cluster_vertices.end()), cluster_vertices.end());
+
+      Cluster cluster{.origin = {kMaxGridCoordinate, kMaxGridCoordinate, kMaxGridCoordinate},
+                      .vertex_offset = static_cast<uint32_t>(positions_.size()),
+                      .triangle_offset = static_cast<uint32_t>(triangles_.size()),
+                      .triangle_count = static_cast<uint32_t>(end - start)};
+      grid_positions.clear();
+      for (uint64_t key : cluster_vertices) {
+        grid_positions.push_back(gridPosition(positions[key >> 32]));
+        for (int i = 0; i < 3; i++) {
+          cluster.origin[i] = std::min(cluster.origin[i], grid_positions.back()[i]);
+        }
+      }
+      for (size_t v = 0; v < cluster_vertices.size(); v++) {
+        QuantizedPosition quantized;
+        for (int i = 0; i < 3; i++) {
+          quantized[i] = static_cast<uint16_t>(std::min(grid_positions[v][i] - cluster.origin[i], 65535u));
+        }
+        positions_.push_back(quantized);
+        if (has_normals_) {
+          normals_.push_back(math::octahedral_encode(normals[cluster_vertices[v] & 0xffffffffu]));
+        }
+      }
+      for (size_t i = start; i < end; i++) {
+        LocalTriangle tri;
+        for (int k = 0; k < 3; k++) {
+          tri[k] = static_cast<uint8_t>(
+            std::lower_bound(cluster_vertices.begin(), cluster_vertices.end(), vertexKey(order[i].second, k))
+            - cluster_vertices.begin());
+        }
+        triangles_.push_back(tri);
+      }
+      clusters_.push_back(cluster);
+
+      // The hierarchy bounds what is intersected, ie. the dequantized positions.
+      BoundingBox box;
+      for (size_t v = 0; v < cluster_vertices.size(); v++) {
+        box.Expand(dequantizePosition(cluster, static_cast<uint8_t>(v)));
+      }
+      cluster_bounds.push_back(box);
+      bounds_.Expand(box);
+    }
+  }
+
+  // Nearest grid cell to |position|. Computed in double, since float can't tell apart the cells
+  // near kMaxGridCoordinate.
+  std::array<uint32_t, 3> gridPosition(const math::Point3f& position) const {
+    std::array<uint32_t, 3> cell;
+    for (int i = 0; i < 3; i++) {
+      const double steps = step_.data[i] > 0.f
+        ? (static_cast<double>(position.data[i]) - origin_.data[i]) / step_.data[i]
+        : 0.0;
+      cell[i] = static_cast<uint32_t>(std::lround(std::clamp(steps, 0.0, static_cast<double>(kMaxGridCoordinate))));
+    }
+    return cell;
+  }
+
+  // Builds the hierarchy over clusters [lo, hi), whose bounds are contained in |node_box|.
+  // Clusters are already in Morton order, so splitting the range in half splits them spatially.
+  uint32_t buildNode(const std::vector<BoundingBox>& cluster_bounds, uint32_t lo, uint32_t hi,
+                     const BoundingBox& node_box) {
+    const uint32_t node_index = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(Node{});
+
+    const uint32_t mid = hi - lo == 1 ? hi : lo + (hi - lo) / 2;
+    const uint32_t ranges[2][2] = {{lo, mid}, {mid, hi}};
+    for (int c = 0; c < 2; c++) {
+      const auto [child_lo, child_hi] = ranges[c];
+      if (child_lo == child_hi) {
+        nodes_[node_index].child[c] = kNoChild;
+        continue;
+      }
+      BoundingBox child_box;
+      for (uint32_t i = child_lo; i < child_hi; i++) {
+        child_box.Expand(cluster_bounds[i]);
+      }
+      quantizeChild(nodes_[node_index], c, child_box, node_box);
+      const BoundingBox quantized_box = dequantizeChild(nodes_[node_index], c, node_box);
+
+      const uint32_t child = child_hi - child_lo == 1
+        ? (child_lo | kLeafFlag)
+        : buildNode(cluster_bounds, child_lo, child_hi, quantized_box);
+      nodes_[node_index].child[c] = child;
+    }
+    return node_index;
+  }
+
+  // Rounds the child's bounds outwards (with some slack for the float error of dequantizing), so
+  // the dequantized box always contains the child.
+  static void quantizeChild(Node& node, int c, const BoundingBox& child_box, const BoundingBox& parent_box) {
+    const math::Vector3f extent = parent_box.Extent();
+    for (int i = 0; i < 3; i++) {
+      if (extent.data[i] <= 0.f) {
+        node.child_min[c][i] = 0;
+        node.child_max[c][i] = 255;
+        continue;
+      }
+      const float lo = (child_box.min.data[i] - parent_box.min.data[i]) / extent.data[i] * 255.f;
+      const float hi = (child_box.max.data[i] - parent_box.min.data[i]) / extent.data[i] * 255.f;
+      node.child_min[c][i] = static_cast<uint8_t>(math::clamp(std::floor(lo - 0.5f), 0.f, 255.f));
+      node.child_max[c][i] = static_cast<uint8_t>(math::clamp(std::ceil(hi + 0.5f), 0.f, 255.f));
+    }
+  }
+
+  static BoundingBox dequantizeChild(const Node& node, int c, const BoundingBox& parent_box) {
+    const math::Vector3f scale = parent_box.Extent() * (1.f / 255.f);
+    BoundingBox box;
+    for (int i = 0; i < 3; i++) {
+      box.min.data[i] = parent_box.min.data[i] + node.child_min[c][i] * scale.data[i];
+      box.max.data[i] = node.child_max[c][i] == 255
+        ? parent_box.max.data[i]
+        : parent_box.min.data[i] + node.child_max[c][i] * scale.data[i];
+    }
+    return box;
+  }
+
+  math::Point3f dequantizePosition(const Cluster& cluster, uint8_t local_index) const {
+    const QuantizedPosition& quantized = positions_[cluster.vertex_offset + local_index];
+    return math::Point3f{origin_.x + static_cast<float>(cluster.origin[0] + quantized[0]) * step_.x,
+                         origin_.y + static_cast<float>(cluster.origin[1] + quantized[1]) * step_.y,
+                         origin_.z + static_cast<float>(cluster.origin[2] + quantized[2]) * step_.z};
+  }
+
+  // Same shading normal as Triangle::Intersect computes, but from the compressed data. |v0| and
+  // |plane_normal| are the dequantized first vertex and (v1 - v0) x (v2 - v0) of the triangle.
+  math::Vector3f shadingNormal(uint32_t cluster_index, uint32_t triangle, const Triangle::GeometryHit& hit,
+                               const math::Point3f& v0, const math::Vector3f& plane_normal) const {
+    math::Vector3f normal = plane_normal;
+    if (has_normals_) {
+      const Cluster& cluster = clusters_[cluster_index];
+      const auto& tri = triangles_[cluster.triangle_offset + triangle];
+      const uint32_t base = cluster.vertex_offset;
+      normal = hit.u * math::octahedral_decode(normals_[base + tri[0]])
+             + hit.v * math::octahedral_decode(normals_[base + tri[1]])
+             + (1 - hit.u - hit.v) * math::octahedral_decode(normals_[base + tri[2]]);
+    }
+    return Triangle::NormalSign(plane_normal, v0) * math::unit_vector(normal);
+  }
+
+  std::vector<Cluster> clusters_{};
+  std::vector<QuantizedPosition> positions_{};
+  std::vector<uint32_t> normals_{};
+  std::vector<LocalTriangle> triangles_{};
+  std::vector<Node> nodes_{};
+  uint32_t root_{0};
+  BoundingBox bounds_{};
+  // Position of grid cell (0, 0, 0), and the size of a cell.
+  math::Point3f origin_{};
+  math::Vector3f step_{};
+  bool has_normals_{false};
+  std::shared_ptr<Material> material_{};
+};
+
+} // graphics::raytracer
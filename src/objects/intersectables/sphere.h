@@ -1,28 +1,51 @@
 // Defines a basic sphere object to render in the scene.
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <optional>
+#include <sstream>
+#include <string>
 
 #include "../../objects/intersectables/intersectable.h"
 #include "../../math/vec.h"
+#include "../../utils/intersection_counters.h"
 #include "../../utils/ray.h"
 #include "../../materials/material.h"
 #include "../../math/fast_math.h"
+#include "../../math/precision.h"
 
 namespace graphics::raytracer {
 
-class Sphere : public Intersectable {
+class Sphere final : public Intersectable {
 
 public:
   Sphere(math::Point3f center, float radius, std::shared_ptr<Material> material) :
     center_{center}, radius_{radius}, material_{material} {}
 
   std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
+    countIntersectionTests(this);
+    const auto t = IntersectDistance(ray);
+    if (!t) {
+      return std::nullopt;
+    }
+    const math::Vector3f normal = math::unit_vector(ray.at(*t) - center_);
+    return ObjectIntersectionInfo{.t = *t,
+                                  .point = ray.at(*t),
+                                  .normal = normal,
+                                  .material = material_,
+                                  .uv = sphericalUv(normal),
+                                  .uv_length = sphericalUvLength(normal),
+                                  .object = this};
+  }
+
+  // Distance t of the hit Intersect would return, without computing the rest of it.
+  std::optional<float> IntersectDistance(const Ray& ray) const {
     const auto rad_sq = radius_ * radius_;
     const bool inside = magnitude_sq(center_ - ray.origin()) < rad_sq;
 
-    const float tc = ((center_ - ray.origin()) * ray.direction()) / magnitude(ray.direction());
+    const float tc = math::dot(center_ - ray.origin(), ray.direction()) / magnitude(ray.direction());
 
     // This means we had no intersection with the sphere.
     if (!inside && tc < 0) {
@@ -38,12 +61,39 @@ public:
     const float t_offset = math::sqrt(rad_sq - dd) / magnitude(ray.direction());
   
     // Make sure the normal is a point thats outside of the sphere
-    float t = tc + (inside ? t_offset : -t_offset);
+    return tc + (inside ? t_offset : -t_offset);
+  }
+
+  std::optional<BoundingBox> Bounds() const override {
+    const math::Vector3f radius{radius_, radius_, radius_};
+    return BoundingBox{.min = center_ - radius, .max = center_ + radius};
+  }
+
+  std::string Describe() const override {
+    std::ostringstream description;
+    description << "sphere at " << center_ << " with radius " << radius_;
+    return description.str();
+  }
+
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("Sphere", sizeof(*this));
+    AccountMaterial(report, material_);
+  }
+
+private:
+  // Longitude/latitude mapping of the unit |normal|, with v = 1 at the top (+y) pole.
+  static math::Vector2f sphericalUv(const math::Vector3f& normal) {
+    constexpr float kPi = 3.14159265358979f;
+    return {0.5f + std::atan2(normal.z, normal.x) / (2.f * kPi),
+            0.5f + std::asin(std::clamp(normal.y, -1.f, 1.f)) / kPi};
+  }
 
-    return ObjectIntersectionInfo{.t = t,
-                                  .point = ray.at(t),
-                                  .normal = normalize(ray.at(t) - center_),
-                                  .material = material_};
+  // sphericalUv's u runs once around the sphere (2 pi r cos(latitude) at the point) and v from pole
+  // to pole (pi r). The shorter of the two, where the texels are densest, is the one that aliases.
+  float sphericalUvLength(const math::Vector3f& normal) const {
+    constexpr float kPi = 3.14159265358979f;
+    const float cos_latitude = std::sqrt(std::max(0.f, 1.f - normal.y * normal.y));
+    return kPi * radius_ * std::min(1.f, 2.f * cos_latitude);
   }
 
 public:
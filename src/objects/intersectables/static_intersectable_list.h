@@ -0,0 +1,150 @@
+// Statically dispatched version of IntersectableList. The built-in primitives are stored by value
+// in one contiguous array per type, and each array is intersected in its own loop. Since the
+// primitive classes are final, the calls in those loops are resolved at compile time, so the
+// compiler can inline the intersection kernels instead of making a virtual call per object.
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../../objects/intersectables/intersectable.h"
+#include "../../objects/intersectables/intersectable_list.h"
+#include "../../objects/intersectables/plane.h"
+#include "../../objects/intersectables/sphere.h"
+#include "../../objects/intersectables/triangle.h"
+#include "../../utils/ray.h"
+
+namespace graphics::raytracer {
+
+class StaticIntersectableList final : public Intersectable {
+
+public:
+  StaticIntersectableList() = default;
+
+  // Takes already built per type arrays.
+  StaticIntersectableList(std::vector<Sphere> spheres, std::vector<Plane> planes, std::vector<Triangle> triangles) :
+    spheres_{std::move(spheres)}, planes_{std::move(planes)}, triangles_{std::move(triangles)} {}
+
+  // Copies the objects of |list| into the per type arrays. Objects of any other type (meshes,
+  // nested lists, ...) are kept behind their pointer and still use virtual dispatch.
+  explicit StaticIntersectableList(const IntersectableList& list) {
+    for (const auto& object : list.intersectable_list_) {
+      if (const auto* sphere = dynamic_cast<const Sphere*>(object.get())) {
+        spheres_.push_back(*sphere);
+      } else if (const auto* plane = dynamic_cast<const Plane*>(object.get())) {
+        planes_.push_back(*plane);
+      } else if (const auto* triangle = dynamic_cast<const Triangle*>(object.get())) {
+        triangles_.push_back(*triangle);
+      } else {
+        others_.push_back(object);
+      }
+    }
+  }
+
+  // Same result as IntersectableList::Intersect, except that if several objects are hit at
+  // exactly the same distance, which of them is reported depends on the type order.
+  std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
+    std::optional<ObjectIntersectionInfo> closest;
+    float max_distance = std::numeric_limits<float>::max();
+    intersectAll(spheres_, ray, closest, max_distance);
+    intersectAll(planes_, ray, closest, max_distance);
+    intersectAll(triangles_, ray, closest, max_distance);
+    for (const auto& object : others_) {
+      if (auto intersection_record = object->Intersect(ray); intersection_record && intersection_record->t <= max_distance) {
+        max_distance = intersection_record->t;
+        closest = std::move(intersection_record);
+      }
+    }
+    return closest;
+  }
+
+  std::optional<BoundingBox> Bounds() const override {
+    if (!planes_.empty()) {
+      return std::nullopt;
+    }
+    BoundingBox box;
+    auto expand = [&](const Intersectable& object) {
+      const auto object_box = object.Bounds();
+      if (object_box) {
+        box.Expand(*object_box);
+      }
+      return object_box.has_value();
+    };
+    for (const auto& sphere : spheres_) {
+      expand(sphere);
+    }
+    for (const auto& triangle : triangles_) {
+      expand(triangle);
+    }
+    for (const auto& object : others_) {
+      if (!expand(*object)) {
+        return std::nullopt;
+      }
+    }
+    return box;
+  }
+
+  std::string Describe() const override {
+    return "statically dispatched list of " + std::to_string(size()) + " objects";
+  }
+
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("object lists", sizeof(*this) + MemoryReport::VectorBytes(others_));
+    accountAll(spheres_, report);
+    accountAll(planes_, report);
+    accountAll(triangles_, report);
+    for (const auto& object : others_) {
+      AccountSharedObject(report, object);
+    }
+  }
+
+  void CollectPrimitives(std::vector<const Intersectable*>& primitives) const override {
+    for (const auto& sphere : spheres_) {
+      primitives.push_back(&sphere);
+    }
+    for (const auto& plane : planes_) {
+      primitives.push_back(&plane);
+    }
+    for (const auto& triangle : triangles_) {
+      primitives.push_back(&triangle);
+    }
+    for (const auto& object : others_) {
+      object->CollectPrimitives(primitives);
+    }
+  }
+
+  size_t size() const { return spheres_.size() + planes_.size() + triangles_.size() + others_.size(); }
+
+private:
+  template <typename T>
+  static void intersectAll(const std::vector<T>& objects, const Ray& ray,
+                           std::optional<ObjectIntersectionInfo>& closest, float& max_distance) {
+    for (const T& object : objects) {
+      // T is final, so this is a direct call.
+      if (auto intersection_record = object.Intersect(ray); intersection_record && intersection_record->t <= max_distance) {
+        max_distance = intersection_record->t;
+        closest = std::move(intersection_record);
+      }
+    }
+  }
+
+  // Objects are stored by value, so only the unused capacity is the list's own.
+  template <typename T>
+  static void accountAll(const std::vector<T>& objects, MemoryReport& report) {
+    report.Add("object lists", (objects.capacity() - objects.size()) * sizeof(T), 0);
+    for (const T& object : objects) {
+      object.AccountMemory(report);
+    }
+  }
+
+  std::vector<Sphere> spheres_{};
+  std::vector<Plane> planes_{};
+  std::vector<Triangle> triangles_{};
+  std::vector<std::shared_ptr<Intersectable>> others_{};
+};
+
+} // graphics::raytracer
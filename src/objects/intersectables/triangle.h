@@ -1,19 +1,24 @@
 // Triangle: https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/ray-triangle-intersection-geometric-solution.html
 #pragma once
 
+#include <cmath>
 #include <memory>
 #include <optional>
+#include <sstream>
+#include <string>
 
 #include "../../utils/vertex.h"
 #include "../../objects/intersectables/intersectable.h"
 #include "../../math/vec.h"
+#include "../../utils/intersection_counters.h"
 #include "../../utils/ray.h"
 #include "../../materials/material.h"
 #include "../../math/fast_math.h"
+#include "../../math/precision.h"
 
 namespace graphics::raytracer {
 
-class Triangle : public Intersectable {
+class Triangle final : public Intersectable {
 
 public:
   // Define a plane with a point and a normal
@@ -25,30 +30,86 @@ public:
       triangle_plane_normal_ = math::cross(v0v1, v0v2);
 
       // To invert the normal vector
-      if (triangle_plane_normal_ * v0_.point > 0) {
-        normal_sign_ = -1;
-      }
+      normal_sign_ = NormalSign(triangle_plane_normal_, v0_.point);
     }
 
+  // Same as above, with the plane normal (v1 - v0) x (v2 - v0) and its NormalSign already
+  // computed, eg. at compile time for an embedded scene.
+  Triangle(Vertexff v0, Vertexff v1, Vertexff v2, const math::Vector3f& plane_normal, float normal_sign,
+           std::shared_ptr<Material> material) :
+    v0_{v0}, v1_{v1}, v2_{v2}, material_{material}, triangle_plane_normal_{plane_normal},
+    normal_sign_{normal_sign} {}
+
   std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
-    auto v0 = v0_.point;
-    auto v1 = v1_.point;
-    auto v2 = v2_.point;
+    countIntersectionTests(this);
+    const auto hit = IntersectGeometry(ray, v0_.point, v1_.point, v2_.point, triangle_plane_normal_);
+    if (!hit) {
+      return std::nullopt;
+    }
+    return ObjectIntersectionInfo{.t = hit->t,
+                                  .point = ray.at(hit->t),  // this ray hits the triangle
+                                  .normal = normal_sign_ * math::unit_vector(interpolateNormal(hit->u, hit->v, 1 - hit->u - hit->v)),
+                                  .material = material_,
+                                  .uv = interpolateUv(hit->u, hit->v, 1 - hit->u - hit->v),
+                                  .uv_length = uvLength(),
+                                  .object = this};
+  }
+
+  // Distance t of the hit Intersect would return, without computing the rest of it.
+  std::optional<float> IntersectDistance(const Ray& ray) const {
+    const auto hit = IntersectGeometry(ray, v0_.point, v1_.point, v2_.point, triangle_plane_normal_);
+    return hit ? std::make_optional(hit->t) : std::nullopt;
+  }
+
+  // Position of vertex |i|, 0, 1 or 2.
+  const math::Vector3f& vertex(int i) const { return i == 0 ? v0_.point : i == 1 ? v1_.point : v2_.point; }
 
-    float denom = triangle_plane_normal_ * triangle_plane_normal_;
+  std::optional<BoundingBox> Bounds() const override {
+    BoundingBox box;
+    box.Expand(v0_.point);
+    box.Expand(v1_.point);
+    box.Expand(v2_.point);
+    return box;
+  }
+
+  std::string Describe() const override {
+    std::ostringstream description;
+    description << "triangle " << v0_.point << ' ' << v1_.point << ' ' << v2_.point;
+    return description.str();
+  }
+
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("Triangle", sizeof(*this));
+    AccountMaterial(report, material_);
+  }
+
+  // Result of the purely geometric part of the intersection test. |u| and |v| are the
+  // barycentric weights of v0 and v1.
+  struct GeometryHit {
+    float t;
+    float u;
+    float v;
+  };
+
+  // Ray/triangle test on raw vertices, so compressed representations of triangles can share it.
+  // |plane_normal| is the (unnormalized) cross product (v1 - v0) x (v2 - v0).
+  static std::optional<GeometryHit> IntersectGeometry(const Ray& ray, const math::Vector3f& v0,
+                                                      const math::Vector3f& v1, const math::Vector3f& v2,
+                                                      const math::Vector3f& plane_normal) {
+    float denom = math::dot(plane_normal, plane_normal);
 
     // Step 1: finding P
 
     // check if the ray and plane are parallel.
-    float NdotRayDirection = triangle_plane_normal_ * ray.direction();
+    float NdotRayDirection = math::dot(plane_normal, ray.direction());
     if (fabs(NdotRayDirection) < 0.001) // almost 0
         return std::nullopt; // they are parallel so they don't intersect! 
 
     // compute d parameter using equation 2
-    float d = -triangle_plane_normal_ * v0;
+    float d = -math::dot(plane_normal, v0);
     
     // compute t (equation 3)
-    float t = -(triangle_plane_normal_ * ray.origin() + d) / NdotRayDirection;
+    float t = -(math::dot(plane_normal, ray.origin()) + d) / NdotRayDirection;
     // check if the triangle is behind the ray
     if (t < 0) return std::nullopt; // the triangle is behind
  
@@ -62,29 +123,31 @@ public:
     math::Vector3f edge0 = v1 - v0; 
     math::Vector3f vp0 = P - v0;
     C = math::cross(edge0, vp0);
-    if (triangle_plane_normal_ * C < 0) return std::nullopt; // P is on the right side
+    if (math::dot(plane_normal, C) < 0) return std::nullopt; // P is on the right side
  
     // edge 1
     float u;
     math::Vector3f edge1 = v2 - v1; 
     math::Vector3f vp1 = P - v1;
     C = math::cross(edge1, vp1);
-    if ((u = triangle_plane_normal_ * C) < 0)  return std::nullopt; // P is on the right side
+    if ((u = math::dot(plane_normal, C)) < 0)  return std::nullopt; // P is on the right side
  
     // edge 2
     float v;
     math::Vector3f edge2 = v0 - v2; 
     math::Vector3f vp2 = P - v2;
     C = math::cross(edge2, vp2);
-    if ((v = triangle_plane_normal_ * C) < 0) return std::nullopt; // P is on the right side;
+    if ((v = math::dot(plane_normal, C)) < 0) return std::nullopt; // P is on the right side;
 
     u /= denom;
     v /= denom;
 
-    return ObjectIntersectionInfo{.t = t,
-                                  .point = ray.at(t),  // this ray hits the triangle
-                                  .normal = normal_sign_ * normalize(interpolateNormal(u, v, 1 - u - v)),
-                                  .material = material_};
+    return GeometryHit{.t = t, .u = u, .v = v};
+  }
+
+  // Normals are flipped for triangles whose plane normal points away from the origin.
+  static constexpr float NormalSign(const math::Vector3f& plane_normal, const math::Vector3f& v0) {
+    return plane_normal * v0 > 0 ? -1.f : 1.f;
   }
 
 private:
@@ -95,6 +158,27 @@ private:
     return u * (*v0_.normal) + v * (*v1_.normal) + w * (*v2_.normal);
   }
 
+  // Interpolated vertex texture coordinates, or the barycentrics if the vertices have none.
+  math::Vector2f interpolateUv(float u, float v, float w) const {
+    if (!v0_.uv || !v1_.uv || !v2_.uv) {
+      return {u, v};
+    }
+    return u * (*v0_.uv) + v * (*v1_.uv) + w * (*v2_.uv);
+  }
+
+  // Square root of the ratio of the triangle's area to its area in texture coordinates. Without
+  // vertex texture coordinates the barycentrics span half a unit square.
+  float uvLength() const {
+    const float area = magnitude(triangle_plane_normal_);
+    if (!v0_.uv || !v1_.uv || !v2_.uv) {
+      return std::sqrt(area);
+    }
+    const math::Vector2f e1 = *v1_.uv - *v0_.uv;
+    const math::Vector2f e2 = *v2_.uv - *v0_.uv;
+    const float uv_area = std::abs(e1.x * e2.y - e1.y * e2.x);
+    return uv_area > 0.f ? std::sqrt(area / uv_area) : std::sqrt(area);
+  }
+
   // the three vertices of the triangle
   Vertexff v0_;
   Vertexff v1_;
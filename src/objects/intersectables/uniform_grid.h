@@ -0,0 +1,266 @@
+// Uniform grid acceleration structure. The bounds of the scene are split into equally sized cells
+// and every cell lists the objects that overlap it. A ray walks the cells it passes through in
+// order (3D-DDA) and stops at the first cell that contains a confirmed hit, so it only tests
+// the objects near its path. Works best for dense scenes of similar sized objects, where a
+// hierarchy spends most of its time descending through nearly identical boxes.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../objects/intersectables/intersectable.h"
+#include "../../utils/bounding_box.h"
+#include "../../utils/ray.h"
+#include "../../utils/thread_pool.h"
+
+namespace graphics::raytracer {
+
+class UniformGrid final : public Intersectable {
+
+public:
+  // Resolution is chosen to give about this many cells per object.
+  static constexpr float kCellsPerObject = 2.f;
+  static constexpr int kMaxCellsPerAxis = 512;
+  static constexpr size_t kMaxCells = size_t{1} << 24;
+
+  // Bins |objects| into the grid on |pool|, or on the calling thread if |pool| is null. Unbounded
+  // objects (planes) can't be binned, and are tested against every ray instead.
+  explicit UniformGrid(std::vector<std::shared_ptr<Intersectable>> objects, ThreadPool* pool = nullptr) {
+    std::vector<BoundingBox> boxes;
+    for (auto& object : objects) {
+      if (auto box = object->Bounds()) {
+        bounds_.Expand(*box);
+        boxes.push_back(*box);
+        objects_.push_back(std::move(object));
+      } else {
+        unbounded_.push_back(std::move(object));
+      }
+    }
+    if (objects_.empty()) {
+      return;
+    }
+    chooseResolution();
+    build(boxes, pool);
+  }
+
+  std::optional<ObjectIntersectionInfo> Intersect(const Ray& ray) const override {
+    std::optional<ObjectIntersectionInfo> closest;
+    float max_distance = std::numeric_limits<float>::max();
+    for (const auto& object : unbounded_) {
+      if (auto intersection_record = object->Intersect(ray); intersection_record && intersection_record->t <= max_distance) {
+        max_distance = intersection_record->t;
+        closest = std::move(intersection_record);
+      }
+    }
+    if (objects_.empty()) {
+      return closest;
+    }
+
+    const math::Vector3f inv_direction = inverse_direction(ray);
+    const auto t_enter = bounds_.Intersect(ray, inv_direction, max_distance);
+    if (!t_enter) {
+      return closest;
+    }
+
+    // Set up the walk: the cell the ray enters the grid in, and for each axis the distance to
+    // the next cell boundary and the distance between boundaries.
+    const math::Point3f origin = ray.origin();
+    const math::Vector3f direction = ray.direction();
+    const math::Point3f entry = ray.at(*t_enter);
+    int cell[3];
+    int step[3];
+    float t_next[3];
+    float t_delta[3];
+    for (int i = 0; i < 3; i++) {
+      cell[i] = std::clamp(static_cast<int>((entry.data[i] - bounds_.min.data[i]) * inv_cell_size_[i]), 0, dims_[i] - 1);
+      if (direction.data[i] > 0.f) {
+        step[i] = 1;
+        t_next[i] = (bounds_.min.data[i] + (cell[i] + 1) * cell_size_[i] - origin.data[i]) * inv_direction.data[i];
+        t_delta[i] = cell_size_[i] * inv_direction.data[i];
+      } else if (direction.data[i] < 0.f) {
+        step[i] = -1;
+        t_next[i] = (bounds_.min.data[i] + cell[i] * cell_size_[i] - origin.data[i]) * inv_direction.data[i];
+        t_delta[i] = -cell_size_[i] * inv_direction.data[i];
+      } else {
+        step[i] = 0;
+        t_next[i] = std::numeric_limits<float>::infinity();
+        t_delta[i] = std::numeric_limits<float>::infinity();
+      }
+    }
+
+    while (true) {
+      const size_t cell_index = (static_cast<size_t>(cell[2]) * dims_[1] + cell[1]) * dims_[0] + cell[0];
+      for (uint32_t i = cell_offsets_[cell_index]; i < cell_offsets_[cell_index + 1]; i++) {
+        const Intersectable* object = objects_[cell_objects_[i]].get();
+        if (auto intersection_record = object->Intersect(ray); intersection_record && intersection_record->t <= max_distance) {
+          max_distance = intersection_record->t;
+          closest = std::move(intersection_record);
+        }
+      }
+      const int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+      // Objects overlap several cells, so a hit found here may lie in a later cell. It is only
+      // confirmed to be the closest once the walk has passed it.
+      if (max_distance <= t_next[axis]) {
+        break;
+      }
+      cell[axis] += step[axis];
+      if (cell[axis] < 0 || cell[axis] >= dims_[axis]) {
+        break;
+      }
+      t_next[axis] += t_delta[axis];
+    }
+    return closest;
+  }
+
+  std::optional<BoundingBox> Bounds() const override {
+    if (!unbounded_.empty()) {
+      return std::nullopt;
+    }
+    return bounds_;
+  }
+
+  std::string Describe() const override {
+    return "uniform grid of " + std::to_string(dims_[0]) + "x" + std::to_string(dims_[1]) + "x" +
+           std::to_string(dims_[2]) + " cells over " + std::to_string(objects_.size()) + " objects";
+  }
+
+  void AccountMemory(MemoryReport& report) const override {
+    report.Add("uniform grid", sizeof(*this) + MemoryReport::VectorBytes(cell_offsets_) +
+                               MemoryReport::VectorBytes(cell_objects_) + MemoryReport::VectorBytes(objects_) +
+                               MemoryReport::VectorBytes(unbounded_));
+    for (const auto& object : unbounded_) {
+      AccountSharedObject(report, object);
+    }
+    for (const auto& object : objects_) {
+      AccountSharedObject(report, object);
+    }
+  }
+
+  // Unbounded objects are tested first. The others are tested in an order that depends on the ray,
+  // so ties between them may be decided differently than in this order.
+  void CollectPrimitives(std::vector<const Intersectable*>& primitives) const override {
+    for (const auto& object : unbounded_) {
+      object->CollectPrimitives(primitives);
+    }
+    for (const auto& object : objects_) {
+      object->CollectPrimitives(primitives);
+    }
+  }
+
+  // Number of cells along each axis.
+  const int* dims() const { return dims_; }
+
+  size_t cell_count() const { return cell_offsets_.empty() ? 0 : cell_offsets_.size() - 1; }
+
+  // Total number of (cell, object) references, ie. how many cells objects overlap in total.
+  size_t reference_count() const { return cell_objects_.size(); }
+
+private:
+  // Objects (or cells) a build worker takes at a time.
+  static constexpr size_t kBuildGrain = 1024;
+
+  // Picks cubic-ish cells such that there are about kCellsPerObject cells per object.
+  void chooseResolution() {
+    // Pad the bounds so flat scenes still have a volume, and objects on the max faces of the box
+    // fall inside the last cell.
+    const math::Vector3f extent = bounds_.Extent();
+    const float padding = 1e-4f * std::max({extent.x, extent.y, extent.z, 1e-3f});
+    bounds_.min = bounds_.min - math::Vector3f{padding, padding, padding};
+    bounds_.max = bounds_.max + math::Vector3f{padding, padding, padding};
+
+    const math::Vector3f padded = bounds_.Extent();
+    const float volume = padded.x * padded.y * padded.z;
+    float cells_per_unit = std::cbrt(kCellsPerObject * objects_.size() / volume);
+    size_t cells = 0;
+    // Coarsen until the cell count is acceptable.
+    do {
+      cells = 1;
+      for (int i = 0; i < 3; i++) {
+        dims_[i] = std::clamp(static_cast<int>(std::ceil(padded.data[i] * cells_per_unit)), 1, kMaxCellsPerAxis);
+        cells *= dims_[i];
+      }
+      cells_per_unit *= 0.8f;
+    } while (cells > kMaxCells);
+
+    for (int i = 0; i < 3; i++) {
+      cell_size_[i] = padded.data[i] / dims_[i];
+      inv_cell_size_[i] = 1.f / cell_size_[i];
+    }
+  }
+
+  // Range of cells overlapped by |box|, as inclusive [first, last] per axis.
+  void cellRange(const BoundingBox& box, int first[3], int last[3]) const {
+    for (int i = 0; i < 3; i++) {
+      first[i] = std::clamp(static_cast<int>((box.min.data[i] - bounds_.min.data[i]) * inv_cell_size_[i]), 0, dims_[i] - 1);
+      last[i] = std::clamp(static_cast<int>((box.max.data[i] - bounds_.min.data[i]) * inv_cell_size_[i]), 0, dims_[i] - 1);
+    }
+  }
+
+  // Calls func(cell_index) for every cell overlapped by |box|.
+  template <typename F>
+  void forEachCell(const BoundingBox& box, F&& func) const {
+    int first[3];
+    int last[3];
+    cellRange(box, first, last);
+    for (int z = first[2]; z <= last[2]; z++) {
+      for (int y = first[1]; y <= last[1]; y++) {
+        for (int x = first[0]; x <= last[0]; x++) {
+          func((static_cast<size_t>(z) * dims_[1] + y) * dims_[0] + x);
+        }
+      }
+    }
+  }
+
+  // Counting sort of the object references by cell, in parallel:
+  // 1. count the objects overlapping each cell,
+  // 2. prefix sum the counts into the offsets of each cell's references,
+  // 3. scatter the object indices to their cells,
+  // 4. sort each cell's references, so the result doesn't depend on thread timing.
+  void build(const std::vector<BoundingBox>& boxes, ThreadPool* pool) {
+    const size_t cells = static_cast<size_t>(dims_[0]) * dims_[1] * dims_[2];
+
+    std::vector<std::atomic<uint32_t>> counts(cells);
+    ParallelFor(pool, 0, boxes.size(), kBuildGrain, [&](size_t i, size_t) {
+      forEachCell(boxes[i], [&](size_t cell) { counts[cell].fetch_add(1, std::memory_order_relaxed); });
+    });
+
+    cell_offsets_.resize(cells + 1);
+    cell_offsets_[0] = 0;
+    for (size_t c = 0; c < cells; c++) {
+      cell_offsets_[c + 1] = cell_offsets_[c] + counts[c].load(std::memory_order_relaxed);
+      // Reuse the counts as the write cursor of each cell.
+      counts[c].store(cell_offsets_[c], std::memory_order_relaxed);
+    }
+
+    cell_objects_.resize(cell_offsets_[cells]);
+    ParallelFor(pool, 0, boxes.size(), kBuildGrain, [&](size_t i, size_t) {
+      forEachCell(boxes[i], [&](size_t cell) {
+        cell_objects_[counts[cell].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(i);
+      });
+    });
+
+    ParallelFor(pool, 0, cells, kBuildGrain, [&](size_t c, size_t) {
+      std::sort(cell_objects_.begin() + cell_offsets_[c], cell_objects_.begin() + cell_offsets_[c + 1]);
+    });
+  }
+
+  std::vector<std::shared_ptr<Intersectable>> objects_{};
+  std::vector<std::shared_ptr<Intersectable>> unbounded_{};
+
+  BoundingBox bounds_{};
+  int dims_[3] = {0, 0, 0};
+  float cell_size_[3] = {0.f, 0.f, 0.f};
+  float inv_cell_size_[3] = {0.f, 0.f, 0.f};
+
+  // Objects of cell c are cell_objects_[cell_offsets_[c]] to cell_objects_[cell_offsets_[c + 1]].
+  std::vector<uint32_t> cell_offsets_{};
+  std::vector<uint32_t> cell_objects_{};
+};
+
+} // graphics::raytracer
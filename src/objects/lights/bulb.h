@@ -2,6 +2,8 @@
 // point and falling off with inverse square intensity.
 #pragma once
 
+#include <memory>
+
 #include "../../objects/lights/light.h"
 
 #include "../../math/vec.h"
@@ -9,7 +11,7 @@
 
 namespace graphics::raytracer {
 
-class Bulb : public Light {
+class Bulb final : public Light {
 public:
   Bulb(const math::Point3f position, const Color3f& color) : position_{position}, color_{color} {}
 
@@ -26,6 +28,12 @@ public:
     return color_;
   }
 
+  std::shared_ptr<Light> Moved(const math::Vector3f& offset) const override {
+    return std::make_shared<Bulb>(position_ + offset, color_);
+  }
+
+  size_t MemoryUsage() const override { return sizeof(*this); }
+
 private:
   math::Point3f position_{};
   Color3f color_{};
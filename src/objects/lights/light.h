@@ -1,6 +1,8 @@
 // Defines the implementation of various lighting components.
 #pragma once
 
+#include <memory>
+
 #include "../../math/vec.h"
 #include "../../utils/color.h"
 
@@ -16,6 +18,12 @@ public:
 
   virtual Color3f Color() const = 0;
 
+  // Copy of the light moved by |offset|. For lights without a position this turns the direction
+  // the light comes from instead.
+  virtual std::shared_ptr<Light> Moved(const math::Vector3f& offset) const = 0;
+
+  // Bytes used by the light object.
+  virtual size_t MemoryUsage() const { return sizeof(Light); }
 };
 
 } // namespace graphics::raytracer
@@ -0,0 +1,67 @@
+// Lights grouped by their concrete type in contiguous arrays. Iterating with ForEach calls the
+// callback with the concrete type, and since Sun and Bulb are final, calls made through it are
+// resolved (and can be inlined) at compile time instead of going through the vtable.
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "../../objects/lights/light.h"
+#include "../../objects/lights/sun.h"
+#include "../../objects/lights/bulb.h"
+#include "../../utils/memory_report.h"
+
+namespace graphics::raytracer {
+
+class LightList {
+
+public:
+  LightList() = default;
+
+  LightList(std::vector<Sun> suns, std::vector<Bulb> bulbs) : suns_{std::move(suns)}, bulbs_{std::move(bulbs)} {}
+
+  // Copies every light into the array for its type. Lights of any other type are kept behind
+  // their pointer and still use virtual dispatch.
+  explicit LightList(const std::vector<std::shared_ptr<Light>>& lights) {
+    for (const auto& light : lights) {
+      if (const auto* sun = dynamic_cast<const Sun*>(light.get())) {
+        suns_.push_back(*sun);
+      } else if (const auto* bulb = dynamic_cast<const Bulb*>(light.get())) {
+        bulbs_.push_back(*bulb);
+      } else {
+        others_.push_back(light);
+      }
+    }
+  }
+
+  // Calls func(light) for every light, one type at a time. Note this doesn't preserve the
+  // original order of the lights.
+  template <typename F>
+  void ForEach(F&& func) const {
+    for (const Sun& sun : suns_) {
+      func(sun);
+    }
+    for (const Bulb& bulb : bulbs_) {
+      func(bulb);
+    }
+    for (const auto& light : others_) {
+      func(static_cast<const Light&>(*light));
+    }
+  }
+
+  size_t size() const { return suns_.size() + bulbs_.size() + others_.size(); }
+
+  // The lights in |others_| are shared with the scene, and accounted for there.
+  void AccountMemory(MemoryReport& report) const {
+    report.Add("lights", sizeof(*this) + MemoryReport::VectorBytes(suns_) + MemoryReport::VectorBytes(bulbs_) +
+                         MemoryReport::VectorBytes(others_), suns_.size() + bulbs_.size());
+  }
+
+private:
+  std::vector<Sun> suns_{};
+  std::vector<Bulb> bulbs_{};
+  std::vector<std::shared_ptr<Light>> others_{};
+};
+
+} // namespace graphics::raytracer
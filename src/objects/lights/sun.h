@@ -2,6 +2,8 @@
 // and emits a light with the highest intensity, with no falloff.
 #pragma once
 
+#include <memory>
+
 #include "../../objects/lights/light.h"
 
 #include "../../math/vec.h"
@@ -9,7 +11,7 @@
 
 namespace graphics::raytracer {
 
-class Sun : public Light {
+class Sun final : public Light {
 public:
   Sun(const math::Point3f position, const Color3f& color) : position_{position}, color_{color} {}
 
@@ -26,6 +28,12 @@ public:
     return color_;
   }
 
+  std::shared_ptr<Light> Moved(const math::Vector3f& offset) const override {
+    return std::make_shared<Sun>(position_ + offset, color_);
+  }
+
+  size_t MemoryUsage() const override { return sizeof(*this); }
+
 private:
   math::Point3f position_{};
   Color3f color_{};
@@ -0,0 +1,162 @@
+// Edge-aware a-trous wavelet denoiser, guided by the albedo and normal feature buffers.
+// See "Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination Filtering"
+// (Dammertz et al. 2010): a 5x5 B3-spline kernel is applied repeatedly with holes of
+// increasing size, and each tap is weighted down when its color, normal or albedo differ
+// from the center pixel so that edges are preserved.
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "../math/vec.h"
+#include "../utils/color.h"
+#include "../utils/frame_buffer.h"
+#include "../utils/image.h"
+#include "../utils/thread_pool.h"
+#include "../renderer/feature_buffers.h"
+
+namespace {
+
+// 1-d B3 spline kernel, the 2-d kernel is the outer product of this with itself.
+constexpr float kAtrousKernel[5] = {1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f};
+
+// Albedo channels below this are not demodulated, to avoid dividing by ~0.
+constexpr float kMinAlbedo = 0.001f;
+
+} // namespace
+
+namespace graphics::raytracer {
+
+struct DenoiserSettings {
+  // Number of a-trous passes. Pass i uses a step of 2^i pixels, so 5 passes cover a 61x61 footprint.
+  int iterations = 5;
+  // Edge stopping parameters, smaller values preserve more edges.
+  float color_sigma = 0.5f;
+  float normal_sigma = 0.3f;
+  float albedo_sigma = 0.1f;
+};
+
+namespace detail {
+
+inline float squaredDistance(const math::Vector3f& a, const math::Vector3f& b) {
+  const math::Vector3f d = a - b;
+  return d * d;
+}
+
+// e^-x for x >= 0, to within 3e-7 relative error. Unlike std::exp it has no branches or calls,
+// so the tap loop below can be if-converted and vectorized. e^-x = 2^t is split into 2^whole, added
+// straight to the exponent bits, and 2^fraction, from a minimax polynomial on (-1, 0].
+inline float expNegative(float x) {
+  // Clamped so that the result stays a normal float.
+  const float t = std::min(x, 87.f) * -1.44269504f;
+  const int32_t whole = static_cast<int32_t>(t);
+  const float fraction = t - static_cast<float>(whole);
+  const float power = 0.99999994f + fraction * (0.69314218f + fraction * (0.24017160f + fraction *
+                      (0.055278149f + fraction * (0.0091868816f + fraction * 0.00093811657f))));
+  return std::bit_cast<float>(std::bit_cast<int32_t>(power) + whole * (1 << 23));
+}
+
+// One a-trous pass over row |y| of |input|, written to |output|.
+inline void atrousRow(const FrameBuffer<Color3f>& input, FrameBuffer<Color3f>& output,
+                      const FeatureBuffers& features, int step, float inv_color_var,
+                      float inv_normal_var, float inv_albedo_var, int y) {
+  const int height = static_cast<int>(input.height());
+  const int width = static_cast<int>(input.width());
+
+  for (int x = 0; x < width; x++) {
+    const Color3f center_color = input.at(y, x);
+    const math::Vector3f center_normal = features.normal.at(y, x);
+    const Color3f center_albedo = features.albedo.at(y, x);
+
+    Color3f sum = colors::Black;
+    float weight_sum = 0.f;
+    for (int ky = 0; ky < 5; ky++) {
+      const int qy = y + (ky - 2) * step;
+      if (qy < 0 || qy >= height) {
+        continue;
+      }
+      const Color3f* color_row = input.row(qy);
+      const math::Vector3f* normal_row = features.normal.row(qy);
+      const Color3f* albedo_row = features.albedo.row(qy);
+      for (int kx = 0; kx < 5; kx++) {
+        // Taps outside the image read the edge pixel and get a weight of 0, instead of being
+        // skipped, so the loop has no branches.
+        const int qx = x + (kx - 2) * step;
+        const int clamped_qx = std::clamp(qx, 0, width - 1);
+        const float inside = qx == clamped_qx ? 1.f : 0.f;
+        const float distance = squaredDistance(center_color, color_row[clamped_qx]) * inv_color_var
+                             + squaredDistance(center_normal, normal_row[clamped_qx]) * inv_normal_var
+                             + squaredDistance(center_albedo, albedo_row[clamped_qx]) * inv_albedo_var;
+        const float weight = inside * kAtrousKernel[ky] * kAtrousKernel[kx] * expNegative(distance);
+        sum += color_row[clamped_qx] * weight;
+        weight_sum += weight;
+      }
+    }
+    // The center tap always has weight > 0, so this never divides by 0.
+    output.at(y, x) = sum * (1.f / weight_sum);
+  }
+}
+
+} // namespace detail
+
+// Returns the denoised version of features.beauty, filtered on |pool|. Lighting is demodulated by
+// the albedo before filtering and remodulated after, so texture/color detail isn't blurred away
+// with the noise.
+inline FrameBuffer<Color3f> Denoise(const FeatureBuffers& features, ThreadPool& pool, const DenoiserSettings& settings = {}) {
+  const size_t height = features.beauty.height();
+  const size_t width = features.beauty.width();
+
+  FrameBuffer<Color3f> current(height, width);
+  FrameBuffer<Color3f> next(height, width);
+
+  pool.ParallelFor(0, height, 1, [&](size_t y, size_t) {
+    for (size_t x = 0; x < width; x++) {
+      const Color3f& albedo = features.albedo.at(y, x);
+      const Color3f& beauty = features.beauty.at(y, x);
+      for (int i = 0; i < 3; i++) {
+        current.at(y, x).data[i] = albedo.data[i] > kMinAlbedo ? beauty.data[i] / albedo.data[i] : beauty.data[i];
+      }
+    }
+  });
+
+  const float inv_normal_var = 1.f / (settings.normal_sigma * settings.normal_sigma);
+  const float inv_albedo_var = 1.f / (settings.albedo_sigma * settings.albedo_sigma);
+  for (int i = 0; i < settings.iterations; i++) {
+    // The color threshold shrinks each pass, since the signal gets smoother as the holes grow.
+    const float color_sigma = settings.color_sigma / static_cast<float>(1 << i);
+    const float inv_color_var = 1.f / (color_sigma * color_sigma);
+    pool.ParallelFor(0, height, 1, [&](size_t y, size_t) {
+      detail::atrousRow(current, next, features, 1 << i, inv_color_var, inv_normal_var, inv_albedo_var,
+                        static_cast<int>(y));
+    });
+    std::swap(current, next);
+  }
+
+  pool.ParallelFor(0, height, 1, [&](size_t y, size_t) {
+    for (size_t x = 0; x < width; x++) {
+      const Color3f& albedo = features.albedo.at(y, x);
+      for (int i = 0; i < 3; i++) {
+        if (albedo.data[i] > kMinAlbedo) {
+          current.at(y, x).data[i] *= albedo.data[i];
+        }
+      }
+    }
+  });
+  return current;
+}
+
+// Denoises the beauty buffer on |pool| and writes the result into |output_image|.
+inline void DenoiseImage(Image& output_image, const FeatureBuffers& features, ThreadPool& pool,
+                         const DenoiserSettings& settings = {}) {
+  const FrameBuffer<Color3f> denoised = Denoise(features, pool, settings);
+  for (size_t r = 0; r < output_image.height(); r++) {
+    for (size_t c = 0; c < output_image.width(); c++) {
+      output_image.set_pixel(denoised.at(r, c), r, c);
+    }
+  }
+}
+
+} // namespace graphics::raytracer
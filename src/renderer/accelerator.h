@@ -0,0 +1,55 @@
+// Selection and construction of the structure that rays are intersected against.
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../objects/intersectables/bvh.h"
+#include "../objects/intersectables/intersectable_list.h"
+#include "../objects/intersectables/uniform_grid.h"
+#include "../renderer/scene.h"
+#include "../utils/accelerator_type.h"
+#include "../utils/thread_pool.h"
+
+namespace graphics::raytracer {
+
+// Returns a copy of |scene| whose objects are organized in an accelerator of type |type|, built on
+// |pool|, or on the calling thread if |pool| is null. Only a scene whose objects are an
+// IntersectableList can be reorganized, anything else is returned as is. With |verbose|, prints
+// what was built.
+inline Scene BuildAccelerator(const Scene& scene, AcceleratorType type, ThreadPool* pool = nullptr, bool verbose = false) {
+  const auto list = std::dynamic_pointer_cast<IntersectableList>(scene.objects);
+  if (type == AcceleratorType::kList || !list) {
+    return scene;
+  }
+  Scene accelerated = scene;
+  switch (type) {
+    case AcceleratorType::kGrid: {
+      auto grid = std::make_shared<UniformGrid>(list->intersectable_list_, pool);
+      if (verbose) {
+        const int* dims = grid->dims();
+        std::cout << "Built a " << dims[0] << "x" << dims[1] << "x" << dims[2] << " uniform grid with "
+                  << grid->reference_count() << " object references.\n";
+      }
+      accelerated.objects = std::move(grid);
+      break;
+    }
+    case AcceleratorType::kBvh:
+    case AcceleratorType::kLbvh: {
+      const BvhQuality quality = type == AcceleratorType::kBvh ? BvhQuality::kHigh : BvhQuality::kFast;
+      auto bvh = std::make_shared<Bvh>(list->intersectable_list_, quality, pool);
+      if (verbose) {
+        std::cout << "Built a " << (quality == BvhQuality::kHigh ? "SAH" : "linear") << " BVH of "
+                  << bvh->node_count() << " nodes, SAH cost " << bvh->SahCost() << ".\n";
+      }
+      accelerated.objects = std::move(bvh);
+      break;
+    }
+    case AcceleratorType::kList:
+      break;
+  }
+  return accelerated;
+}
+
+} // namespace graphics::raytracer
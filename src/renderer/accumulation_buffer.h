@@ -0,0 +1,46 @@
+// Render state of a progressive render, which takes the samples of every pixel a few at a time
+// instead of all at once: the running sum of each pixel's samples, and how many it has. Since the
+// samplers are deterministic given the pixel, the sample index and the seed, this is all it takes
+// to continue the render later (see checkpoint.h) and still get exactly the same image.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "../utils/color.h"
+#include "../utils/image.h"
+
+namespace graphics::raytracer {
+
+struct AccumulationBuffer {
+  AccumulationBuffer(size_t height, size_t width) :
+    height{height}, width{width}, sums(height * width), sample_counts(height * width, 0) {}
+
+  // Smallest number of samples any pixel has.
+  uint32_t min_samples() const {
+    uint32_t min_count = UINT32_MAX;
+    for (uint32_t count : sample_counts) {
+      min_count = std::min(min_count, count);
+    }
+    return sample_counts.empty() ? 0 : min_count;
+  }
+
+  // Writes the average of every pixel's |samples_per_pixel| samples into |image|.
+  void Resolve(Image& image, int samples_per_pixel) const {
+    const float inv_samples = 1.f / std::max(1, samples_per_pixel);
+    for (size_t y = 0; y < height; y++) {
+      for (size_t x = 0; x < width; x++) {
+        image.set_pixel(sums[y * width + x] * inv_samples, y, x);
+      }
+    }
+  }
+
+  size_t height;
+  size_t width;
+  // Row-major, pixel (x, y) at y * width + x.
+  std::vector<Color3f> sums;
+  std::vector<uint32_t> sample_counts;
+};
+
+} // namespace graphics::raytracer
@@ -0,0 +1,253 @@
+// Batch mode: renders many (typically small) scenes in one process from a manifest, instead of
+// paying process startup and thread pool creation once per image.
+//
+// Small images don't split well: a 64x64 image has 4 chunks of tiles, so most render workers idle.
+// So every small job runs start to finish (parse, build, render, encode and write) on a single
+// worker, and the workers take jobs from a shared queue. Only images of at least kBatchSplitPixels
+// are split across the whole pool like a normal render, after the small jobs are done.
+//
+// A manifest has one job per line, '#' starts a comment:
+//   SCENE OUTPUT [size WxH] [eye X Y Z] [forward X Y Z] [up X Y Z]
+// SCENE is a scene file, or embedded:NAME for a scene compiled into the binary. OUTPUT is the PPM
+// to write. Omitted fields take the defaults given to ParseBatchManifest.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../math/vec.h"
+#include "../materials/texture_cache.h"
+#include "../renderer/accelerator.h"
+#include "../renderer/camera.h"
+#include "../renderer/embedded_scenes.h"
+#include "../renderer/render_settings.h"
+#include "../renderer/renderer.h"
+#include "../renderer/scene.h"
+#include "../renderer/static_scene.h"
+#include "../utils/image.h"
+#include "../utils/output_transform.h"
+#include "../utils/scene_parser.h"
+#include "../utils/stopwatch.h"
+
+namespace graphics::raytracer {
+
+// Images with at least this many pixels have enough tiles to keep every worker busy, so they are
+// rendered by the whole pool rather than by one worker.
+constexpr size_t kBatchSplitPixels = size_t{512} * 512;
+constexpr std::string_view kBatchEmbeddedPrefix = "embedded:";
+
+struct BatchJob {
+  // Scene file, or the name of an embedded scene if |embedded|.
+  std::string scene{};
+  bool embedded = false;
+  std::string output_path{};
+  size_t width = 0;
+  size_t height = 0;
+  Camera camera{};
+
+  size_t pixels() const { return width * height; }
+};
+
+// How every job of a batch is rendered.
+struct BatchSettings {
+  RenderSettings render{};
+  OutputSettings output{};
+  // Overrides the accelerator chosen by each scene file, like --accel.
+  std::optional<AcceleratorType> accelerator{};
+  bool static_dispatch = false;
+  // Shared by all jobs, so a texture used by many scenes is decoded once.
+  std::shared_ptr<TextureCache> texture_cache{};
+};
+
+struct BatchStats {
+  size_t jobs = 0;
+  size_t failed = 0;
+  // Jobs rendered by a single worker, and by the whole pool.
+  size_t unsplit = 0;
+  size_t split = 0;
+  double seconds = 0.0;
+
+  double jobs_per_second() const { return seconds > 0.0 ? jobs / seconds : 0.0; }
+};
+
+namespace detail {
+
+// Camera at |eye| looking along |forward|, with |up| as close to its up direction as possible.
+inline Camera lookAlong(const math::Vector3f& eye, const math::Vector3f& forward, const math::Vector3f& up) {
+  const math::Vector3f f = math::normalize(forward);
+  const math::Vector3f right = math::normalize(math::cross(f, up));
+  return Camera{.eye = eye, .forward = f, .right = right, .up = math::cross(right, f)};
+}
+
+// Parses one manifest line into |job|, returns false (after printing why) if it is malformed.
+inline bool parseBatchLine(const std::string& line, size_t line_number, BatchJob& job) {
+  std::istringstream fields(line);
+  auto fail = [&](std::string_view why) {
+    std::cout << "Batch manifest line " << line_number << ": " << why << '\n';
+    return false;
+  };
+  std::string scene;
+  if (!(fields >> scene >> job.output_path)) {
+    return fail("expected a scene and an output path");
+  }
+  if (scene.starts_with(kBatchEmbeddedPrefix)) {
+    job.scene = scene.substr(kBatchEmbeddedPrefix.size());
+    job.embedded = true;
+    if (!embedded::FindEmbeddedScene(job.scene)) {
+      return fail("unknown embedded scene '" + job.scene + "'");
+    }
+  } else {
+    job.scene = scene;
+  }
+
+  math::Vector3f eye = job.camera.eye;
+  math::Vector3f forward = job.camera.forward;
+  math::Vector3f up = job.camera.up;
+  bool moved_camera = false;
+  for (std::string key; fields >> key;) {
+    if (key == "size") {
+      std::string size;
+      fields >> size;
+      std::istringstream size_fields(size);
+      char separator = 0;
+      if (!(size_fields >> job.width >> separator >> job.height) || separator != 'x' || !(size_fields >> std::ws).eof() ||
+          job.width == 0 || job.height == 0) {
+        return fail("invalid size '" + size + "'");
+      }
+    } else if (key == "eye" || key == "forward" || key == "up") {
+      math::Vector3f& vector = key == "eye" ? eye : key == "forward" ? forward : up;
+      if (!(fields >> vector.data[0] >> vector.data[1] >> vector.data[2])) {
+        return fail("expected 3 numbers after '" + key + "'");
+      }
+      moved_camera = true;
+    } else {
+      return fail("unknown field '" + key + "'");
+    }
+  }
+  if (moved_camera) {
+    if (math::magnitude(forward) == 0.f || math::magnitude(math::cross(forward, up)) == 0.f) {
+      return fail("forward must be non-zero and not parallel to up");
+    }
+    job.camera = lookAlong(eye, forward, up);
+  }
+  return true;
+}
+
+// Parses (or instantiates) and builds the scene of |job|, loading meshes and building on
+// |build_pool|, or on the calling thread if it is null. Returns nullopt (after printing why) if the scene file can't be read.
+inline std::optional<Scene> constructBatchScene(const BatchJob& job, const BatchSettings& settings,
+                                                ThreadPool* build_pool) {
+  if (job.embedded) {
+    return embedded::Instantiate(*embedded::FindEmbeddedScene(job.scene));
+  }
+  if (!std::filesystem::is_regular_file(job.scene)) {
+    std::cerr << "Unable to open scene '" << job.scene << "' for '" << job.output_path << "'.\n";
+    return std::nullopt;
+  }
+  SceneParser scene_parser({.texture_cache = settings.texture_cache, .quiet = true, .pool = build_pool});
+  Scene scene = scene_parser.ReadScene(job.scene);
+  const auto accelerator = settings.accelerator.value_or(scene_parser.accelerator().value_or(AcceleratorType::kList));
+  scene = BuildAccelerator(scene, accelerator, build_pool, /*verbose=*/false);
+  if (settings.static_dispatch) {
+    scene = MakeStaticDispatchScene(scene);
+  }
+  return scene;
+}
+
+// Writes the image of |job|, returns false (after printing why) if it couldn't be written.
+inline bool writeBatchImage(const Image& image, const BatchJob& job, const BatchSettings& settings) {
+  if (!image.write(job.output_path, settings.output)) {
+    std::cerr << "Unable to write '" << job.output_path << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+} // namespace detail
+
+// Reads the jobs of the manifest at |path|. Jobs default to a |width| x |height| image seen from
+// |camera|. Returns nullopt (after printing why) if the manifest can't be read or is malformed.
+inline std::optional<std::vector<BatchJob>> ParseBatchManifest(std::string_view path, size_t width, size_t height,
+                                                               const Camera& camera) {
+  std::ifstream file{std::string(path)};
+  if (!file.is_open()) {
+    std::cout << "Unable to open batch manifest '" << path << "'\n";
+    return std::nullopt;
+  }
+  std::vector<BatchJob> jobs;
+  std::string line;
+  for (size_t line_number = 1; std::getline(file, line); line_number++) {
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    BatchJob job{.width = width, .height = height, .camera = camera};
+    if (!detail::parseBatchLine(line, line_number, job)) {
+      return std::nullopt;
+    }
+    jobs.push_back(std::move(job));
+  }
+  return jobs;
+}
+
+// Renders every job of |jobs| with the workers of |renderer|, and writes their images.
+inline BatchStats RenderBatch(Renderer& renderer, const std::vector<BatchJob>& jobs, const BatchSettings& settings) {
+  Stopwatch stopwatch;
+  BatchStats stats{.jobs = jobs.size()};
+
+  // Largest first, so a big job taken last doesn't leave the other workers idle at the end.
+  std::vector<size_t> unsplit;
+  std::vector<size_t> split;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    (jobs[i].pixels() < kBatchSplitPixels ? unsplit : split).push_back(i);
+  }
+  std::stable_sort(unsplit.begin(), unsplit.end(),
+                   [&](size_t a, size_t b) { return jobs[a].pixels() > jobs[b].pixels(); });
+  stats.unsplit = unsplit.size();
+  stats.split = split.size();
+
+  std::atomic<size_t> failed{0};
+  renderer.pool().ParallelFor(0, unsplit.size(), 1, [&](size_t i, size_t) {
+    const BatchJob& job = jobs[unsplit[i]];
+    // Loaded and built on this worker alone, the other workers are busy with jobs of their own
+    // (and the pool can't be re-entered from one of its workers).
+    const auto scene = detail::constructBatchScene(job, settings, nullptr);
+    if (!scene) {
+      failed.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    Image image(job.height, job.width);
+    RenderScene(image, job.camera, *scene, settings.render);
+    if (!detail::writeBatchImage(image, job, settings)) {
+      failed.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+  for (size_t index : split) {
+    const BatchJob& job = jobs[index];
+    const auto scene = detail::constructBatchScene(job, settings, &renderer.pool());
+    if (!scene) {
+      failed.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    Image image = renderer.AllocateImage(job.height, job.width);
+    renderer.Render(image, job.camera, *scene, settings.render);
+    if (!detail::writeBatchImage(image, job, settings)) {
+      failed.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  stats.failed = failed.load();
+  stats.seconds = stopwatch.ElapsedMilliseconds() / 1000.0;
+  return stats;
+}
+
+} // namespace graphics::raytracer
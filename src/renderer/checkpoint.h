@@ -0,0 +1,316 @@
+// Checkpointed renders, for long high sample count renders that must survive the process being
+// killed. The render takes one sample of every pixel per pass into an AccumulationBuffer, and
+// every so often a copy of the buffer is handed to a background thread that writes it to a
+// checkpoint file, so the render threads only wait for the copy, not for the disk. A later run
+// with |resume| loads the checkpoint and continues each pixel from the sample it stopped at,
+// which gives exactly the image an uninterrupted render would have.
+//
+// Checkpoint file (native byte order), replaced atomically on every write:
+//   magic "GRCKPT01", then the CheckpointKey fields as u64 scene_hash, height, width and u32
+//   samples_per_pixel, sampler, seed, then the sample counts run-length encoded as u64 run count
+//   and (u32 count, u32 length) pairs, then the sums as 3 floats per pixel.
+// The sampler state is fully described by the key and the sample counts, as the samplers are
+// stateless.
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../renderer/accumulation_buffer.h"
+#include "../renderer/camera.h"
+#include "../renderer/render_settings.h"
+#include "../renderer/renderer.h"
+#include "../renderer/scene.h"
+#include "../utils/image.h"
+#include "../utils/stopwatch.h"
+
+namespace graphics::raytracer {
+
+constexpr char kCheckpointMagic[8] = {'G', 'R', 'C', 'K', 'P', 'T', '0', '1'};
+
+// What a checkpoint was rendered with. A checkpoint is only resumed by a render with the same key.
+struct CheckpointKey {
+  // FNV-1a hash of the scene file path (or embedded scene name), the scene file's contents, and the
+  // path, size and modification time of every file the scene references.
+  uint64_t scene_hash = 0;
+  uint64_t height = 0;
+  uint64_t width = 0;
+  uint32_t samples_per_pixel = 0;
+  uint32_t sampler = 0;
+  uint32_t seed = 0;
+
+  bool operator==(const CheckpointKey&) const = default;
+};
+
+namespace detail {
+
+constexpr uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+inline uint64_t fnv1a(uint64_t hash, std::string_view bytes) {
+  for (char c : bytes) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * kFnvPrime;
+  }
+  return hash;
+}
+
+} // namespace detail
+
+// |scene_name| is the scene file path, or "embedded:NAME" for an embedded scene. A scene file's
+// contents are hashed as well, so editing the scene between runs invalidates its checkpoints.
+// |asset_paths| are the files the scene references (eg. textures). Those can be large, so only
+// their size and modification time are hashed, which still catches them being replaced or edited.
+inline CheckpointKey MakeCheckpointKey(std::string_view scene_name, const std::vector<std::string>& asset_paths,
+                                       size_t height, size_t width, const RenderSettings& settings) {
+  uint64_t hash = detail::fnv1a(detail::kFnvOffsetBasis, scene_name);
+  if (std::ifstream file{std::string(scene_name), std::ios::binary}) {
+    char buffer[1 << 16];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+      hash = detail::fnv1a(hash, std::string_view(buffer, file.gcount()));
+    }
+  }
+  for (const std::string& path : asset_paths) {
+    hash = detail::fnv1a(hash, path);
+    // A missing file hashes as size and time 0.
+    std::error_code error;
+    const uint64_t size = std::filesystem::file_size(path, error);
+    const int64_t mtime = error ? 0 : std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    const uint64_t stamp[2] = {error ? 0 : size, static_cast<uint64_t>(error ? 0 : mtime)};
+    hash = detail::fnv1a(hash, std::string_view(reinterpret_cast<const char*>(stamp), sizeof(stamp)));
+  }
+  return CheckpointKey{.scene_hash = hash,
+                       .height = height,
+                       .width = width,
+                       .samples_per_pixel = static_cast<uint32_t>(std::max(1, settings.samples_per_pixel)),
+                       .sampler = static_cast<uint32_t>(settings.sampler.type),
+                       .seed = settings.sampler.seed};
+}
+
+namespace detail {
+
+template <typename T>
+void appendBytes(std::vector<char>& out, const T& value) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+bool readBytes(std::istream& in, T& value) {
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+inline std::vector<char> encodeCheckpoint(const CheckpointKey& key, const AccumulationBuffer& accumulation) {
+  std::vector<char> out(std::begin(kCheckpointMagic), std::end(kCheckpointMagic));
+  appendBytes(out, key.scene_hash);
+  appendBytes(out, key.height);
+  appendBytes(out, key.width);
+  appendBytes(out, key.samples_per_pixel);
+  appendBytes(out, key.sampler);
+  appendBytes(out, key.seed);
+
+  // Every pixel has the same count between passes, so the counts shrink to a single run.
+  std::vector<std::pair<uint32_t, uint32_t>> runs;
+  for (uint32_t count : accumulation.sample_counts) {
+    if (runs.empty() || runs.back().first != count || runs.back().second == UINT32_MAX) {
+      runs.emplace_back(count, 0);
+    }
+    runs.back().second++;
+  }
+  appendBytes(out, static_cast<uint64_t>(runs.size()));
+  for (const auto& [count, length] : runs) {
+    appendBytes(out, count);
+    appendBytes(out, length);
+  }
+  const char* sums = reinterpret_cast<const char*>(accumulation.sums.data());
+  out.insert(out.end(), sums, sums + accumulation.sums.size() * sizeof(Color3f));
+  return out;
+}
+
+// Writes |data| to |path| through a temporary file, so |path| always holds a complete checkpoint.
+inline bool replaceFile(const std::string& path, const std::vector<char>& data) {
+  const std::string temp_path = path + ".tmp";
+  const int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+    if (result <= 0) {
+      break;
+    }
+    written += result;
+  }
+  const bool ok = written == data.size() && ::fsync(fd) == 0;
+  ::close(fd);
+  return ok && std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+} // namespace detail
+
+// Loads the checkpoint at |path| if it was written by a render with the same |key|. Returns
+// nullopt (after printing why) otherwise.
+inline std::optional<AccumulationBuffer> LoadCheckpoint(const std::string& path, const CheckpointKey& key) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    std::cout << "No checkpoint at '" << path << "', starting over.\n";
+    return std::nullopt;
+  }
+  char magic[sizeof(kCheckpointMagic)];
+  CheckpointKey file_key;
+  if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0 ||
+      !detail::readBytes(file, file_key.scene_hash) || !detail::readBytes(file, file_key.height) ||
+      !detail::readBytes(file, file_key.width) || !detail::readBytes(file, file_key.samples_per_pixel) ||
+      !detail::readBytes(file, file_key.sampler) || !detail::readBytes(file, file_key.seed)) {
+    std::cout << "'" << path << "' is not a checkpoint, starting over.\n";
+    return std::nullopt;
+  }
+  if (file_key != key) {
+    std::cout << "Checkpoint '" << path << "' is of a different (or edited) scene, size or sampling, starting over.\n";
+    return std::nullopt;
+  }
+
+  AccumulationBuffer accumulation(key.height, key.width);
+  uint64_t num_runs = 0;
+  bool ok = detail::readBytes(file, num_runs);
+  size_t pixel = 0;
+  for (uint64_t run = 0; ok && run < num_runs; run++) {
+    uint32_t count = 0;
+    uint32_t length = 0;
+    ok = detail::readBytes(file, count) && detail::readBytes(file, length) && count <= key.samples_per_pixel &&
+         length <= accumulation.sample_counts.size() - pixel;
+    if (ok) {
+      std::fill_n(accumulation.sample_counts.begin() + pixel, length, count);
+      pixel += length;
+    }
+  }
+  ok = ok && pixel == accumulation.sample_counts.size() &&
+       file.read(reinterpret_cast<char*>(accumulation.sums.data()), accumulation.sums.size() * sizeof(Color3f));
+  if (!ok) {
+    std::cout << "Checkpoint '" << path << "' is truncated, starting over.\n";
+    return std::nullopt;
+  }
+  return accumulation;
+}
+
+// Writes checkpoints on a background thread. Only the latest submitted one matters, so one that
+// is still waiting when the next arrives is replaced.
+class CheckpointWriter {
+
+public:
+  CheckpointWriter(std::string path, const CheckpointKey& key) :
+    path_{std::move(path)}, key_{key}, writer_{[this]() { writerLoop(); }} {}
+
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  ~CheckpointWriter() {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    checkpoint_available_.notify_one();
+    writer_.join();
+  }
+
+  void Submit(AccumulationBuffer snapshot) {
+    std::lock_guard lock(mutex_);
+    pending_ = std::move(snapshot);
+    checkpoint_available_.notify_one();
+  }
+
+private:
+  void writerLoop() {
+    while (true) {
+      std::optional<AccumulationBuffer> snapshot;
+      {
+        std::unique_lock lock(mutex_);
+        checkpoint_available_.wait(lock, [&]() { return pending_.has_value() || stopping_; });
+        if (!pending_) {
+          return;
+        }
+        snapshot = std::move(pending_);
+        pending_.reset();
+      }
+      if (!detail::replaceFile(path_, detail::encodeCheckpoint(key_, *snapshot))) {
+        std::cerr << "Failed to write checkpoint '" << path_ << "'.\n";
+      }
+    }
+  }
+
+  std::string path_;
+  CheckpointKey key_;
+
+  std::mutex mutex_;
+  std::condition_variable checkpoint_available_;
+  std::optional<AccumulationBuffer> pending_{};
+  bool stopping_ = false;
+  std::thread writer_;
+};
+
+struct CheckpointSettings {
+  std::string path;
+  // Minimum time between checkpoints.
+  double interval_seconds = 60.0;
+  // Continue from the checkpoint at |path| if there is a matching one.
+  bool resume = false;
+  // Scene file path or embedded scene name, identifying the render in the checkpoint.
+  std::string scene_name;
+  // Files the scene references besides the scene file, see MakeCheckpointKey.
+  std::vector<std::string> asset_paths{};
+};
+
+// Renders |scene| into |output_image| one sample per pixel at a time, checkpointing the progress
+// as set in |checkpoint|. The checkpoint is left in place; remove it with RemoveCheckpoint once
+// the image is safely written.
+inline void RenderCheckpointed(Renderer& renderer, Image& output_image, const Camera& camera, const Scene& scene,
+                               const RenderSettings& settings, const CheckpointSettings& checkpoint) {
+  const CheckpointKey key =
+      MakeCheckpointKey(checkpoint.scene_name, checkpoint.asset_paths, output_image.height(), output_image.width(),
+                        settings);
+  std::optional<AccumulationBuffer> loaded;
+  if (checkpoint.resume) {
+    loaded = LoadCheckpoint(checkpoint.path, key);
+  }
+  AccumulationBuffer accumulation =
+      loaded ? std::move(*loaded) : AccumulationBuffer(output_image.height(), output_image.width());
+  const uint32_t total_samples = key.samples_per_pixel;
+  if (loaded) {
+    std::cout << "Resuming from checkpoint '" << checkpoint.path << "' at sample " << accumulation.min_samples()
+              << " of " << total_samples << ".\n";
+  }
+
+  // Destroyed (after writing any pending checkpoint) before the image is resolved.
+  {
+    CheckpointWriter writer(checkpoint.path, key);
+    Stopwatch since_checkpoint;
+    for (uint32_t end_sample = accumulation.min_samples() + 1; end_sample <= total_samples; end_sample++) {
+      renderer.RenderSamples(accumulation, end_sample, camera, scene, settings);
+      if (end_sample < total_samples && since_checkpoint.ElapsedMilliseconds() >= checkpoint.interval_seconds * 1000) {
+        writer.Submit(accumulation);
+        since_checkpoint.Reset();
+      }
+    }
+  }
+  accumulation.Resolve(output_image, static_cast<int>(total_samples));
+}
+
+inline void RemoveCheckpoint(const std::string& path) { std::remove(path.c_str()); }
+
+} // namespace graphics::raytracer
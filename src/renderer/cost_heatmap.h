@@ -0,0 +1,179 @@
+// Render cost diagnostics. Records what every pixel cost to render, either in wall time or in
+// ray/primitive intersection tests, and which primitives were tested the most. The costs are
+// written out as a false colored image, so slow regions of a scene can be found (and the
+// geometry responsible fixed) without a profiler.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../objects/intersectables/intersectable.h"
+#include "../utils/color.h"
+#include "../utils/frame_buffer.h"
+#include "../utils/image.h"
+#include "../utils/intersection_counters.h"
+
+namespace {
+
+// Fraction of the pixels that are at or below the top of the heatmap color scale. The scale isn't
+// set by the single most expensive pixel, since timings have outliers (e.g. preemption).
+constexpr float kHeatmapScalePercentile = 0.99f;
+
+// False color scale, from cheap to expensive (roughly the "inferno" color map).
+constexpr std::array<graphics::Color3f, 5> kHeatmapColors = {
+  graphics::Color3f{0.00f, 0.00f, 0.02f},
+  graphics::Color3f{0.34f, 0.06f, 0.43f},
+  graphics::Color3f{0.73f, 0.21f, 0.33f},
+  graphics::Color3f{0.98f, 0.55f, 0.04f},
+  graphics::Color3f{0.99f, 1.00f, 0.64f},
+};
+
+} // namespace
+
+namespace graphics::raytracer {
+
+enum class HeatmapMetric {
+  // Wall time per pixel, in microseconds.
+  kTime,
+  // Ray/primitive intersection tests per pixel, also counted per primitive.
+  kIntersectionTests,
+};
+
+inline std::optional<HeatmapMetric> ParseHeatmapMetric(std::string_view name) {
+  if (name == "time") {
+    return HeatmapMetric::kTime;
+  }
+  if (name == "tests") {
+    return HeatmapMetric::kIntersectionTests;
+  }
+  return std::nullopt;
+}
+
+struct PrimitiveCost {
+  const Intersectable* primitive;
+  uint64_t tests;
+};
+
+class CostHeatmap {
+
+public:
+  CostHeatmap(size_t height, size_t width, HeatmapMetric metric) : metric_{metric}, cost_{height, width, 0.f} {}
+
+  // Calls render() to render pixel (x, y), records what it cost and returns its result.
+  template <typename F>
+  auto Record(int x, int y, F&& render) {
+    IntersectionCounters& counters = t_intersection_counters;
+    // Counting into a hash map is slow, so don't let it distort timings.
+    counters.enabled = metric_ == HeatmapMetric::kIntersectionTests;
+    const uint64_t tests_before = counters.tests;
+    const auto start = std::chrono::steady_clock::now();
+
+    auto result = render();
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    counters.enabled = false;
+    cost_.at(y, x) = metric_ == HeatmapMetric::kTime
+                       ? std::chrono::duration<float, std::micro>(elapsed).count()
+                       : static_cast<float>(counters.tests - tests_before);
+    return result;
+  }
+
+  // Moves the per primitive counts the calling thread recorded into the heatmap. Renderers call
+  // this on each worker once it is done with a chunk of pixels.
+  void FlushThread() {
+    IntersectionCounters& counters = t_intersection_counters;
+    if (counters.per_primitive.empty()) {
+      return;
+    }
+    std::lock_guard lock(mutex_);
+    for (const auto& [primitive, tests] : counters.per_primitive) {
+      primitive_tests_[primitive] += tests;
+    }
+    counters.per_primitive.clear();
+  }
+
+  // Value at the top of the color scale of Write().
+  float ScaleMax() const {
+    std::vector<float> costs(cost_.data(), cost_.data() + cost_.size());
+    if (costs.empty()) {
+      return 0.f;
+    }
+    const size_t index = static_cast<size_t>(kHeatmapScalePercentile * (costs.size() - 1));
+    std::nth_element(costs.begin(), costs.begin() + index, costs.end());
+    return costs[index];
+  }
+
+  // Writes the costs as a false colored image.
+  void Write(std::string_view path) const {
+    const float scale_max = ScaleMax();
+    const float inv_scale = scale_max > 0.f ? 1.f / scale_max : 0.f;
+    Image image(cost_.height(), cost_.width());
+    for (size_t r = 0; r < cost_.height(); r++) {
+      for (size_t c = 0; c < cost_.width(); c++) {
+        image.set_pixel(falseColor(cost_.at(r, c) * inv_scale), r, c);
+      }
+    }
+    image.write(path);
+  }
+
+  // The |count| primitives with the most intersection tests, most tested first.
+  std::vector<PrimitiveCost> TopPrimitives(size_t count) const {
+    std::vector<PrimitiveCost> primitives;
+    primitives.reserve(primitive_tests_.size());
+    for (const auto& [primitive, tests] : primitive_tests_) {
+      primitives.push_back(PrimitiveCost{primitive, tests});
+    }
+    count = std::min(count, primitives.size());
+    std::partial_sort(primitives.begin(), primitives.begin() + count, primitives.end(),
+                      [](const PrimitiveCost& a, const PrimitiveCost& b) { return a.tests > b.tests; });
+    primitives.resize(count);
+    return primitives;
+  }
+
+  // Prints totals, the color scale and the |top_count| most tested primitives.
+  void PrintReport(std::ostream& out, size_t top_count) const {
+    double total = 0.0;
+    for (size_t i = 0; i < cost_.size(); i++) {
+      total += cost_.data()[i];
+    }
+    const std::string_view unit = metric_ == HeatmapMetric::kTime ? "us" : "intersection tests";
+    out << "Render cost: " << total << ' ' << unit << " total, " << total / std::max<size_t>(1, cost_.size())
+        << " per pixel on average. Heatmap scale tops out at " << ScaleMax() << ' ' << unit << ".\n";
+    if (metric_ != HeatmapMetric::kIntersectionTests) {
+      return;
+    }
+    out << "Most tested primitives:\n";
+    for (const PrimitiveCost& primitive : TopPrimitives(top_count)) {
+      out << "  " << primitive.tests << " tests: " << primitive.primitive->Describe() << '\n';
+    }
+  }
+
+  HeatmapMetric metric() const { return metric_; }
+
+  const FrameBuffer<float>& costs() const { return cost_; }
+
+private:
+  // Maps t in [0, 1] (clamped) onto the false color scale.
+  static Color3f falseColor(float t) {
+    const float position = std::clamp(t, 0.f, 1.f) * (kHeatmapColors.size() - 1);
+    const size_t lower = std::min(static_cast<size_t>(position), kHeatmapColors.size() - 2);
+    const float blend = position - lower;
+    return kHeatmapColors[lower] * (1.f - blend) + kHeatmapColors[lower + 1] * blend;
+  }
+
+  HeatmapMetric metric_;
+  FrameBuffer<float> cost_;
+
+  std::mutex mutex_;
+  std::unordered_map<const Intersectable*, uint64_t> primitive_tests_{};
+};
+
+} // namespace graphics::raytracer
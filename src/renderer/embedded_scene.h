@@ -0,0 +1,150 @@
+// Scenes compiled into the binary. An embedded scene is a set of constexpr arrays describing its
+// materials, primitives and lights, and everything the renderer derives from them when a scene
+// file is parsed (plane points and unit normals, triangle plane normals and normal signs) is
+// computed by the compiler instead. Instantiating one copies the arrays straight into a
+// statically dispatched scene, so there is no file to read and nothing to parse.
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "../materials/diffuse.h"
+#include "../math/vec.h"
+#include "../objects/intersectables/plane.h"
+#include "../objects/intersectables/sphere.h"
+#include "../objects/intersectables/static_intersectable_list.h"
+#include "../objects/intersectables/triangle.h"
+#include "../objects/lights/bulb.h"
+#include "../objects/lights/light_list.h"
+#include "../objects/lights/sun.h"
+#include "../renderer/scene.h"
+#include "../utils/color.h"
+#include "../utils/vertex.h"
+
+namespace graphics::raytracer::embedded {
+
+// Primitives refer to their material by index into EmbeddedScene::materials.
+struct SphereDesc {
+  math::Point3f center;
+  float radius;
+  uint32_t material;
+};
+
+struct PlaneDesc {
+  math::Point3f point;
+  math::Vector3f normal;
+  uint32_t material;
+};
+
+struct TriangleDesc {
+  std::array<math::Point3f, 3> vertices;
+  // (v1 - v0) x (v2 - v0), and Triangle::NormalSign of it.
+  math::Vector3f plane_normal;
+  float normal_sign;
+  uint32_t material;
+};
+
+struct LightDesc {
+  enum class Type { kSun, kBulb };
+  Type type;
+  // Direction towards a sun, position of a bulb.
+  math::Point3f position;
+  Color3f color;
+};
+
+// Plane Ax + By + Cz + D = 0, as the 'plane' scene command defines it.
+constexpr PlaneDesc MakePlane(float a, float b, float c, float d, uint32_t material) {
+  math::Point3f point = math::ZeroVector;
+  if (a != 0.f) {
+    point = math::UnitX * (-d / a);
+  } else if (b != 0.f) {
+    point = math::UnitY * (-d / b);
+  } else if (c != 0.f) {
+    point = math::UnitZ * (-d / c);
+  }
+  return PlaneDesc{.point = point, .normal = math::normalize(math::Vector3f{a, b, c}), .material = material};
+}
+
+constexpr TriangleDesc MakeTriangle(const math::Point3f& v0, const math::Point3f& v1, const math::Point3f& v2,
+                                    uint32_t material) {
+  const math::Vector3f plane_normal = math::cross(v1 - v0, v2 - v0);
+  return TriangleDesc{.vertices = {v0, v1, v2},
+                      .plane_normal = plane_normal,
+                      .normal_sign = Triangle::NormalSign(plane_normal, v0),
+                      .material = material};
+}
+
+struct EmbeddedScene {
+  std::string_view name;
+  // Diffuse colors, one material each.
+  std::span<const Color3f> materials;
+  std::span<const SphereDesc> spheres;
+  std::span<const PlaneDesc> planes;
+  std::span<const TriangleDesc> triangles;
+  std::span<const LightDesc> lights;
+  Color3f background_color = Color3f{0.5f, 0.7f, 1.f}; // Sky blue, like parsed scenes
+};
+
+// True if every primitive's material index is in range. Meant for static_assert.
+constexpr bool ValidMaterials(const EmbeddedScene& scene) {
+  auto valid = [&](const auto& primitives) {
+    for (const auto& primitive : primitives) {
+      if (primitive.material >= scene.materials.size()) {
+        return false;
+      }
+    }
+    return true;
+  };
+  return valid(scene.spheres) && valid(scene.planes) && valid(scene.triangles);
+}
+
+// Builds the renderable scene. Every array is allocated once at its final size.
+inline Scene Instantiate(const EmbeddedScene& embedded) {
+  std::vector<std::shared_ptr<Material>> materials;
+  materials.reserve(embedded.materials.size());
+  for (const Color3f& color : embedded.materials) {
+    materials.push_back(std::make_shared<Diffuse>(color));
+  }
+
+  std::vector<Sphere> spheres;
+  spheres.reserve(embedded.spheres.size());
+  for (const SphereDesc& sphere : embedded.spheres) {
+    spheres.emplace_back(sphere.center, sphere.radius, materials[sphere.material]);
+  }
+  std::vector<Plane> planes;
+  planes.reserve(embedded.planes.size());
+  for (const PlaneDesc& plane : embedded.planes) {
+    planes.emplace_back(plane.point, plane.normal, materials[plane.material]);
+  }
+  std::vector<Triangle> triangles;
+  triangles.reserve(embedded.triangles.size());
+  for (const TriangleDesc& triangle : embedded.triangles) {
+    triangles.emplace_back(Vertexff{triangle.vertices[0]}, Vertexff{triangle.vertices[1]},
+                           Vertexff{triangle.vertices[2]}, triangle.plane_normal, triangle.normal_sign,
+                           materials[triangle.material]);
+  }
+
+  Scene scene;
+  scene.objects = std::make_shared<StaticIntersectableList>(std::move(spheres), std::move(planes), std::move(triangles));
+  scene.background_color = embedded.background_color;
+  std::vector<Sun> suns;
+  std::vector<Bulb> bulbs;
+  scene.lights.reserve(embedded.lights.size());
+  for (const LightDesc& light : embedded.lights) {
+    if (light.type == LightDesc::Type::kSun) {
+      suns.emplace_back(light.position, light.color);
+      scene.lights.push_back(std::make_shared<Sun>(light.position, light.color));
+    } else {
+      bulbs.emplace_back(light.position, light.color);
+      scene.lights.push_back(std::make_shared<Bulb>(light.position, light.color));
+    }
+  }
+  scene.static_lights = std::make_shared<LightList>(std::move(suns), std::move(bulbs));
+  return scene;
+}
+
+} // namespace graphics::raytracer::embedded
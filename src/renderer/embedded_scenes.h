@@ -0,0 +1,102 @@
+// The scenes built into the renderer, selected with --embedded NAME. See embedded_scene.h.
+#pragma once
+
+#include <array>
+#include <string_view>
+
+#include "../renderer/embedded_scene.h"
+
+namespace graphics::raytracer::embedded {
+
+namespace basic {
+
+// Same scene as the 'scenes/basic.txt' scene file: two spheres and a triangle over a ground plane.
+constexpr std::array kMaterials = {
+  Color3f{1.f, 0.2f, 0.2f},
+  Color3f{0.2f, 1.f, 0.2f},
+  Color3f{0.8f, 0.8f, 0.8f},
+  Color3f{0.3f, 0.3f, 1.f},
+};
+constexpr std::array kSpheres = {
+  SphereDesc{.center = {0.f, 0.f, -2.f}, .radius = 0.5f, .material = 0},
+  SphereDesc{.center = {0.8f, 0.3f, -2.5f}, .radius = 0.4f, .material = 1},
+};
+constexpr std::array kPlanes = {MakePlane(0.f, 1.f, 0.f, 0.6f, 2)};
+constexpr std::array kTriangles = {
+  MakeTriangle({-1.f, -0.5f, -3.f}, {1.f, -0.5f, -3.f}, {0.f, 1.f, -3.5f}, 3),
+};
+constexpr std::array kLights = {
+  LightDesc{.type = LightDesc::Type::kSun, .position = {1.f, 1.f, 1.f}, .color = {1.f, 1.f, 1.f}},
+  LightDesc{.type = LightDesc::Type::kBulb, .position = {0.f, 1.f, -1.f}, .color = {0.5f, 0.5f, 0.5f}},
+};
+
+} // namespace basic
+
+namespace pedestal {
+
+// Axis aligned box from |min| to |max| as 12 triangles.
+constexpr std::array<TriangleDesc, 12> MakeBox(const math::Point3f& min, const math::Point3f& max, uint32_t material) {
+  const auto corner = [&](int i) {
+    return math::Point3f{(i & 1 ? max : min).data[0], (i & 2 ? max : min).data[1], (i & 4 ? max : min).data[2]};
+  };
+  // Corners of each face, in order around it. Bit k of a corner index picks max on axis k.
+  constexpr int kFaces[6][4] = {{0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6}};
+  std::array<TriangleDesc, 12> triangles{};
+  for (int face = 0; face < 6; face++) {
+    const auto& f = kFaces[face];
+    triangles[2 * face] = MakeTriangle(corner(f[0]), corner(f[1]), corner(f[2]), material);
+    triangles[2 * face + 1] = MakeTriangle(corner(f[0]), corner(f[2]), corner(f[3]), material);
+  }
+  return triangles;
+}
+
+// Product shot: a red sphere resting on a grey box pedestal, lit by a sun and two bulbs.
+constexpr std::array kMaterials = {
+  Color3f{0.9f, 0.15f, 0.1f},
+  Color3f{0.6f, 0.6f, 0.65f},
+  Color3f{0.85f, 0.85f, 0.85f},
+};
+constexpr std::array kSpheres = {
+  SphereDesc{.center = {0.f, -0.05f, -2.5f}, .radius = 0.35f, .material = 0},
+};
+constexpr std::array kPlanes = {MakePlane(0.f, 1.f, 0.f, 0.8f, 2)};
+constexpr std::array kTriangles = MakeBox({-0.4f, -0.8f, -2.9f}, {0.4f, -0.4f, -2.1f}, 1);
+constexpr std::array kLights = {
+  LightDesc{.type = LightDesc::Type::kSun, .position = {-0.5f, 1.f, 0.8f}, .color = {0.8f, 0.8f, 0.8f}},
+  LightDesc{.type = LightDesc::Type::kBulb, .position = {1.f, 0.8f, -1.5f}, .color = {0.4f, 0.4f, 0.4f}},
+  LightDesc{.type = LightDesc::Type::kBulb, .position = {-1.2f, 0.5f, -2.f}, .color = {0.2f, 0.2f, 0.3f}},
+};
+
+} // namespace pedestal
+
+constexpr std::array kEmbeddedScenes = {
+  EmbeddedScene{.name = "basic",
+                .materials = basic::kMaterials,
+                .spheres = basic::kSpheres,
+                .planes = basic::kPlanes,
+                .triangles = basic::kTriangles,
+                .lights = basic::kLights},
+  EmbeddedScene{.name = "pedestal",
+                .materials = pedestal::kMaterials,
+                .spheres = pedestal::kSpheres,
+                .planes = pedestal::kPlanes,
+                .triangles = pedestal::kTriangles,
+                .lights = pedestal::kLights},
+};
+
+static_assert(ValidMaterials(kEmbeddedScenes[0]) && ValidMaterials(kEmbeddedScenes[1]));
+// The derived data really is folded at compile time.
+static_assert(basic::kTriangles[0].plane_normal == math::Vector3f{0.f, 1.f, 3.f});
+static_assert(basic::kPlanes[0].point == math::Vector3f{0.f, -0.6f, 0.f});
+
+// Returns the embedded scene called |name|, or nullptr if there is none.
+constexpr const EmbeddedScene* FindEmbeddedScene(std::string_view name) {
+  for (const EmbeddedScene& scene : kEmbeddedScenes) {
+    if (scene.name == name) {
+      return &scene;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace graphics::raytracer::embedded
@@ -0,0 +1,30 @@
+// Auxiliary per-pixel outputs of the renderer. Besides the final (beauty) color, the renderer can
+// record what the camera ray hit first: the diffuse albedo and the surface normal. These are cheap
+// to produce, noise free, and are used to guide post processing such as denoising.
+#pragma once
+
+#include "../math/vec.h"
+#include "../utils/color.h"
+#include "../utils/frame_buffer.h"
+
+namespace graphics::raytracer {
+
+// Features of the first surface a camera ray hits.
+struct FirstHitFeatures {
+  // Attenuation of the hit material (its diffuse color), or the sky color on a miss.
+  Color3f albedo{};
+  // Surface normal at the hit point, or the zero vector on a miss.
+  math::Vector3f normal{};
+};
+
+struct FeatureBuffers {
+  FeatureBuffers(size_t height, size_t width) :
+    beauty{height, width}, albedo{height, width}, normal{height, width} {}
+
+  // Unquantized color of each pixel.
+  FrameBuffer<Color3f> beauty;
+  FrameBuffer<Color3f> albedo;
+  FrameBuffer<math::Vector3f> normal;
+};
+
+} // namespace graphics::raytracer
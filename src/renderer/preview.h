@@ -0,0 +1,157 @@
+// Interactive preview. While the camera moves, only one ray is traced per block of
+// block_size x block_size pixels and its color fills the whole block, with the block size picked
+// every frame so the frame fits in a frame time budget. Once the camera stops, every following
+// frame halves the block size, only tracing the pixels that the coarser levels haven't, until the
+// image is at full resolution (and then at the full render settings).
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <optional>
+
+#include "../renderer/camera.h"
+#include "../renderer/render_settings.h"
+#include "../renderer/renderer.h"
+#include "../renderer/scene.h"
+#include "../utils/image.h"
+
+namespace graphics::raytracer {
+
+struct PreviewSettings {
+  // Frame time the preview tries to stay under while the camera moves.
+  double target_frame_ms = 33.0;
+  // Largest block of pixels that shares one ray. Must be a power of two.
+  int max_block_size = 8;
+};
+
+struct PreviewFrameStats {
+  // Size of the blocks traced this frame (1 is full resolution).
+  int block_size;
+  // Rays traced this frame.
+  size_t rays;
+  double milliseconds;
+  // True once the image matches a full render with the given settings.
+  bool converged;
+};
+
+class PreviewRenderer {
+
+public:
+  PreviewRenderer(Renderer& renderer, size_t height, size_t width, PreviewSettings settings = {}) :
+    renderer_{renderer}, settings_{settings}, image_{renderer.AllocateImage(height, width)},
+    block_size_{settings.max_block_size} {}
+
+  // Renders the next frame from |camera|. If the camera hasn't moved since the previous frame,
+  // the previous frame is refined instead of being started over. Once converged, this is a no-op
+  // until the camera moves or Invalidate() is called.
+  PreviewFrameStats RenderFrame(const Camera& camera, const Scene& scene, const RenderSettings& settings) {
+    const auto start = std::chrono::steady_clock::now();
+    const bool moved = !last_camera_ || !sameCamera(*last_camera_, camera);
+    last_camera_ = camera;
+
+    size_t rays = 0;
+    if (moved) {
+      block_size_ = chooseBlockSize();
+      rays = renderLevel(camera, scene, settings, block_size_, 0);
+      converged_ = false;
+    } else if (block_size_ > 1) {
+      block_size_ /= 2;
+      rays = renderLevel(camera, scene, settings, block_size_, block_size_ * 2);
+    } else if (!converged_) {
+      // Levels only trace one ray through the pixel corner, so finish with a real render.
+      renderer_.Render(image_, camera, scene, settings);
+      rays = image_.height() * image_.width() * std::max(1, settings.samples_per_pixel);
+      converged_ = true;
+    }
+    if (block_size_ == 1 && isPreviewQuality(settings)) {
+      converged_ = true;
+    }
+
+    const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (moved && rays > 0) {
+      // Smooth the cost estimate a little, a single frame is a noisy measurement.
+      const double ms_per_ray = milliseconds / rays;
+      ms_per_ray_ = ms_per_ray_ > 0.0 ? 0.5 * (ms_per_ray_ + ms_per_ray) : ms_per_ray;
+    }
+    return PreviewFrameStats{.block_size = block_size_, .rays = rays, .milliseconds = milliseconds,
+                             .converged = converged_};
+  }
+
+  // Makes the next frame start over, for when the scene changed without the camera moving.
+  void Invalidate() { last_camera_.reset(); }
+
+  const Image& image() const { return image_; }
+
+private:
+  static bool sameCamera(const Camera& a, const Camera& b) {
+    auto same = [](const math::Vector3f& u, const math::Vector3f& v) {
+      return u.x == v.x && u.y == v.y && u.z == v.z;
+    };
+    return same(a.eye, b.eye) && same(a.forward, b.forward) && same(a.right, b.right) && same(a.up, b.up);
+  }
+
+  // True if one ray through the pixel corner is exactly what a full render with |settings| does.
+  static bool isPreviewQuality(const RenderSettings& settings) {
+    return settings.samples_per_pixel <= 1 && settings.sampler.type == sampling::SamplerType::kPixelCorner;
+  }
+
+  // Smallest block size expected to render within the frame time target.
+  int chooseBlockSize() const {
+    if (ms_per_ray_ <= 0.0) {
+      return settings_.max_block_size;
+    }
+    for (int block_size = 1; block_size < settings_.max_block_size; block_size *= 2) {
+      const size_t rays = ((image_.height() + block_size - 1) / block_size) * ((image_.width() + block_size - 1) / block_size);
+      if (ms_per_ray_ * rays <= settings_.target_frame_ms) {
+        return block_size;
+      }
+    }
+    return settings_.max_block_size;
+  }
+
+  // Traces one ray through the top left pixel of every |block_size| block and fills the block with
+  // its color. Blocks whose top left pixel is on the |skip_block_size| grid were already traced by
+  // the previous level and are skipped (0 skips none). Returns the number of rays traced.
+  size_t renderLevel(const Camera& camera, const Scene& scene, const RenderSettings& settings,
+                     int block_size, int skip_block_size) {
+    const int height = static_cast<int>(image_.height());
+    const int width = static_cast<int>(image_.width());
+    const int block_rows = (height + block_size - 1) / block_size;
+    std::atomic<size_t> rays{0};
+    renderer_.pool().ParallelFor(0, block_rows, 1, [&](size_t block_row, size_t) {
+      const int y0 = static_cast<int>(block_row) * block_size;
+      const int y1 = std::min(height, y0 + block_size);
+      size_t row_rays = 0;
+      for (int x0 = 0; x0 < width; x0 += block_size) {
+        if (skip_block_size > 0 && x0 % skip_block_size == 0 && y0 % skip_block_size == 0) {
+          continue;
+        }
+        const Ray ray = getCameraRay(camera, x0, y0, height, width);
+        const Color3f color = castRay(ray, scene, settings.max_depth);
+        row_rays++;
+        const int x1 = std::min(width, x0 + block_size);
+        for (int y = y0; y < y1; y++) {
+          for (int x = x0; x < x1; x++) {
+            image_.set_pixel(color, y, x);
+          }
+        }
+      }
+      rays += row_rays;
+    });
+    return rays;
+  }
+
+  Renderer& renderer_;
+  PreviewSettings settings_;
+  Image image_;
+
+  std::optional<Camera> last_camera_{};
+  // Block size of the finest level currently in the image.
+  int block_size_;
+  bool converged_ = false;
+  // Running estimate of the cost of one preview ray, 0 until the first frame.
+  double ms_per_ray_ = 0.0;
+};
+
+} // namespace graphics::raytracer
@@ -0,0 +1,353 @@
+// Hybrid primary visibility: camera rays are perfectly coherent, so instead of tracing each one
+// through the acceleration structure, the Triangle and Sphere primitives of the scene are
+// rasterized. Each primitive (a triangle's vertices, a sphere's bounds) is projected to the screen
+// once per frame and binned into tiles, then the workers take tiles and, for every pixel a
+// primitive may cover, run the primitive's own ray intersection test against the pixel's camera
+// ray, keeping the closest hit in a visibility buffer (primitive id and depth). Shading then
+// starts from the buffered hit. Pixels clearly outside a triangle's edges (the planes through the
+// camera and each edge) skip the test, which is most of a small triangle's screen rectangle.
+//
+// Coverage and depth come from the same intersection test tracing uses, and the projected extents
+// and edges are padded, so rasterizing finds exactly the hits tracing would. Primitives that can't
+// be projected (planes, compressed meshes, and anything crossing the camera plane) are traced
+// against each camera ray instead, and ties between equally distant hits are broken in the
+// scene's primitive order like the object lists do, so the image is the same as a traced one. (An
+// acceleration structure breaks ties in its traversal order, which a rasterizer can't reproduce;
+// such ties are rare, eg. a ray through the exact edge shared by two triangles.)
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "../math/vec.h"
+#include "../objects/intersectables/intersectable.h"
+#include "../objects/intersectables/sphere.h"
+#include "../objects/intersectables/triangle.h"
+#include "../renderer/camera.h"
+#include "../renderer/scene.h"
+#include "../utils/ray.h"
+#include "../utils/thread_pool.h"
+
+namespace graphics::raytracer {
+
+constexpr uint32_t kNoPrimitive = UINT32_MAX;
+constexpr size_t kRasterTileSize = 16;
+// Pixels of padding around projected extents, far more than the rounding error of projecting.
+constexpr float kRasterMargin = 0.25f;
+// Primitives with any part closer to the camera plane than this are traced rather than projected.
+constexpr float kRasterNearPlane = 1e-4f;
+// How far (in radians) a camera ray may pass outside a triangle before the intersection test is
+// skipped, several hundred times the test's rounding error on rays that don't graze the triangle.
+constexpr float kRasterEdgeTolerance = 1e-4f;
+// Rays closer than this (cosine) to the plane of a triangle are always tested, since the test's hit
+// point gets imprecise as the ray grazes the plane.
+constexpr float kRasterGrazingCosine = 0.05f;
+
+// Closest rasterized primitive of every pixel, for one camera ray per pixel.
+struct VisibilityBuffer {
+  VisibilityBuffer(size_t height, size_t width) :
+    height{height}, width{width}, primitive(height * width, kNoPrimitive), depth(height * width) {}
+
+  size_t height;
+  size_t width;
+  // Row-major. Index of the primitive in PrimaryVisibility, or kNoPrimitive.
+  std::vector<uint32_t> primitive;
+  // Distance t of the hit along the camera ray, if there is one.
+  std::vector<float> depth;
+};
+
+class PrimaryVisibility {
+
+public:
+  // Projecting a point inverts getCameraRay, which only works for an orthonormal camera basis.
+  static bool CanRasterize(const Camera& camera) {
+    constexpr float kTolerance = 1e-4f;
+    auto unit = [&](const math::Vector3f& v) { return std::abs(v * v - 1.f) < kTolerance; };
+    auto orthogonal = [&](const math::Vector3f& a, const math::Vector3f& b) { return std::abs(a * b) < kTolerance; };
+    return unit(camera.forward) && unit(camera.right) && unit(camera.up) && orthogonal(camera.forward, camera.right) &&
+           orthogonal(camera.forward, camera.up) && orthogonal(camera.right, camera.up);
+  }
+
+  // Sorts the primitives of |scene| into rasterized and traced ones for a |height| x |width| image
+  // seen from |camera|, and bins the rasterized ones into tiles.
+  PrimaryVisibility(const Scene& scene, const Camera& camera, size_t height, size_t width, ThreadPool& pool) :
+    height_{height},
+    width_{width},
+    tiles_x_{(width + kRasterTileSize - 1) / kRasterTileSize},
+    tiles_y_{(height + kRasterTileSize - 1) / kRasterTileSize},
+    bin_offsets_(tiles_x_ * tiles_y_ + 1, 0) {
+    std::vector<const Intersectable*> primitives;
+    scene.objects->CollectPrimitives(primitives);
+
+    std::vector<Coverage> coverage(primitives.size());
+    std::vector<RasterPrimitive> projected(primitives.size());
+    pool.ParallelFor(0, primitives.size(), 256, [&](size_t i, size_t) {
+      projected[i] = RasterPrimitive{.triangle = dynamic_cast<const Triangle*>(primitives[i]),
+                                     .sphere = dynamic_cast<const Sphere*>(primitives[i]),
+                                     .order = static_cast<uint32_t>(i)};
+      if (const Triangle* triangle = projected[i].triangle) {
+        const math::Point3f vertices[3] = {triangle->vertex(0), triangle->vertex(1), triangle->vertex(2)};
+        coverage[i] = project(camera, vertices, projected[i]);
+      } else if (const auto bounds = primitives[i]->Bounds(); bounds && projected[i].sphere) {
+        math::Point3f corners[8];
+        for (int corner = 0; corner < 8; corner++) {
+          corners[corner] = math::Point3f{(corner & 1 ? bounds->max : bounds->min).data[0],
+                                          (corner & 2 ? bounds->max : bounds->min).data[1],
+                                          (corner & 4 ? bounds->max : bounds->min).data[2]};
+        }
+        coverage[i] = project(camera, corners, projected[i]);
+      } else {
+        coverage[i] = Coverage::kTraced;
+      }
+    });
+
+    raster_.reserve(std::count(coverage.begin(), coverage.end(), Coverage::kRasterized));
+    for (size_t i = 0; i < primitives.size(); i++) {
+      if (coverage[i] == Coverage::kTraced) {
+        traced_.push_back(TracedPrimitive{.object = primitives[i], .order = static_cast<uint32_t>(i)});
+      } else if (coverage[i] == Coverage::kRasterized) {
+        raster_.push_back(projected[i]);
+      }
+    }
+
+    // Bins as one array, counting the primitives of every tile first.
+    forEachBin([&](size_t tile, uint32_t) { bin_offsets_[tile + 1]++; });
+    for (size_t tile = 0; tile + 1 < bin_offsets_.size(); tile++) {
+      bin_offsets_[tile + 1] += bin_offsets_[tile];
+    }
+    bins_.resize(bin_offsets_.back());
+    std::vector<uint32_t> bin_ends(bin_offsets_.begin(), bin_offsets_.end() - 1);
+    forEachBin([&](size_t tile, uint32_t index) { bins_[bin_ends[tile]++] = index; });
+  }
+
+  size_t rasterized_count() const { return raster_.size(); }
+  size_t traced_count() const { return traced_.size(); }
+
+  // Fills |buffer| with the closest rasterized primitive hit by ray_at(x, y), the camera ray of
+  // pixel (x, y), for every pixel.
+  template <typename RayAt>
+  void Rasterize(VisibilityBuffer& buffer, ThreadPool& pool, const RayAt& ray_at) const {
+    pool.ParallelFor(0, bin_offsets_.size() - 1, 1, [&](size_t tile, size_t) {
+      const int tile_x0 = static_cast<int>(tile % tiles_x_) * kTile;
+      const int tile_y0 = static_cast<int>(tile / tiles_x_) * kTile;
+      const int tile_x1 = std::min(tile_x0 + kTile, static_cast<int>(width_)) - 1;
+      const int tile_y1 = std::min(tile_y0 + kTile, static_cast<int>(height_)) - 1;
+      uint32_t primitive[kTile * kTile];
+      float depth[kTile * kTile];
+      std::fill_n(primitive, kTile * kTile, kNoPrimitive);
+      std::fill_n(depth, kTile * kTile, std::numeric_limits<float>::max());
+      const std::span<const uint32_t> bin(bins_.data() + bin_offsets_[tile], bins_.data() + bin_offsets_[tile + 1]);
+      if (!bin.empty()) {
+        Ray rays[kTile * kTile];
+        for (int y = tile_y0; y <= tile_y1; y++) {
+          for (int x = tile_x0; x <= tile_x1; x++) {
+            rays[(y - tile_y0) * kTile + (x - tile_x0)] = ray_at(x, y);
+          }
+        }
+        // The bin is in primitive order, so on a tie the later primitive wins, like in the lists.
+        for (uint32_t index : bin) {
+          const RasterPrimitive& p = raster_[index];
+          for (int y = std::max(p.y0, tile_y0); y <= std::min(p.y1, tile_y1); y++) {
+            for (int x = std::max(p.x0, tile_x0); x <= std::min(p.x1, tile_x1); x++) {
+              const int local = (y - tile_y0) * kTile + (x - tile_x0);
+              if (!p.mayHit(rays[local])) {
+                continue;
+              }
+              if (const auto t = p.distance(rays[local]); t && *t <= depth[local]) {
+                depth[local] = *t;
+                primitive[local] = index;
+              }
+            }
+          }
+        }
+      }
+      for (int y = tile_y0; y <= tile_y1; y++) {
+        for (int x = tile_x0; x <= tile_x1; x++) {
+          const int local = (y - tile_y0) * kTile + (x - tile_x0);
+          buffer.primitive[y * width_ + x] = primitive[local];
+          buffer.depth[y * width_ + x] = depth[local];
+        }
+      }
+    });
+  }
+
+  // The closest hit of |ray|, the camera ray |buffer| was rasterized with for pixel (x, y): the hit
+  // on the buffered primitive, or on a traced primitive in front of it. This is the same hit a list
+  // of all the primitives returns.
+  std::optional<ObjectIntersectionInfo> Intersect(const VisibilityBuffer& buffer, size_t x, size_t y,
+                                                  const Ray& ray) const {
+    std::optional<ObjectIntersectionInfo> closest;
+    float max_distance = std::numeric_limits<float>::max();
+    uint32_t closest_order = 0;
+    if (const uint32_t index = buffer.primitive[y * width_ + x]; index != kNoPrimitive) {
+      const RasterPrimitive& p = raster_[index];
+      closest = p.triangle ? p.triangle->Intersect(ray) : p.sphere->Intersect(ray);
+      if (closest) {
+        max_distance = closest->t;
+        closest_order = p.order;
+      }
+    }
+    for (const TracedPrimitive& traced : traced_) {
+      auto intersection_record = traced.object->Intersect(ray);
+      if (intersection_record && (intersection_record->t < max_distance ||
+                                  (intersection_record->t == max_distance && (!closest || traced.order > closest_order)))) {
+        max_distance = intersection_record->t;
+        closest_order = traced.order;
+        closest = std::move(intersection_record);
+      }
+    }
+    return closest;
+  }
+
+private:
+  static constexpr int kTile = static_cast<int>(kRasterTileSize);
+
+  struct RasterPrimitive {
+    // Exactly one of these is set. Both classes are final, so their tests are direct calls.
+    const Triangle* triangle = nullptr;
+    const Sphere* sphere = nullptr;
+    // Position in the scene's primitive order.
+    uint32_t order = 0;
+    // Pixels whose camera rays may hit the primitive, inclusive.
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = -1;
+    int y1 = -1;
+    // Triangles only: planes through the camera and each edge, facing inwards, and how far behind
+    // them a camera ray's (unit) direction may be and still hit.
+    bool edge_filter = false;
+    math::Vector3f edge_planes[3]{};
+    float edge_tolerances[3]{};
+    math::Vector3f unit_normal{};
+
+    // False if |ray| certainly misses the primitive.
+    bool mayHit(const Ray& ray) const {
+      if (!edge_filter || std::abs(unit_normal * ray.direction()) < kRasterGrazingCosine) {
+        return true;
+      }
+      for (int i = 0; i < 3; i++) {
+        if (edge_planes[i] * ray.direction() < -edge_tolerances[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    std::optional<float> distance(const Ray& ray) const {
+      return triangle ? triangle->IntersectDistance(ray) : sphere->IntersectDistance(ray);
+    }
+  };
+
+  struct TracedPrimitive {
+    const Intersectable* object;
+    uint32_t order;
+  };
+
+  enum class Coverage { kRasterized, kTraced, kCulled };
+
+  // Calls func(tile, index) for every tile each rasterized primitive may cover, in primitive order.
+  template <typename F>
+  void forEachBin(F&& func) const {
+    for (size_t index = 0; index < raster_.size(); index++) {
+      const RasterPrimitive& primitive = raster_[index];
+      for (int ty = primitive.y0 / kTile; ty <= primitive.y1 / kTile; ty++) {
+        for (int tx = primitive.x0 / kTile; tx <= primitive.x1 / kTile; tx++) {
+          func(ty * tiles_x_ + tx, static_cast<uint32_t>(index));
+        }
+      }
+    }
+  }
+
+  // Projects |points|, whose convex hull holds the primitive, to find the pixels |primitive| may
+  // cover. The primitive must be traced instead if it reaches (nearly) back to the camera plane,
+  // where projecting breaks down.
+  Coverage project(const Camera& camera, std::span<const math::Point3f> points, RasterPrimitive& primitive) const {
+    const float scale = static_cast<float>(std::max(width_, height_));
+    float min_z = std::numeric_limits<float>::max();
+    float max_z = std::numeric_limits<float>::lowest();
+    float min_x = std::numeric_limits<float>::max();
+    float max_x = std::numeric_limits<float>::lowest();
+    float min_y = std::numeric_limits<float>::max();
+    float max_y = std::numeric_limits<float>::lowest();
+    for (const math::Point3f& point : points) {
+      const math::Vector3f to_point = point - camera.eye;
+      const float z = to_point * camera.forward;
+      min_z = std::min(min_z, z);
+      max_z = std::max(max_z, z);
+      if (z < kRasterNearPlane) {
+        continue;
+      }
+      // Inverse of getCameraRay: image plane position of the camera ray through |point|.
+      const float x = ((to_point * camera.right) / z * scale + width_) / 2;
+      const float y = (height_ - (to_point * camera.up) / z * scale) / 2;
+      min_x = std::min(min_x, x);
+      max_x = std::max(max_x, x);
+      min_y = std::min(min_y, y);
+      max_y = std::max(max_y, y);
+    }
+    // Camera rays only hit points in front of the camera.
+    if (max_z < 0.f) {
+      return Coverage::kCulled;
+    }
+    if (!(min_z >= kRasterNearPlane)) {
+      return Coverage::kTraced;
+    }
+    // Pixel x has its camera rays at image plane positions [x, x + 1).
+    min_x = std::floor(min_x - kRasterMargin);
+    min_y = std::floor(min_y - kRasterMargin);
+    max_x = std::floor(max_x + kRasterMargin);
+    max_y = std::floor(max_y + kRasterMargin);
+    if (max_x < 0.f || max_y < 0.f || min_x >= width_ || min_y >= height_) {
+      return Coverage::kCulled;
+    }
+    primitive.x0 = static_cast<int>(std::max(min_x, 0.f));
+    primitive.y0 = static_cast<int>(std::max(min_y, 0.f));
+    primitive.x1 = static_cast<int>(std::min(max_x, static_cast<float>(width_ - 1)));
+    primitive.y1 = static_cast<int>(std::min(max_y, static_cast<float>(height_ - 1)));
+    if (primitive.triangle) {
+      setEdgePlanes(camera, primitive);
+    }
+    return Coverage::kRasterized;
+  }
+
+  static void setEdgePlanes(const Camera& camera, RasterPrimitive& primitive) {
+    // Skipped when the camera is (nearly) in the triangle's plane or the triangle is degenerate,
+    // where the planes are unreliable.
+    constexpr float kDegenerate = 1e-3f;
+    math::Vector3f to_vertex[3];
+    for (int i = 0; i < 3; i++) {
+      to_vertex[i] = primitive.triangle->vertex(i) - camera.eye;
+    }
+    const math::Vector3f normal = math::cross(to_vertex[1] - to_vertex[0], to_vertex[2] - to_vertex[0]);
+    // |volume| is |normal| |to_vertex[0]| times the cosine between the normal and the view direction.
+    const float volume = normal * to_vertex[0];
+    if (!(std::abs(volume) > kDegenerate * math::magnitude(normal) * math::magnitude(to_vertex[0]))) {
+      return;
+    }
+    for (int i = 0; i < 3; i++) {
+      const math::Vector3f plane = math::cross(to_vertex[i], to_vertex[(i + 1) % 3]);
+      primitive.edge_planes[i] = volume > 0.f ? plane : -plane;
+      primitive.edge_tolerances[i] = kRasterEdgeTolerance * math::magnitude(plane);
+    }
+    primitive.unit_normal = math::unit_vector(normal);
+    primitive.edge_filter = true;
+  }
+
+  size_t height_;
+  size_t width_;
+  size_t tiles_x_;
+  size_t tiles_y_;
+  std::vector<RasterPrimitive> raster_{};
+  std::vector<TracedPrimitive> traced_{};
+  // Indices into raster_ of the primitives that may cover each tile, in ascending order. Those of
+  // tile i are bins_[bin_offsets_[i]] up to bins_[bin_offsets_[i + 1]].
+  std::vector<uint32_t> bin_offsets_;
+  std::vector<uint32_t> bins_{};
+};
+
+} // namespace graphics::raytracer
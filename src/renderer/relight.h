@@ -0,0 +1,129 @@
+// Relighting cache. Keeps the primary hit of every pixel (G-buffer) and what each light
+// contributes there, so that light edits don't need to re-trace the camera rays:
+// - changing a light's color only recombines the cached per-light terms,
+// - moving (or otherwise replacing) a light only re-traces the shadow rays towards that light.
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "../math/vec.h"
+#include "../objects/lights/light.h"
+#include "../renderer/camera.h"
+#include "../renderer/renderer.h"
+#include "../renderer/scene.h"
+#include "../utils/color.h"
+#include "../utils/frame_buffer.h"
+#include "../utils/image.h"
+#include "../utils/thread_pool.h"
+
+namespace graphics::raytracer {
+
+class RelightCache {
+
+public:
+  // Traces the camera rays and every shadow ray once, on |pool|. The pool is also used by later
+  // edits, so it must outlive the cache. |scene| is copied, which is cheap since it only holds
+  // pointers to the objects and lights.
+  RelightCache(const Camera& camera, const Scene& scene, size_t height, size_t width, ThreadPool& pool) :
+    scene_{scene}, gbuffer_{height, width}, pool_{pool} {
+    const int h = static_cast<int>(height);
+    const int w = static_cast<int>(width);
+    pool_.ParallelFor(0, height, 1, [&](size_t row, size_t) {
+      const int y = static_cast<int>(row);
+      for (int x = 0; x < w; x++) {
+        const Ray ray = getCameraRay(camera, x, y, h, w);
+        Texel& texel = gbuffer_.at(y, x);
+        if (auto hit = scene_.objects->Intersect(ray)) {
+          texel.hit = true;
+          texel.point = hit->point;
+          texel.normal = hit->normal;
+          texel.color = hit->material->Scatter(ray, *hit)->attenuation;
+        } else {
+          texel.hit = false;
+          texel.color = skyColor(ray, scene_);
+        }
+      }
+    });
+
+    for (size_t i = 0; i < scene_.lights.size(); i++) {
+      light_colors_.push_back(scene_.lights[i]->Color());
+      light_samples_.emplace_back(height, width);
+      traceLight(i);
+    }
+  }
+
+  // Only rescales the cached contribution of the light, nothing is traced.
+  void SetLightColor(size_t light_index, const Color3f& color) {
+    light_colors_[light_index] = color;
+  }
+
+  // Replaces the light, eg. with one at a new position, and re-traces the shadow rays towards it.
+  void UpdateLight(size_t light_index, std::shared_ptr<Light> light) {
+    scene_.lights[light_index] = light;
+    light_colors_[light_index] = light->Color();
+    traceLight(light_index);
+  }
+
+  // Combines the cached terms into the final image. The cache holds one camera ray per pixel
+  // through the pixel corner, so this matches RenderScene with one corner sample per pixel (the
+  // default) for the current lights, not renders with more samples or another sampler.
+  void Compose(Image& output_image) const {
+    const size_t width = gbuffer_.width();
+    pool_.ParallelFor(0, gbuffer_.height(), 1, [&](size_t y, size_t) {
+      for (size_t x = 0; x < width; x++) {
+        const Texel& texel = gbuffer_.at(y, x);
+        if (!texel.hit) {
+          output_image.set_pixel(texel.color, y, x);
+          continue;
+        }
+        Color3f color = Color3f{0.f, 0.f, 0.f};
+        for (size_t i = 0; i < light_samples_.size(); i++) {
+          const LightSample& sample = light_samples_[i].at(y, x);
+          if (sample.visible) {
+            color += shadeLightSample(texel.color, light_colors_[i], sample);
+          }
+        }
+        output_image.set_pixel(color, y, x);
+      }
+    });
+  }
+
+  const Scene& scene() const { return scene_; }
+
+  // Bytes the cache of a |height| x |width| image with |num_lights| lights holds.
+  static size_t MemoryUsage(size_t height, size_t width, size_t num_lights) {
+    return height * width * (sizeof(Texel) + num_lights * sizeof(LightSample));
+  }
+
+private:
+  struct Texel {
+    bool hit;
+    math::Point3f point;
+    math::Vector3f normal;
+    // Diffuse color of the hit surface, or the sky color if nothing was hit.
+    Color3f color;
+  };
+
+  void traceLight(size_t light_index) {
+    const Light& light = *scene_.lights[light_index];
+    FrameBuffer<LightSample>& samples = light_samples_[light_index];
+    const size_t width = gbuffer_.width();
+    pool_.ParallelFor(0, gbuffer_.height(), 1, [&](size_t y, size_t) {
+      for (size_t x = 0; x < width; x++) {
+        const Texel& texel = gbuffer_.at(y, x);
+        samples.at(y, x) = texel.hit ? sampleLight(light, light_index, texel.point, texel.normal, scene_)
+                                     : LightSample{.visible = false, .intensity = 0.f, .cosine = 0.f};
+      }
+    });
+  }
+
+  Scene scene_;
+  FrameBuffer<Texel> gbuffer_;
+  // One buffer of light samples and one color per light in the scene.
+  std::vector<FrameBuffer<LightSample>> light_samples_{};
+  std::vector<Color3f> light_colors_{};
+  ThreadPool& pool_;
+};
+
+} // namespace graphics::raytracer
@@ -0,0 +1,19 @@
+// Settings shared by the render entry points.
+#pragma once
+
+#include "../sampling/sampler.h"
+
+namespace graphics::raytracer {
+
+struct RenderSettings {
+  // If this becomes > 1, then we have execessive shadow because of our diffuse model.
+  int max_depth = 1;
+  // Number of camera rays averaged per pixel. Sub-pixel positions come from |sampler|.
+  int samples_per_pixel = 1;
+  sampling::SamplerSettings sampler{};
+  // Resolve camera ray hits by rasterizing the scene's triangles and spheres (see
+  // primary_visibility.h) instead of tracing them. Gives the same image.
+  bool raster_primary = false;
+};
+
+} // namespace graphics::raytracer
@@ -1,108 +1,426 @@
 #pragma once
 
-#include <thread>
+#include <algorithm>
 
+#include "../math/precision.h"
 #include "../math/vec.h"
 #include "../utils/ray.h"
 #include "../utils/image.h"
+#include "../utils/thread_pool.h"
 #include "../renderer/camera.h"
+#include "../renderer/accumulation_buffer.h"
+#include "../renderer/cost_heatmap.h"
 #include "../renderer/scene.h"
+#include "../renderer/feature_buffers.h"
+#include "../renderer/primary_visibility.h"
+#include "../renderer/render_settings.h"
+#include "../renderer/shadow_cache.h"
+#include "../sampling/sampler.h"
 
 namespace {
 
 constexpr float kBias = 0.0001f;
+// Consecutive tiles a render worker owns. Large enough that most pages of the image buffer
+// belong to a single worker, small enough that the chunks still balance across workers.
+constexpr size_t kTilesPerChunk = 16;
 
 } // namespace
 
 namespace graphics::raytracer {
 
-Color3f castRay(const Ray& ray, const Scene& scene, [[maybe_unused]] int cur_depth) {
-  Color3f ray_color = Color3f{0.f, 0.f, 0.f};
+// How much of a light reaches a surface point, before the light's color is applied.
+struct LightSample {
+  // False if the point is in shadow, in which case the other fields are 0.
+  bool visible;
+  float intensity;
+  // Cosine between the surface normal and the direction to the light, clamped to 0.
+  float cosine;
+};
 
-  // Check to see if this ray intersects anything at all
-  if (auto intersect_result = scene.objects->Intersect(ray)) {
-    // Then check to see if this ray scatters any light (by default it will)
-    auto scatter_result = intersect_result->material->Scatter(ray, *intersect_result);
+// Traces the shadow ray from |point| towards |light|, the |light_index|th light of the scene, and
+// evaluates the light there. Templated on the light type so that concrete (final) light types are
+// evaluated without virtual calls.
+template <typename LightT>
+LightSample sampleLight(const LightT& light, size_t light_index, const math::Point3f& point,
+                        const math::Vector3f& normal, const Scene& scene) {
+  math::Vector3f dir_to_light_norm = math::unit_vector(light.Direction(point));
+  Ray shadow_ray{point + (kBias * normal), dir_to_light_norm};
 
-    // attenuation is the color of the diffuse component of the hit object.
-    auto diffuse_color = scatter_result->attenuation;
+  // Try the object that shadowed this thread's previous point from the light before the scene.
+  ShadowOccluderCache& shadow_cache = ShadowOccluderCache::ForScene(scene);
+  if (shadow_cache.Occluded(light_index, shadow_ray)) {
+    return LightSample{.visible = false, .intensity = 0.f, .cosine = 0.f};
+  }
+  if (auto shadow_result = scene.objects->Intersect(shadow_ray); shadow_result.has_value()) {
+    shadow_cache.Store(light_index, shadow_result->object);
+    return LightSample{.visible = false, .intensity = 0.f, .cosine = 0.f};
+  }
+  // Lit points tend to be next to lit points, so don't test the old occluder for those.
+  shadow_cache.Store(light_index, nullptr);
+  return LightSample{.visible = true,
+                     .intensity = light.Intensity(point),
+                     .cosine = std::max(0.f, normal * dir_to_light_norm)};
+}
 
-    for (const auto& light : scene.lights) {
- 
-      math::Vector3f dir_to_light_norm = normalize(light->Direction(intersect_result->point));
-      Ray shadow_ray{intersect_result->point + (kBias * intersect_result->normal), dir_to_light_norm};
+// Color a diffuse surface reflects from a light sample.
+Color3f shadeLightSample(const Color3f& diffuse_color, const Color3f& light_color, const LightSample& sample) {
+  Color3f lighting_multiplier = light_color * sample.intensity;
+  return elem_prod(diffuse_color, lighting_multiplier * sample.cosine);
+}
 
-      if (auto shadow_result = scene.objects->Intersect(shadow_ray); !shadow_result.has_value()) {
-        float shadow_multiplier = std::max(0.f, intersect_result->normal * dir_to_light_norm);
-        Color3f lighting_multiplier = light->Color() * light->Intensity(intersect_result->point);
-        ray_color += elem_prod(diffuse_color, lighting_multiplier * shadow_multiplier);
-      }
-    }
-    return ray_color;
+// Calls func(light) for every light in the scene. Uses the statically typed light list when the
+// scene has one, so func is instantiated for each concrete light type.
+template <typename F>
+void forEachLight(const Scene& scene, F&& func) {
+  if (scene.static_lights) {
+    scene.static_lights->ForEach(func);
+    return;
+  }
+  for (const auto& light : scene.lights) {
+    func(*light);
   }
+}
 
-  // Make the background sky color look pretty by making it a gradient.
-  math::Vector3f unit = normalize(ray.direction());
+// Make the background sky color look pretty by making it a gradient.
+Color3f skyColor(const Ray& ray, const Scene& scene) {
+  math::Vector3f unit = math::unit_vector(ray.direction());
   float a = 0.5 * (unit.y + 1.0);
   return (1.f - a) * Color3f{1.f, 1.f, 1.f} + a * scene.background_color;
 }
 
+// Color |ray| sees where it hits the scene at |hit|. If |first_hit| is set, it is filled in with
+// the albedo and normal of the surface.
+Color3f shadeHit(const Ray& ray, const ObjectIntersectionInfo& hit, const Scene& scene,
+                 FirstHitFeatures* first_hit = nullptr) {
+  Color3f ray_color = Color3f{0.f, 0.f, 0.f};
+
+  // Check to see if this ray scatters any light (by default it will)
+  auto scatter_result = hit.material->Scatter(ray, hit);
+
+  // attenuation is the color of the diffuse component of the hit object.
+  auto diffuse_color = scatter_result->attenuation;
+
+  if (first_hit) {
+    *first_hit = FirstHitFeatures{.albedo = diffuse_color, .normal = hit.normal};
+  }
 
-Ray getCameraRay(const Camera& camera, int x, int y, int H, int W) {
+  size_t light_index = 0;
+  forEachLight(scene, [&](const auto& light) {
+    const LightSample sample = sampleLight(light, light_index++, hit.point, hit.normal, scene);
+    if (sample.visible) {
+      ray_color += shadeLightSample(diffuse_color, light.Color(), sample);
+    }
+  });
+  return ray_color;
+}
+
+// Color |ray| sees when it misses the scene, filling in |first_hit| like shadeHit.
+Color3f shadeMiss(const Ray& ray, const Scene& scene, FirstHitFeatures* first_hit = nullptr) {
+  const Color3f sky_color = skyColor(ray, scene);
+  if (first_hit) {
+    *first_hit = FirstHitFeatures{.albedo = sky_color, .normal = math::ZeroVector};
+  }
+  return sky_color;
+}
+
+// Casts |ray| into the scene and returns the color it sees. If |first_hit| is set, it is filled in
+// with the albedo and normal of the surface the ray hit.
+Color3f castRay(const Ray& ray, const Scene& scene, [[maybe_unused]] int cur_depth,
+                FirstHitFeatures* first_hit = nullptr) {
+  // Check to see if this ray intersects anything at all
+  if (auto intersect_result = scene.objects->Intersect(ray)) {
+    return shadeHit(ray, *intersect_result, scene, first_hit);
+  }
+  return shadeMiss(ray, scene, first_hit);
+}
+
+
+// Ray through the image plane position (x, y), in pixels. Integer coordinates are pixel corners.
+// Its spread angle is the angle one pixel of the H x W image covers.
+Ray getCameraRay(const Camera& camera, float x, float y, int H, int W) {
   const float sx = (2 * x - W) / static_cast<float>(std::max(W, H));
   const float sy = (H - 2 * y) / static_cast<float>(std::max(W, H));
 
   const math::Vector3f origin = camera.eye;
-  const math::Vector3f direction = math::normalize(camera.forward + camera.right * sx + camera.up * sy);
+  const math::Vector3f direction = math::unit_vector(camera.forward + camera.right * sx + camera.up * sy);
+  const float pixel_angle = 2.f * magnitude(camera.right) / (std::max(W, H) * magnitude(camera.forward));
+
+  return Ray{origin, direction, pixel_angle};
+}
 
-  return Ray{origin, direction};
+
+// Renders pixel (x, y) by averaging settings.samples_per_pixel camera rays through it. If
+// |first_hit| is set, it receives the average first hit features over those rays.
+Color3f renderPixel(const Camera& camera, const Scene& scene, int x, int y, int height, int width,
+                    const RenderSettings& settings, FirstHitFeatures* first_hit = nullptr) {
+  const int num_samples = std::max(1, settings.samples_per_pixel);
+  if (num_samples == 1 && settings.sampler.type == sampling::SamplerType::kPixelCorner) {
+    return castRay(getCameraRay(camera, x, y, height, width), scene, settings.max_depth, first_hit);
+  }
+
+  Color3f color = colors::Black;
+  FirstHitFeatures features_sum{};
+  for (int s = 0; s < num_samples; s++) {
+    // Dimension 0 is the position inside the pixel.
+    const sampling::Sample2f offset = sampling::Sample2D(settings.sampler, x, y, s, 0);
+    const Ray ray = getCameraRay(camera, x + offset.x, y + offset.y, height, width);
+    FirstHitFeatures sample_features;
+    color += castRay(ray, scene, settings.max_depth, first_hit ? &sample_features : nullptr);
+    if (first_hit) {
+      features_sum.albedo += sample_features.albedo;
+      features_sum.normal += sample_features.normal;
+    }
+  }
+  const float inv_samples = 1.f / num_samples;
+  if (first_hit) {
+    *first_hit = FirstHitFeatures{.albedo = features_sum.albedo * inv_samples,
+                                  .normal = features_sum.normal * inv_samples};
+  }
+  return color * inv_samples;
+}
+
+// Adds samples [first_sample, end_sample) of pixel (x, y) to |sum|. Taking every sample this way
+// and scaling the sum by 1 / settings.samples_per_pixel gives exactly the color renderPixel does.
+void accumulatePixelSamples(const Camera& camera, const Scene& scene, int x, int y, int height, int width,
+                            const RenderSettings& settings, uint32_t first_sample, uint32_t end_sample,
+                            Color3f& sum) {
+  if (settings.samples_per_pixel <= 1 && settings.sampler.type == sampling::SamplerType::kPixelCorner) {
+    if (first_sample < end_sample) {
+      sum += castRay(getCameraRay(camera, x, y, height, width), scene, settings.max_depth);
+    }
+    return;
+  }
+  for (uint32_t s = first_sample; s < end_sample; s++) {
+    const sampling::Sample2f offset = sampling::Sample2D(settings.sampler, x, y, s, 0);
+    sum += castRay(getCameraRay(camera, x + offset.x, y + offset.y, height, width), scene, settings.max_depth);
+  }
 }
 
+// Renders pixel (x, y) into |output_image|. If |features| is set, the unquantized color and the
+// first hit albedo/normal of the pixel are recorded into it as well. If |heatmap| is set, it
+// records what the pixel cost.
+void renderAndStorePixel(Image& output_image, const Camera& camera, const Scene& scene, int x, int y,
+                         const RenderSettings& settings, FeatureBuffers* features, CostHeatmap* heatmap) {
+  const int height = static_cast<int>(output_image.height());
+  const int width = static_cast<int>(output_image.width());
+  FirstHitFeatures first_hit;
+  auto render = [&]() {
+    return renderPixel(camera, scene, x, y, height, width, settings, features ? &first_hit : nullptr);
+  };
+  const Color3f beauty = heatmap ? heatmap->Record(x, y, render) : render();
+  if (features) {
+    features->beauty.at(y, x) = beauty;
+    features->albedo.at(y, x) = first_hit.albedo;
+    features->normal.at(y, x) = first_hit.normal;
+  }
+  // Stored unclamped, the output pass clamps (or tonemaps) it.
+  output_image.set_pixel(beauty, y, x);
+}
 
 // Template here to pass in templated image
+// If |features| is set, the unquantized color and the first hit albedo/normal of every pixel
+// are recorded into it as well. If |heatmap| is set, it records the cost of every pixel.
 void RenderSceneHelper(Image& output_image, const Camera& camera, const Scene& scene,
-                       int min_height, int max_height, int max_depth) {
-  // Have to cast to an integer since this will mess up negative division.
-  const int height = static_cast<int>(output_image.height());
+                       int min_height, int max_height, const RenderSettings& settings,
+                       FeatureBuffers* features = nullptr, CostHeatmap* heatmap = nullptr) {
   const int width = static_cast<int>(output_image.width());
 
   // Basic loop for rendering - go through every pixel in the scene, cast
-  // a ray from it, and see what color it is. Assign that color to the
-  // pixel we just shot a ray from.
+  // rays through it, and see what color it is. Assign that color to the
+  // pixel we just shot the rays from.
   for (int y = min_height; y < max_height; y++) {
     for (int x = 0; x < width; x++) {
-      const Ray ray = getCameraRay(camera, x, y, height, width);
-      // Make sure the color is within 0 - 1.
-      const Color3f color = clamp_color3f(castRay(ray, scene, max_depth));
-      output_image.set_pixel(color, y, x);
+      renderAndStorePixel(output_image, camera, scene, x, y, settings, features, heatmap);
+    }
+  }
+  if (heatmap) {
+    heatmap->FlushThread();
+  }
+}
+
+// Renders every pixel of tile |tile| (row-major tile index) of |output_image|.
+void renderTile(Image& output_image, const Camera& camera, const Scene& scene, size_t tile,
+                const RenderSettings& settings, FeatureBuffers* features, CostHeatmap* heatmap) {
+  const int tile_size = static_cast<int>(Image::kTileSize);
+  const int x0 = static_cast<int>(tile % output_image.tiles_x()) * tile_size;
+  const int y0 = static_cast<int>(tile / output_image.tiles_x()) * tile_size;
+  const int x1 = std::min(x0 + tile_size, static_cast<int>(output_image.width()));
+  const int y1 = std::min(y0 + tile_size, static_cast<int>(output_image.height()));
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      renderAndStorePixel(output_image, camera, scene, x, y, settings, features, heatmap);
     }
   }
 }
 
-void RenderSceneMultithreaded(Image& output_image, const Camera& camera, const Scene& scene, int max_depth) {
-  constexpr int num_threads = 8;
+// Multithreaded renderer. Owns a persistent thread pool, so rendering many frames (or many
+// scenes) in one process doesn't create threads per frame.
+//
+// Tiles are split into chunks of kTilesPerChunk and chunk i is always rendered by worker
+// i % num_threads. Since the assignment is fixed, an image from AllocateImage() has each chunk
+// first touched, and therefore backed by memory on the NUMA node, of the worker that renders it.
+class Renderer {
 
-  const int height = static_cast<int>(output_image.height());
-  const int chunk_size = height / num_threads;
+public:
+  // |num_threads| = 0 uses one worker per hardware thread. See ThreadPool for |pin_threads|.
+  explicit Renderer(size_t num_threads = 0, bool pin_threads = false) : pool_{num_threads, pin_threads} {}
+
+  // Allocates a black image, clearing every chunk of tiles on the worker that will render it.
+  Image AllocateImage(size_t height, size_t width) {
+    Image image(height, width, Image::Initialization::kDeferred);
+    forEachOwnedChunk(image.tile_count(), [&](size_t first_tile, size_t last_tile) {
+      image.clear_tiles(first_tile, last_tile);
+    });
+    return image;
+  }
 
-  std::vector<std::thread> threads(num_threads);
-  // Begin executing our fast render subprocess on each thread
-  for (int i = 0; i < num_threads; i++) {
-    int start_index = i * chunk_size;
-    int end_index = (i == num_threads - 1 ? height : (i + 1) * chunk_size);
-    // Note that output image is passed in by reference since we need each thread
-    // to modify the image buffer directly.
-    threads[i] = std::thread(RenderSceneHelper, std::ref(output_image), camera, scene, start_index, end_index, max_depth);
+  void Render(Image& output_image, const Camera& camera, const Scene& scene,
+              const RenderSettings& settings, FeatureBuffers* features = nullptr,
+              CostHeatmap* heatmap = nullptr) {
+    // The heatmap measures the cost of tracing every pixel, so it always traces.
+    if (settings.raster_primary && !heatmap && PrimaryVisibility::CanRasterize(camera)) {
+      renderRasterized(output_image, camera, scene, settings, features);
+      return;
+    }
+    forEachOwnedChunk(output_image.tile_count(), [&](size_t first_tile, size_t last_tile) {
+      for (size_t tile = first_tile; tile < last_tile; tile++) {
+        renderTile(output_image, camera, scene, tile, settings, features, heatmap);
+      }
+      if (heatmap) {
+        heatmap->FlushThread();
+      }
+    });
   }
-  // Stop the threads by joining them all
-  for (int i = 0; i < num_threads; i++) {
-    threads[i].join();
+
+  // Renders rows [first_row, first_row + band.height()) of a |frame_height| tall frame into
+  // |band|, which is as wide as the frame. Pixels come out exactly as they would in a full render.
+  void RenderRows(Image& band, size_t first_row, size_t frame_height, const Camera& camera, const Scene& scene,
+                  const RenderSettings& settings) {
+    const int tile_size = static_cast<int>(Image::kTileSize);
+    const int width = static_cast<int>(band.width());
+    forEachOwnedChunk(band.tile_count(), [&](size_t first_tile, size_t last_tile) {
+      for (size_t tile = first_tile; tile < last_tile; tile++) {
+        const int x0 = static_cast<int>(tile % band.tiles_x()) * tile_size;
+        const int y0 = static_cast<int>(tile / band.tiles_x()) * tile_size;
+        const int x1 = std::min(x0 + tile_size, width);
+        const int y1 = std::min(y0 + tile_size, static_cast<int>(band.height()));
+        for (int y = y0; y < y1; y++) {
+          for (int x = x0; x < x1; x++) {
+            const Color3f color = renderPixel(camera, scene, x, static_cast<int>(first_row) + y,
+                                              static_cast<int>(frame_height), width, settings);
+            band.set_pixel(color, y, x);
+          }
+        }
+      }
+    });
   }
+
+  // Takes the samples of every pixel of |accumulation| up to (but not including) |end_sample|,
+  // continuing from the number of samples each pixel already has.
+  void RenderSamples(AccumulationBuffer& accumulation, uint32_t end_sample, const Camera& camera,
+                     const Scene& scene, const RenderSettings& settings) {
+    const int height = static_cast<int>(accumulation.height);
+    const int width = static_cast<int>(accumulation.width);
+    pool_.ParallelFor(0, accumulation.height, 1, [&](size_t y, size_t) {
+      for (int x = 0; x < width; x++) {
+        const size_t pixel = y * width + x;
+        uint32_t& count = accumulation.sample_counts[pixel];
+        if (count < end_sample) {
+          accumulatePixelSamples(camera, scene, x, static_cast<int>(y), height, width, settings, count, end_sample,
+                                 accumulation.sums[pixel]);
+          count = end_sample;
+        }
+      }
+    });
+  }
+
+  ThreadPool& pool() { return pool_; }
+
+  size_t num_threads() const { return pool_.size(); }
+
+private:
+  // Render with the camera ray hits of each sample pass resolved by rasterizing. Sums the samples
+  // in the same order renderPixel does, so the image is the same as a traced one.
+  void renderRasterized(Image& output_image, const Camera& camera, const Scene& scene,
+                        const RenderSettings& settings, FeatureBuffers* features) {
+    const int height = static_cast<int>(output_image.height());
+    const int width = static_cast<int>(output_image.width());
+    const int num_samples = std::max(1, settings.samples_per_pixel);
+    const PrimaryVisibility visibility(scene, camera, output_image.height(), output_image.width(), pool_);
+    VisibilityBuffer buffer(output_image.height(), output_image.width());
+    AccumulationBuffer accumulation(output_image.height(), output_image.width());
+    std::vector<FirstHitFeatures> features_sums(features ? accumulation.sums.size() : 0);
+
+    for (int s = 0; s < num_samples; s++) {
+      auto ray_at = [&](int x, int y) {
+        // Dimension 0 is the position inside the pixel, (0, 0) for the pixel corner sampler.
+        const sampling::Sample2f offset = sampling::Sample2D(settings.sampler, x, y, s, 0);
+        return getCameraRay(camera, x + offset.x, y + offset.y, height, width);
+      };
+      visibility.Rasterize(buffer, pool_, ray_at);
+      pool_.ParallelFor(0, output_image.height(), 1, [&](size_t y, size_t) {
+        for (int x = 0; x < width; x++) {
+          const size_t pixel = y * width + x;
+          const Ray ray = ray_at(x, static_cast<int>(y));
+          FirstHitFeatures sample_features;
+          FirstHitFeatures* first_hit = features ? &sample_features : nullptr;
+          const auto hit = visibility.Intersect(buffer, x, y, ray);
+          accumulation.sums[pixel] += hit ? shadeHit(ray, *hit, scene, first_hit) : shadeMiss(ray, scene, first_hit);
+          if (features) {
+            features_sums[pixel].albedo += sample_features.albedo;
+            features_sums[pixel].normal += sample_features.normal;
+          }
+        }
+      });
+    }
+
+    accumulation.Resolve(output_image, num_samples);
+    if (features) {
+      const float inv_samples = 1.f / num_samples;
+      for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+          const size_t pixel = y * width + x;
+          features->beauty.at(y, x) = accumulation.sums[pixel] * inv_samples;
+          features->albedo.at(y, x) = features_sums[pixel].albedo * inv_samples;
+          features->normal.at(y, x) = features_sums[pixel].normal * inv_samples;
+        }
+      }
+    }
+  }
+
+  // Calls func(first_tile, last_tile) on each worker for every chunk of tiles it owns.
+  template <typename F>
+  void forEachOwnedChunk(size_t tile_count, F&& func) {
+    const size_t num_chunks = (tile_count + kTilesPerChunk - 1) / kTilesPerChunk;
+    const size_t num_workers = pool_.size();
+    pool_.RunOnAll([&](size_t worker) {
+      for (size_t chunk = worker; chunk < num_chunks; chunk += num_workers) {
+        func(chunk * kTilesPerChunk, std::min(tile_count, (chunk + 1) * kTilesPerChunk));
+      }
+    });
+  }
+
+  ThreadPool pool_;
+};
+
+// Renderer used by RenderSceneMultithreaded, with one worker per hardware thread. Created on
+// first use and kept for the rest of the process.
+Renderer& DefaultRenderer() {
+  static Renderer renderer;
+  return renderer;
+}
+
+void RenderSceneMultithreaded(Image& output_image, const Camera& camera, const Scene& scene,
+                              const RenderSettings& settings, FeatureBuffers* features = nullptr,
+                              CostHeatmap* heatmap = nullptr) {
+  DefaultRenderer().Render(output_image, camera, scene, settings, features, heatmap);
 }
 
-void RenderScene(Image& output_image, const Camera& camera, const Scene& scene, int max_depth) {
+void RenderScene(Image& output_image, const Camera& camera, const Scene& scene,
+                 const RenderSettings& settings, FeatureBuffers* features = nullptr,
+                 CostHeatmap* heatmap = nullptr) {
   const int height = static_cast<int>(output_image.height());
-  RenderSceneHelper(output_image, camera, scene, 0, height, max_depth);
+  RenderSceneHelper(output_image, camera, scene, 0, height, settings, features, heatmap);
 }
 
 } // namespace graphics::raytracer
@@ -2,18 +2,39 @@
 #include <memory>
 #include <vector>
 
-#include "../objects/intersectables/intersectable_list.h"
+#include "../objects/intersectables/intersectable.h"
 #include "../objects/lights/light.h"
+#include "../objects/lights/light_list.h"
 #include "../utils/color.h"
+#include "../utils/memory_report.h"
 
 namespace graphics::raytracer {
 
 // Represents the scene, like objects in the intersectable list
 // any lighting elements, the sky background, etc.
 struct Scene {
-  std::shared_ptr<IntersectableList> objects;
+  // Usually an IntersectableList, but can be any intersectable (eg. an acceleration structure).
+  std::shared_ptr<Intersectable> objects;
   std::vector<std::shared_ptr<Light>> lights;
   Color3f background_color{};
+  // Optional copy of |lights| grouped by concrete type. When set, shading iterates over it
+  // instead of |lights| so light evaluation doesn't go through virtual calls.
+  std::shared_ptr<const LightList> static_lights{};
 };
 
+// Adds the objects and lights of |scene| to |report|.
+inline void AccountSceneMemory(const Scene& scene, MemoryReport& report) {
+  AccountSharedObject(report, scene.objects);
+  report.Add("lights", MemoryReport::VectorBytes(scene.lights), 0);
+  for (const auto& light : scene.lights) {
+    if (report.FirstVisit(light.get())) {
+      report.Add("lights", light->MemoryUsage());
+      report.Add("control blocks", MemoryReport::kControlBlockBytes);
+    }
+  }
+  if (scene.static_lights) {
+    scene.static_lights->AccountMemory(report);
+  }
+}
+
 } // namespace graphics::raytracer
@@ -0,0 +1,117 @@
+// Per thread cache of the primitive that last blocked a shadow ray towards each light. Nearby
+// shading points are usually shadowed from a light by the same object, so testing that one
+// primitive first answers most shadow rays without traversing the scene. Whether the cached
+// primitive or the full query finds the occluder, the point is in shadow, so the cache never
+// changes the image. Hits on meshes that hold their own triangles have no primitive to cache (see
+// ObjectIntersectionInfo::object), so shadow rays after those go straight to the full query.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../objects/intersectables/intersectable.h"
+#include "../renderer/scene.h"
+
+namespace graphics::raytracer {
+
+struct ShadowCacheStats {
+  // Shadow rays that had a cached occluder to test, and how many of those it blocked.
+  uint64_t lookups = 0;
+  uint64_t hits = 0;
+
+  double hit_rate() const { return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups; }
+};
+
+class ShadowOccluderCache {
+
+public:
+  // Shadow rays towards lights at or past this index aren't cached.
+  static constexpr size_t kMaxLights = 64;
+
+  // The calling thread's cache. Occluders cached for a different scene are forgotten.
+  static ShadowOccluderCache& ForScene(const Scene& scene) {
+    thread_local ShadowOccluderCache cache;
+    // Compares the owners rather than the addresses, since a new scene could be allocated where a
+    // destroyed one was. The weak_ptr keeps the old owner's control block, and so its address, alive.
+    if (cache.scene_.owner_before(scene.objects) || scene.objects.owner_before(cache.scene_)) {
+      cache.scene_ = scene.objects;
+      cache.occluders_.fill(nullptr);
+    }
+    return cache;
+  }
+
+  // Counts over every thread, including threads that have exited.
+  static ShadowCacheStats Stats() {
+    std::lock_guard lock(registry().mutex);
+    ShadowCacheStats stats = registry().retired;
+    for (const ShadowOccluderCache* cache : registry().caches) {
+      stats.lookups += cache->lookups_.load(std::memory_order_relaxed);
+      stats.hits += cache->hits_.load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+  ShadowOccluderCache(const ShadowOccluderCache&) = delete;
+  ShadowOccluderCache& operator=(const ShadowOccluderCache&) = delete;
+
+  // True if the primitive cached for |light_index| blocks |shadow_ray|.
+  bool Occluded(size_t light_index, const Ray& shadow_ray) {
+    if (light_index >= kMaxLights || occluders_[light_index] == nullptr) {
+      return false;
+    }
+    // Only this thread writes its counters, so a relaxed load and store is enough (and doesn't
+    // need a locked instruction).
+    lookups_.store(lookups_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (!occluders_[light_index]->Intersect(shadow_ray)) {
+      return false;
+    }
+    hits_.store(hits_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Records |occluder| as the primitive that last blocked a shadow ray towards |light_index|.
+  void Store(size_t light_index, const Intersectable* occluder) {
+    if (light_index < kMaxLights) {
+      occluders_[light_index] = occluder;
+    }
+  }
+
+private:
+  struct Registry {
+    std::mutex mutex;
+    std::vector<const ShadowOccluderCache*> caches;
+    // Counts of the caches of threads that have exited.
+    ShadowCacheStats retired;
+  };
+
+  // Never destroyed, since render threads owned by other static objects can exit after it would be.
+  static Registry& registry() {
+    static Registry* registry = new Registry();
+    return *registry;
+  }
+
+  ShadowOccluderCache() {
+    std::lock_guard lock(registry().mutex);
+    registry().caches.push_back(this);
+  }
+
+  ~ShadowOccluderCache() {
+    std::lock_guard lock(registry().mutex);
+    auto& caches = registry().caches;
+    caches.erase(std::find(caches.begin(), caches.end(), this));
+    registry().retired.lookups += lookups_.load(std::memory_order_relaxed);
+    registry().retired.hits += hits_.load(std::memory_order_relaxed);
+  }
+
+  std::weak_ptr<Intersectable> scene_{};
+  std::array<const Intersectable*, kMaxLights> occluders_{};
+  std::atomic<uint64_t> lookups_{0};
+  std::atomic<uint64_t> hits_{0};
+};
+
+} // namespace graphics::raytracer
@@ -0,0 +1,25 @@
+// Builds the statically dispatched representation of a scene, see StaticIntersectableList and
+// LightList.
+#pragma once
+
+#include <memory>
+
+#include "../objects/intersectables/intersectable_list.h"
+#include "../objects/intersectables/static_intersectable_list.h"
+#include "../objects/lights/light_list.h"
+#include "../renderer/scene.h"
+
+namespace graphics::raytracer {
+
+// Returns a copy of |scene| whose primitives and lights are stored per concrete type. If the
+// scene's objects aren't an IntersectableList (eg. an acceleration structure), they are kept.
+inline Scene MakeStaticDispatchScene(const Scene& scene) {
+  Scene static_scene = scene;
+  if (const auto list = std::dynamic_pointer_cast<IntersectableList>(scene.objects)) {
+    static_scene.objects = std::make_shared<StaticIntersectableList>(*list);
+  }
+  static_scene.static_lights = std::make_shared<LightList>(scene.lights);
+  return static_scene;
+}
+
+} // namespace graphics::raytracer
@@ -0,0 +1,57 @@
+// Renders images too large to hold in memory by streaming them to disk a band of rows at a time,
+// see StreamingPpmWriter.
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+
+#include "../renderer/camera.h"
+#include "../renderer/render_settings.h"
+#include "../renderer/renderer.h"
+#include "../renderer/scene.h"
+#include "../utils/image.h"
+#include "../utils/streaming_ppm_writer.h"
+
+namespace graphics::raytracer {
+
+// Pixels per band. Bands are a whole number of tile rows, so the tiles of a band are rendered
+// (and first touched) by the workers that own them, just like a full image.
+constexpr size_t kStreamingBandPixels = size_t{1} << 22;
+// Bands waiting to be written (or being written) while the next one renders.
+constexpr size_t kStreamingPendingBands = 2;
+
+// Rows per band for images |width| pixels wide.
+inline size_t StreamingBandRows(size_t width) {
+  const size_t rows = kStreamingBandPixels / std::max<size_t>(1, width);
+  return std::max(Image::kTileSize, rows / Image::kTileSize * Image::kTileSize);
+}
+
+// Bytes of framebuffer a streaming render of an image |width| pixels wide keeps in memory: the
+// band being rendered and the ones waiting to be written.
+inline size_t StreamingMemoryUsage(size_t height, size_t width) {
+  const size_t bands = std::min(kStreamingPendingBands + 1, (height + StreamingBandRows(width) - 1) / StreamingBandRows(width));
+  return bands * Image::bytes_for(std::min(height, StreamingBandRows(width)), width);
+}
+
+// Renders a |height| x |width| image into the binary PPM at |path|, writing each band of rows as
+// soon as it is done, converted with |output_settings|. With |resume|, rows an interrupted
+// earlier render already wrote are kept.
+// Returns false if the image couldn't be written.
+inline bool RenderStreaming(Renderer& renderer, const Camera& camera, const Scene& scene, const RenderSettings& settings,
+                            size_t height, size_t width, std::string_view path, bool resume,
+                            const OutputSettings& output_settings = {}) {
+  auto writer = StreamingPpmWriter::Open(path, height, width, resume, kStreamingPendingBands, output_settings);
+  if (!writer) {
+    return false;
+  }
+  const size_t band_rows = StreamingBandRows(width);
+  for (size_t first_row = writer->completed_rows(); first_row < height; first_row += band_rows) {
+    Image band = renderer.AllocateImage(std::min(band_rows, height - first_row), width);
+    renderer.RenderRows(band, first_row, height, camera, scene, settings);
+    writer->Submit(std::move(band), first_row);
+  }
+  return writer->Finish();
+}
+
+} // namespace graphics::raytracer
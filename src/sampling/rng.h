@@ -0,0 +1,58 @@
+// Small, counter based random number generation. Random numbers are derived by hashing the
+// coordinates of what they are for (pixel, sample index, dimension, seed) instead of advancing a
+// shared generator, so the result never depends on which thread renders a pixel or in what order.
+#pragma once
+
+#include <cstdint>
+
+namespace graphics::sampling {
+
+// Hash from "Hash Functions for GPU Rendering" (Jarzynski & Olano 2020), a single round of the
+// PCG permutation. Good avalanche behaviour for its cost.
+constexpr uint32_t pcg_hash(uint32_t value) {
+  const uint32_t state = value * 747796405u + 2891336453u;
+  const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Combines a hash with another value, order dependent.
+constexpr uint32_t hash_combine(uint32_t seed, uint32_t value) {
+  return pcg_hash(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// Maps 32 random bits to a float in [0, 1). Uses the top 24 bits so the result is exact.
+constexpr float to_unit_float(uint32_t bits) {
+  return static_cast<float>(bits >> 8) * (1.f / 16777216.f);
+}
+
+// PCG32 generator (O'Neill 2014): 16 bytes of state, for when a stream of numbers is needed.
+// Seed it from a hash of the pixel/sample so the stream is still reproducible.
+class Pcg32 {
+
+public:
+  constexpr explicit Pcg32(uint64_t seed, uint64_t stream = 0) : increment_{(stream << 1u) | 1u} {
+    next();
+    state_ += seed;
+    next();
+  }
+
+  constexpr uint32_t next() {
+    const uint64_t old_state = state_;
+    state_ = old_state * 6364136223846793005ull + increment_;
+    const uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+    const uint32_t rotation = static_cast<uint32_t>(old_state >> 59u);
+    return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+  }
+
+  constexpr float next_float() {
+    return to_unit_float(next());
+  }
+
+  constexpr uint64_t state() const { return state_; }
+
+private:
+  uint64_t state_ = 0;
+  uint64_t increment_;
+};
+
+} // namespace graphics::sampling
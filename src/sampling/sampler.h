@@ -0,0 +1,151 @@
+// Per pixel sample generation. Every sample is a pure function of (pixel, sample index,
+// dimension, seed), so renders are reproducible regardless of thread count or scheduling, and a
+// render can be continued from any sample index.
+//
+// Sequences:
+// - kPixelCorner: always (0, 0), ie. one ray through the pixel's corner like the original renderer.
+// - kIndependent: uniform random samples.
+// - kStratified: jittered samples, one per cell of a ~sqrt(n) x sqrt(n) grid over the pixel.
+// - kSobol: Owen scrambled Sobol (0, 2)-sequence, with the hash based nested uniform scrambling
+//   from "Practical Hash-based Owen Scrambling" (Burley 2020). Converges fastest for smooth pixels.
+// - kBlueNoise: R2 low discrepancy sequence per pixel, with a per pixel Cranley-Patterson rotation
+//   from interleaved gradient noise (Jimenez 2014), so the error of neighbouring pixels is
+//   decorrelated and low spp noise looks like high frequency (blue) noise.
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "../math/vec.h"
+#include "../sampling/rng.h"
+
+namespace graphics::sampling {
+
+enum class SamplerType {
+  kPixelCorner,
+  kIndependent,
+  kStratified,
+  kSobol,
+  kBlueNoise,
+};
+
+inline std::optional<SamplerType> ParseSamplerType(std::string_view name) {
+  if (name == "corner") return SamplerType::kPixelCorner;
+  if (name == "independent") return SamplerType::kIndependent;
+  if (name == "stratified") return SamplerType::kStratified;
+  if (name == "sobol") return SamplerType::kSobol;
+  if (name == "bluenoise") return SamplerType::kBlueNoise;
+  return std::nullopt;
+}
+
+struct SamplerSettings {
+  SamplerType type = SamplerType::kPixelCorner;
+  // Total number of samples taken per pixel, used for stratification.
+  uint32_t samples_per_pixel = 1;
+  uint32_t seed = 0;
+};
+
+using Sample2f = math::Vector<float, 2>;
+
+namespace detail {
+
+constexpr uint32_t reverseBits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+// Permutes the bits of x such that each bit only depends on the bits below it.
+constexpr uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+// Owen scrambling of a 0.32 fixed point number.
+constexpr uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+  return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// First two dimensions of the Sobol sequence, as 0.32 fixed point numbers.
+constexpr uint32_t sobol(uint32_t index, uint32_t dimension) {
+  if (dimension == 0) {
+    return reverseBits(index);
+  }
+  uint32_t result = 0;
+  for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+    if (index & 1) {
+      result ^= v;
+    }
+  }
+  return result;
+}
+
+inline float fract(float x) {
+  return x - std::floor(x);
+}
+
+} // namespace detail
+
+// Returns the 2-d sample |sample_index| of pixel (x, y) for |dimension|, in [0, 1)^2. Different
+// dimensions (eg. 0 for the position in the pixel, 1+ for material sampling) are decorrelated.
+inline Sample2f Sample2D(const SamplerSettings& settings, uint32_t x, uint32_t y,
+                         uint32_t sample_index, uint32_t dimension) {
+  const uint32_t pixel_seed = hash_combine(hash_combine(hash_combine(settings.seed, x), y), dimension);
+
+  switch (settings.type) {
+    case SamplerType::kPixelCorner:
+      return Sample2f{0.f, 0.f};
+
+    case SamplerType::kIndependent: {
+      const uint32_t bits = hash_combine(pixel_seed, sample_index);
+      return Sample2f{to_unit_float(bits), to_unit_float(pcg_hash(bits))};
+    }
+
+    case SamplerType::kStratified: {
+      const uint32_t n = std::max(1u, settings.samples_per_pixel);
+      const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(n))));
+      const uint32_t rows = (n + columns - 1) / columns;
+      // Visit the strata in a per pixel order, so a prefix of the samples isn't clustered in the
+      // top rows of the pixel.
+      const uint32_t stratum = (sample_index + pixel_seed) % (columns * rows);
+      const uint32_t jitter = hash_combine(pixel_seed, sample_index);
+      return Sample2f{(stratum % columns + to_unit_float(jitter)) / columns,
+                      (stratum / columns + to_unit_float(pcg_hash(jitter))) / rows};
+    }
+
+    case SamplerType::kSobol: {
+      const uint32_t index = detail::nestedUniformScramble(sample_index, pixel_seed);
+      const uint32_t sx = detail::nestedUniformScramble(detail::sobol(index, 0), hash_combine(pixel_seed, 0));
+      const uint32_t sy = detail::nestedUniformScramble(detail::sobol(index, 1), hash_combine(pixel_seed, 1));
+      return Sample2f{to_unit_float(sx), to_unit_float(sy)};
+    }
+
+    case SamplerType::kBlueNoise: {
+      // R2 sequence (Roberts 2018), based on the plastic number. The sequence term is reduced in
+      // double: in float, kA1 * sample_index has no fractional bits left once it passes 2^24, and
+      // every later sample would land on one of a few points.
+      constexpr double kA1 = 0.7548776662466927;
+      constexpr double kA2 = 0.5698402909980532;
+      const auto sequence = [sample_index](double a) {
+        const double value = 0.5 + a * sample_index;
+        return static_cast<float>(value - std::floor(value));
+      };
+      const float ign = detail::fract(52.9829189f * detail::fract(0.06711056f * x + 0.00583715f * y));
+      const float rotation = to_unit_float(hash_combine(settings.seed, dimension));
+      return Sample2f{detail::fract(sequence(kA1) + ign + rotation),
+                      detail::fract(sequence(kA2) + detail::fract(ign * 1.6180339887f) + rotation)};
+    }
+  }
+  return Sample2f{0.f, 0.f};
+}
+
+} // namespace graphics::sampling
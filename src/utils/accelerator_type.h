@@ -0,0 +1,38 @@
+// The kinds of structure rays can be intersected against, as named in scene files and on the
+// command line. Building one is in renderer/accelerator.h.
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+namespace graphics::raytracer {
+
+enum class AcceleratorType {
+  // Test every object (IntersectableList).
+  kList,
+  // Uniform grid walked with a 3D-DDA (UniformGrid).
+  kGrid,
+  // Bounding volume hierarchy from the binned SAH builder: slower to build, faster to trace.
+  kBvh,
+  // Bounding volume hierarchy from the parallel Morton code (LBVH) builder: fast to build, for
+  // interactive jobs where time to first pixel matters.
+  kLbvh,
+};
+
+inline std::optional<AcceleratorType> ParseAcceleratorType(std::string_view name) {
+  if (name == "list") {
+    return AcceleratorType::kList;
+  }
+  if (name == "grid") {
+    return AcceleratorType::kGrid;
+  }
+  if (name == "bvh") {
+    return AcceleratorType::kBvh;
+  }
+  if (name == "lbvh") {
+    return AcceleratorType::kLbvh;
+  }
+  return std::nullopt;
+}
+
+} // namespace graphics::raytracer
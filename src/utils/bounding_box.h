@@ -0,0 +1,83 @@
+// Axis aligned bounding box, used by the acceleration structures to cull groups of objects
+// that a ray can't hit.
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+#include "../math/vec.h"
+#include "../utils/ray.h"
+
+namespace graphics {
+
+struct BoundingBox {
+  // An empty box has min > max, so expanding it by anything gives that thing's bounds.
+  math::Point3f min{std::numeric_limits<float>::infinity(),
+                    std::numeric_limits<float>::infinity(),
+                    std::numeric_limits<float>::infinity()};
+  math::Point3f max{-std::numeric_limits<float>::infinity(),
+                    -std::numeric_limits<float>::infinity(),
+                    -std::numeric_limits<float>::infinity()};
+
+  void Expand(const math::Point3f& point) {
+    for (int i = 0; i < 3; i++) {
+      min.data[i] = std::min(min.data[i], point.data[i]);
+      max.data[i] = std::max(max.data[i], point.data[i]);
+    }
+  }
+
+  void Expand(const BoundingBox& box) {
+    for (int i = 0; i < 3; i++) {
+      min.data[i] = std::min(min.data[i], box.min.data[i]);
+      max.data[i] = std::max(max.data[i], box.max.data[i]);
+    }
+  }
+
+  bool Empty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+
+  math::Vector3f Extent() const {
+    return Empty() ? math::ZeroVector : max - min;
+  }
+
+  math::Point3f Centroid() const {
+    return (min + max) * 0.5f;
+  }
+
+  float SurfaceArea() const {
+    const math::Vector3f e = Extent();
+    return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+  }
+
+  // Slab test. Returns the distance at which the ray enters the box (0 if it starts inside),
+  // or nullopt if it misses the box or only reaches it after |t_max|.
+  std::optional<float> Intersect(const Ray& ray, const math::Vector3f& inv_direction,
+                                 float t_max = std::numeric_limits<float>::max()) const {
+    const math::Point3f origin = ray.origin();
+    float t_enter = 0.f;
+    float t_exit = t_max;
+    for (int i = 0; i < 3; i++) {
+      float t0 = (min.data[i] - origin.data[i]) * inv_direction.data[i];
+      float t1 = (max.data[i] - origin.data[i]) * inv_direction.data[i];
+      if (t0 > t1) {
+        std::swap(t0, t1);
+      }
+      t_enter = std::max(t_enter, t0);
+      t_exit = std::min(t_exit, t1);
+      if (t_enter > t_exit) {
+        return std::nullopt;
+      }
+    }
+    return t_enter;
+  }
+};
+
+// Component wise reciprocal of a ray direction, for use with BoundingBox::Intersect.
+inline math::Vector3f inverse_direction(const Ray& ray) {
+  const math::Vector3f direction = ray.direction();
+  return math::Vector3f{1.f / direction.x, 1.f / direction.y, 1.f / direction.z};
+}
+
+} // namespace graphics
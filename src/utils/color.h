@@ -1,5 +1,6 @@
 #pragma once
 #include "../math/math_utils.h"
+#include "../math/vec.h"
 
 namespace graphics {
 
@@ -0,0 +1,48 @@
+// Simple row-major 2-d buffer of arbitrary per-pixel values. Used for auxiliary render
+// outputs (albedo, normals, ...) that are consumed by post processing passes rather than
+// written out directly like Image.
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace graphics {
+
+template <typename T>
+class FrameBuffer {
+
+public:
+  FrameBuffer() = default;
+
+  FrameBuffer(size_t height, size_t width) : height_{height}, width_{width}, buffer_(height * width) {}
+
+  FrameBuffer(size_t height, size_t width, const T& value) :
+    height_{height}, width_{width}, buffer_(height * width, value) {}
+
+  const T& at(size_t r, size_t c) const { return buffer_[width_ * r + c]; }
+
+  T& at(size_t r, size_t c) { return buffer_[width_ * r + c]; }
+
+  const T* row(size_t r) const { return buffer_.data() + width_ * r; }
+
+  T* row(size_t r) { return buffer_.data() + width_ * r; }
+
+  const T* data() const { return buffer_.data(); }
+
+  T* data() { return buffer_.data(); }
+
+  size_t width() const { return width_; }
+
+  size_t height() const { return height_; }
+
+  size_t size() const { return buffer_.size(); }
+
+  bool empty() const { return buffer_.empty(); }
+
+private:
+  size_t height_{};
+  size_t width_{};
+  std::vector<T> buffer_{};
+};
+
+} // namespace graphics
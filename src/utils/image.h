@@ -4,9 +4,14 @@
 #include <fstream>
 #include <iostream>
 #include <array>
+#include <cstring>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include "../utils/color.h"
+#include "../utils/output_transform.h"
+#include "../math/morton.h"
 
 namespace {
 
@@ -18,69 +23,186 @@ constexpr int kMaxPpmValue = 255;
 namespace graphics {
 
 // Implements a basic PPM image. Accesses to the image class should be done through set/get pixel,
-// since these transparently convert Colors between Color3f and Color3, and they access the buffer
-// with the correct offsets.
+// since these access the buffer with the correct offsets.
+//
+// Pixels hold linear radiance as floats. Values aren't clamped, so HDR values survive until the
+// image is written: write() and encode() run them through an OutputTransform (tonemapping, gamma,
+// quantization) to get 8-bit RGB.
+//
+// The buffer is not stored row-major. Pixels are grouped into square tiles of kTileSize x kTileSize
+// pixels, and inside a tile pixels are laid out in Morton (Z) order. Each tile starts on a cache line
+// boundary, so as long as every tile is written by a single thread, threads never share a cache line.
+// Use linearize() (or write()) to get the pixels back in row-major order.
 class Image {
 
 public:
-  Image(size_t height, size_t width) : height_{height}, width_{width}, buffer_{height_ * width_} {}
+  // Side length of a tile in pixels. Must be a power of two.
+  static constexpr size_t kTileSize = 8;
+  static constexpr size_t kTilePixels = kTileSize * kTileSize;
+  static constexpr size_t kCacheLineSize = 64;
+
+  struct alignas(kCacheLineSize) Tile {
+    // Deliberately leaves the pixels uninitialized, so allocating the buffer doesn't touch its
+    // memory. See Initialization::kDeferred.
+    Tile() {}
+    Color3f pixels[kTilePixels];
+  };
+
+  enum class Initialization {
+    // The buffer is zeroed (black) on construction.
+    kZero,
+    // The buffer is left uninitialized and its pages unbacked. The caller is expected to
+    // clear_tiles() or write every pixel before reading, which lets a multithreaded renderer make
+    // each worker the first to touch (and so the NUMA node that backs) the tiles it renders.
+    kDeferred,
+  };
+
+  Image(size_t height, size_t width, Initialization initialization = Initialization::kZero) :
+    height_{height},
+    width_{width},
+    tiles_x_{(width + kTileSize - 1) / kTileSize},
+    tiles_y_{(height + kTileSize - 1) / kTileSize},
+    buffer_(tiles_x_ * tiles_y_) {
+    if (initialization == Initialization::kZero) {
+      clear_tiles(0, buffer_.size());
+    }
+  }
 
-  void write(std::string_view filepath) const {
-    std::ofstream file(filepath, std::ios::binary);
+  // Writes the image as a PPM to |filepath|. Returns false if the file couldn't be written.
+  bool write(std::string_view filepath, const OutputSettings& output_settings = {}) const {
+    std::ofstream file(std::string(filepath), std::ios::binary);
+    if (!file.is_open()) {
+      return false;
+    }
 
     // Set up PPM header component.
     file << kEncoding << '\n' << width_ << ' ' << height_ << '\n' << kMaxPpmValue << '\n';
 
     // Write out all the PPM rows. Pretty print it for easier debugging, though this doesn't
     // actually matter for the actual format.
+    const std::vector<uint8_t> pixels = encode(OutputTransform(output_settings));
     for (size_t r = 0; r < height_; r++) {
       for (size_t c = 0; c < width_; c++) {
-        const auto& pixel =  get_pixel(r, c);
-        file << pixel.r << ' ' << pixel.g << ' ' << pixel.b << '\t';
+        const uint8_t* pixel = &pixels[(r * width_ + c) * 3];
+        file << int{pixel[0]} << ' ' << int{pixel[1]} << ' ' << int{pixel[2]} << '\t';
       }
       file << '\n';
     }
+    file.close();
+    return !file.fail();
+  }
+
+  // Converts the image to row-major, packed 8-bit RGB (3 bytes per pixel). Every tile is
+  // converted in one call, since its pixels are contiguous, and then scattered into its rows.
+  std::vector<uint8_t> encode(const OutputTransform& transform) const {
+    std::vector<uint8_t> bytes(height_ * width_ * 3);
+    uint8_t tile_bytes[kTilePixels * 3];
+    for (size_t tile = 0; tile < buffer_.size(); tile++) {
+      transform.Convert(&buffer_[tile].pixels[0].data[0], tile_bytes, kTilePixels * 3);
+      const size_t r0 = (tile / tiles_x_) * kTileSize;
+      const size_t c0 = (tile % tiles_x_) * kTileSize;
+      const size_t rows = std::min(kTileSize, height_ - r0);
+      const size_t columns = std::min(kTileSize, width_ - c0);
+      for (size_t ly = 0; ly < rows; ly++) {
+        uint8_t* out = &bytes[((r0 + ly) * width_ + c0) * 3];
+        for (size_t lx = 0; lx < columns; lx++) {
+          std::memcpy(out + lx * 3, &tile_bytes[math::morton_encode_2d(lx, ly) * 3], 3);
+        }
+      }
+    }
+    return bytes;
+  }
+
+  // Copies the tiled buffer out into a row-major buffer of height * width pixels. Walks the
+  // tiles one row of tiles at a time, so each tile is only pulled into cache kTileSize times.
+  std::vector<Color3f> linearize() const {
+    std::vector<Color3f> pixels(height_ * width_);
+    for (size_t r = 0; r < height_; r++) {
+      const size_t tile_row = (r / kTileSize) * tiles_x_;
+      const uint32_t local_y = r % kTileSize;
+      Color3f* out_row = pixels.data() + r * width_;
+      for (size_t tx = 0; tx < tiles_x_; tx++) {
+        const Tile& tile = buffer_[tile_row + tx];
+        const size_t c0 = tx * kTileSize;
+        const size_t count = std::min(kTileSize, width_ - c0);
+        for (size_t lx = 0; lx < count; lx++) {
+          out_row[c0 + lx] = tile.pixels[math::morton_encode_2d(lx, local_y)];
+        }
+      }
+    }
+    return pixels;
   }
 
   constexpr void set_pixel(const Color3& color, size_t r, size_t c) {
-    buffer_[to_1d(r, c)] = color;
+    set_pixel(to_color3f(color), r, c);
   }
 
   constexpr void set_pixel(const Color3f& color, size_t r, size_t c) {
-    set_pixel(to_color3(color), r, c);
+    pixel_ref(r, c) = color;
   }
 
-  constexpr Color3 get_pixel(size_t r, size_t c) const {
-    return buffer_[to_1d(r, c)];
+  constexpr Color3f get_pixel(size_t r, size_t c) const {
+    return pixel_ref(r, c);
   }
 
-  constexpr Color3& get_pixel(size_t r, size_t c) {
-    return buffer_[to_1d(r, c)];
+  constexpr Color3f& get_pixel(size_t r, size_t c) {
+    return pixel_ref(r, c);
   }
 
   constexpr size_t width() const { return width_; }
 
   constexpr size_t height() const { return height_; }
 
-  constexpr const Color3& operator[](int i) const {
-    return buffer_[i];
+  // Number of tiles along each axis. Tiles on the right and bottom edges may be partially empty.
+  constexpr size_t tiles_x() const { return tiles_x_; }
+
+  constexpr size_t tiles_y() const { return tiles_y_; }
+
+  constexpr size_t tile_count() const { return buffer_.size(); }
+
+  // Bytes of pixel storage an image of |height| x |width| needs.
+  static constexpr size_t bytes_for(size_t height, size_t width) {
+    return ((width + kTileSize - 1) / kTileSize) * ((height + kTileSize - 1) / kTileSize) * sizeof(Tile);
   }
 
-  constexpr Color3& operator[](int i) {
-    return buffer_[i];
+  // Sets tiles [first, last) to black. Tiles are numbered row-major.
+  void clear_tiles(size_t first, size_t last) {
+    std::memset(static_cast<void*>(buffer_.data() + first), 0, (last - first) * sizeof(Tile));
+  }
+
+  // Row-major pixel access, kept for compatibility with the old flat layout.
+  constexpr const Color3f& operator[](int i) const {
+    return pixel_ref(i / width_, i % width_);
+  }
+
+  constexpr Color3f& operator[](int i) {
+    return pixel_ref(i / width_, i % width_);
   }
 
 private:
 
-  int to_1d(int r, int c) const {
-    return width_ * r + c;
+  constexpr size_t to_tiled(size_t r, size_t c) const {
+    const size_t tile = (r / kTileSize) * tiles_x_ + (c / kTileSize);
+    return tile * kTilePixels + math::morton_encode_2d(c % kTileSize, r % kTileSize);
+  }
+
+  constexpr const Color3f& pixel_ref(size_t r, size_t c) const {
+    const size_t i = to_tiled(r, c);
+    return buffer_[i / kTilePixels].pixels[i % kTilePixels];
+  }
+
+  constexpr Color3f& pixel_ref(size_t r, size_t c) {
+    const size_t i = to_tiled(r, c);
+    return buffer_[i / kTilePixels].pixels[i % kTilePixels];
   }
 
   size_t height_{};
   size_t width_{};
+  size_t tiles_x_{};
+  size_t tiles_y_{};
 
-  // 1-d buffer. The buffer color is a triple of values, where each value is between 0 and 255.
-  std::vector<Color3> buffer_{};
+  // Tiled buffer of linear radiance.
+  std::vector<Tile> buffer_{};
 };
 
 } // namespace graphics
@@ -0,0 +1,37 @@
+// Per thread counters of ray/primitive intersection tests, used by the render cost heatmap.
+// Counting is off unless a heatmap is being recorded on the thread, so ordinary renders only pay
+// for one well predicted branch per test.
+//
+// Tests are counted by the primitives that run them (spheres, planes, triangles and meshes), not by
+// the lists and acceleration structures that call them, so a test is counted once however deeply
+// its primitive is nested.
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace graphics::raytracer {
+
+class Intersectable;
+
+struct IntersectionCounters {
+  bool enabled = false;
+  // Tests counted on this thread so far.
+  uint64_t tests = 0;
+  // Tests per primitive, by address. A mesh counts the triangles it tests as its own tests.
+  std::unordered_map<const Intersectable*, uint64_t> per_primitive{};
+};
+
+inline thread_local IntersectionCounters t_intersection_counters;
+
+// Records that |primitive| ran |count| intersection tests against a ray.
+inline void countIntersectionTests(const Intersectable* primitive, uint64_t count = 1) {
+  IntersectionCounters& counters = t_intersection_counters;
+  if (!counters.enabled) [[likely]] {
+    return;
+  }
+  counters.tests += count;
+  counters.per_primitive[primitive] += count;
+}
+
+} // namespace graphics::raytracer
@@ -0,0 +1,86 @@
+// Read-only memory mapping of a file (POSIX). The mapping is released when the object is destroyed.
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace graphics {
+
+class MappedFile {
+
+public:
+  MappedFile() = default;
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+      unmap();
+      data_ = other.data_;
+      size_ = other.size_;
+      other.data_ = nullptr;
+      other.size_ = 0;
+    }
+    return *this;
+  }
+
+  ~MappedFile() { unmap(); }
+
+  // Maps the whole file at |path|. Returns false if the file could not be opened or mapped.
+  // |advice| is passed to madvise, eg. MADV_SEQUENTIAL for a single streaming pass.
+  bool open(std::string_view path, int advice = MADV_NORMAL) {
+    unmap();
+    const int fd = ::open(std::string(path).c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+      ::close(fd);
+      return false;
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+      void* mapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED) {
+        ::close(fd);
+        size_ = 0;
+        return false;
+      }
+      data_ = static_cast<const char*>(mapping);
+      ::madvise(const_cast<char*>(data_), size_, advice);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    return true;
+  }
+
+  const char* data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  std::string_view view() const { return {data_, size_}; }
+
+private:
+  void unmap() {
+    if (data_) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+} // namespace graphics
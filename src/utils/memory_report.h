@@ -0,0 +1,85 @@
+// Accounting of the memory a scene needs, by category (primitive type, materials, lights, the
+// acceleration structure, the framebuffer, ...). Objects add themselves to a MemoryReport, which
+// can be printed as a table or written as JSON, and checked against a memory budget before
+// rendering starts.
+#pragma once
+
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace graphics {
+
+class MemoryReport {
+
+public:
+  // Bytes std::make_shared allocates next to the object: the use and weak counts, and the
+  // control block's vtable pointer.
+  static constexpr size_t kControlBlockBytes = 2 * sizeof(int) + sizeof(void*);
+
+  // Adds |count| items of |category| taking |bytes| in total.
+  void Add(std::string_view category, size_t bytes, size_t count = 1) {
+    for (auto& [name, entry] : entries_) {
+      if (name == category) {
+        entry.bytes += bytes;
+        entry.count += count;
+        return;
+      }
+    }
+    entries_.emplace_back(std::string(category), Entry{.bytes = bytes, .count = count});
+  }
+
+  // Returns true the first time it is called for |object|, so objects with several owners (eg.
+  // materials shared by many primitives) are only counted once.
+  bool FirstVisit(const void* object) { return visited_.insert(object).second; }
+
+  template <typename T>
+  static size_t VectorBytes(const std::vector<T>& vector) {
+    return vector.capacity() * sizeof(T);
+  }
+
+  size_t total_bytes() const {
+    size_t total = 0;
+    for (const auto& [name, entry] : entries_) {
+      total += entry.bytes;
+    }
+    return total;
+  }
+
+  // Categories in the order they were first added.
+  void Print(std::ostream& out) const {
+    out << "Memory use by category:\n";
+    for (const auto& [name, entry] : entries_) {
+      out << "  " << std::left << std::setw(20) << name << std::right << std::setw(14) << entry.bytes
+          << " bytes in " << entry.count << (entry.count == 1 ? " item\n" : " items\n");
+    }
+    out << "  " << std::left << std::setw(20) << "total" << std::right << std::setw(14) << total_bytes()
+        << " bytes\n";
+  }
+
+  void WriteJson(std::ostream& out) const {
+    out << "{\n  \"total_bytes\": " << total_bytes() << ",\n  \"categories\": [";
+    for (size_t i = 0; i < entries_.size(); i++) {
+      const auto& [name, entry] = entries_[i];
+      out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << name << "\", \"bytes\": " << entry.bytes
+          << ", \"count\": " << entry.count << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+private:
+  struct Entry {
+    size_t bytes = 0;
+    size_t count = 0;
+  };
+
+  // There are only a dozen or so categories, so a vector keeps them in a stable order cheaply.
+  std::vector<std::pair<std::string, Entry>> entries_{};
+  std::unordered_set<const void*> visited_{};
+};
+
+} // namespace graphics
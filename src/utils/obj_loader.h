@@ -0,0 +1,358 @@
+// Parallel loader for (large) Wavefront OBJ meshes. The file is memory mapped and split into
+// one byte range per pool worker, with every range boundary moved forward to the next line start.
+// Each worker parses its range into its own vertex and face arrays, then the arrays are merged
+// with a prefix sum over the per-chunk vertex/face counts. Only 'v', 'vn' and 'f' lines are used,
+// everything else (texture coordinates, groups, materials, ...) is skipped. Files too large to
+// load are streamed through StreamObj instead, one window of the file at a time.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../math/vec.h"
+#include "../utils/mapped_file.h"
+#include "../utils/thread_pool.h"
+
+namespace graphics::raytracer {
+
+// Flat, fully resolved (0-based) triangle mesh.
+struct ObjMesh {
+  std::vector<math::Point3f> vertices;
+  std::vector<std::array<uint32_t, 3>> faces;
+  // Vertex normals, and for every face the index into |normals| of the normal of each corner. Both
+  // are empty if the file has no normals, or if some faces don't have them (ie. flat shading).
+  std::vector<math::Vector3f> normals;
+  std::vector<std::array<uint32_t, 3>> face_normals;
+};
+
+// Everything parsed out of one byte range of the file.
+struct ObjChunk {
+  std::vector<math::Point3f> vertices;
+  std::vector<math::Vector3f> normals;
+  // Positive OBJ indices are already absolute and are stored 0-based. Negative indices are
+  // relative to the vertices parsed so far, which isn't known until every earlier chunk has been
+  // counted, so those are stored as chunk-local vertex indices and flagged in |relative_mask|
+  // (bits 0-2 for the positions, bits 3-5 for the normals).
+  std::vector<std::array<int64_t, 3>> faces;
+  // Normal indices of the faces that have normals on every corner, in order. They line up with
+  // |faces| if |faces_without_normals| is 0 in every chunk.
+  std::vector<std::array<int64_t, 3>> face_normals;
+  std::vector<uint8_t> relative_mask;
+  size_t faces_without_normals = 0;
+  size_t invalid_faces = 0;
+};
+
+namespace detail {
+
+inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipSpaces(const char* it, const char* end) {
+  while (it != end && isSpace(*it)) {
+    it++;
+  }
+  return it;
+}
+
+inline const char* parseFloat(const char* it, const char* end, float& value) {
+  it = skipSpaces(it, end);
+  // from_chars doesn't accept a leading '+'.
+  if (it != end && *it == '+') {
+    it++;
+  }
+  const auto result = std::from_chars(it, end, value);
+  return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+inline const char* parseIndex(const char* it, const char* end, int64_t& value) {
+  if (it != end && *it == '+') {
+    it++;
+  }
+  const auto result = std::from_chars(it, end, value);
+  return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// Parses a face vertex like "7", "-1", "7/2", "7/2/5" or "7//5". The texture coordinate index is
+// skipped, |normal| is left at 0 (which is never a valid OBJ index) if there is none.
+inline const char* parseFaceVertex(const char* it, const char* end, int64_t& position, int64_t& normal) {
+  it = parseIndex(skipSpaces(it, end), end, position);
+  if (!it) {
+    return nullptr;
+  }
+  for (int slashes = 0; it != end && *it == '/' && it + 1 != end; slashes++) {
+    it++;
+    if (slashes == 1) {
+      it = parseIndex(it, end, normal);
+      if (!it) {
+        return nullptr;
+      }
+    }
+    while (it != end && *it != '/' && !isSpace(*it) && *it != '\n') {
+      it++;
+    }
+  }
+  while (it != end && !isSpace(*it) && *it != '\n') {
+    it++;
+  }
+  return it;
+}
+
+inline void parseObjChunk(const char* begin, const char* end, ObjChunk& chunk) {
+  const char* line = begin;
+  while (line < end) {
+    const char* line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+    if (!line_end) {
+      line_end = end;
+    }
+    const char* it = skipSpaces(line, line_end);
+
+    if (line_end - it > 1 && it[0] == 'v' && isSpace(it[1])) {
+      math::Point3f point;
+      const char* cursor = it + 1;
+      for (int i = 0; i < 3 && cursor; i++) {
+        cursor = parseFloat(cursor, line_end, point.data[i]);
+      }
+      // Keep malformed vertices as the origin so later indices still line up.
+      chunk.vertices.push_back(cursor ? point : math::ZeroVector);
+    } else if (line_end - it > 2 && it[0] == 'v' && it[1] == 'n' && isSpace(it[2])) {
+      math::Vector3f normal;
+      const char* cursor = it + 2;
+      for (int i = 0; i < 3 && cursor; i++) {
+        cursor = parseFloat(cursor, line_end, normal.data[i]);
+      }
+      chunk.normals.push_back(cursor ? normal : math::ZeroVector);
+    } else if (line_end - it > 1 && it[0] == 'f' && isSpace(it[1])) {
+      // Like SceneParser::addTriangle, only the first three vertices of a face are used.
+      std::array<int64_t, 3> face;
+      std::array<int64_t, 3> normals;
+      bool has_normals = true;
+      uint8_t mask = 0;
+      const char* cursor = it + 1;
+      for (int i = 0; i < 3 && cursor; i++) {
+        int64_t index = 0;
+        int64_t normal = 0;
+        cursor = parseFaceVertex(cursor, line_end, index, normal);
+        if (index < 0) {
+          face[i] = static_cast<int64_t>(chunk.vertices.size()) + index;
+          mask |= 1 << i;
+        } else {
+          face[i] = index - 1;
+        }
+        if (normal < 0) {
+          normals[i] = static_cast<int64_t>(chunk.normals.size()) + normal;
+          mask |= 1 << (3 + i);
+        } else {
+          normals[i] = normal - 1;
+        }
+        has_normals &= normal != 0;
+      }
+      if (cursor) {
+        chunk.faces.push_back(face);
+        chunk.relative_mask.push_back(mask);
+        if (has_normals) {
+          chunk.face_normals.push_back(normals);
+        } else {
+          chunk.faces_without_normals++;
+        }
+      } else {
+        chunk.invalid_faces++;
+      }
+    }
+    line = line_end + 1;
+  }
+}
+
+// Parses [data, data + size), which starts and ends at line boundaries, into one chunk per pool
+// worker (or a single chunk for small ranges), in file order.
+inline std::vector<ObjChunk> parseObjRange(const char* data, size_t size, ThreadPool* pool) {
+  // Don't bother splitting small ranges into tiny chunks.
+  constexpr size_t kMinChunkBytes = 1 << 20;
+  const size_t num_chunks = std::clamp<size_t>(size / kMinChunkBytes, 1, WorkerCount(pool));
+
+  // Chunk i covers [bounds[i], bounds[i + 1]), every bound except the first and last is moved to
+  // just after a newline.
+  std::vector<size_t> bounds(num_chunks + 1, size);
+  bounds[0] = 0;
+  for (size_t i = 1; i < num_chunks; i++) {
+    size_t bound = std::max(bounds[i - 1], size * i / num_chunks);
+    while (bound < size && bound > 0 && data[bound - 1] != '\n') {
+      bound++;
+    }
+    bounds[i] = bound;
+  }
+
+  std::vector<ObjChunk> chunks(num_chunks);
+  ParallelFor(pool, 0, num_chunks, 1, [&](size_t i, size_t) {
+    parseObjChunk(data + bounds[i], data + bounds[i + 1], chunks[i]);
+  });
+  return chunks;
+}
+
+} // namespace detail
+
+// Bytes of the file StreamObj parses at a time.
+constexpr size_t kStreamWindowBytes = size_t{64} << 20;
+
+// Streams the OBJ file at |path|, for files too large to load. The file is parsed kStreamWindowBytes
+// at a time (on |pool|, like LoadObjParallel), and func(chunk, first_vertex) is called for every
+// chunk in file order, where |first_vertex| is the number of vertices before the chunk, which its
+// relative indices are resolved against. Windows are dropped from memory once they are parsed.
+// Returns false if the file can't be opened.
+template <typename F>
+bool StreamObj(std::string_view path, ThreadPool* pool, F&& func) {
+  MappedFile file;
+  if (!file.open(path, MADV_SEQUENTIAL)) {
+    return false;
+  }
+  const char* data = file.data();
+  const size_t size = file.size();
+  const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  uint64_t first_vertex = 0;
+  for (size_t begin = 0; begin < size;) {
+    size_t end = std::min(size, begin + kStreamWindowBytes);
+    while (end < size && data[end - 1] != '\n') {
+      end++;
+    }
+    for (const ObjChunk& chunk : detail::parseObjRange(data + begin, end - begin, pool)) {
+      func(chunk, first_vertex);
+      first_vertex += chunk.vertices.size();
+    }
+    // The mapping is file backed, so this only drops the parsed pages from memory.
+    const size_t parsed_pages = end / page_size * page_size;
+    ::madvise(const_cast<char*>(data), parsed_pages, MADV_DONTNEED);
+    begin = end;
+  }
+  return true;
+}
+
+// Loads the OBJ file at |path| on |pool|, or on the calling thread if |pool| is null. Faces that
+// reference vertices that don't exist are dropped with a warning. Faces index vertices with 32
+// bits, so files with more vertices are rejected.
+inline std::optional<ObjMesh> LoadObjParallel(std::string_view path, ThreadPool* pool = nullptr) {
+  MappedFile file;
+  if (!file.open(path, MADV_SEQUENTIAL)) {
+    std::cerr << "Unable to open file.\n";
+    return std::nullopt;
+  }
+  std::vector<ObjChunk> chunks = detail::parseObjRange(file.data(), file.size(), pool);
+  const size_t num_chunks = chunks.size();
+
+  // Exclusive prefix sums of the counts give every chunk its offset in the merged arrays.
+  std::vector<size_t> vertex_offsets(num_chunks + 1, 0);
+  std::vector<size_t> normal_offsets(num_chunks + 1, 0);
+  std::vector<size_t> face_offsets(num_chunks + 1, 0);
+  size_t faces_without_normals = 0;
+  for (size_t i = 0; i < num_chunks; i++) {
+    vertex_offsets[i + 1] = vertex_offsets[i] + chunks[i].vertices.size();
+    normal_offsets[i + 1] = normal_offsets[i] + chunks[i].normals.size();
+    face_offsets[i + 1] = face_offsets[i] + chunks[i].faces.size();
+    faces_without_normals += chunks[i].faces_without_normals;
+  }
+  const size_t num_vertices = vertex_offsets[num_chunks];
+  const size_t num_normals = normal_offsets[num_chunks];
+  const size_t num_faces = face_offsets[num_chunks];
+  if (num_vertices > UINT32_MAX || num_normals > UINT32_MAX) {
+    std::cerr << "Too many vertices (" << num_vertices << ") to load, use a geometry store.\n";
+    return std::nullopt;
+  }
+  // Shading can't mix interpolated and flat normals within a mesh, so normals are all or nothing.
+  const bool use_normals = num_faces > 0 && faces_without_normals == 0;
+  if (faces_without_normals > 0 && faces_without_normals < num_faces) {
+    std::cerr << "Ignoring vertex normals, " << faces_without_normals << " faces don't have them.\n";
+  }
+
+  ObjMesh mesh;
+  mesh.vertices.resize(num_vertices);
+  mesh.faces.resize(num_faces);
+  if (use_normals) {
+    mesh.normals.resize(num_normals);
+    mesh.face_normals.resize(num_faces);
+  }
+  std::vector<size_t> invalid_faces(num_chunks, 0);
+
+  // Resolves corner |v| of face |f| of chunk |i| to an index into an array of |count| elements
+  // whose first element of the chunk is at |offset|, or returns nullopt if it is out of range.
+  auto resolveIndex = [&](size_t i, size_t f, int v, int64_t index, size_t offset, size_t count) -> std::optional<uint32_t> {
+    if (chunks[i].relative_mask[f] & (1 << v)) {
+      index += static_cast<int64_t>(offset);
+    }
+    if (index < 0 || static_cast<size_t>(index) >= count) {
+      return std::nullopt;
+    }
+    return static_cast<uint32_t>(index);
+  };
+
+  ParallelFor(pool, 0, num_chunks, 1, [&](size_t i, size_t) {
+    const ObjChunk& chunk = chunks[i];
+    std::copy(chunk.vertices.begin(), chunk.vertices.end(), mesh.vertices.begin() + vertex_offsets[i]);
+    if (use_normals) {
+      std::copy(chunk.normals.begin(), chunk.normals.end(), mesh.normals.begin() + normal_offsets[i]);
+    }
+
+    size_t out = face_offsets[i];
+    for (size_t f = 0; f < chunk.faces.size(); f++) {
+      std::array<uint32_t, 3> face;
+      std::array<uint32_t, 3> normals{};
+      bool valid = true;
+      for (int v = 0; v < 3; v++) {
+        const auto index = resolveIndex(i, f, v, chunk.faces[f][v], vertex_offsets[i], num_vertices);
+        valid &= index.has_value();
+        face[v] = index.value_or(0);
+        if (use_normals) {
+          const auto normal = resolveIndex(i, f, 3 + v, chunk.face_normals[f][v], normal_offsets[i], num_normals);
+          valid &= normal.has_value();
+          normals[v] = normal.value_or(0);
+        }
+      }
+      if (valid) {
+        if (use_normals) {
+          mesh.face_normals[out] = normals;
+        }
+        mesh.faces[out++] = face;
+      } else {
+        invalid_faces[i]++;
+      }
+    }
+    // Mark the unused tail of this chunk's face range, it is compacted away below.
+    for (; out < face_offsets[i + 1]; out++) {
+      mesh.faces[out] = {UINT32_MAX, UINT32_MAX, UINT32_MAX};
+    }
+    invalid_faces[i] += chunk.invalid_faces;
+  });
+
+  size_t num_invalid = 0;
+  for (size_t count : invalid_faces) {
+    num_invalid += count;
+  }
+  if (num_invalid > 0) {
+    std::cerr << "Skipped " << num_invalid << " malformed or out of range faces.\n";
+    size_t kept = 0;
+    for (size_t f = 0; f < mesh.faces.size(); f++) {
+      if (mesh.faces[f][0] == UINT32_MAX) {
+        continue;
+      }
+      if (use_normals) {
+        mesh.face_normals[kept] = mesh.face_normals[f];
+      }
+      mesh.faces[kept++] = mesh.faces[f];
+    }
+    mesh.faces.resize(kept);
+    if (use_normals) {
+      mesh.face_normals.resize(kept);
+    }
+  }
+  return mesh;
+}
+
+} // namespace graphics::raytracer
@@ -0,0 +1,381 @@
+// Command line options for the ray tracer binary. Usage:
+//   rayTracer {path to scene file} [flags]
+//   rayTracer --embedded NAME [flags]
+//   rayTracer --batch MANIFEST [flags]
+#pragma once
+
+#include <charconv>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "../materials/texture_cache.h"
+#include "../renderer/cost_heatmap.h"
+#include "../renderer/embedded_scenes.h"
+#include "../sampling/sampler.h"
+#include "../utils/accelerator_type.h"
+#include "../utils/output_transform.h"
+
+namespace graphics {
+
+struct Options {
+  std::string scene_path;
+  // Render the scene compiled into the binary with this name instead of a scene file.
+  std::string embedded_scene;
+  // Render every job of this manifest (see batch_render.h) instead of a single scene.
+  std::string batch_path;
+  // Size of the rendered image in pixels.
+  size_t width = 400;
+  size_t height = 400;
+  // Stream the image to a binary PPM here a band of rows at a time, instead of keeping all of it
+  // in memory and writing ./test.ppm at the end.
+  std::string stream_path;
+  // Checkpoint the render state here every |checkpoint_interval_s| seconds.
+  std::string checkpoint_path;
+  double checkpoint_interval_s = 60.0;
+  // Continue an interrupted streamed or checkpointed render of the same size.
+  bool resume = false;
+  // How the linear radiance is turned into 8-bit output.
+  OutputSettings output{};
+  // Run the feature guided denoiser over the rendered image before writing it.
+  bool denoise = false;
+  // Load OBJ meshes into the compressed (quantized) geometry representation.
+  bool compress_geometry = false;
+  // Render OBJ meshes out-of-core from a memory mapped geometry store at this path.
+  std::string geometry_store_path;
+  // Store primitives and lights in per type arrays so intersection and shading avoid virtual calls.
+  bool static_dispatch = false;
+  // Resolve camera ray hits by rasterizing triangles and spheres instead of tracing them.
+  bool raster_primary = false;
+  // Camera rays per pixel, and the sequence their sub-pixel positions come from.
+  int samples_per_pixel = 1;
+  std::optional<sampling::SamplerType> sampler{};
+  uint32_t seed = 0;
+  // Render worker threads, 0 for one per hardware thread, and whether to pin them to CPUs.
+  int num_threads = 0;
+  bool pin_threads = false;
+  // Run the interactive preview with the camera moving for this many frames, then refine.
+  int preview_frames = 0;
+  double preview_target_ms = 33.0;
+  // Relight demo: render once into a relighting cache, then apply this many light edits to it.
+  int relight_edits = 0;
+  // Write a false colored render cost image here, and what the cost is measured in.
+  std::string heatmap_path;
+  raytracer::HeatmapMetric heatmap_metric = raytracer::HeatmapMetric::kIntersectionTests;
+  // Overrides the accelerator chosen by the scene file ('accel' command, list by default).
+  std::optional<raytracer::AcceleratorType> accelerator{};
+  // Print the time spent in each phase and the peak memory use, in a machine readable line.
+  bool timings = false;
+  // Print hardware performance counters for each phase and render thread.
+  bool perf = false;
+  // Memory budget for decoded texture tiles, in MB.
+  size_t texture_budget_mb = raytracer::TextureCache::kDefaultBudgetBytes >> 20;
+  // Write the memory use of the scene by category as JSON here ('-' for stdout).
+  std::string memory_report_path;
+  // Exit before rendering if the scene would need more than this many MB, 0 for no limit.
+  size_t memory_budget_mb = 0;
+};
+
+inline void PrintUsage() {
+  std::cout << "Usage: rayTracer {path to scene file} [flags]\n"
+            << "       rayTracer --embedded NAME [flags]\n"
+            << "       rayTracer --batch MANIFEST [flags]\n"
+            << "  --embedded NAME        Render a scene compiled into the binary (basic or pedestal).\n"
+            << "  --batch MANIFEST       Render many scenes, one 'SCENE OUTPUT [size WxH] [eye X Y Z] [forward X Y Z]\n"
+            << "                         [up X Y Z]' job per line. --size sets the default size.\n"
+            << "  --size WxH             Image size in pixels (default 400x400).\n"
+            << "  --stream PATH          Write the image to a binary PPM at PATH band by band as it renders.\n"
+            << "  --checkpoint PATH      Save the render state to PATH periodically while rendering.\n"
+            << "  --checkpoint-interval S\n"
+            << "                         Seconds between checkpoints (default 60).\n"
+            << "  --resume               Continue an interrupted --stream or --checkpoint render.\n"
+            << "  --exposure X           Multiply the radiance by X before tonemapping (default 1).\n"
+            << "  --tonemap NAME         clamp (default) or reinhard.\n"
+            << "  --gamma G              Encoding gamma of the output, eg. 2.2 (default 1, linear).\n"
+            << "  --denoise              Denoise the render using albedo and normal feature buffers.\n"
+            << "  --compress-geometry    Store OBJ meshes with quantized positions and normals.\n"
+            << "  --geometry-store PATH  Render OBJ meshes from a memory mapped geometry store, building it if needed.\n"
+            << "  --static-dispatch      Store primitives and lights by type to avoid virtual calls.\n"
+            << "  --raster-primary       Find what camera rays hit by rasterizing triangles and spheres.\n"
+            << "  --spp N                Camera rays per pixel (default 1).\n"
+            << "  --sampler NAME         corner, independent, stratified, sobol or bluenoise (default sobol\n"
+            << "                         if --spp > 1, corner otherwise).\n"
+            << "  --seed N               Seed for the sampler.\n"
+            << "  --threads N            Worker threads for loading, building and rendering (default: one per\n"
+            << "                         hardware thread).\n"
+            << "  --pin-threads          Pin each render worker to its own CPU.\n"
+            << "  --preview FRAMES       Preview demo: pan the camera for FRAMES frames, then refine until converged.\n"
+            << "  --preview-target MS    Preview frame time target in milliseconds (default 33).\n"
+            << "  --relight EDITS        Relight demo: cache the camera hits, then recolor and move the lights EDITS times.\n"
+            << "  --heatmap PATH         Write a false colored image of the render cost of every pixel.\n"
+            << "  --heatmap-metric NAME  tests (intersection tests, default) or time.\n"
+            << "  --accel NAME           list, grid, bvh or lbvh, overriding the scene's 'accel' command.\n"
+            << "  --timings              Print parse, build and render times and peak memory use.\n"
+            << "  --perf                 Print cycles, instructions, cache and branch misses per phase and thread.\n"
+            << "  --texture-budget MB    Memory budget for decoded texture tiles (default 256).\n"
+            << "  --memory-report PATH   Write the memory use of the scene by category as JSON ('-' for stdout).\n"
+            << "  --memory-budget MB     Exit before rendering if the scene needs more memory than this.\n";
+}
+
+namespace detail {
+
+template <typename T>
+std::optional<T> parseNumber(std::string_view value) {
+  T number{};
+  const auto result = std::from_chars(value.data(), value.data() + value.size(), number);
+  if (result.ec != std::errc() || result.ptr != value.data() + value.size()) {
+    return std::nullopt;
+  }
+  return number;
+}
+
+} // namespace detail
+
+// Parses the command line, returns nullopt (after printing why) if it is malformed.
+inline std::optional<Options> ParseOptions(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg = argv[i];
+
+    // Value of a flag that takes one, printing an error if it is missing.
+    auto next_value = [&]() -> std::optional<std::string_view> {
+      if (i + 1 >= argc) {
+        std::cout << "Missing value for '" << arg << "'\n";
+        return std::nullopt;
+      }
+      return std::string_view(argv[++i]);
+    };
+    auto next_number = [&]<typename T>(T& out, T min_value) -> bool {
+      const auto value = next_value();
+      if (!value) {
+        return false;
+      }
+      const auto number = detail::parseNumber<T>(*value);
+      if (!number || *number < min_value) {
+        std::cout << "Invalid value for '" << arg << "': '" << *value << "'\n";
+        return false;
+      }
+      out = *number;
+      return true;
+    };
+
+    if (arg == "--embedded") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      if (!raytracer::embedded::FindEmbeddedScene(*value)) {
+        std::cout << "Unknown embedded scene: '" << *value << "'\n";
+        return std::nullopt;
+      }
+      options.embedded_scene = *value;
+    } else if (arg == "--batch") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      options.batch_path = *value;
+    } else if (arg == "--exposure") {
+      if (!next_number(options.output.exposure, 0.f)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--gamma") {
+      if (!next_number(options.output.gamma, 0.01f)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--tonemap") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      const auto tonemap = ParseTonemap(*value);
+      if (!tonemap) {
+        std::cout << "Unknown tonemap: '" << *value << "'\n";
+        return std::nullopt;
+      }
+      options.output.tonemap = *tonemap;
+    } else if (arg == "--denoise") {
+      options.denoise = true;
+    } else if (arg == "--size") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      const size_t separator = value->find('x');
+      const auto width = detail::parseNumber<size_t>(value->substr(0, separator));
+      const auto height = separator == std::string_view::npos
+          ? std::nullopt : detail::parseNumber<size_t>(value->substr(separator + 1));
+      if (!width || !height || *width == 0 || *height == 0) {
+        std::cout << "Invalid image size: '" << *value << "'\n";
+        return std::nullopt;
+      }
+      options.width = *width;
+      options.height = *height;
+    } else if (arg == "--stream") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      options.stream_path = *value;
+    } else if (arg == "--checkpoint") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      options.checkpoint_path = *value;
+    } else if (arg == "--checkpoint-interval") {
+      if (!next_number(options.checkpoint_interval_s, 0.0)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--resume") {
+      options.resume = true;
+    } else if (arg == "--compress-geometry") {
+      options.compress_geometry = true;
+    } else if (arg == "--accel") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      options.accelerator = raytracer::ParseAcceleratorType(*value);
+      if (!options.accelerator) {
+        std::cout << "Unknown accelerator: '" << *value << "'\n";
+        return std::nullopt;
+      }
+    } else if (arg == "--timings") {
+      options.timings = true;
+    } else if (arg == "--perf") {
+      options.perf = true;
+    } else if (arg == "--memory-report") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      options.memory_report_path = *value;
+    } else if (arg == "--memory-budget") {
+      if (!next_number(options.memory_budget_mb, size_t{1})) {
+        return std::nullopt;
+      }
+    } else if (arg == "--texture-budget") {
+      if (!next_number(options.texture_budget_mb, size_t{1})) {
+        return std::nullopt;
+      }
+    } else if (arg == "--static-dispatch") {
+      options.static_dispatch = true;
+    } else if (arg == "--raster-primary") {
+      options.raster_primary = true;
+    } else if (arg == "--geometry-store") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      options.geometry_store_path = *value;
+    } else if (arg == "--spp") {
+      if (!next_number(options.samples_per_pixel, 1)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--seed") {
+      if (!next_number(options.seed, 0u)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--threads") {
+      if (!next_number(options.num_threads, 1)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--pin-threads") {
+      options.pin_threads = true;
+    } else if (arg == "--preview") {
+      if (!next_number(options.preview_frames, 1)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--preview-target") {
+      if (!next_number(options.preview_target_ms, 0.0)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--relight") {
+      if (!next_number(options.relight_edits, 1)) {
+        return std::nullopt;
+      }
+    } else if (arg == "--heatmap") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      options.heatmap_path = *value;
+    } else if (arg == "--heatmap-metric") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      const auto metric = raytracer::ParseHeatmapMetric(*value);
+      if (!metric) {
+        std::cout << "Unknown heatmap metric: '" << *value << "'\n";
+        return std::nullopt;
+      }
+      options.heatmap_metric = *metric;
+    } else if (arg == "--sampler") {
+      const auto value = next_value();
+      if (!value) {
+        return std::nullopt;
+      }
+      options.sampler = sampling::ParseSamplerType(*value);
+      if (!options.sampler) {
+        std::cout << "Unknown sampler: '" << *value << "'\n";
+        return std::nullopt;
+      }
+    } else if (arg.starts_with("--")) {
+      std::cout << "Unknown flag: '" << arg << "'\n";
+      return std::nullopt;
+    } else if (options.scene_path.empty()) {
+      options.scene_path = arg;
+    } else {
+      std::cout << "Unexpected argument: '" << arg << "'\n";
+      return std::nullopt;
+    }
+  }
+  const int num_inputs = !options.scene_path.empty() + !options.embedded_scene.empty() + !options.batch_path.empty();
+  if (num_inputs != 1) {
+    std::cout << (num_inputs == 0 ? "Missing input scene argument.\n"
+                                  : "Give only one of a scene file, --embedded or --batch.\n");
+    return std::nullopt;
+  }
+  if (!options.batch_path.empty() && (!options.stream_path.empty() || options.denoise || options.preview_frames > 0 ||
+                                      !options.heatmap_path.empty() || options.perf || !options.checkpoint_path.empty())) {
+    std::cout << "--batch can't be combined with --stream, --denoise, --preview, --heatmap, --perf or --checkpoint.\n";
+    return std::nullopt;
+  }
+  if (!options.checkpoint_path.empty() && (!options.stream_path.empty() || options.denoise ||
+                                           options.preview_frames > 0 || !options.heatmap_path.empty())) {
+    std::cout << "--checkpoint can't be combined with --stream, --denoise, --preview or --heatmap.\n";
+    return std::nullopt;
+  }
+  if (!options.stream_path.empty() && (options.denoise || options.preview_frames > 0 || !options.heatmap_path.empty())) {
+    std::cout << "--stream can't be combined with --denoise, --preview or --heatmap.\n";
+    return std::nullopt;
+  }
+  if (options.preview_frames > 0 && !options.heatmap_path.empty()) {
+    std::cout << "--preview can't be combined with --heatmap.\n";
+    return std::nullopt;
+  }
+  if (options.raster_primary && (!options.batch_path.empty() || !options.stream_path.empty() ||
+                                 !options.checkpoint_path.empty() || options.preview_frames > 0 ||
+                                 !options.heatmap_path.empty())) {
+    std::cout << "--raster-primary can't be combined with --batch, --stream, --checkpoint, --preview or --heatmap.\n";
+    return std::nullopt;
+  }
+  if (options.relight_edits > 0 &&
+      (!options.batch_path.empty() || !options.stream_path.empty() || !options.checkpoint_path.empty() ||
+       options.denoise || options.preview_frames > 0 || !options.heatmap_path.empty() || options.raster_primary ||
+       options.samples_per_pixel > 1 || (options.sampler && *options.sampler != sampling::SamplerType::kPixelCorner))) {
+    std::cout << "--relight can't be combined with --batch, --stream, --checkpoint, --denoise, --preview, --heatmap,\n"
+                 "--raster-primary, --spp above 1 or a sampler other than corner.\n";
+    return std::nullopt;
+  }
+  if (options.resume && options.stream_path.empty() && options.checkpoint_path.empty()) {
+    std::cout << "--resume needs --stream or --checkpoint.\n";
+    return std::nullopt;
+  }
+  return options;
+}
+
+} // namespace graphics
@@ -0,0 +1,128 @@
+// Output pass that turns the linear radiance an Image holds into the 8-bit RGB that is written
+// out: exposure, tonemapping, gamma encoding and quantization. Works on whole arrays of channel
+// values at a time, so the conversion runs 16 values per iteration with SSE2 instead of one
+// pixel at a time. The default settings reproduce the renderer's original per-pixel conversion
+// (clamp to [0, 1], scale by 255 and truncate) exactly.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace graphics {
+
+enum class Tonemap {
+  // Clip to [0, 1], what the renderer always did.
+  kClamp,
+  // Reinhard x / (1 + x), which compresses highlights instead of clipping them.
+  kReinhard,
+};
+
+inline std::optional<Tonemap> ParseTonemap(std::string_view name) {
+  if (name == "clamp") {
+    return Tonemap::kClamp;
+  }
+  if (name == "reinhard") {
+    return Tonemap::kReinhard;
+  }
+  return std::nullopt;
+}
+
+struct OutputSettings {
+  // Radiance is multiplied by this before tonemapping.
+  float exposure = 1.f;
+  Tonemap tonemap = Tonemap::kClamp;
+  // Encoding gamma, eg. 2.2 for display. 1 writes the tonemapped values linearly.
+  float gamma = 1.f;
+};
+
+class OutputTransform {
+
+public:
+  // Gamma encoding is looked up in a table of this many evenly spaced tonemapped values.
+  static constexpr size_t kGammaTableSize = 4096;
+
+  explicit OutputTransform(const OutputSettings& settings = {}) :
+    settings_{settings}, linear_{settings.gamma == 1.f} {
+    for (size_t i = 0; i < kGammaTableSize; i++) {
+      const float value = std::pow(static_cast<float>(i) / (kGammaTableSize - 1), 1.f / settings.gamma);
+      gamma_table_[i] = static_cast<uint8_t>(std::clamp(value, 0.f, 1.f) * 255.f + 0.5f);
+    }
+  }
+
+  // Converts |count| channel values from |in| into bytes in |out|.
+  void Convert(const float* in, uint8_t* out, size_t count) const {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 exposure = _mm_set1_ps(settings_.exposure);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 scale = _mm_set1_ps(linear_ ? 255.f : static_cast<float>(kGammaTableSize - 1));
+    const __m128 rounding = _mm_set1_ps(linear_ ? 0.f : 0.5f);
+    const bool reinhard = settings_.tonemap == Tonemap::kReinhard;
+    auto quantize = [&](const float* values) {
+      __m128 x = _mm_mul_ps(_mm_loadu_ps(values), exposure);
+      // The comparison picks 0 for NaN too.
+      x = _mm_max_ps(x, zero);
+      if (reinhard) {
+        x = _mm_div_ps(x, _mm_add_ps(x, one));
+      }
+      x = _mm_min_ps(x, one);
+      return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, scale), rounding));
+    };
+    for (; i + 16 <= count; i += 16) {
+      const __m128i a = quantize(in + i);
+      const __m128i b = quantize(in + i + 4);
+      const __m128i c = quantize(in + i + 8);
+      const __m128i d = quantize(in + i + 12);
+      if (linear_) {
+        const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+        continue;
+      }
+      alignas(16) int32_t indices[16];
+      _mm_store_si128(reinterpret_cast<__m128i*>(indices), a);
+      _mm_store_si128(reinterpret_cast<__m128i*>(indices + 4), b);
+      _mm_store_si128(reinterpret_cast<__m128i*>(indices + 8), c);
+      _mm_store_si128(reinterpret_cast<__m128i*>(indices + 12), d);
+      for (int k = 0; k < 16; k++) {
+        out[i + k] = gamma_table_[indices[k]];
+      }
+    }
+#endif
+    for (; i < count; i++) {
+      out[i] = ConvertValue(in[i]);
+    }
+  }
+
+  // Converts a single channel value, with the same result as Convert.
+  uint8_t ConvertValue(float value) const {
+    float x = value * settings_.exposure;
+    x = x > 0.f ? x : 0.f;
+    if (settings_.tonemap == Tonemap::kReinhard) {
+      x = x / (x + 1.f);
+    }
+    x = std::min(x, 1.f);
+    if (linear_) {
+      return static_cast<uint8_t>(static_cast<int>(x * 255.f));
+    }
+    return gamma_table_[static_cast<int>(x * (kGammaTableSize - 1) + 0.5f)];
+  }
+
+  const OutputSettings& settings() const { return settings_; }
+
+private:
+  OutputSettings settings_;
+  bool linear_;
+  std::array<uint8_t, kGammaTableSize> gamma_table_{};
+};
+
+} // namespace graphics
@@ -0,0 +1,265 @@
+// Hardware performance counters (Linux perf_event_open) around the phases of a run and per render
+// thread: cycles, instructions, last level cache misses and branch misses. They tell whether a
+// slow phase is memory bound, mispredicting, or just executing a lot of instructions, which wall
+// clock times can't. Only user space is counted, which perf_event_paranoid allows by default.
+//
+// Counters are often unavailable (containers, VMs without a virtual PMU, stricter paranoid
+// settings), and any single event may be unsupported. Missing events are reported as such, and
+// with no counters at all the report falls back to wall clock times.
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../utils/stopwatch.h"
+
+namespace graphics {
+
+enum PerfEvent {
+  kPerfCycles,
+  kPerfInstructions,
+  kPerfLlcMisses,
+  kPerfBranchMisses,
+  kNumPerfEvents,
+};
+
+// Values of the events, nullopt for events that couldn't be counted.
+using PerfCounts = std::array<std::optional<uint64_t>, kNumPerfEvents>;
+
+inline PerfCounts operator-(const PerfCounts& a, const PerfCounts& b) {
+  PerfCounts difference;
+  for (int i = 0; i < kNumPerfEvents; i++) {
+    if (a[i] && b[i]) {
+      difference[i] = *a[i] - *b[i];
+    }
+  }
+  return difference;
+}
+
+inline PerfCounts& operator+=(PerfCounts& a, const PerfCounts& b) {
+  for (int i = 0; i < kNumPerfEvents; i++) {
+    if (b[i]) {
+      a[i] = a[i].value_or(0) + *b[i];
+    }
+  }
+  return a;
+}
+
+inline pid_t CurrentThreadId() { return static_cast<pid_t>(::syscall(SYS_gettid)); }
+
+// The counters of one thread.
+class ThreadPerfCounters {
+
+public:
+  // Counts thread |tid|, and with |inherit| also the threads it creates from now on (their counts
+  // are added when they exit). Check counting() for whether any event could be opened.
+  ThreadPerfCounters(pid_t tid, bool inherit) {
+    static constexpr std::array<std::pair<uint32_t, uint64_t>, kNumPerfEvents> kEvents = {{
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    }};
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = kEvents[i].first;
+      attr.config = kEvents[i].second;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.inherit = inherit;
+      // Scaled by enabled / running time when there are more events than hardware counters.
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fds_[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0));
+      if (fds_[i] < 0 && error_.empty()) {
+        error_ = std::strerror(errno);
+      }
+    }
+  }
+
+  ThreadPerfCounters(ThreadPerfCounters&& other) noexcept : fds_{other.fds_}, error_{std::move(other.error_)} {
+    other.fds_.fill(-1);
+  }
+
+  ThreadPerfCounters(const ThreadPerfCounters&) = delete;
+  ThreadPerfCounters& operator=(const ThreadPerfCounters&) = delete;
+  ThreadPerfCounters& operator=(ThreadPerfCounters&&) = delete;
+
+  ~ThreadPerfCounters() {
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  bool counting() const {
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Why the first event that failed to open couldn't be, empty if they all opened.
+  const std::string& error() const { return error_; }
+
+  PerfCounts Read() const {
+    PerfCounts counts;
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      uint64_t values[3];
+      if (fds_[i] < 0 || ::read(fds_[i], values, sizeof(values)) != sizeof(values)) {
+        continue;
+      }
+      const uint64_t enabled = values[1];
+      const uint64_t running = values[2];
+      counts[i] = running == 0 ? 0 : static_cast<uint64_t>(static_cast<double>(values[0]) * enabled / running);
+    }
+    return counts;
+  }
+
+private:
+  std::array<int, kNumPerfEvents> fds_{};
+  std::string error_;
+};
+
+// Counts phases of a run. The phase counts are those of the calling (main) thread, including the
+// threads it starts during the phase once they exit, plus those of the render threads.
+class PerfProfiler {
+
+public:
+  // Must be created on the main thread after the render threads |render_thread_ids| were
+  // started, so that they are counted individually rather than inherited.
+  explicit PerfProfiler(const std::vector<pid_t>& render_thread_ids) : main_{CurrentThreadId(), /*inherit=*/true} {
+    for (pid_t tid : render_thread_ids) {
+      render_threads_.emplace_back(tid, /*inherit=*/false);
+    }
+  }
+
+  // False if no event could be counted, in which case only wall clock times are reported.
+  bool counting() const { return main_.counting(); }
+
+  // Starts phase |name|, which lasts until the next BeginPhase or End.
+  void BeginPhase(std::string_view name) {
+    End();
+    current_ = Phase{.name = std::string(name), .start_main = main_.Read(), .start_threads = readThreads()};
+    stopwatch_.Reset();
+  }
+
+  void End() {
+    if (!current_) {
+      return;
+    }
+    current_->wall_ms = stopwatch_.ElapsedMilliseconds();
+    current_->main = main_.Read() - current_->start_main;
+    const std::vector<PerfCounts> threads = readThreads();
+    for (size_t i = 0; i < threads.size(); i++) {
+      current_->threads.push_back(threads[i] - current_->start_threads[i]);
+    }
+    phases_.push_back(std::move(*current_));
+    current_.reset();
+  }
+
+  // Prints every phase, and the render threads in phases where they did any work.
+  void Print(std::ostream& out) const {
+    if (!counting()) {
+      out << "Hardware performance counters unavailable (" << main_.error() << "), wall clock only.\n";
+    } else if (!main_.error().empty()) {
+      out << "Some hardware performance counters are unavailable (" << main_.error() << ").\n";
+    }
+    out << "Performance counters:\n";
+    printHeader(out);
+    for (const Phase& phase : phases_) {
+      PerfCounts total = phase.main;
+      for (const PerfCounts& thread : phase.threads) {
+        total += thread;
+      }
+      printRow(out, phase.name, phase.wall_ms, total);
+    }
+    for (const Phase& phase : phases_) {
+      for (size_t i = 0; i < phase.threads.size(); i++) {
+        if (phase.threads[i][kPerfInstructions].value_or(0) > 0) {
+          printRow(out, "  " + phase.name + " thread " + std::to_string(i), std::nullopt, phase.threads[i]);
+        }
+      }
+    }
+  }
+
+private:
+  struct Phase {
+    std::string name;
+    PerfCounts start_main;
+    std::vector<PerfCounts> start_threads;
+    double wall_ms = 0.0;
+    PerfCounts main{};
+    std::vector<PerfCounts> threads{};
+  };
+
+  std::vector<PerfCounts> readThreads() const {
+    std::vector<PerfCounts> counts;
+    for (const auto& thread : render_threads_) {
+      counts.push_back(thread.Read());
+    }
+    return counts;
+  }
+
+  static void printHeader(std::ostream& out) {
+    out << "  " << std::left << std::setw(20) << "phase" << std::right << std::setw(12) << "wall ms"
+        << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(7) << "IPC"
+        << std::setw(14) << "LLC misses" << std::setw(14) << "branch misses" << '\n';
+  }
+
+  static void printRow(std::ostream& out, const std::string& name, std::optional<double> wall_ms,
+                       const PerfCounts& counts) {
+    auto count = [&](PerfEvent event, int width) {
+      out << std::setw(width);
+      if (counts[event]) {
+        out << *counts[event];
+      } else {
+        out << '-';
+      }
+    };
+    out << "  " << std::left << std::setw(20) << name << std::right << std::setw(12);
+    if (wall_ms) {
+      out << std::fixed << std::setprecision(1) << *wall_ms << std::defaultfloat;
+    } else {
+      out << "";
+    }
+    count(kPerfCycles, 16);
+    count(kPerfInstructions, 16);
+    out << std::setw(7);
+    if (counts[kPerfCycles].value_or(0) > 0 && counts[kPerfInstructions]) {
+      out << std::fixed << std::setprecision(2)
+          << static_cast<double>(*counts[kPerfInstructions]) / *counts[kPerfCycles] << std::defaultfloat;
+    } else {
+      out << '-';
+    }
+    count(kPerfLlcMisses, 14);
+    count(kPerfBranchMisses, 14);
+    out << '\n';
+  }
+
+  ThreadPerfCounters main_;
+  std::vector<ThreadPerfCounters> render_threads_{};
+  std::optional<Phase> current_{};
+  std::vector<Phase> phases_{};
+  Stopwatch stopwatch_;
+};
+
+} // namespace graphics
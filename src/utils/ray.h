@@ -11,14 +11,22 @@ public:
 
   Ray(const math::Point3f& origin, const math::Vector3f& direction) : origin_{origin}, direction_{direction} {}
 
+  // |spread_angle| is the angle the ray's footprint widens by, eg. the angle one pixel covers for a
+  // camera ray. Textures are filtered over the footprint, rays that don't set it get the sharpest
+  // texture level.
+  Ray(const math::Point3f& origin, const math::Vector3f& direction, float spread_angle) :
+    origin_{origin}, direction_{direction}, spread_angle_{spread_angle} {}
+
   math::Point3f at(float t) const { return origin_ + t * direction_; }
 
   math::Point3f origin() const { return origin_; }
   math::Vector3f direction() const { return direction_; }
+  float spread_angle() const { return spread_angle_; }
 
 private:
   math::Point3f origin_{};
   math::Vector3f direction_{};
+  float spread_angle_ = 0.f;
 };
 
 }  // namespace graphics
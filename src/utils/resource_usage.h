@@ -0,0 +1,36 @@
+// Process resource usage counters (POSIX getrusage).
+#pragma once
+
+#include <sys/resource.h>
+
+namespace graphics {
+
+struct PageFaults {
+  // Faults served without I/O, eg. from the page cache.
+  long minor = 0;
+  // Faults that had to read from disk.
+  long major = 0;
+};
+
+inline PageFaults CurrentPageFaults() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return {};
+  }
+  return PageFaults{.minor = usage.ru_minflt, .major = usage.ru_majflt};
+}
+
+// Largest resident set size of the process so far, in kilobytes.
+inline long PeakResidentKilobytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return usage.ru_maxrss;
+}
+
+inline PageFaults operator-(const PageFaults& a, const PageFaults& b) {
+  return PageFaults{.minor = a.minor - b.minor, .major = a.major - b.major};
+}
+
+} // namespace graphics
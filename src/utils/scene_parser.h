@@ -1,5 +1,8 @@
 // Parses scenes from file formats specified in: https://www.cs.virginia.edu/luther/4810/F2021/hw3.html
+#pragma once
 
+#include <algorithm>
+#include <array>
 #include <iostream>
 #include <vector>
 #include <memory>
@@ -12,7 +15,11 @@
 #include "../objects/all_objects.h"
 #include "../renderer/scene.h"
 #include "../materials/all_materials.h"
+#include "../utils/accelerator_type.h"
+#include "../utils/memory_report.h"
 #include "../utils/vertex.h"
+#include "../utils/obj_loader.h"
+#include "../utils/thread_pool.h"
 
 namespace {
 
@@ -25,10 +32,15 @@ constexpr std::string_view kTriangleCommand = "trif";
 constexpr std::string_view kSunCommand = "sun";
 constexpr std::string_view kBulbCommand = "bulb";
 constexpr std::string_view kNormalCommand = "normal";
+constexpr std::string_view kAccelCommand = "accel";
+constexpr std::string_view kTextureCommand = "texture";
+constexpr std::string_view kTexCoordCommand = "texcoord";
+constexpr std::string_view kMeshCommand = "mesh";
 
 // for obj files
 constexpr std::string_view kObjVertexCommand = "v";
 constexpr std::string_view kObjTriangleCommand = "f";
+constexpr std::string_view kObjExtension = ".obj";
 
 }
 
@@ -52,23 +64,74 @@ std::vector<std::string> SplitString(const std::string& s) {
 
 namespace graphics::raytracer {
 
+struct SceneParserSettings {
+  // Store OBJ meshes as a single QuantizedMesh instead of individual Triangle objects.
+  bool compress_geometry = false;
+  // If set, OBJ meshes are rendered out-of-core from a memory mapped geometry store at this path.
+  // The store is built from the OBJ file the first time, and reused (without parsing the OBJ) after.
+  std::string geometry_store_path{};
+  // Cache that textures from 'texture' commands are loaded into. One with the default budget is
+  // created on first use if not set.
+  std::shared_ptr<TextureCache> texture_cache{};
+  // Don't print progress messages (errors are still printed), eg. when parsing many scenes at once.
+  bool quiet = false;
+  // Pool that OBJ meshes are loaded and turned into triangles on. If null, they are loaded on the
+  // calling thread.
+  ThreadPool* pool = nullptr;
+};
+
 class SceneParser {
 
 public:
   SceneParser() = default;
 
+  explicit SceneParser(SceneParserSettings settings) : settings_{settings} {}
+
+  // Accelerator requested by the last scene read with an 'accel' command, if any.
+  std::optional<AcceleratorType> accelerator() const { return accelerator_; }
+
+  // Adds what parsing holds on to beyond the scene itself, ie. the vertices of triangles.
+  void AccountMemory(MemoryReport& report) const {
+    report.Add("vertices", MemoryReport::VectorBytes(vertices_), vertices_.size());
+  }
+
+  // Files the last scene read referenced besides the scene file itself, ie. its textures and meshes.
+  const std::vector<std::string>& asset_paths() const { return asset_paths_; }
+
+  // Cache holding the textures of the scenes read so far, or nullptr if none used textures.
+  std::shared_ptr<TextureCache> texture_cache() const { return settings_.texture_cache; }
+
   Scene ReadScene(std::string_view path) {
+    objects_ = std::make_shared<IntersectableList>();
+    accelerator_.reset();
+    asset_paths_.clear();
+    current_texture_.reset();
     Scene scene {
-      .objects = std::make_shared<IntersectableList>(),
+      .objects = objects_,
       .background_color = graphics::Color3f{0.5, 0.7, 1.0} // Sky blue
     };
 
+    // Plain OBJ meshes can be huge, so they go through the parallel loader instead.
+    if (path.ends_with(kObjExtension) && !settings_.geometry_store_path.empty()) {
+      addMappedMesh(path);
+      logProgress("Scene parsing complete.\n");
+      return scene;
+    }
+    if (path.ends_with(kObjExtension)) {
+      logProgress("Beginning parallel OBJ parsing.\n");
+      if (auto mesh = LoadObjParallel(path, settings_.pool)) {
+        addMesh(*mesh);
+      }
+      logProgress("Scene parsing complete.\n");
+      return scene;
+    }
+
     std::string line;
-    std::ifstream file(path);
+    std::ifstream file{std::string(path)};
     if (!file.is_open()) {
       std::cerr << "Unable to open file.\n";
     }
-    std::cout << "Beginning scene parsing.\n";
+    logProgress("Beginning scene parsing.\n");
     while (std::getline(file, line)) {
       if (line == "\n" || line.empty() || line[0] == '#') {
         continue;
@@ -76,11 +139,17 @@ public:
       parseCommand(scene, SplitString(line));
     }
     file.close();
-    std::cout << "Scene parsing complete.\n";
+    logProgress("Scene parsing complete.\n");
     return scene;
   }
 
 private:
+  void logProgress(std::string_view message) const {
+    if (!settings_.quiet) {
+      std::cout << message;
+    }
+  }
+
   void parseCommand(Scene& scene, const std::vector<std::string>& split_line) {
     if (split_line[0] == kPngCommand) {
       return;
@@ -88,18 +157,26 @@ private:
       updateColor(split_line);
     }  else if (split_line[0] == kNormalCommand) {
       setNormal(split_line);
+    } else if (split_line[0] == kTexCoordCommand) {
+      setTexCoord(split_line);
+    } else if (split_line[0] == kTextureCommand) {
+      setTexture(split_line);
+    } else if (split_line[0] == kMeshCommand) {
+      loadMesh(split_line);
     } else if (split_line[0] == kVertexCommand || split_line[0] == kObjVertexCommand) {
       addVertex(split_line);
     } else if (split_line[0] == kSphereCommand) {
-      addSphere(scene, split_line);
+      addSphere(split_line);
     } else if (split_line[0] == kPlaneCommand) {
-      addPlane(scene, split_line);
+      addPlane(split_line);
     } else if (split_line[0] == kTriangleCommand || split_line[0] == kObjTriangleCommand) {
-      addTriangle(scene, split_line);
+      addTriangle(split_line);
     } else if (split_line[0] == kSunCommand) {
       addSun(scene, split_line);
     } else if (split_line[0] == kBulbCommand) {
       addBulb(scene, split_line);
+    } else if (split_line[0] == kAccelCommand) {
+      setAccelerator(split_line);
     } else {
       std::cerr << "Unsupported command: '" << split_line[0] << "' \n";
     }
@@ -113,6 +190,15 @@ private:
     };
   }
 
+  void setAccelerator(const std::vector<std::string>& split_line) {
+    const auto accelerator = ParseAcceleratorType(split_line[1]);
+    if (!accelerator) {
+      std::cerr << "Unsupported accelerator: '" << split_line[1] << "' \n";
+      return;
+    }
+    accelerator_ = accelerator;
+  }
+
   void setNormal(const std::vector<std::string>& split_line) {
     current_normal_ = math::Vector3f {
       std::stof(split_line[1]),
@@ -121,44 +207,167 @@ private:
     };
   }
 
+  void setTexCoord(const std::vector<std::string>& split_line) {
+    current_uv_ = math::Vector2f {
+      std::stof(split_line[1]),
+      std::stof(split_line[2]),
+    };
+  }
+
+  // 'texture PATH [SCALE]' textures the objects that follow with the PPM image at PATH (tinted by
+  // the current color), repeated SCALE times per unit of texture coordinates. 'texture none' goes
+  // back to plain colors.
+  void setTexture(const std::vector<std::string>& split_line) {
+    if (split_line[1] == "none") {
+      current_texture_.reset();
+      return;
+    }
+    if (std::find(asset_paths_.begin(), asset_paths_.end(), split_line[1]) == asset_paths_.end()) {
+      asset_paths_.push_back(split_line[1]);
+    }
+    if (!settings_.texture_cache) {
+      settings_.texture_cache = std::make_shared<TextureCache>();
+    }
+    const auto texture = settings_.texture_cache->Load(split_line[1]);
+    if (!texture) {
+      return;
+    }
+    current_texture_ = CurrentTexture{.id = *texture, .scale = split_line.size() > 2 ? std::stof(split_line[2]) : 1.f};
+  }
+
+  // 'mesh PATH' adds the OBJ mesh at PATH with the current material, the same way an OBJ scene is
+  // loaded (except for the geometry store).
+  void loadMesh(const std::vector<std::string>& split_line) {
+    if (std::find(asset_paths_.begin(), asset_paths_.end(), split_line[1]) == asset_paths_.end()) {
+      asset_paths_.push_back(split_line[1]);
+    }
+    if (auto mesh = LoadObjParallel(split_line[1], settings_.pool)) {
+      addMesh(*mesh);
+    }
+  }
+
+  // Material for the objects that follow: the current color, textured if a texture is set.
+  std::shared_ptr<Material> currentMaterial() const {
+    if (current_texture_) {
+      return std::make_shared<TexturedDiffuse>(settings_.texture_cache, current_texture_->id, current_color_,
+                                               current_texture_->scale);
+    }
+    return std::make_shared<Diffuse>(current_color_);
+  }
+
   void addVertex(const std::vector<std::string>& split_line) {
     math::Point3f point {
       std::stof(split_line[1]),
       std::stof(split_line[2]),
       std::stof(split_line[3]),
     };
-    vertices_.push_back(Vertexff{point, current_normal_});
+    vertices_.push_back(Vertexff{point, current_normal_, current_uv_});
   }
 
-  void addSphere(Scene& scene, const std::vector<std::string>& split_line) const {
-    auto diffuse_color = std::make_shared<Diffuse>(current_color_);
+  void addSphere(const std::vector<std::string>& split_line) const {
+    auto material = currentMaterial();
     auto center = math::Point3f {
       std::stof(split_line[1]),
       std::stof(split_line[2]),
       std::stof(split_line[3]),
     };
     float radius = std::stof(split_line[4]);
-    auto sphere = std::make_shared<Sphere>(center, radius, diffuse_color);
-    scene.objects->AddObject(sphere);
+    auto sphere = std::make_shared<Sphere>(center, radius, material);
+    objects_->AddObject(sphere);
   }
 
-  void addPlane(Scene& scene, const std::vector<std::string>& split_line) const {
-    auto diffuse_color = std::make_shared<Diffuse>(current_color_);
+  void addPlane(const std::vector<std::string>& split_line) const {
+    auto material = currentMaterial();
     float A = std::stof(split_line[1]);
     float B = std::stof(split_line[2]);
     float C = std::stof(split_line[3]);
     float D = std::stof(split_line[4]);
-    auto plane = std::make_shared<Plane>(A, B, C, D, diffuse_color);
-    scene.objects->AddObject(plane);
+    auto plane = std::make_shared<Plane>(A, B, C, D, material);
+    objects_->AddObject(plane);
   }
 
-  void addTriangle(Scene& scene, const std::vector<std::string>& split_line) const {
-    auto diffuse_color = std::make_shared<Diffuse>(current_color_);
+  void addTriangle(const std::vector<std::string>& split_line) const {
+    auto material = currentMaterial();
     auto v1 = getVertex(std::stoi(split_line[1]));
     auto v2 = getVertex(std::stoi(split_line[2]));
     auto v3 = getVertex(std::stoi(split_line[3]));
-    auto triangle = std::make_shared<Triangle>(v1, v2, v3, diffuse_color);
-    scene.objects->AddObject(triangle);
+    auto triangle = std::make_shared<Triangle>(v1, v2, v3, material);
+    objects_->AddObject(triangle);
+  }
+
+  // Adds every face of |mesh| as a triangle with the current color, smooth shaded with the mesh's
+  // normals if it has them and with the current normal otherwise. Triangles are constructed in
+  // parallel on the pool since their constructors do a cross product each.
+  void addMesh(const ObjMesh& mesh) const {
+    auto material = currentMaterial();
+    if (settings_.compress_geometry) {
+      addCompressedMesh(mesh, material);
+      return;
+    }
+    std::vector<std::shared_ptr<Intersectable>> triangles(mesh.faces.size());
+    constexpr size_t kGrain = 4096;
+    ParallelFor(settings_.pool, 0, triangles.size(), kGrain, [&](size_t i, size_t) {
+      const auto& face = mesh.faces[i];
+      std::array<std::optional<math::Vector3f>, 3> normals{current_normal_, current_normal_, current_normal_};
+      if (!mesh.face_normals.empty()) {
+        for (int k = 0; k < 3; k++) {
+          normals[k] = mesh.normals[mesh.face_normals[i][k]];
+        }
+      }
+      triangles[i] = std::make_shared<Triangle>(Vertexff{mesh.vertices[face[0]], normals[0]},
+                                                Vertexff{mesh.vertices[face[1]], normals[1]},
+                                                Vertexff{mesh.vertices[face[2]], normals[2]},
+                                                material);
+    });
+    objects_->AddObjects(std::move(triangles));
+  }
+
+  void addCompressedMesh(const ObjMesh& mesh, std::shared_ptr<Material> material) const {
+    std::shared_ptr<QuantizedMesh> quantized_mesh;
+    if (mesh.face_normals.empty() && current_normal_) {
+      // Every corner uses the current normal.
+      const std::vector<std::array<uint32_t, 3>> face_normals(mesh.faces.size(), {0, 0, 0});
+      quantized_mesh = std::make_shared<QuantizedMesh>(mesh.vertices, mesh.faces, std::vector{*current_normal_},
+                                                       face_normals, material);
+    } else {
+      quantized_mesh = std::make_shared<QuantizedMesh>(mesh.vertices, mesh.faces, mesh.normals, mesh.face_normals,
+                                                       material);
+    }
+
+    // What the same mesh costs as individual triangles: the object, its control block (from
+    // make_shared) and the pointer to it in the intersectable list.
+    const size_t full_bytes = mesh.faces.size() * (sizeof(Triangle) + 2 * sizeof(void*) + sizeof(std::shared_ptr<Intersectable>));
+    const size_t compressed_bytes = quantized_mesh->MemoryUsage();
+    std::cout << "Compressed " << mesh.faces.size() << " triangles: " << compressed_bytes << " bytes vs "
+              << full_bytes << " bytes at full precision ("
+              << (full_bytes > 0 ? 100.0 * compressed_bytes / full_bytes : 0.0) << "%).\n";
+    objects_->AddObject(quantized_mesh);
+  }
+
+  void addMappedMesh(std::string_view obj_path) const {
+    auto material = currentMaterial();
+    const auto source = geometry_store::ReadSourceStamp(obj_path);
+    if (!source) {
+      std::cerr << "Unable to read '" << obj_path << "'.\n";
+      return;
+    }
+    // A store built from another OBJ, or an older version of this one, is rebuilt.
+    auto mapped_mesh = MappedMesh::Open(settings_.geometry_store_path, *source, material);
+    if (!mapped_mesh) {
+      std::cout << "Building geometry store '" << settings_.geometry_store_path << "' from '" << obj_path << "'.\n";
+      if (!BuildGeometryStore(settings_.geometry_store_path, obj_path, *source, settings_.pool)) {
+        std::cerr << "Unable to build geometry store.\n";
+        return;
+      }
+      mapped_mesh = MappedMesh::Open(settings_.geometry_store_path, *source, material);
+    }
+    if (!mapped_mesh) {
+      std::cerr << "Unable to open geometry store.\n";
+      return;
+    }
+    std::cout << "Mapped " << mapped_mesh->triangle_count() << " triangles (" << mapped_mesh->mapped_bytes()
+              << " bytes) from the geometry store.\n";
+    objects_->AddObject(mapped_mesh);
   }
 
   void addSun(Scene& scene, const std::vector<std::string>& split_line) const {
@@ -192,10 +401,22 @@ private:
     return vertices_[i - 1];
   }
 
+  SceneParserSettings settings_{};
+  // Objects of the scene currently being read.
+  std::shared_ptr<IntersectableList> objects_{};
+  std::optional<AcceleratorType> accelerator_{};
+  std::vector<std::string> asset_paths_{};
   std::vector<Vertexff> vertices_{};
 
   Color3f current_color_{colors::White};
   std::optional<math::Vector3f> current_normal_{};
+  std::optional<math::Vector2f> current_uv_{};
+
+  struct CurrentTexture {
+    TextureId id;
+    float scale;
+  };
+  std::optional<CurrentTexture> current_texture_{};
 };
 
 } // namespace graphics::raytracer
@@ -0,0 +1,23 @@
+// Wall clock stopwatch for timing phases of a run.
+#pragma once
+
+#include <chrono>
+
+namespace graphics {
+
+class Stopwatch {
+
+public:
+  Stopwatch() : start_{std::chrono::steady_clock::now()} {}
+
+  void Reset() { start_ = std::chrono::steady_clock::now(); }
+
+  double ElapsedMilliseconds() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace graphics
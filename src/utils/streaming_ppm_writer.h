@@ -0,0 +1,226 @@
+// Incremental writer of binary PPM (P6) images that are too large to keep in memory. The file is
+// created at its full size up front (sparse, so unwritten rows take no disk space and read as
+// black), and bands of finished rows are encoded and written into place by a background thread
+// while the next band renders. At most a fixed number of bands are queued at once, so memory use
+// doesn't depend on the image height.
+//
+// After every band is durably written, a small progress file next to the image records how many
+// rows are complete. If the process dies, the image is still a valid PPM, and reopening it with
+// |resume| continues from the first incomplete row. The progress file is removed when the image
+// is finished.
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../utils/image.h"
+#include "../utils/output_transform.h"
+
+namespace graphics {
+
+class StreamingPpmWriter {
+
+public:
+  static constexpr std::string_view kProgressSuffix = ".progress";
+
+  // Opens |path| for a |height| x |width| image, keeping at most |max_pending_bands| submitted
+  // bands in memory. With |resume|, an image left incomplete by an earlier run with the same size
+  // is continued, otherwise the file is (re)created. Returns nullptr (after printing why) on failure.
+  static std::unique_ptr<StreamingPpmWriter> Open(std::string_view path, size_t height, size_t width, bool resume,
+                                                  size_t max_pending_bands, const OutputSettings& output_settings = {}) {
+    auto writer = std::unique_ptr<StreamingPpmWriter>(
+        new StreamingPpmWriter(path, height, width, max_pending_bands, output_settings));
+    if (resume && writer->reopen()) {
+      std::cout << "Resuming '" << path << "' at row " << writer->completed_rows_ << " of " << height << ".\n";
+    } else if (!writer->create()) {
+      std::cerr << "Unable to create '" << path << "'.\n";
+      return nullptr;
+    }
+    writer->writer_ = std::thread([writer = writer.get()]() { writer->writerLoop(); });
+    return writer;
+  }
+
+  StreamingPpmWriter(const StreamingPpmWriter&) = delete;
+  StreamingPpmWriter& operator=(const StreamingPpmWriter&) = delete;
+
+  ~StreamingPpmWriter() {
+    stop();
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  // Rows [0, completed_rows()) were already written when the image was opened.
+  size_t completed_rows() const { return completed_rows_; }
+
+  // Queues |band|, the rows starting at |first_row|, to be written. Blocks while the queue is
+  // full. Bands must be submitted top to bottom.
+  void Submit(Image band, size_t first_row) {
+    std::unique_lock lock(mutex_);
+    space_available_.wait(lock, [&]() { return pending_.size() < max_pending_bands_; });
+    pending_.emplace_back(first_row, std::move(band));
+    band_available_.notify_one();
+  }
+
+  // Waits for every queued band to be written, then removes the progress file. Returns false if
+  // any write failed, in which case the progress file is kept.
+  bool Finish() {
+    stop();
+    if (failed_) {
+      return false;
+    }
+    std::remove(progress_path_.c_str());
+    return true;
+  }
+
+private:
+  StreamingPpmWriter(std::string_view path, size_t height, size_t width, size_t max_pending_bands,
+                     const OutputSettings& output_settings) :
+    path_{path},
+    progress_path_{std::string(path) + std::string(kProgressSuffix)},
+    header_{"P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n"},
+    height_{height},
+    width_{width},
+    max_pending_bands_{std::max<size_t>(1, max_pending_bands)},
+    transform_{output_settings} {}
+
+  size_t fileSize() const { return header_.size() + height_ * width_ * 3; }
+
+  bool create() {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0 || ::ftruncate(fd_, static_cast<off_t>(fileSize())) != 0 ||
+        !writeAll(header_.data(), header_.size(), 0)) {
+      return false;
+    }
+    completed_rows_ = 0;
+    return writeProgress(0);
+  }
+
+  // Reopens an image whose progress file matches its size. Returns false if there is nothing to
+  // resume.
+  bool reopen() {
+    std::ifstream progress(progress_path_);
+    size_t width = 0;
+    size_t height = 0;
+    size_t rows = 0;
+    if (!(progress >> width >> height >> rows) || width != width_ || height != height_ || rows > height_) {
+      std::cout << "Nothing to resume for '" << path_ << "', starting over.\n";
+      return false;
+    }
+    fd_ = ::open(path_.c_str(), O_RDWR);
+    struct stat file_stat;
+    if (fd_ < 0 || ::fstat(fd_, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) != fileSize()) {
+      if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+      }
+      std::cout << "'" << path_ << "' doesn't match its progress file, starting over.\n";
+      return false;
+    }
+    completed_rows_ = rows;
+    return true;
+  }
+
+  // Writes the progress file next to the image, replacing the old one atomically.
+  bool writeProgress(size_t rows) const {
+    const std::string temp_path = progress_path_ + ".tmp";
+    {
+      std::ofstream progress(temp_path, std::ios::trunc);
+      progress << width_ << ' ' << height_ << ' ' << rows << '\n';
+      if (!progress.flush()) {
+        return false;
+      }
+    }
+    return std::rename(temp_path.c_str(), progress_path_.c_str()) == 0;
+  }
+
+  bool writeAll(const void* data, size_t size, size_t offset) const {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+      const ssize_t written = ::pwrite(fd_, bytes, size, static_cast<off_t>(offset));
+      if (written <= 0) {
+        return false;
+      }
+      bytes += written;
+      size -= written;
+      offset += written;
+    }
+    return true;
+  }
+
+  void writerLoop() {
+    while (true) {
+      std::pair<size_t, Image> band{0, Image(0, 0)};
+      {
+        std::unique_lock lock(mutex_);
+        band_available_.wait(lock, [&]() { return !pending_.empty() || stopping_; });
+        if (pending_.empty()) {
+          return;
+        }
+        band = std::move(pending_.front());
+      }
+      const auto& [first_row, image] = band;
+      const std::vector<uint8_t> encoded = image.encode(transform_);
+      // The rows must be on disk before the progress file says they are.
+      const size_t rows_done = first_row + image.height();
+      if (!failed_ && (!writeAll(encoded.data(), encoded.size(), header_.size() + first_row * width_ * 3) ||
+                       ::fdatasync(fd_) != 0 || !writeProgress(rows_done))) {
+        std::cerr << "Failed to write rows " << first_row << " to " << rows_done << " of '" << path_ << "'.\n";
+        failed_ = true;
+      }
+      // Only free the queue slot once the band is written, so the number of bands in memory
+      // (queued or being written) stays bounded.
+      std::lock_guard lock(mutex_);
+      pending_.pop_front();
+      space_available_.notify_one();
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    band_available_.notify_one();
+    if (writer_.joinable()) {
+      writer_.join();
+    }
+  }
+
+  std::string path_;
+  std::string progress_path_;
+  std::string header_;
+  size_t height_;
+  size_t width_;
+  size_t max_pending_bands_;
+  OutputTransform transform_;
+  int fd_ = -1;
+  size_t completed_rows_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable band_available_;
+  std::condition_variable space_available_;
+  // Bands waiting to be written. The front one is being written while it is still in the queue.
+  std::deque<std::pair<size_t, Image>> pending_{};
+  bool stopping_ = false;
+  // Only touched by the writer thread until it is joined.
+  bool failed_ = false;
+  std::thread writer_;
+};
+
+} // namespace graphics
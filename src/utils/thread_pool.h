@@ -0,0 +1,163 @@
+// Persistent pool of worker threads. The workers are created once and reused for every task, so
+// repeated renders in one process don't pay for creating and joining threads each time. Workers
+// can optionally be pinned to CPUs, which keeps the memory they first touch on their NUMA node.
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace graphics {
+
+class ThreadPool {
+
+public:
+  // |num_threads| = 0 uses one worker per hardware thread. With |pin_threads|, worker i is bound
+  // to the i-th CPU this process is allowed to run on (wrapping around).
+  explicit ThreadPool(size_t num_threads = 0, bool pin_threads = false) {
+    if (num_threads == 0) {
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const std::vector<int> cpus = pin_threads ? allowedCpus() : std::vector<int>{};
+    workers_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+      workers_.emplace_back([this, i]() { workerLoop(i); });
+      if (!cpus.empty()) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpus[i % cpus.size()], &cpu_set);
+        pinned_ &= pthread_setaffinity_np(workers_.back().native_handle(), sizeof(cpu_set), &cpu_set) == 0;
+      }
+    }
+    pinned_ &= !cpus.empty();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    task_ready_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  size_t size() const { return workers_.size(); }
+
+  // True if every worker was successfully pinned to a CPU.
+  bool pinned() const { return pinned_; }
+
+  // Runs func(worker_index) once on every worker, and returns when all of them are done. Calls
+  // from several threads at once are run one after another. Not reentrant: func must not call
+  // back into the same pool.
+  void RunOnAll(const std::function<void(size_t)>& func) {
+    // The workers only track one task at a time.
+    std::lock_guard run_lock(run_mutex_);
+    std::unique_lock lock(mutex_);
+    task_ = &func;
+    pending_ = workers_.size();
+    generation_++;
+    task_ready_.notify_all();
+    task_done_.wait(lock, [this]() { return pending_ == 0; });
+    task_ = nullptr;
+  }
+
+  // Calls func(i, worker_index) for every i in [begin, end). Indices are handed out dynamically in
+  // chunks of |grain|, so uneven work is balanced across the workers.
+  template <typename F>
+  void ParallelFor(size_t begin, size_t end, size_t grain, F&& func) {
+    grain = std::max<size_t>(1, grain);
+    std::atomic<size_t> next{begin};
+    RunOnAll([&](size_t worker) {
+      for (size_t start = next.fetch_add(grain); start < end; start = next.fetch_add(grain)) {
+        const size_t stop = std::min(end, start + grain);
+        for (size_t i = start; i < stop; i++) {
+          func(i, worker);
+        }
+      }
+    });
+  }
+
+private:
+  void workerLoop(size_t worker_index) {
+    size_t seen_generation = 0;
+    while (true) {
+      const std::function<void(size_t)>* task = nullptr;
+      {
+        std::unique_lock lock(mutex_);
+        task_ready_.wait(lock, [&]() { return stopping_ || generation_ != seen_generation; });
+        if (stopping_) {
+          return;
+        }
+        seen_generation = generation_;
+        task = task_;
+      }
+      (*task)(worker_index);
+      {
+        std::lock_guard lock(mutex_);
+        if (--pending_ == 0) {
+          task_done_.notify_one();
+        }
+      }
+    }
+  }
+
+  static std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpu_set)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+    return cpus;
+  }
+
+  std::vector<std::thread> workers_{};
+  bool pinned_ = true;
+
+  // Held for the whole of a RunOnAll call.
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable task_ready_;
+  std::condition_variable task_done_;
+  const std::function<void(size_t)>* task_ = nullptr;
+  size_t generation_ = 0;
+  size_t pending_ = 0;
+  bool stopping_ = false;
+};
+
+// Runs pool->ParallelFor(begin, end, grain, func), or calls func(i, 0) for every i in order on the
+// calling thread if |pool| is null. Work that may itself run on a worker of a pool (eg. a batch job)
+// passes null, since the pool can't be re-entered.
+template <typename F>
+void ParallelFor(ThreadPool* pool, size_t begin, size_t end, size_t grain, F&& func) {
+  if (pool == nullptr) {
+    for (size_t i = begin; i < end; i++) {
+      func(i, size_t{0});
+    }
+    return;
+  }
+  pool->ParallelFor(begin, end, grain, func);
+}
+
+// Number of workers ParallelFor(pool, ...) runs on.
+inline size_t WorkerCount(const ThreadPool* pool) {
+  return pool == nullptr ? 1 : pool->size();
+}
+
+} // namespace graphics
@@ -1,4 +1,4 @@
-// Represents a vertex, which logically is a point (and potentially a normal).
+// Represents a vertex, which logically is a point (and potentially a normal and texture coordinates).
 #pragma once
 
 #include <optional>
@@ -12,6 +12,7 @@ template <typename PointT, typename NormalT>
 struct Vertex {
   math::Vector<PointT, 3> point{};
   std::optional<math::Vector<NormalT, 3>> normal{}; // We may or may not have a normal
+  std::optional<math::Vector2f> uv{};
 };
 
 using Vertexff = Vertex<float, float>;
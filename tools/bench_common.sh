@@ -0,0 +1,55 @@
+# Setup shared by the benchmark scripts in tools/. Source it after `set -euo pipefail`:
+#   source "$(dirname "$0")/bench_common.sh"
+# It defines:
+#   repo_dir     the repository root
+#   build_dir    directory with the rayTracer and tool binaries, from BUILD_DIR (default: ./build)
+#   repeats      renders of each variant in best_render_ms, from REPEATS (default: 3)
+#   extra_flags  extra flags for every render, from EXTRA_FLAGS
+#   THREADS      thread counts, "1 2 4 ... nproc" unless already set
+#   work_dir     a scratch directory, removed on exit. Renders write ./test.ppm, so they run in it.
+# and the render_timings and best_render_ms functions below.
+
+repo_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+build_dir="$(cd "${BUILD_DIR:-$repo_dir/build}" && pwd)"
+repeats="${REPEATS:-3}"
+extra_flags="${EXTRA_FLAGS:-}"
+
+if [[ -z "${THREADS:-}" ]]; then
+  THREADS=""
+  max_threads="$(nproc)"
+  for ((t = 1; t < max_threads; t *= 2)); do
+    THREADS+="$t "
+  done
+  THREADS+="$max_threads"
+fi
+
+work_dir="$(mktemp -d)"
+trap 'rm -rf "$work_dir"' EXIT
+
+# Renders scene $1 with flags $2 (plus extra_flags) in work_dir, and prints its "Timings:" line.
+render_timings() {
+  # shellcheck disable=SC2086
+  (cd "$work_dir" && "$build_dir/rayTracer" "$1" --timings $2 $extra_flags | grep '^Timings:')
+}
+
+# Prints field $2 (eg. render_ms) of the timings line $1.
+timings_field() {
+  sed -n "s/.* $2=\([^ ]*\).*/\1/p" <<< "$1"
+}
+
+# Prints the best render_ms of |repeats| renders of scene $1 with flags $2. With $3, keeps the image
+# of the last render there.
+best_render_ms() {
+  local best=""
+  for ((i = 0; i < repeats; i++)); do
+    local ms
+    ms="$(timings_field "$(render_timings "$1" "$2")" render_ms)"
+    if [[ -z "$best" ]] || awk "BEGIN { exit !($ms < $best) }"; then
+      best="$ms"
+    fi
+  done
+  if [[ -n "${3:-}" ]]; then
+    mv "$work_dir/test.ppm" "$3"
+  fi
+  echo "$best"
+}
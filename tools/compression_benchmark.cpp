@@ -0,0 +1,169 @@
+// Accuracy of the compressed geometry (see src/objects/intersectables/quantized_mesh.h) against
+// the uncompressed mesh. Builds a QuantizedMesh over a jittered GRID x GRID height field with
+// random vertex normals, matches every stored vertex back to its original, and reports the worst
+// position error (in grid steps) and the worst normal angle error. Vertices shared by several
+// clusters must dequantize to the same position in each, or the mesh would have cracks. Random
+// unit vectors are also round tripped through the octahedral encoding directly, to cover every
+// direction. Exits with an error if any error is over its stated bound or a vertex cracks. Usage:
+//   compressionBenchmark [GRID] [SEED]
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "../src/math/octahedral.h"
+#include "../src/math/vec.h"
+#include "../src/objects/intersectables/quantized_mesh.h"
+#include "../src/objects/intersectables/triangle.h"
+
+namespace {
+
+constexpr size_t kDefaultGrid = 512;
+constexpr size_t kNumDirections = 1 << 20;
+// Vertices are jittered by less than half the grid spacing, so rounding a dequantized position
+// recovers its grid cell.
+constexpr float kJitter = 0.25f;
+constexpr float kMaxHeight = 50.f;
+// Dequantizing computes origin + cell * step in float, which adds a rounding error of a few ulps of
+// the mesh's coordinates on top of the quantization error.
+constexpr float kRoundingUlps = 4.f;
+
+using graphics::math::Point3f;
+using graphics::math::Vector3f;
+using graphics::raytracer::QuantizedMesh;
+
+size_t parseArg(const char* arg, size_t fallback) {
+  const std::string_view value = arg;
+  size_t number = 0;
+  const auto result = std::from_chars(value.data(), value.data() + value.size(), number);
+  return result.ec == std::errc() && number > 0 ? number : fallback;
+}
+
+Vector3f randomDirection(std::mt19937& rng) {
+  std::normal_distribution<float> gaussian;
+  Vector3f direction;
+  do {
+    direction = Vector3f{gaussian(rng), gaussian(rng), gaussian(rng)};
+  } while (graphics::math::magnitude_sq(direction) < 1e-12f);
+  return graphics::math::normalize(direction);
+}
+
+// Angle between unit vectors |a| and |b|, accurate for small angles.
+double angleBetween(const Vector3f& a, const Vector3f& b) {
+  return std::atan2(graphics::math::magnitude(graphics::math::cross(a, b)), a * b);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t grid = argc > 1 ? parseArg(argv[1], kDefaultGrid) : kDefaultGrid;
+  const uint32_t seed = argc > 2 ? static_cast<uint32_t>(parseArg(argv[2], 1)) : 1;
+  std::mt19937 rng(seed);
+
+  const size_t side = grid + 1;
+  std::uniform_real_distribution<float> jitter(-kJitter, kJitter);
+  std::uniform_real_distribution<float> height(-kMaxHeight, kMaxHeight);
+  std::vector<Point3f> positions(side * side);
+  std::vector<Vector3f> normals(side * side);
+  for (size_t j = 0; j < side; j++) {
+    for (size_t i = 0; i < side; i++) {
+      positions[j * side + i] = Point3f{i + jitter(rng), height(rng), j + jitter(rng)};
+      normals[j * side + i] = randomDirection(rng);
+    }
+  }
+  std::vector<std::array<uint32_t, 3>> faces;
+  faces.reserve(2 * grid * grid);
+  for (size_t j = 0; j < grid; j++) {
+    for (size_t i = 0; i < grid; i++) {
+      const auto a = static_cast<uint32_t>(j * side + i);
+      const auto b = a + 1;
+      const auto c = static_cast<uint32_t>(a + side);
+      const auto d = c + 1;
+      faces.push_back({a, b, d});
+      faces.push_back({a, d, c});
+    }
+  }
+
+  // Every vertex has its own normal, so the normal indices of the faces are their vertex indices.
+  const QuantizedMesh mesh(positions, faces, normals, faces, nullptr);
+  const Vector3f step = mesh.step();
+  const graphics::BoundingBox& bounds = mesh.bounds();
+
+  double max_position_steps = 0.0;
+  double max_position_error = 0.0;
+  double max_mesh_normal_error = 0.0;
+  bool within_position_bound = true;
+  // First dequantized position of every vertex, to compare the copies in other clusters against.
+  std::vector<Point3f> stored(positions.size());
+  std::vector<bool> visited(positions.size(), false);
+  size_t unmatched = 0;
+  size_t shared = 0;
+  size_t cracked = 0;
+  mesh.ForEachVertex([&](const Point3f& position, const Vector3f& normal) {
+    const long i = std::lround(position.x);
+    const long j = std::lround(position.z);
+    if (i < 0 || j < 0 || i >= static_cast<long>(side) || j >= static_cast<long>(side)) {
+      unmatched++;
+      return;
+    }
+    const size_t index = static_cast<size_t>(j) * side + static_cast<size_t>(i);
+    if (visited[index]) {
+      shared++;
+      cracked += position != stored[index];
+      return;
+    }
+    visited[index] = true;
+    stored[index] = position;
+    for (int k = 0; k < 3; k++) {
+      const float original = positions[index].data[k];
+      const double magnitude = std::max(std::abs(bounds.min.data[k]), std::abs(bounds.max.data[k]));
+      const double error = std::abs(static_cast<double>(position.data[k]) - original);
+      const double bound = QuantizedMesh::kMaxPositionError * step.data[k] +
+                           kRoundingUlps * std::numeric_limits<float>::epsilon() * magnitude;
+      within_position_bound &= error <= bound;
+      max_position_error = std::max(max_position_error, error);
+      if (step.data[k] > 0.f) {
+        max_position_steps = std::max(max_position_steps, error / step.data[k]);
+      }
+    }
+    max_mesh_normal_error = std::max(max_mesh_normal_error, angleBetween(normal, normals[index]));
+  });
+  const size_t missing = std::count(visited.begin(), visited.end(), false);
+
+  double max_direction_error = 0.0;
+  for (size_t i = 0; i < kNumDirections; i++) {
+    const Vector3f direction = randomDirection(rng);
+    const Vector3f decoded = graphics::math::octahedral_decode(graphics::math::octahedral_encode(direction));
+    max_direction_error = std::max(max_direction_error, angleBetween(direction, decoded));
+  }
+
+  const double normal_bound = graphics::math::kOctahedralMaxAngleError;
+  const double max_normal_error = std::max(max_mesh_normal_error, max_direction_error);
+  const bool within_normal_bound = max_normal_error <= normal_bound;
+  const size_t full_bytes = faces.size() * sizeof(graphics::raytracer::Triangle);
+  constexpr double kDegrees = 180.0 / 3.14159265358979;
+  std::cout << grid << 'x' << grid << " grid, " << positions.size() << " vertices, " << mesh.triangle_count()
+            << " triangles:\n"
+            << "  size:            " << mesh.MemoryUsage() << " bytes vs " << full_bytes << " bytes as triangles ("
+            << 100.0 * mesh.MemoryUsage() / full_bytes << "%)\n"
+            << "  position error:  " << max_position_error << " max, " << max_position_steps << " grid steps (bound "
+            << QuantizedMesh::kMaxPositionError << " plus float rounding, step " << step.x << ' ' << step.y << ' '
+            << step.z << ")\n"
+            << "  cluster borders: " << shared << " vertex copies in other clusters, " << cracked
+            << " dequantize elsewhere\n"
+            << "  normal error:    " << max_mesh_normal_error << " rad on the mesh, " << max_direction_error
+            << " rad over " << kNumDirections << " random directions (bound " << normal_bound << " rad, "
+            << normal_bound * kDegrees << " degrees)\n";
+  if (missing > 0 || unmatched > 0) {
+    std::cout << "  " << missing << " vertices were not stored, " << unmatched << " stored vertices didn't match\n";
+  }
+  const bool ok = within_position_bound && within_normal_bound && missing == 0 && unmatched == 0 && cracked == 0;
+  std::cout << "  " << (ok ? "within bounds" : "OVER BOUNDS") << '\n';
+  return ok ? 0 : 1;
+}
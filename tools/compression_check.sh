@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+# Image error of --compress-geometry. Generates smooth shaded OBJ spheres of increasing triangle
+# counts (SIZES), lights each in a scene that adds it with the 'mesh' command, renders it with full
+# precision triangles and compressed, and writes one CSV row per size with the RMSE and the largest
+# difference (in 8-bit steps) of the compressed render and how many pixels differ. Fails if an RMSE
+# is over MAX_RMSE.
+#
+# Usage: tools/compression_check.sh [output.csv]
+# Environment overrides:
+#   BUILD_DIR    directory with the rayTracer, sceneGenerator and imageDiff binaries (default: ./build)
+#   SIZES        triangle counts (default: "500 2000 20000"). Past about 20000 the triangles get
+#                small enough for Triangle's parallel ray test to reject them in both renders.
+#   MAX_RMSE     largest RMSE a compressed render may have (default: 1)
+#   EXTRA_FLAGS  extra flags for every render, e.g. "--spp 4"
+set -euo pipefail
+
+source "$(dirname "$0")/bench_common.sh"
+output="${1:-/dev/stdout}"
+sizes="${SIZES:-500 2000 20000}"
+max_rmse="${MAX_RMSE:-1}"
+
+echo "triangles,rmse,max_difference,differing_pixels" > "$output"
+failed=0
+for n in $sizes; do
+  mesh="$work_dir/objmesh-$n.obj"
+  scene="$work_dir/objmesh-$n.txt"
+  "$build_dir/sceneGenerator" objmesh "$n" -o "$mesh"
+  cat > "$scene" <<EOF
+color 0.9 0.5 0.2
+mesh $mesh
+color 0.8 0.8 0.8
+plane 0 1 0 1.5
+color 1 1 1
+sun 1 1 1
+EOF
+  render_timings "$scene" "--accel bvh" > /dev/null
+  mv "$work_dir/test.ppm" "$work_dir/full.ppm"
+  render_timings "$scene" "--accel bvh --compress-geometry" > /dev/null
+  # imageDiff exits with 1 when the RMSE is over the threshold, which is reported below.
+  diff_line="$({ "$build_dir/imageDiff" "$work_dir/test.ppm" "$work_dir/full.ppm" "$max_rmse" || [[ $? == 1 ]]; })"
+  rmse="$(sed -n 's/^rmse \([^,]*\),.*/\1/p' <<< "$diff_line")"
+  max_difference="$(sed -n 's/.*max difference \([0-9]*\),.*/\1/p' <<< "$diff_line")"
+  differing="$(sed -n 's/.*, \([0-9]*\) of [0-9]* pixels differ/\1/p' <<< "$diff_line")"
+  echo "$n,$rmse,$max_difference,$differing" >> "$output"
+  if awk "BEGIN { exit !($rmse > $max_rmse) }"; then
+    echo "Compressed render of $n triangles is over the RMSE bound ($rmse > $max_rmse)." >&2
+    failed=1
+  fi
+done
+exit "$failed"
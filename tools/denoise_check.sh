@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+# Denoiser quality check. Renders a generated scene at SPP samples per pixel with --denoise, and
+# without it at SPP, 2, 4 and 8 times SPP, and writes one CSV row per render with its RMSE (in 8-bit
+# steps) against a REFERENCE_SPP render. The denoiser is meant to match a render with 4 to 8 times
+# the samples, so the check fails if the denoised render is further from the reference than the
+# undenoised one at 4 times SPP.
+#
+# Usage: tools/denoise_check.sh [output.csv]
+# Environment overrides:
+#   BUILD_DIR     directory with the rayTracer, sceneGenerator and imageDiff binaries (default: ./build)
+#   SCENE         kind:N scene to generate (default: spheres:300)
+#   SPP           samples per pixel of the denoised render (default: 4)
+#   REFERENCE_SPP samples per pixel of the reference (default: 128)
+#   EXTRA_FLAGS   extra flags for every render, e.g. "--sampler independent"
+set -euo pipefail
+
+source "$(dirname "$0")/bench_common.sh"
+output="${1:-/dev/stdout}"
+scene_spec="${SCENE:-spheres:300}"
+spp="${SPP:-4}"
+reference_spp="${REFERENCE_SPP:-128}"
+
+kind="${scene_spec%%:*}"
+n="${scene_spec##*:}"
+scene="$work_dir/$kind-$n.txt"
+"$build_dir/sceneGenerator" "$kind" "$n" -o "$scene"
+render_timings "$scene" "--spp $reference_spp" > /dev/null
+mv "$work_dir/test.ppm" "$work_dir/reference.ppm"
+
+# Prints the RMSE of image $1 against the reference. imageDiff exits with 1 when the images differ.
+rmse() {
+  { "$build_dir/imageDiff" "$1" "$work_dir/reference.ppm" || [[ $? == 1 ]]; } | sed -n 's/^rmse \([^,]*\),.*/\1/p'
+}
+
+echo "spp,denoised,rmse" > "$output"
+render_timings "$scene" "--spp $spp --denoise" > /dev/null
+denoised_rmse="$(rmse "$work_dir/test.ppm")"
+echo "$spp,yes,$denoised_rmse" >> "$output"
+target_rmse=""
+for factor in 1 2 4 8; do
+  render_timings "$scene" "--spp $((factor * spp))" > /dev/null
+  noisy_rmse="$(rmse "$work_dir/test.ppm")"
+  echo "$((factor * spp)),no,$noisy_rmse" >> "$output"
+  [[ "$factor" == 4 ]] && target_rmse="$noisy_rmse"
+done
+
+if awk "BEGIN { exit !($denoised_rmse > $target_rmse) }"; then
+  echo "Denoised $spp spp is further from the reference than $((4 * spp)) spp ($denoised_rmse > $target_rmse)." >&2
+  exit 1
+fi
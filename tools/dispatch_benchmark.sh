@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+# Static against virtual dispatch benchmark. Generates scenes with sceneGenerator, renders each
+# with the default virtual calls and with --static-dispatch, checks that both give the same image,
+# and writes one CSV row per scene and accelerator with the best render time of each.
+# --static-dispatch stores primitives by type only when the scene is a plain list ('list'
+# accelerator), with other accelerators only the lights are.
+#
+# Usage: tools/dispatch_benchmark.sh [output.csv]
+# Environment overrides:
+#   BUILD_DIR   directory with the rayTracer and sceneGenerator binaries (default: ./build)
+#   SCENES      kind:N pairs to generate (default: "spheres:300 mesh:2000 bulbs:64")
+#   ACCELS      accelerators to render with (default: "list bvh")
+#   REPEATS     renders of each variant, the fastest is kept (default: 3)
+#   EXTRA_FLAGS extra flags for every render, e.g. "--threads 1"
+set -euo pipefail
+
+source "$(dirname "$0")/bench_common.sh"
+output="${1:-/dev/stdout}"
+scenes="${SCENES:-spheres:300 mesh:2000 bulbs:64}"
+accels="${ACCELS:-list bvh}"
+
+echo "kind,n,accel,virtual_ms,static_ms,speedup,identical" > "$output"
+for kind_n in $scenes; do
+  kind="${kind_n%%:*}"
+  n="${kind_n##*:}"
+  scene="$work_dir/$kind-$n.txt"
+  "$build_dir/sceneGenerator" "$kind" "$n" -o "$scene"
+  for accel in $accels; do
+    virtual_ms="$(best_render_ms "$scene" "--accel $accel" "$work_dir/virtual.ppm")"
+    static_ms="$(best_render_ms "$scene" "--accel $accel --static-dispatch" "$work_dir/static.ppm")"
+    identical=yes
+    cmp -s "$work_dir/virtual.ppm" "$work_dir/static.ppm" || identical=no
+    speedup="$(awk "BEGIN { printf \"%.2f\", $virtual_ms / $static_ms }")"
+    echo "$kind,$n,$accel,$virtual_ms,$static_ms,$speedup,$identical" >> "$output"
+  done
+done
@@ -0,0 +1,128 @@
+// Benchmark of framebuffer writes across thread counts. Every thread writes the pixels it owns,
+// once as 8x8 tiles handed out round robin (what a tile scheduler does) and once as contiguous
+// bands of rows, into a row-major buffer and into the tiled Image. With tiles handed out round
+// robin, neighbouring tiles of a row-major buffer share cache lines between threads (false
+// sharing), while Image tiles are cache line aligned and have a single writer. Also times
+// linearizing the tiled image, and checks that both layouts hold the same pixels. Usage:
+//   framebufferBenchmark [SIZE] [REPEATS] [MAX_THREADS]
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../src/utils/image.h"
+
+namespace {
+
+constexpr size_t kDefaultSize = 2048;
+constexpr int kDefaultRepeats = 5;
+// Every pixel is written this many times per run, so the runs are long enough to time.
+constexpr int kPasses = 4;
+
+size_t parseArg(const char* arg, size_t fallback) {
+  const std::string_view value = arg;
+  size_t number = 0;
+  const auto result = std::from_chars(value.data(), value.data() + value.size(), number);
+  return result.ec == std::errc() && number > 0 ? number : fallback;
+}
+
+template <typename F>
+double bestMilliseconds(int repeats, F&& f) {
+  double best = 0;
+  for (int i = 0; i < repeats; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    best = i == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+graphics::Color3f pixelValue(size_t r, size_t c, int pass) {
+  return graphics::Color3f{static_cast<float>(r), static_cast<float>(c), static_cast<float>(pass)};
+}
+
+// Runs write(min_row, max_row, min_col, max_col) over the pixels each of |num_threads| threads
+// owns: 8x8 tiles dealt out round robin if |tiled|, contiguous bands of whole tile rows otherwise.
+template <typename F>
+void writeOwnedPixels(size_t size, size_t num_threads, bool tiled, F&& write) {
+  constexpr size_t kTile = graphics::Image::kTileSize;
+  const size_t tiles = (size + kTile - 1) / kTile;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      if (tiled) {
+        for (size_t tile = t; tile < tiles * tiles; tile += num_threads) {
+          const size_t r0 = (tile / tiles) * kTile;
+          const size_t c0 = (tile % tiles) * kTile;
+          write(r0, std::min(size, r0 + kTile), c0, std::min(size, c0 + kTile));
+        }
+      } else {
+        const size_t r0 = tiles * t / num_threads * kTile;
+        const size_t r1 = std::min(size, tiles * (t + 1) / num_threads * kTile);
+        write(r0, r1, size_t{0}, size);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t size = argc > 1 ? parseArg(argv[1], kDefaultSize) : kDefaultSize;
+  const int repeats = argc > 2 ? static_cast<int>(parseArg(argv[2], kDefaultRepeats)) : kDefaultRepeats;
+  const size_t max_threads = argc > 3 ? parseArg(argv[3], 0) : std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<graphics::Color3f> row_major(size * size);
+  graphics::Image image(size, size);
+  const double megapixels = static_cast<double>(size * size) * kPasses / 1e6;
+
+  std::cout << size << 'x' << size << " image, " << kPasses << " writes per pixel, best of " << repeats
+            << ", MP/s written:\n"
+            << std::setw(8) << "threads" << std::setw(11) << "ownership" << std::setw(11) << "row-major"
+            << std::setw(9) << "tiled" << std::setw(9) << "speedup" << '\n' << std::fixed << std::setprecision(1);
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    for (const bool tiled : {true, false}) {
+      const double row_major_ms = bestMilliseconds(repeats, [&]() {
+        writeOwnedPixels(size, threads, tiled, [&](size_t r0, size_t r1, size_t c0, size_t c1) {
+          for (int pass = 0; pass < kPasses; pass++) {
+            for (size_t r = r0; r < r1; r++) {
+              for (size_t c = c0; c < c1; c++) {
+                row_major[r * size + c] = pixelValue(r, c, pass);
+              }
+            }
+          }
+        });
+      });
+      const double tiled_ms = bestMilliseconds(repeats, [&]() {
+        writeOwnedPixels(size, threads, tiled, [&](size_t r0, size_t r1, size_t c0, size_t c1) {
+          for (int pass = 0; pass < kPasses; pass++) {
+            for (size_t r = r0; r < r1; r++) {
+              for (size_t c = c0; c < c1; c++) {
+                image.set_pixel(pixelValue(r, c, pass), r, c);
+              }
+            }
+          }
+        });
+      });
+      std::cout << std::setw(8) << threads << std::setw(11) << (tiled ? "tiles" : "bands") << std::setw(11)
+                << megapixels / row_major_ms * 1e3 << std::setw(9) << megapixels / tiled_ms * 1e3 << std::setw(8)
+                << std::setprecision(2) << row_major_ms / tiled_ms << 'x' << std::setprecision(1) << '\n';
+    }
+  }
+
+  std::vector<graphics::Color3f> linearized;
+  const double linearize_ms = bestMilliseconds(repeats, [&]() { linearized = image.linearize(); });
+  const bool identical = std::memcmp(linearized.data(), row_major.data(), row_major.size() * sizeof(graphics::Color3f)) == 0;
+  std::cout << "linearize: " << linearize_ms << " ms (" << size * size / 1e6 / linearize_ms * 1e3 << " MP/s)\n"
+            << "output " << (identical ? "identical" : "DIFFERS") << '\n';
+  return identical ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+# Uniform grid against plain list benchmark. Generates scenes with sceneGenerator, renders each with
+# --accel list and --accel grid, and writes one CSV row per scene with the best render time of
+# each, the speedup and whether both give the same image. Scenes are generated from fixed seeds,
+# so runs are reproducible. Exits with an error if any grid render differs from its list render.
+#
+# Usage: tools/grid_benchmark.sh [output.csv]
+# Environment overrides:
+#   BUILD_DIR   directory with the rayTracer and sceneGenerator binaries (default: ./build)
+#   KINDS       scene kinds to generate (default: "spheres mesh")
+#   SIZES       values of N (default: "100 500 2000")
+#   REPEATS     renders of each variant, the fastest is kept (default: 3)
+#   EXTRA_FLAGS extra flags for every render, e.g. "--threads 1"
+set -euo pipefail
+
+source "$(dirname "$0")/bench_common.sh"
+output="${1:-/dev/stdout}"
+kinds="${KINDS:-spheres mesh}"
+sizes="${SIZES:-100 500 2000}"
+
+differing=0
+echo "kind,n,list_ms,grid_ms,speedup,identical" > "$output"
+for kind in $kinds; do
+  for n in $sizes; do
+    scene="$work_dir/$kind-$n.txt"
+    "$build_dir/sceneGenerator" "$kind" "$n" -o "$scene"
+    list_ms="$(best_render_ms "$scene" "--accel list" "$work_dir/list.ppm")"
+    grid_ms="$(best_render_ms "$scene" "--accel grid" "$work_dir/grid.ppm")"
+    identical=yes
+    if ! cmp -s "$work_dir/list.ppm" "$work_dir/grid.ppm"; then
+      identical=no
+      differing=$((differing + 1))
+    fi
+    speedup="$(awk "BEGIN { printf \"%.2f\", $list_ms / $grid_ms }")"
+    echo "$kind,$n,$list_ms,$grid_ms,$speedup,$identical" >> "$output"
+  done
+done
+
+if [[ "$differing" -gt 0 ]]; then
+  echo "$differing grid renders differ from the list render." >&2
+  exit 1
+fi
@@ -0,0 +1,65 @@
+// Compares two PPM images of the same size, eg. a render against a reference render. Prints the
+// root mean square error and the largest difference over all channels (in 8-bit steps), and the
+// number of pixels that differ at all. With MAX_RMSE, exits with an error if the RMSE is above it;
+// otherwise exits with an error if the images aren't identical. Usage:
+//   imageDiff IMAGE REFERENCE [MAX_RMSE]
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include "../src/materials/texture_cache.h"
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: imageDiff IMAGE REFERENCE [MAX_RMSE]\n";
+    return 2;
+  }
+  double max_rmse = -1.0;
+  if (argc > 3) {
+    const std::string_view value = argv[3];
+    if (std::from_chars(value.data(), value.data() + value.size(), max_rmse).ec != std::errc() || max_rmse < 0.0) {
+      std::cerr << "Invalid MAX_RMSE: '" << value << "'\n";
+      return 2;
+    }
+  }
+  const auto image = graphics::raytracer::TextureSource::Open(argv[1]);
+  const auto reference = graphics::raytracer::TextureSource::Open(argv[2]);
+  if (!image || !reference) {
+    return 2;
+  }
+  if (image->width() != reference->width() || image->height() != reference->height()) {
+    std::cerr << "Sizes differ: " << image->width() << 'x' << image->height() << " vs " << reference->width() << 'x'
+              << reference->height() << '\n';
+    return 2;
+  }
+
+  const uint32_t width = image->width();
+  std::vector<uint8_t> image_row(3 * width);
+  std::vector<uint8_t> reference_row(3 * width);
+  double squared_error = 0.0;
+  int max_difference = 0;
+  size_t differing_pixels = 0;
+  for (uint32_t y = 0; y < image->height(); y++) {
+    image->ReadTexels(y, 0, width, image_row.data());
+    reference->ReadTexels(y, 0, width, reference_row.data());
+    for (uint32_t x = 0; x < width; x++) {
+      bool differs = false;
+      for (uint32_t c = 3 * x; c < 3 * x + 3; c++) {
+        const int difference = std::abs(image_row[c] - reference_row[c]);
+        squared_error += static_cast<double>(difference) * difference;
+        max_difference = std::max(max_difference, difference);
+        differs |= difference != 0;
+      }
+      differing_pixels += differs;
+    }
+  }
+  const double rmse = std::sqrt(squared_error / (3.0 * width * image->height()));
+  std::cout << "rmse " << rmse << ", max difference " << max_difference << ", " << differing_pixels << " of "
+            << static_cast<size_t>(width) * image->height() << " pixels differ\n";
+  return (max_rmse >= 0.0 ? rmse <= max_rmse : differing_pixels == 0) ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+// Benchmark of the output pass. Fills an image with random linear radiance (some of it out of
+// [0, 1]) and times converting it to 8-bit RGB the old way, one pixel at a time through
+// clamp_color3f and to_color3 into a Color3 per pixel, against Image::encode with the default
+// OutputTransform. Both must give the same bytes. Usage:
+//   outputBenchmark [SIZE] [REPEATS]
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "../src/utils/image.h"
+
+namespace {
+
+constexpr size_t kDefaultSize = 2048;
+constexpr int kDefaultRepeats = 5;
+
+size_t parseArg(const char* arg, size_t fallback) {
+  const std::string_view value = arg;
+  size_t number = 0;
+  const auto result = std::from_chars(value.data(), value.data() + value.size(), number);
+  return result.ec == std::errc() && number > 0 ? number : fallback;
+}
+
+// What Image::write did per pixel before the output pass.
+std::vector<uint8_t> legacyConvert(const graphics::Image& image) {
+  std::vector<graphics::Color3> pixels(image.height() * image.width());
+  for (size_t r = 0; r < image.height(); r++) {
+    for (size_t c = 0; c < image.width(); c++) {
+      pixels[r * image.width() + c] = graphics::to_color3(graphics::clamp_color3f(image.get_pixel(r, c)));
+    }
+  }
+  std::vector<uint8_t> bytes(pixels.size() * 3);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    for (int k = 0; k < 3; k++) {
+      bytes[i * 3 + k] = static_cast<uint8_t>(pixels[i][k]);
+    }
+  }
+  return bytes;
+}
+
+template <typename F>
+double bestMilliseconds(int repeats, F&& f) {
+  double best = 0;
+  for (int i = 0; i < repeats; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    best = i == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t size = argc > 1 ? parseArg(argv[1], kDefaultSize) : kDefaultSize;
+  const int repeats = argc > 2 ? static_cast<int>(parseArg(argv[2], kDefaultRepeats)) : kDefaultRepeats;
+
+  graphics::Image image(size, size);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> radiance(-0.1f, 1.5f);
+  for (size_t r = 0; r < size; r++) {
+    for (size_t c = 0; c < size; c++) {
+      image.set_pixel(graphics::Color3f{radiance(rng), radiance(rng), radiance(rng)}, r, c);
+    }
+  }
+
+  const graphics::OutputTransform transform;
+  std::vector<uint8_t> legacy;
+  std::vector<uint8_t> encoded;
+  const double legacy_ms = bestMilliseconds(repeats, [&]() { legacy = legacyConvert(image); });
+  const double encode_ms = bestMilliseconds(repeats, [&]() { encoded = image.encode(transform); });
+
+  const bool identical = legacy.size() == encoded.size() &&
+                         std::memcmp(legacy.data(), encoded.data(), legacy.size()) == 0;
+  const double megapixels = static_cast<double>(size * size) / 1e6;
+  std::cout << size << 'x' << size << " image, best of " << repeats << ":\n"
+            << "  per-pixel conversion: " << legacy_ms << " ms (" << megapixels / legacy_ms * 1e3 << " MP/s)\n"
+            << "  output pass:          " << encode_ms << " ms (" << megapixels / encode_ms * 1e3 << " MP/s)\n"
+            << "  speedup:              " << legacy_ms / encode_ms << "x\n"
+            << "  output " << (identical ? "identical" : "DIFFERS") << '\n';
+  return identical ? 0 : 1;
+}
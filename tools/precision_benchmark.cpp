@@ -0,0 +1,171 @@
+// Accuracy and speed of the fast math kernels (see src/math/precision.h) against the exact ones.
+// Normalizes random vectors of widely varying length both ways, and reports the worst direction
+// and length error of the fast path and the time per vector. Given two renders of the same scene,
+// one from an exact build and one from a -DFAST_MATH=ON build, it also reports how much the
+// images differ. Exits with an error if any error is over its bound. Usage:
+//   precisionBenchmark [EXACT.ppm FAST.ppm]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/math/precision.h"
+#include "../src/math/vec.h"
+
+namespace {
+
+constexpr size_t kNumVectors = 1 << 20;
+constexpr int kRepeats = 10;
+
+// Bounds the fast path must stay within. The Newton refined estimate is good to about 2^-22
+// relative error, so directions are off by a few 1e-7 radians at most.
+constexpr double kMaxAngleError = 2e-6;
+constexpr double kMaxLengthError = 2e-6;
+// 8-bit levels a channel may change by, and the fraction of channels that may change at all.
+// Shadow ray and edge decisions can flip at exactly grazing configurations, so a few channels
+// are allowed to change a lot.
+constexpr int kMaxTypicalChannelError = 1;
+constexpr double kMaxChangedChannels = 0.01;
+
+using graphics::math::Precision;
+using graphics::math::Vector3f;
+
+template <typename F>
+double bestNanosecondsPerVector(F&& f) {
+  double best = 0;
+  for (int i = 0; i < kRepeats; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    best = i == 0 ? ns : std::min(best, ns);
+  }
+  return best / kNumVectors;
+}
+
+template <Precision P>
+void normalizeAll(const std::vector<Vector3f>& in, std::vector<Vector3f>& out) {
+  for (size_t i = 0; i < in.size(); i++) {
+    out[i] = graphics::math::unit_vector<P>(in[i]);
+  }
+}
+
+// Channel values of a P3 or P6 image with a maxval of 255.
+std::optional<std::vector<int>> readPpm(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::string magic;
+  size_t width = 0;
+  size_t height = 0;
+  int max_value = 0;
+  if (!(file >> magic >> width >> height >> max_value) || (magic != "P3" && magic != "P6") || max_value != 255) {
+    std::cerr << "Can't read '" << path << "' (only 8-bit P3 and P6 images are supported).\n";
+    return std::nullopt;
+  }
+  std::vector<int> values(width * height * 3);
+  if (magic == "P6") {
+    file.get();
+    std::vector<char> bytes(values.size());
+    file.read(bytes.data(), bytes.size());
+    std::transform(bytes.begin(), bytes.end(), values.begin(), [](char b) { return static_cast<uint8_t>(b); });
+  } else {
+    for (int& value : values) {
+      file >> value;
+    }
+  }
+  if (!file) {
+    std::cerr << "'" << path << "' is truncated.\n";
+    return std::nullopt;
+  }
+  return values;
+}
+
+bool compareImages(const std::string& exact_path, const std::string& fast_path) {
+  const auto exact = readPpm(exact_path);
+  const auto fast = readPpm(fast_path);
+  if (!exact || !fast) {
+    return false;
+  }
+  if (exact->size() != fast->size()) {
+    std::cerr << "The images have different sizes.\n";
+    return false;
+  }
+  size_t changed = 0;
+  size_t changed_more = 0;
+  int max_error = 0;
+  double total_error = 0;
+  for (size_t i = 0; i < exact->size(); i++) {
+    const int error = std::abs((*exact)[i] - (*fast)[i]);
+    changed += error > 0;
+    changed_more += error > kMaxTypicalChannelError;
+    max_error = std::max(max_error, error);
+    total_error += error;
+  }
+  const double changed_fraction = static_cast<double>(changed) / exact->size();
+  std::cout << "Image error: " << changed << " of " << exact->size() << " channels changed ("
+            << 100.0 * changed_fraction << "%), " << changed_more << " by more than " << kMaxTypicalChannelError
+            << ", max " << max_error << ", mean " << total_error / exact->size() << '\n';
+  return changed_fraction <= kMaxChangedChannels &&
+         static_cast<double>(changed_more) / exact->size() <= kMaxChangedChannels / 10;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 1 && argc != 3) {
+    std::cerr << "Usage: precisionBenchmark [EXACT.ppm FAST.ppm]\n";
+    return 1;
+  }
+
+  // Directions of random lengths between 1e-3 and 1e3, like unnormalized normals and light
+  // directions.
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> component(-1.f, 1.f);
+  std::uniform_real_distribution<float> log_length(-3.f, 3.f);
+  std::vector<Vector3f> vectors(kNumVectors);
+  for (Vector3f& vector : vectors) {
+    Vector3f direction;
+    do {
+      direction = Vector3f{component(rng), component(rng), component(rng)};
+    } while (direction * direction < 1e-4f);
+    vector = direction * std::pow(10.f, log_length(rng));
+  }
+
+  std::vector<Vector3f> exact(kNumVectors);
+  std::vector<Vector3f> fast(kNumVectors);
+  const double exact_ns = bestNanosecondsPerVector([&]() { normalizeAll<Precision::kExact>(vectors, exact); });
+  const double fast_ns = bestNanosecondsPerVector([&]() { normalizeAll<Precision::kFast>(vectors, fast); });
+
+  double max_angle = 0;
+  double max_length = 0;
+  for (size_t i = 0; i < kNumVectors; i++) {
+    // In double, since the float cosine of such small angles rounds to 1.
+    const graphics::math::Vector<double, 3> a{exact[i].x, exact[i].y, exact[i].z};
+    const graphics::math::Vector<double, 3> b{fast[i].x, fast[i].y, fast[i].z};
+    const double length = graphics::math::magnitude(b);
+    max_angle = std::max(max_angle, std::atan2(graphics::math::magnitude(graphics::math::cross(a, b)), a * b));
+    max_length = std::max(max_length, std::abs(length - 1.0));
+  }
+
+#ifdef FP_FAST_FMAF
+  constexpr bool kFma = true;
+#else
+  constexpr bool kFma = false;
+#endif
+  std::cout << "Renderer precision: " << (graphics::math::kPrecision == Precision::kFast ? "fast" : "exact")
+            << (kFma ? " (FMA available)" : " (no FMA)") << '\n'
+            << "Normalize: exact " << exact_ns << " ns, fast " << fast_ns << " ns per vector ("
+            << exact_ns / fast_ns << "x)\n"
+            << "Fast normalize error: max direction " << max_angle << " rad, max length " << max_length << '\n';
+  bool ok = max_angle <= kMaxAngleError && max_length <= kMaxLengthError;
+  if (argc == 3) {
+    ok = compareImages(argv[1], argv[2]) && ok;
+  }
+  std::cout << (ok ? "Within bounds.\n" : "OUT OF BOUNDS.\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+# Rasterized primary visibility benchmark. Generates triangle and sphere heavy scenes with
+# sceneGenerator, renders each traced and with --raster-primary, checks that both give the same
+# image, and writes one CSV row per scene and accelerator with the best render time of each.
+#
+# Usage: tools/raster_benchmark.sh [output.csv]
+# Environment overrides:
+#   BUILD_DIR   directory with the rayTracer and sceneGenerator binaries (default: ./build)
+#   KINDS       scene kinds to generate (default: "mesh spheres")
+#   SIZES       values of N (default: "1000 10000 50000")
+#   ACCELS      accelerators to trace with (default: "bvh grid")
+#   REPEATS     renders of each variant, the fastest is kept (default: 3)
+#   EXTRA_FLAGS extra flags for every render, e.g. "--spp 4"
+set -euo pipefail
+
+source "$(dirname "$0")/bench_common.sh"
+output="${1:-/dev/stdout}"
+kinds="${KINDS:-mesh spheres}"
+sizes="${SIZES:-1000 10000 50000}"
+accels="${ACCELS:-bvh grid}"
+
+echo "kind,n,accel,traced_ms,raster_ms,speedup,identical" > "$output"
+for kind in $kinds; do
+  for n in $sizes; do
+    scene="$work_dir/$kind-$n.txt"
+    "$build_dir/sceneGenerator" "$kind" "$n" -o "$scene"
+    for accel in $accels; do
+      traced_ms="$(best_render_ms "$scene" "--accel $accel" "$work_dir/traced.ppm")"
+      raster_ms="$(best_render_ms "$scene" "--accel $accel --raster-primary" "$work_dir/raster.ppm")"
+      identical=yes
+      cmp -s "$work_dir/traced.ppm" "$work_dir/raster.ppm" || identical=no
+      speedup="$(awk "BEGIN { printf \"%.2f\", $traced_ms / $raster_ms }")"
+      echo "$kind,$n,$accel,$traced_ms,$raster_ms,$speedup,$identical" >> "$output"
+    done
+  done
+done
@@ -0,0 +1,57 @@
+#!/usr/bin/env bash
+# Sampler convergence check. Renders a generated scene with every sampler at increasing samples per
+# pixel, and writes one CSV row per render with its RMSE (in 8-bit steps) against a REFERENCE_SPP
+# render and the ratio to the RMSE of independent sampling at the same spp. Stratified, Sobol and
+# R2 (bluenoise) samples are meant to converge faster than independent ones, so the check fails if
+# any of them is further from the reference than independent sampling at the same spp above 1.
+#
+# Usage: tools/sampler_convergence.sh [output.csv]
+# Environment overrides:
+#   BUILD_DIR     directory with the rayTracer, sceneGenerator and imageDiff binaries (default: ./build)
+#   SCENE         kind:N scene to generate (default: spheres:30)
+#   SAMPLERS      samplers to compare with independent (default: "stratified sobol bluenoise")
+#   SPPS          samples per pixel (default: "1 4 16")
+#   REFERENCE_SPP samples per pixel of the reference, rendered with sobol (default: 256)
+#   EXTRA_FLAGS   extra flags for every render, e.g. "--seed 7"
+set -euo pipefail
+
+source "$(dirname "$0")/bench_common.sh"
+output="${1:-/dev/stdout}"
+scene_spec="${SCENE:-spheres:30}"
+samplers="${SAMPLERS:-stratified sobol bluenoise}"
+spps="${SPPS:-1 4 16}"
+reference_spp="${REFERENCE_SPP:-256}"
+
+kind="${scene_spec%%:*}"
+n="${scene_spec##*:}"
+scene="$work_dir/$kind-$n.txt"
+"$build_dir/sceneGenerator" "$kind" "$n" -o "$scene"
+render_timings "$scene" "--spp $reference_spp --sampler sobol" > /dev/null
+mv "$work_dir/test.ppm" "$work_dir/reference.ppm"
+
+# Prints the RMSE of image $1 against the reference. imageDiff exits with 1 when the images differ.
+rmse() {
+  { "$build_dir/imageDiff" "$1" "$work_dir/reference.ppm" || [[ $? == 1 ]]; } | sed -n 's/^rmse \([^,]*\),.*/\1/p'
+}
+
+slower=0
+echo "sampler,spp,rmse,rmse_vs_independent" > "$output"
+for spp in $spps; do
+  render_timings "$scene" "--spp $spp --sampler independent" > /dev/null
+  independent_rmse="$(rmse "$work_dir/test.ppm")"
+  echo "independent,$spp,$independent_rmse,1.00" >> "$output"
+  for sampler in $samplers; do
+    render_timings "$scene" "--spp $spp --sampler $sampler" > /dev/null
+    sampler_rmse="$(rmse "$work_dir/test.ppm")"
+    ratio="$(awk "BEGIN { printf \"%.2f\", ($independent_rmse > 0 ? $sampler_rmse / $independent_rmse : 1) }")"
+    echo "$sampler,$spp,$sampler_rmse,$ratio" >> "$output"
+    if [[ "$spp" -gt 1 ]] && awk "BEGIN { exit !($sampler_rmse > $independent_rmse) }"; then
+      slower=$((slower + 1))
+    fi
+  done
+done
+
+if [[ "$slower" -gt 0 ]]; then
+  echo "$slower renders were further from the reference than independent sampling at the same spp." >&2
+  exit 1
+fi
@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+# Scaling regression harness. Generates scenes of increasing size with sceneGenerator, renders
+# each with rayTracer at several thread counts, and writes one CSV row per render with the parse,
+# build and render times and the peak memory use.
+#
+# Usage: tools/scaling_harness.sh [output.csv]
+# Environment overrides:
+#   BUILD_DIR   directory with the rayTracer and sceneGenerator binaries (default: ./build)
+#   KINDS       scene kinds to generate (default: "spheres mesh bulbs")
+#   SIZES       values of N (default: "10 100 1000")
+#   THREADS     thread counts (default: "1 2 4 ... nproc")
+#   EXTRA_FLAGS extra flags for every render, e.g. "--static-dispatch"
+set -euo pipefail
+
+source "$(dirname "$0")/bench_common.sh"
+output="${1:-/dev/stdout}"
+kinds="${KINDS:-spheres mesh bulbs}"
+sizes="${SIZES:-10 100 1000}"
+
+echo "kind,n,threads,parse_ms,build_ms,render_ms,peak_rss_kb" > "$output"
+for kind in $kinds; do
+  for n in $sizes; do
+    scene="$work_dir/$kind-$n.txt"
+    "$build_dir/sceneGenerator" "$kind" "$n" -o "$scene"
+    for threads in $THREADS; do
+      line="$(render_timings "$scene" "--threads $threads")"
+      field() { timings_field "$line" "$1"; }
+      echo "$kind,$n,$threads,$(field parse_ms),$(field build_ms),$(field render_ms),$(field peak_rss_kb)" >> "$output"
+    done
+  done
+done
@@ -0,0 +1,191 @@
+// Procedural scene generator. Writes scenes of a controlled size in the SceneParser format, for
+// measuring how parsing, building and rendering scale. Usage:
+//   sceneGenerator {spheres|mesh|objmesh|bulbs} N [--seed S] [-o path]
+// - spheres: N randomly placed spheres over a ground plane.
+// - mesh:    a tessellated sphere of (at least) N triangles over a ground plane.
+// - objmesh: the sphere of 'mesh' alone, as an OBJ file with vertex normals. Scenes can add it
+//            with the 'mesh' command.
+// - bulbs:   a grid of N bulbs lighting a few spheres and a ground plane.
+// Output is deterministic for a given kind, N and seed. It goes to stdout unless -o is given.
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr float kPi = 3.14159265358979f;
+
+// Everything is placed inside this box, which the default camera (at z = 1, looking down -z)
+// sees most of.
+constexpr float kSceneMinX = -2.f;
+constexpr float kSceneMaxX = 2.f;
+constexpr float kSceneMinY = -1.5f;
+constexpr float kSceneMaxY = 1.5f;
+constexpr float kSceneMinZ = -6.f;
+constexpr float kSceneMaxZ = -2.f;
+constexpr float kGroundY = -1.5f;
+
+void writeGround(std::ostream& out) {
+  out << "color 0.8 0.8 0.8\n"
+      << "plane 0 1 0 " << -kGroundY << '\n';
+}
+
+void writeSun(std::ostream& out) {
+  out << "color 1 1 1\n"
+      << "sun 1 1 1\n";
+}
+
+// N spheres with random centers and colors. Radii shrink with N, so the fraction of the view
+// that is covered stays about the same.
+void writeSpheres(std::ostream& out, int count, std::mt19937& rng) {
+  std::uniform_real_distribution<float> x(kSceneMinX, kSceneMaxX);
+  std::uniform_real_distribution<float> y(kSceneMinY, kSceneMaxY);
+  std::uniform_real_distribution<float> z(kSceneMinZ, kSceneMaxZ);
+  std::uniform_real_distribution<float> channel(0.2f, 1.f);
+  const float radius = 1.2f / std::cbrt(static_cast<float>(std::max(1, count)));
+  for (int i = 0; i < count; i++) {
+    out << "color " << channel(rng) << ' ' << channel(rng) << ' ' << channel(rng) << '\n'
+        << "sphere " << x(rng) << ' ' << y(rng) << ' ' << z(rng) << ' ' << radius << '\n';
+  }
+  writeGround(out);
+  writeSun(out);
+}
+
+// UV sphere with |stacks| rings of 2 * |stacks| quads, picked so there are at least N triangles.
+// Calls vertex(position, normal) for every vertex, then face(a, b, c) with the 1-based vertex
+// indices of every triangle. Triangles are wound so their plane normal points outwards, which
+// Triangle needs to orient interpolated normals.
+template <typename V, typename F>
+void tessellateSphere(int count, V&& vertex, F&& face) {
+  const int stacks = std::max(2, static_cast<int>(std::ceil(std::sqrt(count / 4.f))));
+  const int slices = 2 * stacks;
+  const float radius = 1.2f;
+  const float center[3] = {0.f, 0.f, -3.5f};
+
+  for (int i = 0; i <= stacks; i++) {
+    const float theta = kPi * i / stacks;
+    for (int j = 0; j < slices; j++) {
+      const float phi = 2.f * kPi * j / slices;
+      const float n[3] = {std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+      const float p[3] = {center[0] + radius * n[0], center[1] + radius * n[1], center[2] + radius * n[2]};
+      vertex(p, n);
+    }
+  }
+  auto index = [&](int i, int j) { return i * slices + (j % slices) + 1; };
+  for (int i = 0; i < stacks; i++) {
+    for (int j = 0; j < slices; j++) {
+      face(index(i, j), index(i + 1, j + 1), index(i + 1, j));
+      face(index(i, j), index(i, j + 1), index(i + 1, j + 1));
+    }
+  }
+}
+
+// Tessellated sphere whose vertices carry their normal, so the mesh is smooth shaded.
+void writeMesh(std::ostream& out, int count) {
+  out << "color 0.9 0.5 0.2\n";
+  tessellateSphere(
+    count,
+    [&](const float* p, const float* n) {
+      out << "normal " << n[0] << ' ' << n[1] << ' ' << n[2] << '\n'
+          << "xyz " << p[0] << ' ' << p[1] << ' ' << p[2] << '\n';
+    },
+    [&](int a, int b, int c) { out << "trif " << a << ' ' << b << ' ' << c << '\n'; });
+  writeGround(out);
+  writeSun(out);
+}
+
+// The same sphere as an OBJ mesh, with a normal per vertex.
+void writeObjMesh(std::ostream& out, int count) {
+  tessellateSphere(
+    count,
+    [&](const float* p, const float* n) {
+      out << "v " << p[0] << ' ' << p[1] << ' ' << p[2] << '\n'
+          << "vn " << n[0] << ' ' << n[1] << ' ' << n[2] << '\n';
+    },
+    [&](int a, int b, int c) { out << "f " << a << "//" << a << ' ' << b << "//" << b << ' ' << c << "//" << c << '\n'; });
+}
+
+// A square grid of N bulbs above a few spheres. The bulbs get dimmer with N so the image doesn't
+// saturate.
+void writeBulbs(std::ostream& out, int count, std::mt19937& rng) {
+  writeSpheres(out, 8, rng);
+  const int side = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<float>(count)))));
+  const float intensity = 1.f / std::sqrt(static_cast<float>(std::max(1, count)));
+  out << "color " << intensity << ' ' << intensity << ' ' << intensity << '\n';
+  for (int i = 0; i < count; i++) {
+    const float u = side > 1 ? static_cast<float>(i % side) / (side - 1) : 0.5f;
+    const float v = side > 1 ? static_cast<float>(i / side) / (side - 1) : 0.5f;
+    out << "bulb " << kSceneMinX + u * (kSceneMaxX - kSceneMinX) << ' ' << kSceneMaxY + 0.5f << ' '
+        << kSceneMinZ + v * (kSceneMaxZ - kSceneMinZ) << '\n';
+  }
+}
+
+void printUsage() {
+  std::cout << "Usage: sceneGenerator {spheres|mesh|objmesh|bulbs} N [--seed S] [-o path]\n";
+}
+
+template <typename T>
+bool parseNumber(std::string_view value, T& number) {
+  const auto result = std::from_chars(value.data(), value.data() + value.size(), number);
+  return result.ec == std::errc() && result.ptr == value.data() + value.size();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    printUsage();
+    return 1;
+  }
+  const std::string_view kind = argv[1];
+  int count = 0;
+  if (!parseNumber(argv[2], count) || count < 1) {
+    std::cerr << "Invalid count: '" << argv[2] << "'\n";
+    return 1;
+  }
+  uint32_t seed = 1;
+  std::string output_path;
+  for (int i = 3; i < argc; i++) {
+    const std::string_view arg = argv[i];
+    if (arg == "--seed" && i + 1 < argc && parseNumber(argv[i + 1], seed)) {
+      i++;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output_path = argv[++i];
+    } else {
+      printUsage();
+      return 1;
+    }
+  }
+
+  std::ofstream file;
+  if (!output_path.empty()) {
+    file.open(output_path);
+    if (!file.is_open()) {
+      std::cerr << "Unable to open '" << output_path << "'\n";
+      return 1;
+    }
+  }
+  std::ostream& out = output_path.empty() ? std::cout : file;
+
+  std::mt19937 rng(seed);
+  out << "# Generated by sceneGenerator " << kind << ' ' << count << " --seed " << seed << '\n';
+  if (kind == "spheres") {
+    writeSpheres(out, count, rng);
+  } else if (kind == "mesh") {
+    writeMesh(out, count);
+  } else if (kind == "objmesh") {
+    writeObjMesh(out, count);
+  } else if (kind == "bulbs") {
+    writeBulbs(out, count, rng);
+  } else {
+    std::cerr << "Unknown scene kind: '" << kind << "'\n";
+    printUsage();
+    return 1;
+  }
+  return out.good() ? 0 : 1;
+}
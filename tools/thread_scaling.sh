@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+# Thread scaling benchmark. Generates one scene per kind with sceneGenerator, renders it with
+# rayTracer at 1, 2, 4, ... nproc threads, unpinned and with --pin-threads, and writes one CSV row
+# per render with the best render time, the speedup over one unpinned thread and the parallel
+# efficiency (speedup / threads).
+#
+# Usage: tools/thread_scaling.sh [output.csv]
+# Environment overrides:
+#   BUILD_DIR   directory with the rayTracer and sceneGenerator binaries (default: ./build)
+#   KINDS       scene kinds to generate (default: "spheres mesh")
+#   N           size of the generated scenes (default: 10000)
+#   THREADS     thread counts (default: "1 2 4 ... nproc")
+#   REPEATS     renders of each variant, the fastest is kept (default: 3)
+#   EXTRA_FLAGS extra flags for every render, e.g. "--accel bvh --spp 4"
+set -euo pipefail
+
+source "$(dirname "$0")/bench_common.sh"
+output="${1:-/dev/stdout}"
+kinds="${KINDS:-spheres mesh}"
+n="${N:-10000}"
+
+echo "kind,n,threads,pinned,render_ms,speedup,efficiency" > "$output"
+for kind in $kinds; do
+  scene="$work_dir/$kind-$n.txt"
+  "$build_dir/sceneGenerator" "$kind" "$n" -o "$scene"
+  baseline_ms="$(best_render_ms "$scene" "--threads 1")"
+  for threads in $THREADS; do
+    for pinned in no yes; do
+      flags="--threads $threads"
+      [[ "$pinned" == yes ]] && flags+=" --pin-threads"
+      if [[ "$threads" == 1 && "$pinned" == no ]]; then
+        ms="$baseline_ms"
+      else
+        ms="$(best_render_ms "$scene" "$flags")"
+      fi
+      speedup="$(awk "BEGIN { printf \"%.2f\", $baseline_ms / $ms }")"
+      efficiency="$(awk "BEGIN { printf \"%.2f\", $baseline_ms / $ms / $threads }")"
+      echo "$kind,$n,$threads,$pinned,$ms,$speedup,$efficiency" >> "$output"
+    done
+  done
+done